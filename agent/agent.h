@@ -99,6 +99,10 @@ struct
      upon this timeout value.  */
   unsigned long pinentry_timeout;
 
+  /* The maximum number of private key operations to run in parallel
+     without holding the nPth lock.  0 disables this.  */
+  unsigned int crypto_threads;
+
   /* The default and maximum TTL of cache entries. */
   unsigned long def_cache_ttl;     /* Default. */
   unsigned long def_cache_ttl_ssh; /* for SSH. */
@@ -217,6 +221,9 @@ struct server_control_s
      spawning a new connection thread.  */
   struct {
     gnupg_fd_t fd;
+    void *(*func) (void *arg);  /* The connection thread's main function. */
+    struct timespec accepted;   /* Time the connection was accepted.     */
+    ctrl_t next;                /* Used to queue the connection.         */
   } thread_startup;
 
   /* Flag indicating the connection is run in restricted mode.
@@ -372,16 +379,39 @@ struct card_key_info_s
   char *idstr;
 };
 
+/* Statistics about the connections as returned by
+ * get_agent_connection_stats.  */
+struct connection_stats_s
+{
+  unsigned int active;        /* Number of active connections.        */
+  unsigned int threads;       /* Number of connection threads.        */
+  unsigned int idle;          /* Number of idle connection threads.   */
+  unsigned long accepted;     /* Number of accepted connections.      */
+  unsigned long spawned;      /* Number of created threads.           */
+  unsigned long latency_avg;  /* Average accept latency in us.        */
+  unsigned long latency_max;  /* Maximum accept latency in us.        */
+};
+
 /*-- gpg-agent.c --*/
 void agent_exit (int rc)
                 GPGRT_ATTR_NORETURN; /* Also implemented in other tools */
 void agent_set_progress_cb (void (*cb)(ctrl_t ctrl, const char *what,
                                        int printchar, int current, int total),
                             ctrl_t ctrl);
+gpg_error_t agent_pk_compute (gcry_error_t (*fnc)(gcry_sexp_t *, gcry_sexp_t,
+                                                gcry_sexp_t),
+                              gcry_sexp_t *r_result, gcry_sexp_t s_data,
+                              gcry_sexp_t s_skey);
+gpg_error_t agent_kdf_derive (const void *passphrase, size_t passphraselen,
+                              int algo, int subalgo,
+                              const void *salt, size_t saltlen,
+                              unsigned long iterations,
+                              size_t keysize, void *keybuffer);
 gpg_error_t agent_copy_startup_env (ctrl_t ctrl);
 const char *get_agent_socket_name (void);
 const char *get_agent_ssh_socket_name (void);
 int get_agent_active_connection_count (void);
+void get_agent_connection_stats (struct connection_stats_s *r_stats);
 #ifdef HAVE_W32_SYSTEM
 void *get_agent_scd_notify_event (void);
 #endif
@@ -398,6 +428,7 @@ gpg_error_t agent_print_status (ctrl_t ctrl, const char *keyword,
      GPGRT_ATTR_PRINTF(3,4);
 void bump_key_eventcounter (void);
 void bump_card_eventcounter (void);
+void get_agent_eventcounters (unsigned int *r_key, unsigned int *r_card);
 void start_command_handler (ctrl_t, gnupg_fd_t, gnupg_fd_t);
 gpg_error_t pinentry_loopback (ctrl_t, const char *keyword,
                                unsigned char **buffer, size_t *size,
@@ -439,6 +470,8 @@ gpg_error_t agent_key_from_file (ctrl_t ctrl,
                                  lookup_ttl_t lookup_ttl,
                                  gcry_sexp_t *result,
                                  char **r_passphrase);
+gpg_error_t agent_warmup_key (ctrl_t ctrl, const unsigned char *grip,
+                              const char *passphrase);
 gpg_error_t agent_raw_key_from_file (ctrl_t ctrl, const unsigned char *grip,
                                      gcry_sexp_t *result);
 gpg_error_t agent_public_key_from_file (ctrl_t ctrl,
@@ -478,6 +511,18 @@ int agent_clear_passphrase (ctrl_t ctrl,
 			    const char *keyinfo, cache_mode_t cache_mode);
 
 /*-- cache.c --*/
+
+/* Statistics about the cache as returned by agent_get_cache_stats.  */
+struct cache_stats_s
+{
+  unsigned int items;     /* Number of items in the cache.        */
+  unsigned int queued;    /* Number of items in the expiry queue. */
+  unsigned long hits;     /* Number of successful lookups.        */
+  unsigned long misses;   /* Number of failed lookups.            */
+  unsigned long expired;  /* Number of expired secrets.           */
+  unsigned int keks;      /* Number of cached S2K derived keys.   */
+};
+
 void initialize_module_cache (void);
 void deinitialize_module_cache (void);
 void agent_cache_housekeeping (void);
@@ -486,6 +531,29 @@ int agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
                      const char *data, int ttl);
 char *agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode);
 void agent_store_cache_hit (const char *key);
+void agent_put_cache_skey (ctrl_t ctrl, const char *key,
+                           cache_mode_t cache_mode, const char *stamp,
+                           const unsigned char *skey);
+unsigned char *agent_get_cache_skey (ctrl_t ctrl, const char *key,
+                                     cache_mode_t cache_mode,
+                                     const char *stamp);
+void agent_flush_cache_skey (const char *key);
+gpg_error_t agent_get_cache_kek (const char *passphrase, int hashalgo,
+                                 const unsigned char *s2ksalt,
+                                 unsigned long s2kcount,
+                                 unsigned char *key, size_t keylen);
+void agent_put_cache_kek (const char *passphrase, int hashalgo,
+                          const unsigned char *s2ksalt,
+                          unsigned long s2kcount,
+                          const unsigned char *key, size_t keylen);
+void agent_get_cache_stats (struct cache_stats_s *r_stats);
+
+
+/*-- metrics.c --*/
+void agent_metrics_start (struct timespec *r_start);
+void agent_metrics_update (const char *category, const char *name,
+                           const struct timespec *start);
+void agent_metrics_write (membuf_t *mb);
 
 
 /*-- pksign.c --*/
@@ -497,6 +565,15 @@ gpg_error_t agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           const char *desc_text,
                           membuf_t *outbuf, cache_mode_t cache_mode);
+gpg_error_t agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                                const char *desc_text,
+                                cache_mode_t cache_mode,
+                                gpg_error_t (*next_cb)(void *opaque,
+                                                       ctrl_t ctrl),
+                                gpg_error_t (*sig_cb)(void *opaque,
+                                                      const void *sig,
+                                                      size_t siglen),
+                                void *opaque);
 
 /*-- pkdecrypt.c --*/
 int agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
@@ -621,6 +698,7 @@ int agent_card_scd (ctrl_t ctrl, const char *cmdline,
                     int (*getpin_cb)(void *, const char *,
                                      const char *, char*, size_t),
                     void *getpin_cb_arg, void *assuan_context);
+void agent_card_flush_cache (void);
 void agent_card_free_keyinfo (struct card_key_info_s *l);
 gpg_error_t agent_card_keyinfo (ctrl_t ctrl, const char *keygrip,
                                 int cap, struct card_key_info_s **result);
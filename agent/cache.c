@@ -34,6 +34,16 @@
 /* The size of the encryption key in bytes.  */
 #define ENCRYPTION_KEYSIZE (128/8)
 
+/* The number of buckets of the cache hash table.  Must be a power of
+ * 2.  */
+#define CACHE_TABLE_SIZE 1024
+
+/* Unused items are removed after this many seconds.  */
+#define UNUSED_ITEM_TTL (60*30)
+
+/* The maximum number of S2K derived keys stored with one item.  */
+#define MAX_KEKS_PER_ITEM 4
+
 /* A mutex used to serialize access to the cache.  */
 static npth_mutex_t cache_lock;
 /* The encryption context.  This is the only place where the
@@ -47,27 +57,67 @@ static npth_mutex_t cache_lock;
    more secure.  */
 static gcry_cipher_hd_t encryption_handle;
 
+/* A random key used to compute the PWHASH of the cache items.  This
+ * is allocated in secure memory along with the encryption context.  */
+static unsigned char *pwhash_key;
+
 
 struct secret_data_s {
   int  totallen; /* This includes the padding and space for AESWRAP. */
   char data[1];  /* A string.  */
 };
 
+/* A key derived from a cached passphrase by the S2K function.  */
+struct cache_kek_s {
+  struct cache_kek_s *next;
+  int hashalgo;
+  unsigned long s2kcount;
+  unsigned char s2ksalt[8];
+  size_t keylen;
+  struct secret_data_s *kek;
+};
+
 /* The cache object.  */
 typedef struct cache_item_s *ITEM;
 struct cache_item_s {
-  ITEM next;
+  ITEM next;        /* Next item in the same hash bucket.  */
+  ITEM next_pw;     /* Next item in the same PWHASH_TABLE bucket.  */
+  int queueidx;     /* Index into EXPIRY_QUEUE or -1.  */
+  time_t expires;   /* Time of the next housekeeping action.  */
   time_t created;
   time_t accessed;  /* Not updated for CACHE_MODE_DATA */
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
   struct secret_data_s *pw;
+  struct secret_data_s *skey;  /* NULL or the unprotected private key.  */
+  char skey_stamp[64];  /* Stamp of the key file used for SKEY.  */
+  unsigned char pwhash[32];  /* HMAC of PW; valid if PW is set.  */
+  struct cache_kek_s *keks;  /* Keys derived from PW.  */
   cache_mode_t cache_mode;
   int restricted;  /* The value of ctrl->restricted is part of the key.  */
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
+/* The cache himself.  This is a hash table indexed by the key.  */
+static ITEM thecache[CACHE_TABLE_SIZE];
+
+/* A second hash table with all items which have a passphrase indexed
+ * by their PWHASH.  This is used to find the S2K derived keys.  */
+static ITEM pwhash_table[CACHE_TABLE_SIZE];
+
+/* A binary min-heap of all items which need a housekeeping action
+ * ordered by their EXPIRES time.  */
+static ITEM *expiry_queue;
+static size_t expiry_queue_len;
+static size_t expiry_queue_size;
+
+/* Some statistics.  */
+static struct {
+  unsigned int items;     /* Number of items in the cache.  */
+  unsigned long hits;     /* Number of successful lookups.  */
+  unsigned long misses;   /* Number of failed lookups.  */
+  unsigned long expired;  /* Number of expired secrets.  */
+  unsigned int keks;      /* Number of stored S2K derived keys.  */
+} cache_stats;
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
@@ -92,6 +142,8 @@ deinitialize_module_cache (void)
 {
   gcry_cipher_close (encryption_handle);
   encryption_handle = NULL;
+  xfree (pwhash_key);
+  pwhash_key = NULL;
 }
 
 
@@ -122,6 +174,12 @@ init_encryption (void)
           err = gcry_cipher_setkey (encryption_handle, key, ENCRYPTION_KEYSIZE);
           xfree (key);
         }
+      if (!err)
+        {
+          pwhash_key = gcry_random_bytes_secure (32, GCRY_STRONG_RANDOM);
+          if (!pwhash_key)
+            err = gpg_error_from_syserror ();
+        }
       if (err)
         {
           gcry_cipher_close (encryption_handle);
@@ -143,12 +201,73 @@ release_data (struct secret_data_s *data)
    xfree (data);
 }
 
+
+/* Release the list of derived keys KEKS.  */
+static void
+release_keks (struct cache_kek_s *keks)
+{
+  struct cache_kek_s *k;
+
+  while ((k = keks))
+    {
+      keks = k->next;
+      release_data (k->kek);
+      xfree (k);
+      cache_stats.keks--;
+    }
+}
+
+
+/* Return the bucket of PWHASH_TABLE for PWHASH.  PWHASH is an HMAC
+ * and thus we can simply take some of its bits.  */
+static ITEM *
+pwhash_bucket (const unsigned char *pwhash)
+{
+  return pwhash_table + (((pwhash[0] << 8) | pwhash[1])
+                         & (CACHE_TABLE_SIZE - 1));
+}
+
+
+/* Remove item R from PWHASH_TABLE.  */
+static void
+pwhash_unlink (ITEM r)
+{
+  ITEM *rp;
+
+  for (rp = pwhash_bucket (r->pwhash); *rp; rp = &(*rp)->next_pw)
+    if (*rp == r)
+      {
+        *rp = r->next_pw;
+        break;
+      }
+  r->next_pw = NULL;
+}
+
+
+/* Release the passphrase of the cache item R and everything which
+ * depends on it.  */
+static void
+release_item_data (ITEM r)
+{
+  if (r->pw)
+    pwhash_unlink (r);
+  release_data (r->pw);
+  r->pw = NULL;
+  release_data (r->skey);
+  r->skey = NULL;
+  *r->skey_stamp = 0;
+  release_keks (r->keks);
+  r->keks = NULL;
+}
+
+
+/* Encrypt the LENGTH bytes at BUFFER and store them in a new secret
+ * data object at R_DATA.  */
 static gpg_error_t
-new_data (const char *string, struct secret_data_s **r_data)
+new_data (const void *buffer, size_t length, struct secret_data_s **r_data)
 {
   gpg_error_t err;
   struct secret_data_s *d, *d_enc;
-  size_t length;
   int total;
 
   *r_data = NULL;
@@ -157,8 +276,6 @@ new_data (const char *string, struct secret_data_s **r_data)
   if (err)
     return err;
 
-  length = strlen (string) + 1;
-
   /* We pad the data to 32 bytes so that it get more complicated
      finding something out by watching allocation patterns.  This is
      usually not possible but we better assume nothing about our secure
@@ -169,7 +286,8 @@ new_data (const char *string, struct secret_data_s **r_data)
   d = xtrymalloc_secure (sizeof *d + total - 1);
   if (!d)
     return gpg_error_from_syserror ();
-  memcpy (d->data, string, length);
+  memcpy (d->data, buffer, length);
+  memset (d->data + length, 0, total - length);
 
   d_enc = xtrymalloc (sizeof *d_enc + total - 1);
   if (!d_enc)
@@ -193,79 +311,316 @@ new_data (const char *string, struct secret_data_s **r_data)
 }
 
 
+/* Decrypt the secret data object D and store the plaintext in a new
+ * buffer allocated in secure memory at R_VALUE.  */
+static gpg_error_t
+get_data (struct secret_data_s *d, char **r_value)
+{
+  gpg_error_t err;
+  char *value;
 
-/* Check whether there are items to expire.  */
-static void
-housekeeping (void)
+  *r_value = NULL;
+
+  if (d->totallen < 32)
+    return gpg_error (GPG_ERR_INV_LENGTH);
+  err = init_encryption ();
+  if (err)
+    return err;
+  value = xtrymalloc_secure (d->totallen - 8);
+  if (!value)
+    return gpg_error_from_syserror ();
+  err = gcry_cipher_decrypt (encryption_handle, value, d->totallen - 8,
+                             d->data, d->totallen);
+  if (err)
+    {
+      xfree (value);
+      return err;
+    }
+  *r_value = value;
+  return 0;
+}
+
+
+
+/* Compute the HMAC of PASSPHRASE using our random PWHASH_KEY and
+ * store it at R_HASH which must provide space for 32 bytes.  The
+ * hash allows to find the items with a given passphrase without
+ * decrypting them.  */
+static gpg_error_t
+compute_pwhash (const char *passphrase, unsigned char *r_hash)
 {
-  ITEM r, rprev;
-  time_t current = gnupg_get_time ();
+  gcry_buffer_t iov[2];
+
+  if (!pwhash_key)
+    return gpg_error (GPG_ERR_NOT_INITIALIZED);
+
+  memset (iov, 0, sizeof iov);
+  iov[0].data = pwhash_key;
+  iov[0].len = 32;
+  iov[1].data = (void*)passphrase;
+  iov[1].len = strlen (passphrase);
+  return gcry_md_hash_buffers (GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC,
+                               r_hash, iov, 2);
+}
+
 
-  /* First expire the actual data */
-  for (r=thecache; r; r = r->next)
+/* Set the passphrase DATA into the cache item R.  */
+static gpg_error_t
+set_item_pw (ITEM r, const char *data)
+{
+  gpg_error_t err;
+
+  err = new_data (data, strlen (data) + 1, &r->pw);
+  if (!err)
     {
-      if (r->cache_mode == CACHE_MODE_PIN)
-        ; /* Don't let it expire - scdaemon explicitly flushes them.  */
-      else if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
+      err = compute_pwhash (data, r->pwhash);
+      if (err)
         {
-          if (DBG_CACHE)
-            log_debug ("  expired '%s'.%d (%ds after last access)\n",
-                       r->key, r->restricted, r->ttl);
           release_data (r->pw);
           r->pw = NULL;
-          r->accessed = current;
+        }
+      else
+        {
+          ITEM *bucket = pwhash_bucket (r->pwhash);
+
+          r->next_pw = *bucket;
+          *bucket = r;
         }
     }
+  return err;
+}
+
 
-  /* Second, make sure that we also remove them based on the created
-   * stamp so that the user has to enter it from time to time.  We
-   * don't do this for data items which are used to storage secrets in
-   * meory and are not user entered passphrases etc.  */
-  for (r=thecache; r; r = r->next)
+/* Return the hash table bucket for KEY.  */
+static ITEM *
+cache_bucket (const char *key)
+{
+  const unsigned char *s;
+  unsigned int hash = 0;
+
+  /* This is the one-at-a-time hash; it is good enough for the hex
+   * keygrips and nonces we use as keys.  */
+  for (s = (const unsigned char*)key; *s; s++)
     {
-      unsigned long maxttl;
+      hash += *s;
+      hash += (hash << 10);
+      hash ^= (hash >> 6);
+    }
+  hash += (hash << 3);
+  hash ^= (hash >> 11);
+  hash += (hash << 15);
+
+  return thecache + (hash & (CACHE_TABLE_SIZE - 1));
+}
 
-      switch (r->cache_mode)
+
+/* Return the maximum lifetime of an item with CACHE_MODE or 0 if
+ * there is no maximum lifetime.  */
+static unsigned long
+max_ttl_for_mode (cache_mode_t cache_mode)
+{
+  switch (cache_mode)
+    {
+    case CACHE_MODE_DATA:
+    case CACHE_MODE_PIN:
+      return 0;  /* No MAX TTL here.  */
+    case CACHE_MODE_SSH: return opt.max_cache_ttl_ssh;
+    default: return opt.max_cache_ttl;
+    }
+}
+
+
+/* Helper to swap two elements of the expiry queue.  */
+static void
+queue_swap (size_t a, size_t b)
+{
+  ITEM tmp = expiry_queue[a];
+
+  expiry_queue[a] = expiry_queue[b];
+  expiry_queue[b] = tmp;
+  expiry_queue[a]->queueidx = a;
+  expiry_queue[b]->queueidx = b;
+}
+
+
+/* Restore the heap property of the expiry queue for the element at
+ * index IDX.  */
+static void
+queue_fix (size_t idx)
+{
+  size_t parent, child;
+
+  while (idx && (expiry_queue[idx]->expires
+                 < expiry_queue[(parent = (idx - 1) / 2)]->expires))
+    {
+      queue_swap (idx, parent);
+      idx = parent;
+    }
+
+  for (;;)
+    {
+      child = 2 * idx + 1;
+      if (child >= expiry_queue_len)
+        break;
+      if (child + 1 < expiry_queue_len
+          && expiry_queue[child+1]->expires < expiry_queue[child]->expires)
+        child++;
+      if (expiry_queue[idx]->expires <= expiry_queue[child]->expires)
+        break;
+      queue_swap (idx, child);
+      idx = child;
+    }
+}
+
+
+/* Remove item R from the expiry queue.  */
+static void
+queue_remove (ITEM r)
+{
+  size_t idx;
+
+  if (r->queueidx < 0)
+    return;
+  idx = r->queueidx;
+  r->queueidx = -1;
+  expiry_queue_len--;
+  if (idx != expiry_queue_len)
+    {
+      expiry_queue[idx] = expiry_queue[expiry_queue_len];
+      expiry_queue[idx]->queueidx = idx;
+      queue_fix (idx);
+    }
+}
+
+
+/* Compute the time of the next housekeeping action for item R and
+ * update its position in the expiry queue.  The rules are those
+ * applied by housekeeping.  */
+static void
+update_expiry (ITEM r)
+{
+  time_t expires = 0;
+  unsigned long maxttl;
+
+  if (r->pw)
+    {
+      /* Note that the conditions in housekeeping use "<" and thus
+       * the action is due one second later.  */
+      if (r->cache_mode != CACHE_MODE_PIN && r->ttl >= 0)
+        expires = r->accessed + r->ttl + 1;
+      maxttl = max_ttl_for_mode (r->cache_mode);
+      if (maxttl && (!expires || r->created + maxttl + 1 < expires))
+        expires = r->created + maxttl + 1;
+    }
+  else if (r->ttl >= 0)
+    expires = r->accessed + UNUSED_ITEM_TTL + 1;
+
+  if (!expires)
+    {
+      queue_remove (r);
+      return;
+    }
+
+  r->expires = expires;
+  if (r->queueidx < 0)
+    {
+      if (expiry_queue_len == expiry_queue_size)
         {
-        case CACHE_MODE_DATA:
-        case CACHE_MODE_PIN:
-          continue;  /* No MAX TTL here.  */
-        case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
-        default: maxttl = opt.max_cache_ttl; break;
+          size_t newsize = expiry_queue_size? 2 * expiry_queue_size : 64;
+          ITEM *newqueue;
+
+          newqueue = xtryrealloc (expiry_queue, newsize * sizeof *newqueue);
+          if (!newqueue)
+            {
+              /* Better expire the secret now than never.  */
+              log_error ("error enlarging the cache expiry queue: %s\n",
+                         gpg_strerror (gpg_error_from_syserror ()));
+              release_item_data (r);
+              return;
+            }
+          expiry_queue = newqueue;
+          expiry_queue_size = newsize;
         }
-      if (r->pw && r->created + maxttl < current)
+      r->queueidx = expiry_queue_len++;
+      expiry_queue[r->queueidx] = r;
+    }
+  queue_fix (r->queueidx);
+}
+
+
+/* Unlink item R from the cache and release it.  */
+static void
+remove_item (ITEM r)
+{
+  ITEM *bucket, *rp;
+
+  bucket = cache_bucket (r->key);
+  for (rp = bucket; *rp; rp = &(*rp)->next)
+    if (*rp == r)
+      {
+        *rp = r->next;
+        break;
+      }
+  queue_remove (r);
+  release_item_data (r);
+  xfree (r);
+  cache_stats.items--;
+}
+
+
+/* Check whether there are items to expire.  Only items whose expiry
+ * time has been reached are looked at.  */
+static void
+housekeeping (void)
+{
+  ITEM r;
+  time_t current = gnupg_get_time ();
+  unsigned long maxttl;
+
+  while (expiry_queue_len && expiry_queue[0]->expires <= current)
+    {
+      r = expiry_queue[0];
+
+      /* First expire the actual data.  PIN items don't expire
+       * because scdaemon explicitly flushes them.  */
+      if (r->cache_mode != CACHE_MODE_PIN
+          && r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
+        {
+          if (DBG_CACHE)
+            log_debug ("  expired '%s'.%d (%ds after last access)\n",
+                       r->key, r->restricted, r->ttl);
+          release_item_data (r);
+          r->accessed = current;
+          cache_stats.expired++;
+        }
+
+      /* Second, make sure that we also remove them based on the
+       * created stamp so that the user has to enter it from time to
+       * time.  We don't do this for data items which are used to
+       * storage secrets in meory and are not user entered passphrases
+       * etc.  */
+      maxttl = max_ttl_for_mode (r->cache_mode);
+      if (maxttl && r->pw && r->created + maxttl < current)
         {
           if (DBG_CACHE)
             log_debug ("  expired '%s'.%d (%lus after creation)\n",
-                       r->key, r->restricted, opt.max_cache_ttl);
-          release_data (r->pw);
-          r->pw = NULL;
+                       r->key, r->restricted, maxttl);
+          release_item_data (r);
           r->accessed = current;
+          cache_stats.expired++;
         }
-    }
 
-  /* Third, make sure that we don't have too many items in the list.
-   * Expire old and unused entries after 30 minutes.  */
-  for (rprev=NULL, r=thecache; r; )
-    {
-      if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < current)
+      /* Third, make sure that we don't have too many items in the
+       * list.  Expire old and unused entries after 30 minutes.  */
+      if (!r->pw && r->ttl >= 0 && r->accessed + UNUSED_ITEM_TTL < current)
         {
-          ITEM r2 = r->next;
           if (DBG_CACHE)
             log_debug ("  removed '%s'.%d (mode %d) (slot not used for 30m)\n",
                        r->key, r->restricted, r->cache_mode);
-          xfree (r);
-          if (!rprev)
-            thecache = r2;
-          else
-            rprev->next = r2;
-          r = r2;
+          remove_item (r);
         }
       else
-        {
-          rprev = r;
-          r = r->next;
-        }
+        update_expiry (r);
     }
 }
 
@@ -295,6 +650,7 @@ agent_flush_cache (int pincache_only)
 {
   ITEM r;
   int res;
+  int i;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache%s\n", pincache_only?" (pincache only)":"");
@@ -303,19 +659,20 @@ agent_flush_cache (int pincache_only)
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
-        continue;
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-        }
-    }
+  for (i=0; i < CACHE_TABLE_SIZE; i++)
+    for (r=thecache[i]; r; r = r->next)
+      {
+        if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
+          continue;
+        if (r->pw)
+          {
+            if (DBG_CACHE)
+              log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
+            release_item_data (r);
+            r->accessed = 0;
+            update_expiry (r);
+          }
+      }
 
   res = npth_mutex_unlock (&cache_lock);
   if (res)
@@ -373,7 +730,7 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     goto out;
 
-  for (r=thecache; r; r = r->next)
+  for (r = *cache_bucket (key); r; r = r->next)
     {
       if (cache_mode == CACHE_MODE_PIN && data)
         {
@@ -397,20 +754,17 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
     }
   if (r) /* Replace.  */
     {
-      if (r->pw)
-        {
-          release_data (r->pw);
-          r->pw = NULL;
-        }
+      release_item_data (r);
       if (data)
         {
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = set_item_pw (r, data);
           if (err)
             log_error ("error replacing cache item: %s\n", gpg_strerror (err));
         }
+      update_expiry (r);
     }
   else if (data) /* Insert.  */
     {
@@ -420,17 +774,22 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
       else
         {
           strcpy (r->key, key);
+          r->queueidx = -1;
           r->restricted = restricted;
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = set_item_pw (r, data);
           if (err)
             xfree (r);
           else
             {
-              r->next = thecache;
-              thecache = r;
+              ITEM *bucket = cache_bucket (key);
+
+              r->next = *bucket;
+              *bucket = r;
+              cache_stats.items++;
+              update_expiry (r);
             }
         }
       if (err)
@@ -480,7 +839,7 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
                last_stored? " (stored cache key)":"");
   housekeeping ();
 
-  for (r=thecache; r; r = r->next)
+  for (r = *cache_bucket (key); r; r = r->next)
     {
       if (cache_mode == CACHE_MODE_PIN)
         yes = (r->pw && !strcmp (r->key, key));
@@ -500,33 +859,27 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
            * below.  Note also that we don't update the accessed time
            * for data items.  */
           if (r->cache_mode != CACHE_MODE_DATA)
-            r->accessed = gnupg_get_time ();
-          if (DBG_CACHE)
-            log_debug ("... hit\n");
-          if (r->pw->totallen < 32)
-            err = gpg_error (GPG_ERR_INV_LENGTH);
-          else if ((err = init_encryption ()))
-            ;
-          else if (!(value = xtrymalloc_secure (r->pw->totallen - 8)))
-            err = gpg_error_from_syserror ();
-          else
             {
-              err = gcry_cipher_decrypt (encryption_handle,
-                                         value, r->pw->totallen - 8,
-                                         r->pw->data, r->pw->totallen);
+              r->accessed = gnupg_get_time ();
+              update_expiry (r);
             }
+          if (DBG_CACHE)
+            log_debug ("... hit\n");
+          err = get_data (r->pw, &value);
           if (err)
-            {
-              xfree (value);
-              value = NULL;
-              log_error ("retrieving cache entry '%s'.%d failed: %s\n",
-                         key, restricted, gpg_strerror (err));
-            }
+            log_error ("retrieving cache entry '%s'.%d failed: %s\n",
+                       key, restricted, gpg_strerror (err));
           break;
         }
     }
-  if (DBG_CACHE && value == NULL)
-    log_debug ("... miss\n");
+  if (value)
+    cache_stats.hits++;
+  else
+    {
+      cache_stats.misses++;
+      if (DBG_CACHE)
+        log_debug ("... miss\n");
+    }
 
  out:
   res = npth_mutex_unlock (&cache_lock);
@@ -537,6 +890,301 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
 }
 
 
+/* Attach the unprotected private key SKEY, given as canonical
+ * S-expression, to the passphrase cached for the keygrip KEY with
+ * CACHE_MODE.  STAMP is a string describing the state of the key file
+ * SKEY has been read from.  The key is only stored if a passphrase
+ * for KEY is cached and it is removed together with that
+ * passphrase.  */
+void
+agent_put_cache_skey (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
+                      const char *stamp, const unsigned char *skey)
+{
+  gpg_error_t err;
+  ITEM r;
+  int res;
+  int restricted = ctrl? ctrl->restricted : -1;
+  size_t skeylen;
+
+  skeylen = gcry_sexp_canon_len (skey, 0, NULL, NULL);
+  if (!skeylen || strlen (stamp) >= sizeof r->skey_stamp)
+    return;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  for (r = *cache_bucket (key); r; r = r->next)
+    if (r->pw && cache_mode_equal (r->cache_mode, cache_mode)
+        && r->restricted == restricted && !strcmp (r->key, key))
+      break;
+  if (r)
+    {
+      release_data (r->skey);
+      r->skey = NULL;
+      err = new_data (skey, skeylen, &r->skey);
+      if (err)
+        {
+          *r->skey_stamp = 0;
+          log_error ("error caching key '%s': %s\n", key, gpg_strerror (err));
+        }
+      else
+        {
+          strcpy (r->skey_stamp, stamp);
+          if (DBG_CACHE)
+            log_debug ("agent_put_cache_skey '%s'.%d stamp=%s\n",
+                       key, restricted, stamp);
+        }
+    }
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
+
+
+/* Return the unprotected private key for the keygrip KEY and
+ * CACHE_MODE as canonical S-expression in secure memory or NULL if it
+ * is not cached, the passphrase has expired, or STAMP does not match
+ * the stamp used when the key was stored.  */
+unsigned char *
+agent_get_cache_skey (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
+                      const char *stamp)
+{
+  gpg_error_t err;
+  ITEM r;
+  char *value = NULL;
+  int res;
+  int restricted = ctrl? ctrl->restricted : -1;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  housekeeping ();
+
+  for (r = *cache_bucket (key); r; r = r->next)
+    if (r->pw && cache_mode_equal (r->cache_mode, cache_mode)
+        && r->restricted == restricted && !strcmp (r->key, key))
+      break;
+  if (r && r->skey)
+    {
+      if (strcmp (r->skey_stamp, stamp))
+        {
+          if (DBG_CACHE)
+            log_debug ("agent_get_cache_skey '%s'.%d: key file changed\n",
+                       key, restricted);
+          release_data (r->skey);
+          r->skey = NULL;
+          *r->skey_stamp = 0;
+        }
+      else
+        {
+          r->accessed = gnupg_get_time ();
+          update_expiry (r);
+          err = get_data (r->skey, &value);
+          if (err)
+            log_error ("retrieving cached key '%s'.%d failed: %s\n",
+                       key, restricted, gpg_strerror (err));
+          else if (DBG_CACHE)
+            log_debug ("agent_get_cache_skey '%s'.%d: hit\n", key, restricted);
+        }
+    }
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+
+  return (unsigned char *)value;
+}
+
+
+/* Remove all cached private keys for the keygrip KEY.  This is used
+ * if the key file is modified or deleted.  */
+void
+agent_flush_cache_skey (const char *key)
+{
+  ITEM r;
+  int res;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  for (r = *cache_bucket (key); r; r = r->next)
+    if (r->skey && !strcmp (r->key, key))
+      {
+        release_data (r->skey);
+        r->skey = NULL;
+        *r->skey_stamp = 0;
+      }
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
+
+
+/* Return the first item which has the passphrase with the hash
+ * PWHASH.  */
+static ITEM
+find_item_by_pwhash (const unsigned char *pwhash)
+{
+  ITEM r;
+
+  for (r = *pwhash_bucket (pwhash); r; r = r->next_pw)
+    if (!memcmp (r->pwhash, pwhash, sizeof r->pwhash))
+      return r;
+  return NULL;
+}
+
+
+/* Look for a key derived by the S2K function from PASSPHRASE with
+ * HASHALGO, S2KSALT and S2KCOUNT and store it at KEY.  Such keys are
+ * only cached as long as PASSPHRASE is cached.  Returns
+ * GPG_ERR_NOT_FOUND if no such key is cached.  */
+gpg_error_t
+agent_get_cache_kek (const char *passphrase, int hashalgo,
+                     const unsigned char *s2ksalt, unsigned long s2kcount,
+                     unsigned char *key, size_t keylen)
+{
+  gpg_error_t err = gpg_error (GPG_ERR_NOT_FOUND);
+  unsigned char pwhash[32];
+  struct cache_kek_s *k = NULL;
+  char *value;
+  ITEM r;
+  int res;
+
+  if (!passphrase || !*passphrase)
+    return err;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  housekeeping ();
+
+  if (!cache_stats.keks || compute_pwhash (passphrase, pwhash))
+    goto leave;
+
+  for (r = *pwhash_bucket (pwhash); r && !k; r = r->next_pw)
+    if (r->keks && !memcmp (r->pwhash, pwhash, sizeof pwhash))
+      for (k = r->keks; k; k = k->next)
+        if (k->hashalgo == hashalgo && k->s2kcount == s2kcount
+            && k->keylen == keylen && !memcmp (k->s2ksalt, s2ksalt, 8))
+          break;
+  if (k && !get_data (k->kek, &value))
+    {
+      memcpy (key, value, keylen);
+      wipememory (value, keylen);
+      xfree (value);
+      err = 0;
+    }
+
+ leave:
+  wipememory (pwhash, sizeof pwhash);
+  if (DBG_CACHE)
+    log_debug ("agent_get_cache_kek: %s\n", err? "miss":"hit");
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+
+  return err;
+}
+
+
+/* Store KEY, the result of the S2K function applied to PASSPHRASE
+ * with HASHALGO, S2KSALT and S2KCOUNT.  The key is attached to a
+ * cache item with the same passphrase and removed along with that
+ * passphrase; if PASSPHRASE is not cached nothing is stored.  */
+void
+agent_put_cache_kek (const char *passphrase, int hashalgo,
+                     const unsigned char *s2ksalt, unsigned long s2kcount,
+                     const unsigned char *key, size_t keylen)
+{
+  gpg_error_t err;
+  unsigned char pwhash[32];
+  struct cache_kek_s *k, *kprev;
+  ITEM r;
+  int n;
+  int res;
+
+  if (!passphrase || !*passphrase)
+    return;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  if (compute_pwhash (passphrase, pwhash))
+    goto leave;
+  r = find_item_by_pwhash (pwhash);
+  if (!r)
+    goto leave;
+
+  k = xtrycalloc (1, sizeof *k);
+  if (!k)
+    goto leave;
+  k->hashalgo = hashalgo;
+  k->s2kcount = s2kcount;
+  memcpy (k->s2ksalt, s2ksalt, 8);
+  k->keylen = keylen;
+  err = new_data (key, keylen, &k->kek);
+  if (err)
+    {
+      log_error ("error caching derived key: %s\n", gpg_strerror (err));
+      xfree (k);
+      goto leave;
+    }
+  k->next = r->keks;
+  r->keks = k;
+  cache_stats.keks++;
+
+  /* Keep only the most recent keys.  */
+  for (n=0, kprev=NULL, k=r->keks; k; kprev = k, k = k->next)
+    if (++n > MAX_KEKS_PER_ITEM)
+      {
+        kprev->next = NULL;
+        release_keks (k);
+        break;
+      }
+
+  if (DBG_CACHE)
+    log_debug ("agent_put_cache_kek: stored with '%s'.%d\n",
+               r->key, r->restricted);
+
+ leave:
+  wipememory (pwhash, sizeof pwhash);
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
+
+
+/* Store statistics about the cache at R_STATS.  */
+void
+agent_get_cache_stats (struct cache_stats_s *r_stats)
+{
+  int res;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  r_stats->items   = cache_stats.items;
+  r_stats->queued  = expiry_queue_len;
+  r_stats->hits    = cache_stats.hits;
+  r_stats->misses  = cache_stats.misses;
+  r_stats->expired = cache_stats.expired;
+  r_stats->keks    = cache_stats.keks;
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
+
+
 /* Store the key for the last successful cache hit.  That value is
    used by agent_get_cache if the requested KEY is given as NULL.
    NULL may be used to remove that key. */
@@ -69,6 +69,9 @@ static struct
 /* A mutex used to serialize access to the pinentry. */
 static npth_mutex_t entry_lock;
 
+/* The time ENTRY_LOCK was taken by start_pinentry.  */
+static struct timespec entry_lock_time;
+
 /* The thread ID of the popup working thread. */
 static npth_t  popup_tid;
 
@@ -177,6 +180,7 @@ unlock_pinentry (ctrl_t ctrl, gpg_error_t rc)
 
   if (--ctrl->pinentry_active == 0)
     {
+      agent_metrics_update ("pinentry", NULL, &entry_lock_time);
       entry_ctx = NULL;
       err = npth_mutex_unlock (&entry_lock);
       if (err)
@@ -323,6 +327,7 @@ start_pinentry (ctrl_t ctrl)
                  gpg_strerror (rc));
       return rc;
     }
+  agent_metrics_start (&entry_lock_time);
 
   if (entry_ctx)
     return 0;
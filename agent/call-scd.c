@@ -57,6 +57,7 @@ struct scd_local_s
                              used with this connection. */
   unsigned int in_use: 1; /* CTX is in use.  */
   unsigned int invalid:1; /* CTX is invalid, should be released.  */
+  struct timespec start;  /* Time CTX was marked as in use.  */
 };
 
 
@@ -109,6 +110,41 @@ static assuan_context_t primary_scd_ctx;
    any connection. */
 static int primary_scd_ctx_reusable;
 
+/* Time in seconds the cached card information is used even if no
+ * card event has been seen.  This is a safeguard for systems where
+ * scdaemon can't signal card changes.  */
+#define CARD_CACHE_TTL 10
+
+/* A cached READKEY result.  */
+struct card_cache_key_s
+{
+  struct card_cache_key_s *next;
+  unsigned char *buf;   /* The canonical S-expression.  */
+  size_t buflen;
+  char *keyref;         /* NULL or the keyref.  */
+  char id[1];           /* The requested keygrip.  */
+};
+
+/* The maximum number of cached READKEY results.  */
+#define CARD_CACHE_MAX_KEYS 32
+
+/* Information read from the cards which is kept across sessions so
+ * that KEYINFO, READKEY and the ssh identity listing do not need a
+ * round trip to scdaemon as long as nothing changed.  The cache is
+ * flushed if the card event counter changed, if the scdaemon
+ * terminated, and after commands which may modify the card.  */
+static struct
+{
+  int valid;
+  unsigned int eventno;          /* The card event counter.        */
+  time_t created;                /* Time the cache was filled.     */
+  char *serialno;                /* Result of "SERIALNO --all".    */
+  int have_keyinfo[4];           /* KEYINFO cached for cap index.  */
+  struct card_key_info_s *keyinfo[4];
+  struct card_cache_key_s *keys;
+  int nkeys;
+} card_cache;
+
 
 
 /* Local prototypes.  */
@@ -150,6 +186,94 @@ agent_scd_dump_state (void)
 }
 
 
+/* Flush all cached information from the cards.  */
+void
+agent_card_flush_cache (void)
+{
+  struct card_cache_key_s *k, *k_next;
+  int i;
+
+  xfree (card_cache.serialno);
+  card_cache.serialno = NULL;
+  for (i=0; i < DIM (card_cache.keyinfo); i++)
+    {
+      agent_card_free_keyinfo (card_cache.keyinfo[i]);
+      card_cache.keyinfo[i] = NULL;
+      card_cache.have_keyinfo[i] = 0;
+    }
+  for (k = card_cache.keys; k; k = k_next)
+    {
+      k_next = k->next;
+      xfree (k->buf);
+      xfree (k->keyref);
+      xfree (k);
+    }
+  card_cache.keys = NULL;
+  card_cache.nkeys = 0;
+  card_cache.valid = 0;
+}
+
+
+/* Make sure that the card cache may be used.  This flushes the cache
+ * if it is stale and prepares it for new entries.  */
+static void
+check_card_cache (void)
+{
+  unsigned int keyno, cardno;
+  time_t now = gnupg_get_time ();
+
+  get_agent_eventcounters (&keyno, &cardno);
+  if (card_cache.valid
+      && (card_cache.eventno != cardno
+          || now < card_cache.created
+          || now - card_cache.created > CARD_CACHE_TTL))
+    agent_card_flush_cache ();
+  if (!card_cache.valid)
+    {
+      card_cache.valid = 1;
+      card_cache.eventno = cardno;
+      card_cache.created = now;
+    }
+}
+
+
+/* Return a copy of the keyinfo list L.  If ONLY is true, only the
+ * first item is copied.  Returns NULL and sets ERRNO on error.  Note
+ * that NULL is also returned for an empty list.  */
+static struct card_key_info_s *
+copy_keyinfo (const struct card_key_info_s *l, int only)
+{
+  struct card_key_info_s *result = NULL;
+  struct card_key_info_s **l_p = &result;
+  struct card_key_info_s *ki;
+
+  for (; l; l = only? NULL : l->next)
+    {
+      ki = xtrycalloc (1, sizeof *ki);
+      if (!ki)
+        goto leave;
+      *l_p = ki;
+      l_p = &ki->next;
+      strcpy (ki->keygrip, l->keygrip);
+      ki->serialno = xtrystrdup (l->serialno);
+      if (!ki->serialno)
+        goto leave;
+      ki->idstr = xtrystrdup (l->idstr);
+      if (!ki->idstr)
+        goto leave;
+    }
+  return result;
+
+ leave:
+  {
+    int saved_errno = errno;
+    agent_card_free_keyinfo (result);
+    gpg_err_set_errno (saved_errno);
+  }
+  return NULL;
+}
+
+
 /* The unlock_scd function shall be called after having accessed the
    SCD.  It is currently not very useful but gives an opportunity to
    keep track of connections currently calling SCD.  Note that the
@@ -168,6 +292,8 @@ unlock_scd (ctrl_t ctrl, int rc)
       if (!rc)
         rc = gpg_error (GPG_ERR_INTERNAL);
     }
+  else
+    agent_metrics_update ("scd", NULL, &ctrl->scd_local->start);
   err = npth_mutex_lock (&start_scd_lock);
   if (err)
     {
@@ -247,6 +373,7 @@ wait_child_thread (void *arg)
 #endif
 
   agent_flush_cache (1);  /* Flush the PIN cache.  */
+  agent_card_flush_cache ();
 
   err = npth_mutex_lock (&start_scd_lock);
   if (err)
@@ -307,6 +434,7 @@ start_scd (ctrl_t ctrl)
   if (ctrl->scd_local && ctrl->scd_local->ctx)
     {
       ctrl->scd_local->in_use = 1;
+      agent_metrics_start (&ctrl->scd_local->start);
       return 0; /* Okay, the context is fine.  */
     }
 
@@ -343,6 +471,7 @@ start_scd (ctrl_t ctrl)
     }
 
   ctrl->scd_local->in_use = 1;
+  agent_metrics_start (&ctrl->scd_local->start);
 
   /* Check whether the pipe server has already been started and in
      this case either reuse a lingering pipe connection or establish a
@@ -845,7 +974,9 @@ get_serialno_cb (void *opaque, const char *line)
 /* Return the serial number of the card or an appropriate error.  The
  * serial number is returned as a hexstring.  If the serial number is
  * not required by the caller R_SERIALNO can be NULL; this might be
- * useful to test whether a card is available. */
+ * useful to test whether a card is available.  Without DEMAND a
+ * cached serial number is used if available; errors are not cached
+ * so that scdaemon will look for a new card on the next call. */
 int
 agent_card_serialno (ctrl_t ctrl, char **r_serialno, const char *demand)
 {
@@ -853,6 +984,18 @@ agent_card_serialno (ctrl_t ctrl, char **r_serialno, const char *demand)
   char *serialno = NULL;
   char line[ASSUAN_LINELENGTH];
 
+  if (!demand)
+    {
+      check_card_cache ();
+      if (card_cache.serialno)
+        {
+          if (r_serialno
+              && !(*r_serialno = xtrystrdup (card_cache.serialno)))
+            return gpg_error_from_syserror ();
+          return 0;
+        }
+    }
+
   rc = start_scd (ctrl);
   if (rc)
     return rc;
@@ -870,6 +1013,18 @@ agent_card_serialno (ctrl_t ctrl, char **r_serialno, const char *demand)
       xfree (serialno);
       return unlock_scd (ctrl, rc);
     }
+  if (demand)
+    {
+      /* Another card may have been selected.  */
+      agent_card_flush_cache ();
+    }
+  else if (serialno)
+    {
+      /* The cache might have been flushed meanwhile.  */
+      check_card_cache ();
+      xfree (card_cache.serialno);
+      card_cache.serialno = xtrystrdup (serialno);
+    }
   if (r_serialno)
     *r_serialno = serialno;
   else
@@ -1220,6 +1375,54 @@ readkey_status_cb (void *opaque, const char *line)
 }
 
 
+/* Store the READKEY result BUF of length BUFLEN with KEYREF for ID in
+ * the card cache.  Only results for a keygrip are cached because the
+ * result for a keyref depends on the currently selected card.  */
+static void
+put_card_cache_key (const char *id, const unsigned char *buf, size_t buflen,
+                    const char *keyref)
+{
+  struct card_cache_key_s *k, **k_p;
+
+  if (strlen (id) != 2*KEYGRIP_LEN
+      || strspn (id, "0123456789abcdefABCDEF") != 2*KEYGRIP_LEN)
+    return;
+
+  check_card_cache ();
+  for (k_p = &card_cache.keys; *k_p; k_p = &(*k_p)->next)
+    if (!strcmp ((*k_p)->id, id))
+      {
+        /* Remove an older result, for example one without keyref.  */
+        k = *k_p;
+        *k_p = k->next;
+        xfree (k->buf);
+        xfree (k->keyref);
+        xfree (k);
+        card_cache.nkeys--;
+        break;
+      }
+  if (card_cache.nkeys >= CARD_CACHE_MAX_KEYS)
+    return;
+
+  k = xtrycalloc (1, sizeof *k + strlen (id));
+  if (!k)
+    return;
+  strcpy (k->id, id);
+  k->buf = xtrymalloc (buflen);
+  if (!k->buf || (keyref && !(k->keyref = xtrystrdup (keyref))))
+    {
+      xfree (k->buf);
+      xfree (k);
+      return;
+    }
+  memcpy (k->buf, buf, buflen);
+  k->buflen = buflen;
+  k->next = card_cache.keys;
+  card_cache.keys = k;
+  card_cache.nkeys++;
+}
+
+
 /* Read a key with ID (keyref or keygrip) and return it in a malloced
  * buffer pointed to by R_BUF as a valid S-expression.  If R_KEYREF is
  * not NULL the keyref is stored there. */
@@ -1232,6 +1435,7 @@ agent_card_readkey (ctrl_t ctrl, const char *id,
   membuf_t data;
   size_t len, buflen;
   struct readkey_status_parm_s parm;
+  struct card_cache_key_s *k;
 
   memset (&parm, 0, sizeof parm);
 
@@ -1239,6 +1443,24 @@ agent_card_readkey (ctrl_t ctrl, const char *id,
   if (r_keyref)
     *r_keyref = NULL;
 
+  check_card_cache ();
+  for (k = card_cache.keys; k; k = k->next)
+    if (!strcmp (k->id, id) && (!r_keyref || k->keyref))
+      {
+        *r_buf = xtrymalloc (k->buflen);
+        if (!*r_buf)
+          return gpg_error_from_syserror ();
+        memcpy (*r_buf, k->buf, k->buflen);
+        if (r_keyref && !(*r_keyref = xtrystrdup (k->keyref)))
+          {
+            rc = gpg_error_from_syserror ();
+            xfree (*r_buf);
+            *r_buf = NULL;
+            return rc;
+          }
+        return 0;
+      }
+
   rc = start_scd (ctrl);
   if (rc)
     return rc;
@@ -1269,6 +1491,7 @@ agent_card_readkey (ctrl_t ctrl, const char *id,
       xfree (*r_buf); *r_buf = NULL;
       return unlock_scd (ctrl, gpg_error (GPG_ERR_INV_VALUE));
     }
+  put_card_cache_key (id, *r_buf, buflen, parm.keyref);
   if (r_keyref)
     *r_keyref = parm.keyref;
   else
@@ -1324,6 +1547,7 @@ agent_card_writekey (ctrl_t ctrl,  int force, const char *serialno,
   err = assuan_transact (ctrl->scd_local->ctx, line, NULL, NULL,
                          inq_writekey_parms, &parms,
                          pincache_put_cb, NULL);
+  agent_card_flush_cache ();
   return unlock_scd (ctrl, err);
 }
 
@@ -1544,7 +1768,9 @@ agent_card_free_keyinfo (struct card_key_info_s *l)
    retrieve list of available keys on cards.  With CAP, we can limit
    keys with specified capability.  On success, the allocated
    structure is stored at RESULT.  On error, an error code is returned
-   and NULL is stored at RESULT.  */
+   and NULL is stored at RESULT.  Lists are taken from the card cache
+   if possible; a KEYGRIP is looked up in the cached full list but
+   only a found key is taken from there.  */
 gpg_error_t
 agent_card_keyinfo (ctrl_t ctrl, const char *keygrip, int cap,
                     struct card_key_info_s **result)
@@ -1553,18 +1779,39 @@ agent_card_keyinfo (ctrl_t ctrl, const char *keygrip, int cap,
   struct card_keyinfo_parm_s parm;
   char line[ASSUAN_LINELENGTH];
   char *list_option;
+  int capidx;
+  struct card_key_info_s *ki;
 
   *result = NULL;
 
   switch (cap)
     {
-    case                  0: list_option = "--list";      break;
-    case GCRY_PK_USAGE_SIGN: list_option = "--list=sign"; break;
-    case GCRY_PK_USAGE_ENCR: list_option = "--list=encr"; break;
-    case GCRY_PK_USAGE_AUTH: list_option = "--list=auth"; break;
+    case                  0: list_option = "--list";      capidx = 0; break;
+    case GCRY_PK_USAGE_SIGN: list_option = "--list=sign"; capidx = 1; break;
+    case GCRY_PK_USAGE_ENCR: list_option = "--list=encr"; capidx = 2; break;
+    case GCRY_PK_USAGE_AUTH: list_option = "--list=auth"; capidx = 3; break;
     default:                 return gpg_error (GPG_ERR_INV_VALUE);
     }
 
+  check_card_cache ();
+  if (keygrip && card_cache.have_keyinfo[0])
+    {
+      for (ki = card_cache.keyinfo[0]; ki; ki = ki->next)
+        if (!strcmp (ki->keygrip, keygrip))
+          {
+            if (!(*result = copy_keyinfo (ki, 1)))
+              return gpg_error_from_syserror ();
+            return 0;
+          }
+    }
+  else if (!keygrip && card_cache.have_keyinfo[capidx])
+    {
+      *result = copy_keyinfo (card_cache.keyinfo[capidx], 0);
+      if (!*result && card_cache.keyinfo[capidx])
+        return gpg_error_from_syserror ();
+      return 0;
+    }
+
   memset (&parm, 0, sizeof parm);
   snprintf (line, sizeof line, "KEYINFO %s", keygrip ? keygrip : list_option);
 
@@ -1578,6 +1825,16 @@ agent_card_keyinfo (ctrl_t ctrl, const char *keygrip, int cap,
   if (!err && parm.error)
     err = parm.error;
 
+  if (!err && !keygrip)
+    {
+      /* The cache might have been flushed meanwhile.  */
+      check_card_cache ();
+      agent_card_free_keyinfo (card_cache.keyinfo[capidx]);
+      card_cache.keyinfo[capidx] = copy_keyinfo (parm.list, 0);
+      card_cache.have_keyinfo[capidx] = (!parm.list
+                                         || card_cache.keyinfo[capidx]);
+    }
+
   if (!err)
     *result = parm.list;
   else
@@ -1667,6 +1924,10 @@ agent_card_scd (ctrl_t ctrl, const char *cmdline,
                         pass_status_thru, assuan_context);
 
   assuan_set_flag (ctrl->scd_local->ctx, ASSUAN_CONVEY_COMMENTS, saveflag);
+
+  /* The command may have changed the card or selected another one.  */
+  agent_card_flush_cache ();
+
   if (rc)
     {
       return unlock_scd (ctrl, rc);
@@ -1683,4 +1944,5 @@ agent_card_killscd (void)
   assuan_transact (primary_scd_ctx, "KILLSCD",
                    NULL, NULL, NULL, NULL, NULL, NULL);
   agent_flush_cache (1);  /* Flush the PIN cache.  */
+  agent_card_flush_cache ();
 }
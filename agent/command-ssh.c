@@ -94,6 +94,12 @@
 /* The name of the control file.  */
 #define SSH_CONTROL_FILE_NAME "sshcontrol"
 
+/* The number of seconds the cached list of card identities is used
+ * without asking the scdaemon again.  Card changes are usually
+ * signaled by an event but that does not work if no scdaemon is
+ * running.  */
+#define SSH_CARD_IDENTITIES_TTL 10
+
 /* The blurb we put into the header of a newly created control file.  */
 static const char sshcontrolblurb[] =
 "# List of allowed ssh keys.  Only keys present in this file are used\n"
@@ -227,6 +233,22 @@ struct ssh_control_file_s
 };
 
 
+/* A part of the answer to request_identities as kept in the cache.
+ * The keys from the cards and those listed in the control file are
+ * kept in separate parts because they are invalidated by different
+ * events.  */
+struct ssh_identities_part_s
+{
+  int valid;             /* True if this part may be used.  */
+  u32 count;             /* The number of keys in BLOBS.  */
+  void *blobs;           /* The public keys in ssh format.  */
+  size_t bloblen;        /* The length of BLOBS.  */
+  unsigned int eventno;  /* The event counter at creation time.  */
+  time_t created;        /* The time this part was created.  */
+  char stamp[128];       /* The stamp of the files used.  */
+};
+
+
 /* Prototypes.  */
 static gpg_error_t ssh_handler_request_identities (ctrl_t ctrl,
 						   estream_t request,
@@ -264,6 +286,7 @@ static gpg_error_t ssh_signature_encoder_eddsa (ssh_key_type_spec_t *spec,
                                                 estream_t signature_blob,
                                                 gcry_sexp_t signature);
 static gpg_error_t ssh_key_extract_comment (gcry_sexp_t key, char **comment);
+static void flush_identities_cache (void);
 
 
 struct peer_info_s
@@ -274,6 +297,10 @@ struct peer_info_s
 
 /* Global variables.  */
 
+/* The cached answers to request_identities.  */
+static struct ssh_identities_part_s card_identities;
+static struct ssh_identities_part_s file_identities;
+
 
 /* Associating request types with the corresponding request
    handlers.  */
@@ -1109,6 +1136,7 @@ add_control_entry (ctrl_t ctrl, ssh_key_type_spec_t *spec,
                tp->tm_hour, tp->tm_min, tp->tm_sec,
                fpr_md5, fpr_sha256, hexgrip, ttl, confirm? " confirm":"");
 
+      flush_identities_cache ();
     }
  out:
   xfree (fpr_md5);
@@ -2466,90 +2494,189 @@ card_key_available (ctrl_t ctrl, const struct card_key_info_s *keyinfo,
 */
 
 
-/* Handler for the "request_identities" command.  */
-static gpg_error_t
-ssh_handler_request_identities (ctrl_t ctrl,
-                                estream_t request, estream_t response)
+/* Release the cached identities of PART.  */
+static void
+clear_identities_part (struct ssh_identities_part_s *part)
 {
-  u32 key_counter;
-  estream_t key_blobs;
-  gcry_sexp_t key_public;
-  gpg_error_t err;
-  int ret;
-  ssh_control_file_t cf = NULL;
-  gpg_error_t ret_err;
+  es_free (part->blobs);
+  memset (part, 0, sizeof *part);
+}
+
+
+/* Flush the cached answers to request_identities.  */
+static void
+flush_identities_cache (void)
+{
+  clear_identities_part (&card_identities);
+  clear_identities_part (&file_identities);
+}
+
+
+/* Store a stamp describing the current state of the control file and
+ * the private key directory at STAMP.  The stamp is the empty string
+ * if the state can't be determined.  */
+static void
+get_control_file_stamp (char *stamp, size_t stampsize)
+{
+  char *fname;
+  struct stat st1, st2;
+
+  *stamp = 0;
+  fname = make_filename_try (gnupg_homedir (), SSH_CONTROL_FILE_NAME, NULL);
+  if (!fname)
+    return;
+  if (!stat (fname, &st1))
+    {
+      xfree (fname);
+      fname = make_filename_try (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
+                                 NULL);
+      if (fname && !stat (fname, &st2))
+        snprintf (stamp, stampsize, "%lu.%lu.%lu/%lu.%lu",
+                  (unsigned long)st1.st_mtime, (unsigned long)st1.st_size,
+                  (unsigned long)st1.st_ino,
+                  (unsigned long)st2.st_mtime, (unsigned long)st2.st_ino);
+    }
+  xfree (fname);
+}
 
-  (void)request;
 
-  /* Prepare buffer stream.  */
+/* Move the keys in the memory stream BLOBS to the cache PART and
+ * close the stream.  On error the part is left invalid.  */
+static gpg_error_t
+put_identities_part (struct ssh_identities_part_s *part, estream_t blobs,
+                     u32 count, unsigned int eventno, const char *stamp)
+{
+  void *buffer;
+  size_t buflen;
+
+  clear_identities_part (part);
+  if (es_fclose_snatch (blobs, &buffer, &buflen))
+    return gpg_error_from_syserror ();
+  part->blobs = buffer;
+  part->bloblen = buflen;
+  part->count = count;
+  part->eventno = eventno;
+  part->created = gnupg_get_time ();
+  if (stamp)
+    strcpy (part->stamp, stamp);
+  part->valid = 1;
+  return 0;
+}
+
+
+/* Store a copy of the keys of both cache parts at R_BLOBS and
+ * R_BLOBLEN and their number at R_COUNT.  The caller must release
+ * R_BLOBS.  This function does not yield to other threads; thus the
+ * copy is consistent even if another connection updates the cache
+ * while the caller writes the copy out.  */
+static gpg_error_t
+copy_identities (void **r_blobs, size_t *r_bloblen, u32 *r_count)
+{
+  size_t bloblen;
+  char *blobs;
+
+  bloblen = card_identities.bloblen + file_identities.bloblen;
+  blobs = xtrymalloc (bloblen? bloblen : 1);
+  if (!blobs)
+    return gpg_error_from_syserror ();
+  if (card_identities.bloblen)
+    memcpy (blobs, card_identities.blobs, card_identities.bloblen);
+  if (file_identities.bloblen)
+    memcpy (blobs + card_identities.bloblen, file_identities.blobs,
+            file_identities.bloblen);
+
+  *r_blobs = blobs;
+  *r_bloblen = bloblen;
+  *r_count = card_identities.count + file_identities.count;
+  return 0;
+}
 
-  key_public = NULL;
-  key_counter = 0;
+
+/* Collect the keys available on the cards into the cache part
+ * CARD_IDENTITIES.  */
+static gpg_error_t
+update_card_identities (ctrl_t ctrl, unsigned int eventno)
+{
+  gpg_error_t err;
+  estream_t key_blobs;
+  gcry_sexp_t key_public = NULL;
+  u32 key_counter = 0;
+  char *serialno;
+  struct card_key_info_s *keyinfo_list;
+  struct card_key_info_s *keyinfo;
 
   key_blobs = es_fopenmem (0, "r+b");
-  if (! key_blobs)
+  if (!key_blobs)
+    return gpg_error_from_syserror ();
+
+  /* Scan device(s), and get list of KEYGRIP.  */
+  err = agent_card_serialno (ctrl, &serialno, NULL);
+  if (!err)
     {
-      err = gpg_error_from_syserror ();
-      goto out;
+      xfree (serialno);
+      err = agent_card_keyinfo (ctrl, NULL, GCRY_PK_USAGE_AUTH,
+                                &keyinfo_list);
     }
 
-  /* First check whether a key is currently available in the card
-     reader - this should be allowed even without being listed in
-     sshcontrol. */
+  if (err)
+    {
+      if (opt.verbose)
+        log_info (_("error getting list of cards: %s\n"),
+                  gpg_strerror (err));
+      /* Cache the fact that no card is available.  */
+      return put_identities_part (&card_identities, key_blobs, 0,
+                                  eventno, NULL);
+    }
 
-  if (!opt.disable_scdaemon)
+  for (keyinfo = keyinfo_list; keyinfo; keyinfo = keyinfo->next)
     {
-      char *serialno;
-      struct card_key_info_s *keyinfo_list;
-      struct card_key_info_s *keyinfo;
+      char *cardsn;
 
-      /* Scan device(s), and get list of KEYGRIP.  */
-      err = agent_card_serialno (ctrl, &serialno, NULL);
-      if (!err)
-        {
-          xfree (serialno);
-          err = agent_card_keyinfo (ctrl, NULL, GCRY_PK_USAGE_AUTH,
-                                    &keyinfo_list);
-        }
+      if (card_key_available (ctrl, keyinfo, &key_public, &cardsn))
+        continue;
 
+      err = ssh_send_key_public (key_blobs, key_public, cardsn);
+      if (err && opt.verbose)
+        gcry_log_debugsxp ("pubkey", key_public);
+      gcry_sexp_release (key_public);
+      key_public = NULL;
+      xfree (cardsn);
       if (err)
         {
-          if (opt.verbose)
-            log_info (_("error getting list of cards: %s\n"),
-                      gpg_strerror (err));
-          goto scd_out;
+          agent_card_free_keyinfo (keyinfo_list);
+          es_fclose (key_blobs);
+          return err;
         }
 
-      for (keyinfo = keyinfo_list; keyinfo; keyinfo = keyinfo->next)
-        {
-          char *cardsn;
+      key_counter++;
+    }
 
-          if (card_key_available (ctrl, keyinfo, &key_public, &cardsn))
-            continue;
+  agent_card_free_keyinfo (keyinfo_list);
 
-          err = ssh_send_key_public (key_blobs, key_public, cardsn);
-          if (err && opt.verbose)
-            gcry_log_debugsxp ("pubkey", key_public);
-          gcry_sexp_release (key_public);
-          key_public = NULL;
-          xfree (cardsn);
-          if (err)
-            {
-              agent_card_free_keyinfo (keyinfo_list);
-              goto out;
-            }
+  return put_identities_part (&card_identities, key_blobs, key_counter,
+                              eventno, NULL);
+}
 
-          key_counter++;
-        }
 
-      agent_card_free_keyinfo (keyinfo_list);
-    }
+/* Collect the keys listed in the control file into the cache part
+ * FILE_IDENTITIES.  */
+static gpg_error_t
+update_file_identities (ctrl_t ctrl, unsigned int eventno,
+                        const char *stamp)
+{
+  gpg_error_t err;
+  estream_t key_blobs;
+  gcry_sexp_t key_public = NULL;
+  u32 key_counter = 0;
+  ssh_control_file_t cf = NULL;
+
+  key_blobs = es_fopenmem (0, "r+b");
+  if (!key_blobs)
+    return gpg_error_from_syserror ();
 
- scd_out:
-  /* Then look at all the registered and non-disabled keys. */
   err = open_control_file (&cf, 0);
   if (err)
-    goto out;
+    goto leave;
 
   while (!read_control_file_item (cf))
     {
@@ -2572,34 +2699,92 @@ ssh_handler_request_identities (ctrl_t ctrl,
         }
 
       err = ssh_send_key_public (key_blobs, key_public, NULL);
-      if (err)
-        goto out;
       gcry_sexp_release (key_public);
       key_public = NULL;
+      if (err)
+        goto leave;
 
       key_counter++;
     }
-  err = 0;
 
-  ret = es_fseek (key_blobs, 0, SEEK_SET);
-  if (ret)
+  /* An empty stamp means that we can't detect changes; thus do not
+   * cache this part.  */
+  err = put_identities_part (&file_identities, key_blobs, key_counter,
+                             eventno, stamp);
+  key_blobs = NULL;
+  if (!err && !*stamp)
+    file_identities.valid = 0;
+
+ leave:
+  es_fclose (key_blobs);
+  close_control_file (cf);
+  return err;
+}
+
+
+/* Handler for the "request_identities" command.  The answer is built
+ * from a cache which is updated as needed: The keys from the cards
+ * are re-read after a card event or after SSH_CARD_IDENTITIES_TTL
+ * seconds; the keys from the control file are re-read after a change
+ * of a private key or the control file.  */
+static gpg_error_t
+ssh_handler_request_identities (ctrl_t ctrl,
+                                estream_t request, estream_t response)
+{
+  gpg_error_t err;
+  gpg_error_t ret_err;
+  unsigned int key_eventno, card_eventno;
+  char stamp[sizeof file_identities.stamp];
+  u32 key_counter;
+  void *key_blobs = NULL;
+  size_t key_blobslen;
+
+  (void)request;
+
+  /* Take the event counters and the stamp before reading so that
+   * changes done while we are reading invalidate the result.  */
+  get_agent_eventcounters (&key_eventno, &card_eventno);
+  get_control_file_stamp (stamp, sizeof stamp);
+
+  /* First check whether a key is currently available in the card
+     reader - this should be allowed even without being listed in
+     sshcontrol. */
+  if (opt.disable_scdaemon)
+    clear_identities_part (&card_identities);
+  else if (!card_identities.valid
+           || card_identities.eventno != card_eventno
+           || (gnupg_get_time ()
+               >= card_identities.created + SSH_CARD_IDENTITIES_TTL))
+    {
+      err = update_card_identities (ctrl, card_eventno);
+      if (err)
+        goto out;
+    }
+
+  /* Then look at all the registered and non-disabled keys. */
+  if (!file_identities.valid
+      || file_identities.eventno != key_eventno
+      || strcmp (file_identities.stamp, stamp))
     {
-      err = gpg_error_from_syserror ();
-      goto out;
+      err = update_file_identities (ctrl, key_eventno, stamp);
+      if (err)
+        goto out;
     }
 
+  /* Writing to the response stream may switch to another connection
+   * which may replace the cached parts; thus take a copy first.  */
+  err = copy_identities (&key_blobs, &key_blobslen, &key_counter);
+
  out:
   /* Send response.  */
 
-  gcry_sexp_release (key_public);
-
   if (!err)
     {
       ret_err = stream_write_byte (response, SSH_RESPONSE_IDENTITIES_ANSWER);
       if (!ret_err)
         ret_err = stream_write_uint32 (response, key_counter);
-      if (!ret_err)
-        ret_err = stream_copy (response, key_blobs);
+      if (!ret_err && key_blobslen)
+        ret_err = stream_write_data (response, key_blobs, key_blobslen);
     }
   else
     {
@@ -2608,9 +2793,7 @@ ssh_handler_request_identities (ctrl_t ctrl,
       ret_err = stream_write_byte (response, SSH_RESPONSE_FAILURE);
     }
 
-  es_fclose (key_blobs);
-  close_control_file (cf);
-
+  xfree (key_blobs);
   return ret_err;
 }
 
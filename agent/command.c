@@ -33,6 +33,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <npth.h>
 
 #include "agent.h"
 #include <assuan.h>
@@ -51,6 +52,11 @@
 #define MAXLEN_KEYDATA 8192
 /* Maximum length of a secret to store under one key.  */
 #define MAXLEN_PUT_SECRET 4096
+/* Maximum allowed size of the inquired list of hashes for a batch
+ * signing operation.  */
+#define MAXLEN_HASHLIST 65536
+/* Maximum allowed size of the inquired list of keys to warm up.  */
+#define MAXLEN_WARMUP_LIST 65536
 /* The size of the import/export KEK key (in bytes).  */
 #define KEYWRAP_KEYSIZE (128/8)
 
@@ -94,6 +100,11 @@ struct server_local_s
   /* Flag indicating whether pinentry notifications shall be done. */
   unsigned int allow_pinentry_notify : 1;
 
+  /* The name of the currently running command and its start time;
+   * used for the metrics.  */
+  const char *cmd_name;
+  struct timespec cmd_start;
+
   /* An allocated description for the next key operation.  This is
      used if a pinnetry needs to be popped up.  */
   char *keydesc;
@@ -482,6 +493,18 @@ bump_key_eventcounter (void)
 }
 
 
+/* Store the current values of the KEY and CARD event counters at
+ * R_KEY and R_CARD.  The returned CARD value also changes if the
+ * keys on a card may have been changed.  This function is assured
+ * not to do any context switches.  */
+void
+get_agent_eventcounters (unsigned int *r_key, unsigned int *r_card)
+{
+  *r_key = eventcounter.key;
+  *r_card = eventcounter.card + eventcounter.maybe_key_change;
+}
+
+
 /* This function should be called for all card reader status
    changes.  This function is assured not to do any context
    switches. */
@@ -828,6 +851,141 @@ cmd_pksign (assuan_context_t ctx, char *line)
 }
 
 
+/* State for the callbacks used by cmd_pksign_batch.  */
+struct pksign_batch_parm_s
+{
+  assuan_context_t ctx;
+  char *next;       /* The next line in the inquired list.  */
+  unsigned int lnr; /* The number of the current line.  */
+};
+
+
+/* Callback for agent_pksign_batch to store the next hash from the
+ * list into CTRL.  */
+static gpg_error_t
+pksign_batch_next_cb (void *opaque, ctrl_t ctrl)
+{
+  struct pksign_batch_parm_s *parm = opaque;
+  gpg_error_t err;
+  char *line, *p;
+
+  (void)ctrl;
+
+  do
+    {
+      line = parm->next;
+      if (!line || !*line)
+        return gpg_error (GPG_ERR_EOF);
+      p = strchr (line, '\n');
+      if (p)
+        *p++ = 0;
+      parm->next = p;
+      parm->lnr++;
+      trim_spaces (line);
+    }
+  while (!*line);
+
+  /* Each line uses the syntax of the SETHASH command.  */
+  err = cmd_sethash (parm->ctx, line);
+  if (err)
+    log_error ("PKSIGN_BATCH: error in hash list at line %u: %s\n",
+               parm->lnr, gpg_strerror (err));
+  return err;
+}
+
+
+/* Callback for agent_pksign_batch to send one signature back.  The
+ * data is flushed so that the client receives each signature as
+ * soon as it has been created.  */
+static gpg_error_t
+pksign_batch_sig_cb (void *opaque, const void *sig, size_t siglen)
+{
+  struct pksign_batch_parm_s *parm = opaque;
+  gpg_error_t err;
+
+  err = assuan_send_data (parm->ctx, sig, siglen);
+  if (!err)
+    err = assuan_send_data (parm->ctx, NULL, 0);
+  return err;
+}
+
+
+static const char hlp_pksign_batch[] =
+  "PKSIGN_BATCH [<cache_nonce>]\n"
+  "\n"
+  "Sign a list of hashes with the key set by SIGKEY.  The list is\n"
+  "inquired using the keyword HASHES; each line of it has the same\n"
+  "syntax as the arguments of the SETHASH command.  The key is\n"
+  "unprotected only once for the entire list.  The signatures are\n"
+  "returned in the same order as the hashes as a sequence of\n"
+  "canonical encoded S-expressions, each one sent as soon as it has\n"
+  "been created.  On error the sequence stops at the failed hash.";
+static gpg_error_t
+cmd_pksign_batch (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  cache_mode_t cache_mode = CACHE_MODE_NORMAL;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  struct pksign_batch_parm_s parm;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  char *list = NULL;
+  char *cache_nonce = NULL;
+  char *p;
+
+  line = skip_options (line);
+
+  for (p=line; *p && *p != ' ' && *p != '\t'; p++)
+    ;
+  *p = '\0';
+  if (*line)
+    {
+      cache_nonce = xtrystrdup (line);
+      if (!cache_nonce)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  if (opt.ignore_cache_for_signing)
+    cache_mode = CACHE_MODE_IGNORE;
+  else if (!ctrl->server_local->use_cache_for_signing)
+    cache_mode = CACHE_MODE_IGNORE;
+
+  err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_HASHLIST);
+  if (!err)
+    err = assuan_inquire (ctx, "HASHES", &value, &valuelen, MAXLEN_HASHLIST);
+  if (err)
+    goto leave;
+
+  /* Make the list a string.  */
+  list = xtrymalloc (valuelen + 1);
+  if (!list)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (list, value, valuelen);
+  list[valuelen] = 0;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctx = ctx;
+  parm.next = list;
+  err = agent_pksign_batch (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                            cache_mode,
+                            pksign_batch_next_cb, pksign_batch_sig_cb, &parm);
+
+ leave:
+  xfree (list);
+  xfree (value);
+  xfree (cache_nonce);
+  xfree (ctrl->server_local->keydesc);
+  ctrl->server_local->keydesc = NULL;
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_pkdecrypt[] =
   "PKDECRYPT [<options>]\n"
   "\n"
@@ -2053,6 +2211,199 @@ leave:
 
 
 
+/* An item of the list processed by cmd_warmup_keys.  */
+struct warmup_item_s
+{
+  unsigned char grip[20];
+  const char *passphrase;
+  gpg_error_t err;
+  unsigned long msec;   /* Time used for this key.  */
+};
+
+/* The parameter for the worker threads of cmd_warmup_keys.  */
+struct warmup_parm_s
+{
+  ctrl_t ctrl;
+  struct warmup_item_s *items;
+  int nitems;
+  int next;             /* Index of the next item to process.  */
+};
+
+
+/* Worker thread for cmd_warmup_keys.  */
+static void *
+warmup_thread (void *arg)
+{
+  struct warmup_parm_s *parm = arg;
+  struct warmup_item_s *item;
+  struct timespec t0, t1;
+
+  /* Taking the next item does not switch threads.  */
+  while (parm->next < parm->nitems)
+    {
+      item = parm->items + parm->next++;
+      npth_clock_gettime (&t0);
+      item->err = agent_warmup_key (parm->ctrl, item->grip, item->passphrase);
+      npth_clock_gettime (&t1);
+      item->msec = ((t1.tv_sec - t0.tv_sec) * 1000
+                    + (t1.tv_nsec - t0.tv_nsec) / 1000000);
+    }
+  return NULL;
+}
+
+
+static const char hlp_warmup_keys[] =
+  "WARMUP_KEYS\n"
+  "\n"
+  "Preset the passphrases for a list of keys and unprotect the keys\n"
+  "so that the first use of a key does not need to read and decrypt\n"
+  "its file.  The list is inquired using the keyword KEYLIST; each\n"
+  "line has a keygrip and the hex encoded passphrase.  The passphrases\n"
+  "are cached like with PRESET_PASSPHRASE and the keys are processed\n"
+  "in parallel by up to --crypto-threads threads.  For each key a\n"
+  "status line\n"
+  "\n"
+  "  S WARMUP <keygrip> <errorcode> <milliseconds>\n"
+  "\n"
+  "is emitted.  If a passphrase does not fit its key, it is not\n"
+  "cached.  This command requires --allow-preset-passphrase.";
+static gpg_error_t
+cmd_warmup_keys (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  char *list = NULL;
+  char *p, *pend;
+  struct warmup_parm_s parm;
+  struct warmup_item_s *items = NULL;
+  int nitems, i, nthreads;
+  npth_t *tids = NULL;
+  npth_attr_t tattr;
+  char hexgrip[40+1];
+
+  (void)line;
+
+  memset (&parm, 0, sizeof parm);
+
+  if (ctrl->restricted)
+    return leave_cmd (ctx, gpg_error (GPG_ERR_FORBIDDEN));
+
+  if (!opt.allow_preset_passphrase)
+    return set_error (GPG_ERR_NOT_SUPPORTED, "no --allow-preset-passphrase");
+
+  err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_WARMUP_LIST);
+  if (!err)
+    err = assuan_inquire (ctx, "KEYLIST", &value, &valuelen,
+                          MAXLEN_WARMUP_LIST);
+  if (err)
+    goto leave;
+
+  /* Make the list a string and count the lines.  */
+  list = xtrymalloc_secure (valuelen + 1);
+  if (!list)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (list, value, valuelen);
+  list[valuelen] = 0;
+  wipememory (value, valuelen);
+  for (nitems=1, p=list; (p = strchr (p, '\n')); p++)
+    nitems++;
+  items = xtrycalloc (nitems, sizeof *items);
+  if (!items)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Parse the list.  */
+  for (i=0, p=list; p; p = pend)
+    {
+      pend = strchr (p, '\n');
+      if (pend)
+        *pend++ = 0;
+      trim_spaces (p);
+      if (!*p)
+        continue;
+      if (hex2bin (p, items[i].grip, 20) != 40
+          || !(p[40] == ' ' || p[40] == '\t'))
+        {
+          err = set_error (GPG_ERR_INV_DATA, "invalid keygrip in list");
+          goto leave;
+        }
+      for (p += 41; *p == ' ' || *p == '\t'; p++)
+        ;
+      if (!*p || !hex2str (p, p, strlen (p)+1, NULL))
+        {
+          err = set_error (GPG_ERR_INV_DATA, "invalid passphrase in list");
+          goto leave;
+        }
+      items[i++].passphrase = p;
+    }
+  nitems = i;
+
+  parm.ctrl = ctrl;
+  parm.items = items;
+  parm.nitems = nitems;
+
+  /* Start the worker threads; the last one is the current thread.  */
+  nthreads = opt.crypto_threads? opt.crypto_threads : 1;
+  if (nthreads > nitems)
+    nthreads = nitems;
+  if (nthreads > 1)
+    {
+      tids = xtrycalloc (nthreads - 1, sizeof *tids);
+      if (!tids)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (npth_attr_init (&tattr))
+        nthreads = 1;
+      else
+        {
+          npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+          for (i=0; i < nthreads - 1; i++)
+            if (npth_create (&tids[i], &tattr, warmup_thread, &parm))
+              {
+                log_error ("error spawning warmup thread: %s\n",
+                           strerror (errno));
+                break;
+              }
+          nthreads = i + 1;
+          npth_attr_destroy (&tattr);
+        }
+    }
+  warmup_thread (&parm);
+  for (i=0; i < nthreads - 1; i++)
+    npth_join (tids[i], NULL);
+
+  for (i=0; i < nitems && !err; i++)
+    {
+      bin2hex (items[i].grip, 20, hexgrip);
+      if (items[i].err)
+        log_info ("warming up key %s failed: %s\n",
+                  hexgrip, gpg_strerror (items[i].err));
+      err = print_assuan_status (ctx, "WARMUP", "%s %u %lu", hexgrip,
+                                 items[i].err, items[i].msec);
+    }
+
+ leave:
+  xfree (tids);
+  xfree (items);
+  if (list)
+    {
+      wipememory (list, valuelen);
+      xfree (list);
+    }
+  xfree (value);
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_scd[] =
   "SCD <commands to pass to the scdaemon>\n"
   " \n"
@@ -3108,6 +3459,10 @@ static const char hlp_getinfo[] =
   "  std_startup_env - List the standard startup environment.\n"
   "  getenv NAME     - Return value of envvar NAME.\n"
   "  connections     - Return number of active connections.\n"
+  "  connection_stats - Return statistics about the connections.\n"
+  "  cache_stats     - Return statistics about the passphrase cache.\n"
+  "  metrics         - Return latency histograms of commands and of\n"
+  "                    internal operations.\n"
   "  jent_active     - Returns OK if Libgcrypt's JENT is active.\n"
   "  restricted      - Returns OK if the connection is in restricted mode.\n"
   "  cmd_has_option CMD OPT\n"
@@ -3268,6 +3623,48 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 get_agent_active_connection_count ());
       rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "connection_stats"))
+    {
+      struct connection_stats_s stats;
+      char numbuf[200];
+
+      get_agent_connection_stats (&stats);
+      snprintf (numbuf, sizeof numbuf,
+                "active=%u threads=%u idle=%u accepted=%lu spawned=%lu"
+                " accept_avg_us=%lu accept_max_us=%lu",
+                stats.active, stats.threads, stats.idle,
+                stats.accepted, stats.spawned,
+                stats.latency_avg, stats.latency_max);
+      rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
+    }
+  else if (!strcmp (line, "metrics"))
+    {
+      membuf_t mb;
+      char *buf;
+      size_t buflen;
+
+      init_membuf (&mb, 4096);
+      agent_metrics_write (&mb);
+      buf = get_membuf (&mb, &buflen);
+      if (!buf)
+        rc = gpg_error_from_syserror ();
+      else
+        rc = assuan_send_data (ctx, buf, buflen);
+      xfree (buf);
+    }
+  else if (!strcmp (line, "cache_stats"))
+    {
+      struct cache_stats_s stats;
+      char numbuf[200];
+
+      agent_get_cache_stats (&stats);
+      snprintf (numbuf, sizeof numbuf,
+                "items=%u queued=%u hits=%lu misses=%lu expired=%lu"
+                " keks=%u",
+                stats.items, stats.queued,
+                stats.hits, stats.misses, stats.expired, stats.keks);
+      rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
+    }
   else if (!strcmp (line, "jent_active"))
     {
 #if GCRYPT_VERSION_NUMBER >= 0x010800
@@ -3425,6 +3822,18 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Called by libassuan before a command is run.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  ctrl->server_local->cmd_name = cmd;
+  agent_metrics_start (&ctrl->server_local->cmd_start);
+  return 0;
+}
+
+
 /* Called by libassuan after all commands. ERR is the error from the
    last assuan operation and not the one returned from the command. */
 static void
@@ -3434,6 +3843,13 @@ post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
 
   (void)err;
 
+  if (ctrl->server_local->cmd_name)
+    {
+      agent_metrics_update ("cmd", ctrl->server_local->cmd_name,
+                            &ctrl->server_local->cmd_start);
+      ctrl->server_local->cmd_name = NULL;
+    }
+
   /* Switch off any I/O monitor controlled logging pausing. */
   ctrl->server_local->pause_io_logging = 0;
 }
@@ -3522,11 +3938,13 @@ register_commands (assuan_context_t ctx)
     { "SETKEYDESC",     cmd_setkeydesc,hlp_setkeydesc },
     { "SETHASH",        cmd_sethash,   hlp_sethash },
     { "PKSIGN",         cmd_pksign,    hlp_pksign },
+    { "PKSIGN_BATCH",   cmd_pksign_batch, hlp_pksign_batch },
     { "PKDECRYPT",      cmd_pkdecrypt, hlp_pkdecrypt },
     { "GENKEY",         cmd_genkey,    hlp_genkey },
     { "READKEY",        cmd_readkey,   hlp_readkey },
     { "GET_PASSPHRASE", cmd_get_passphrase, hlp_get_passphrase },
     { "PRESET_PASSPHRASE", cmd_preset_passphrase, hlp_preset_passphrase },
+    { "WARMUP_KEYS",    cmd_warmup_keys, hlp_warmup_keys },
     { "CLEAR_PASSPHRASE", cmd_clear_passphrase,   hlp_clear_passphrase },
     { "GET_CONFIRMATION", cmd_get_confirmation,   hlp_get_confirmation },
     { "LISTTRUSTED",    cmd_listtrusted, hlp_listtrusted },
@@ -3560,6 +3978,7 @@ register_commands (assuan_context_t ctx)
       if (rc)
         return rc;
     }
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
   assuan_register_post_cmd_notify (ctx, post_cmd_notify);
   assuan_register_reset_notify (ctx, reset_notify);
   assuan_register_option_handler (ctx, option_handler);
@@ -112,6 +112,8 @@ ask_for_card (ctrl_t ctrl, const unsigned char *shadow_info,
               gpg_err_code (err) == GPG_ERR_NO_PIN_ENTRY)
             err = gpg_error (GPG_ERR_CARD_NOT_PRESENT);
 
+          /* The user may have inserted another card.  */
+          agent_card_flush_cache ();
           xfree (desc);
         }
 
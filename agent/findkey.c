@@ -197,6 +197,32 @@ write_extended_private_key (char *fname, estream_t fp, int update,
   return err;
 }
 
+/* Store a string describing the current state of the key file for
+ * GRIP at STAMP which has a size of STAMPSIZE.  This is used to
+ * detect changes of the file after it has been cached.  */
+static gpg_error_t
+key_file_stamp (const unsigned char *grip, char *stamp, size_t stampsize)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  char hexgrip[40+4+1];
+  struct stat st;
+
+  bin2hex (grip, 20, hexgrip);
+  strcpy (hexgrip+40, ".key");
+  fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
+                         hexgrip, NULL);
+  if (stat (fname, &st))
+    err = gpg_error_from_syserror ();
+  else
+    snprintf (stamp, stampsize, "%lu.%lu.%lu",
+              (unsigned long)st.st_mtime, (unsigned long)st.st_size,
+              (unsigned long)st.st_ino);
+  xfree (fname);
+  return err;
+}
+
+
 /* Write an S-expression formatted key to our key storage.  With FORCE
  * passed as true an existing key with the given GRIP will get
  * overwritten.  If SERIALNO and KEYREF are given a Token line is added to
@@ -211,6 +237,7 @@ agent_write_private_key (const unsigned char *grip,
   char hexgrip[40+4+1];
 
   bin2hex (grip, 20, hexgrip);
+  agent_flush_cache_skey (hexgrip);
   strcpy (hexgrip+40, ".key");
 
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
@@ -788,14 +815,10 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 }
 
 
-/* Read the key identified by GRIP from the private key directory and
- * return it as an gcrypt S-expression object in RESULT.  If R_KEYMETA
- * is not NULl and the extended key format is used, the meta data
- * items are stored there.  However the "Key:" item is removed from
- * it.  On failure returns an error code and stores NULL at RESULT and
- * R_KEYMETA. */
+/* Worker for read_key_file.  */
 static gpg_error_t
-read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
+do_read_key_file (const unsigned char *grip, gcry_sexp_t *result,
+                  nvc_t *r_keymeta)
 {
   gpg_error_t err;
   char *fname;
@@ -925,6 +948,25 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
 }
 
 
+/* Read the key identified by GRIP from the private key directory and
+ * return it as an gcrypt S-expression object in RESULT.  If R_KEYMETA
+ * is not NULl and the extended key format is used, the meta data
+ * items are stored there.  However the "Key:" item is removed from
+ * it.  On failure returns an error code and stores NULL at RESULT and
+ * R_KEYMETA. */
+static gpg_error_t
+read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
+{
+  gpg_error_t err;
+  struct timespec start;
+
+  agent_metrics_start (&start);
+  err = do_read_key_file (grip, result, r_keymeta);
+  agent_metrics_update ("keyfile", NULL, &start);
+  return err;
+}
+
+
 /* Remove the key identified by GRIP from the private key directory.  */
 static gpg_error_t
 remove_key_file (const unsigned char *grip)
@@ -934,6 +976,7 @@ remove_key_file (const unsigned char *grip)
   char hexgrip[40+4+1];
 
   bin2hex (grip, 20, hexgrip);
+  agent_flush_cache_skey (hexgrip);
   strcpy (hexgrip+40, ".key");
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
                          hexgrip, NULL);
@@ -972,6 +1015,9 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   gcry_sexp_t s_skey;
   nvc_t keymeta = NULL;
   char *desc_text_buffer = NULL;  /* Used in case we extend DESC_TEXT.  */
+  char hexgrip[40+1];
+  char stamp[64];
+  int use_skey_cache = 0;
 
   *result = NULL;
   if (shadow_info)
@@ -979,6 +1025,34 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   if (r_passphrase)
     *r_passphrase = NULL;
 
+  /* If the passphrase of a protected key is cached we may also have
+   * the unprotected key in the cache.  This avoids reading the file
+   * and the costly S2K for repeated operations with the same key.  */
+  if ((cache_mode == CACHE_MODE_NORMAL || cache_mode == CACHE_MODE_SSH)
+      && !r_passphrase
+      && !key_file_stamp (grip, stamp, sizeof stamp))
+    {
+      use_skey_cache = 1;
+      bin2hex (grip, 20, hexgrip);
+      buf = agent_get_cache_skey (ctrl, hexgrip, cache_mode, stamp);
+      if (buf)
+        {
+          buflen = gcry_sexp_canon_len (buf, 0, NULL, NULL);
+          err = gcry_sexp_sscan (&s_skey, &erroff, (char*)buf, buflen);
+          wipememory (buf, buflen);
+          xfree (buf);
+          if (!err)
+            {
+              if (cache_mode == CACHE_MODE_NORMAL)
+                agent_store_cache_hit (hexgrip);
+              *result = s_skey;
+              return 0;
+            }
+          log_error ("failed to build S-Exp (off=%u): %s\n",
+                     (unsigned int)erroff, gpg_strerror (err));
+        }
+    }
+
   err = read_key_file (grip, &s_skey, &keymeta);
   if (err)
     {
@@ -1066,6 +1140,8 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
 	    if (err)
 	      log_error ("failed to unprotect the secret key: %s\n",
 			 gpg_strerror (err));
+            else if (use_skey_cache)
+              agent_put_cache_skey (ctrl, hexgrip, cache_mode, stamp, buf);
 	  }
 
 	xfree (desc_text_final);
@@ -1142,6 +1218,72 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
 }
 
 
+/* Put PASSPHRASE into the cache for the key GRIP, like the preset
+ * passphrase feature does, and cache the unprotected key too.  No
+ * pinentry is used; if PASSPHRASE does not fit the key an error is
+ * returned and the cache is not changed.  */
+gpg_error_t
+agent_warmup_key (ctrl_t ctrl, const unsigned char *grip,
+                  const char *passphrase)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_skey;
+  unsigned char *buf = NULL;
+  unsigned char *result = NULL;
+  size_t len, resultlen;
+  char hexgrip[40+1];
+  char stamp[64];
+
+  bin2hex (grip, 20, hexgrip);
+
+  /* Take the stamp before reading the file; see agent_key_from_file.  */
+  err = key_file_stamp (grip, stamp, sizeof stamp);
+  if (!err)
+    err = read_key_file (grip, &s_skey, NULL);
+  if (err)
+    {
+      if (gpg_err_code (err) == GPG_ERR_ENOENT)
+        err = gpg_error (GPG_ERR_NO_SECKEY);
+      return err;
+    }
+  err = make_canon_sexp (s_skey, &buf, &len);
+  gcry_sexp_release (s_skey);
+  if (err)
+    return err;
+
+  switch (agent_private_key_type (buf))
+    {
+    case PRIVATE_KEY_PROTECTED:
+      break;
+    case PRIVATE_KEY_SHADOWED:
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    case PRIVATE_KEY_CLEAR:
+    case PRIVATE_KEY_OPENPGP_NONE:
+      err = gpg_error (GPG_ERR_NOT_ENCRYPTED);
+      goto leave;
+    default:
+      err = gpg_error (GPG_ERR_BAD_SECKEY);
+      goto leave;
+    }
+
+  /* Check the passphrase before it is put into the cache so that a
+   * wrong passphrase does not replace a cached one.  */
+  err = agent_unprotect (ctrl, buf, passphrase, NULL, &result, &resultlen);
+  if (err)
+    goto leave;
+  err = agent_put_cache (ctrl, hexgrip, CACHE_MODE_ANY, passphrase, -1);
+  if (err)
+    goto leave;
+  agent_put_cache_skey (ctrl, hexgrip, CACHE_MODE_ANY, stamp, result);
+
+ leave:
+  xfree (result);
+  xfree (buf);
+  return err;
+}
+
+
 /* Return the string name from the S-expression S_KEY as well as a
    string describing the names of the parameters.  ALGONAMESIZE and
    ELEMSSIZE give the allocated size of the provided buffers.  The
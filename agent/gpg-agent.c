@@ -48,6 +48,9 @@
 # include <signal.h>
 #endif
 #include <npth.h>
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
 
 #define INCLUDED_BY_MAIN_MODULE 1
 #define GNUPG_COMMON_NEED_AFLOCAL
@@ -121,6 +124,7 @@ enum cmd_and_opt_values
   oFakedSystemTime,
 
   oIgnoreCacheForSigning,
+  oCryptoThreads,
   oAllowMarkTrusted,
   oNoAllowMarkTrusted,
   oAllowPresetPassphrase,
@@ -222,6 +226,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDisableExtendedKeyFormat, "disable-extended-key-format", "@"),
   ARGPARSE_s_n (oEnableExtendedKeyFormat, "enable-extended-key-format", "@"),
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
+  ARGPARSE_s_u (oCryptoThreads, "crypto-threads",
+                /* */ N_("|N|run up to N private key operations in parallel")),
   ARGPARSE_op_u (oAutoExpandSecmem, "auto-expand-secmem", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
 
@@ -446,6 +452,40 @@ static int reliable_homedir_inotify;
 /* Number of active connections.  */
 static int active_connections;
 
+/* Maximum number of idle connection threads kept for reuse and the
+ * time in seconds after which an idle connection thread terminates.  */
+#define MAX_IDLE_CONNECTION_THREADS 16
+#define CONNECTION_THREAD_IDLE_TIME 60
+
+/* The pool of connection threads.  Accepted connections are queued
+ * using their control object and picked up by an idle thread; a new
+ * thread is only created if no idle thread is available.  */
+static struct
+{
+  npth_mutex_t lock;
+  npth_cond_t cond;
+  ctrl_t queue;                /* Connections waiting for a thread.  */
+  ctrl_t *queue_tail;
+  unsigned int queued;         /* Length of QUEUE.                   */
+  unsigned int threads;        /* Number of connection threads.      */
+  unsigned int idle;           /* Number of idle connection threads. */
+  unsigned long accepted;      /* Number of accepted connections.    */
+  unsigned long spawned;       /* Number of created threads.         */
+  unsigned long long latency;  /* Sum of the accept latencies (us).  */
+  unsigned long latency_max;   /* Maximum accept latency (us).       */
+} conn_pool;
+
+/* Key to mark a thread which currently runs without holding the nPth
+ * lock; see agent_pk_compute.  */
+static npth_key_t unlocked_key;
+
+/* Lock and condition to limit the number of threads running public
+ * key operations without holding the nPth lock.  */
+static npth_mutex_t crypto_threads_lock;
+static npth_cond_t crypto_threads_cond;
+static unsigned int crypto_threads_active;
+static int crypto_threads_ready;
+
 /* This object is used to dispatch progress messages from Libgcrypt to
  * the right thread.  Given that we will have at max only a few dozen
  * connections at a time, using a linked list is the easiest way to
@@ -822,6 +862,25 @@ cleanup (void)
 }
 
 
+/* Return the default for --crypto-threads which is the number of
+ * online CPUs.  */
+static unsigned int
+default_crypto_threads (void)
+{
+#if defined(HAVE_W32_SYSTEM)
+  SYSTEM_INFO si;
+
+  GetSystemInfo (&si);
+  return si.dwNumberOfProcessors? si.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return n > 0? (unsigned int)n : 1;
+#else
+  return 1;
+#endif
+}
+
 
 /* Handle options which are allowed to be reset after program start.
    Return true when the current option in PARGS could be handled and
@@ -867,6 +926,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       /* Note: When changing the next line, change also gpgconf_list.  */
       opt.ssh_fingerprint_digest = GCRY_MD_MD5;
       opt.s2k_count = 0;
+      opt.crypto_threads = default_crypto_threads ();
       set_s2k_calibration_time (0);  /* Set to default.  */
       return 1;
     }
@@ -941,6 +1001,8 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
 
     case oIgnoreCacheForSigning: opt.ignore_cache_for_signing = 1; break;
 
+    case oCryptoThreads: opt.crypto_threads = pargs->r.ret_ulong; break;
+
     case oAllowMarkTrusted: opt.allow_mark_trusted = 1; break;
     case oNoAllowMarkTrusted: opt.allow_mark_trusted = 0; break;
 
@@ -991,6 +1053,24 @@ finalize_rereadable_options (void)
 }
 
 
+/* The system call clamp functions.  These are the nPth functions to
+ * release and re-acquire the nPth lock unless the current thread
+ * already runs without that lock; see agent_pk_compute.  */
+static void
+agent_syscall_clamp_pre (void)
+{
+  if (!npth_getspecific (unlocked_key))
+    npth_unprotect ();
+}
+
+static void
+agent_syscall_clamp_post (void)
+{
+  if (!npth_getspecific (unlocked_key))
+    npth_protect ();
+}
+
+
 static void
 thread_init_once (void)
 {
@@ -998,10 +1078,20 @@ thread_init_once (void)
 
   if (!npth_initialized)
     {
+      int err;
+
       npth_initialized++;
       npth_init ();
-    }
-  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+      err = npth_key_create (&unlocked_key, NULL);
+      if (!err)
+        err = npth_mutex_init (&crypto_threads_lock, NULL);
+      if (!err)
+        err = npth_cond_init (&crypto_threads_cond, NULL);
+      if (err)
+        log_fatal ("error initializing crypto threads: %s\n", strerror (err));
+      crypto_threads_ready = 1;
+    }
+  gpgrt_set_syscall_clamp (agent_syscall_clamp_pre, agent_syscall_clamp_post);
   /* Now that we have set the syscall clamp we need to tell Libgcrypt
    * that it should get them from libgpg-error.  Note that Libgcrypt
    * has already been initialized but at that point nPth was not
@@ -1420,6 +1510,8 @@ main (int argc, char **argv)
                  GC_OPT_FLAG_DEFAULT, MAX_PASSPHRASE_DAYS);
       es_printf ("ssh-fingerprint-digest:%lu:\"%s:\n",
                  GC_OPT_FLAG_DEFAULT, "md5");
+      es_printf ("crypto-threads:%lu:%u:\n",
+                 GC_OPT_FLAG_DEFAULT, default_crypto_threads ());
 
       agent_exit (0);
     }
@@ -1811,6 +1903,11 @@ agent_libgcrypt_progress_cb (void *data, const char *what, int printchar,
 
   (void)data;
 
+  /* Without the nPth lock we may neither walk the list nor write to
+   * the client.  */
+  if (npth_getspecific (unlocked_key))
+    return;
+
   for (dispatch = progress_dispatch_list; dispatch; dispatch = dispatch->next)
     if (dispatch->ctrl && dispatch->tid == mytid)
       break;
@@ -1898,6 +1995,102 @@ agent_set_progress_cb (void (*cb)(ctrl_t ctrl, const char *what,
 }
 
 
+/* Wait until less than --crypto-threads threads are running without
+ * holding the nPth lock and then release that lock.  Between this
+ * and leave_unlocked_crypto only thread-safe functions may be used;
+ * Libgcrypt and the logging functions are fine.  */
+static void
+enter_unlocked_crypto (void)
+{
+  int rc;
+
+  rc = npth_mutex_lock (&crypto_threads_lock);
+  if (rc)
+    log_fatal ("failed to acquire crypto threads lock: %s\n", strerror (rc));
+  while (crypto_threads_active >= opt.crypto_threads)
+    npth_cond_wait (&crypto_threads_cond, &crypto_threads_lock);
+  crypto_threads_active++;
+  npth_mutex_unlock (&crypto_threads_lock);
+
+  npth_setspecific (unlocked_key, (void*)1);
+  npth_unprotect ();
+}
+
+
+/* Counterpart to enter_unlocked_crypto.  */
+static void
+leave_unlocked_crypto (void)
+{
+  int rc;
+
+  npth_protect ();
+  npth_setspecific (unlocked_key, NULL);
+
+  rc = npth_mutex_lock (&crypto_threads_lock);
+  if (rc)
+    log_fatal ("failed to acquire crypto threads lock: %s\n", strerror (rc));
+  crypto_threads_active--;
+  npth_cond_signal (&crypto_threads_cond);
+  npth_mutex_unlock (&crypto_threads_lock);
+}
+
+
+/* Run the Libgcrypt public key function FNC (gcry_pk_sign or
+ * gcry_pk_decrypt) with the arguments R_RESULT, S_DATA, and S_SKEY.
+ * nPth runs only one thread at a time and thus the computation is
+ * done without holding the nPth lock so that other connections can
+ * proceed and use other CPUs meanwhile.  The number of such
+ * computations is limited by --crypto-threads; a value of 0 runs
+ * them with the lock held.  */
+gpg_error_t
+agent_pk_compute (gcry_error_t (*fnc)(gcry_sexp_t *, gcry_sexp_t,
+                                      gcry_sexp_t),
+                  gcry_sexp_t *r_result, gcry_sexp_t s_data,
+                  gcry_sexp_t s_skey)
+{
+  gpg_error_t err;
+
+  if (!opt.crypto_threads || !crypto_threads_ready)
+    return fnc (r_result, s_data, s_skey);
+
+  enter_unlocked_crypto ();
+  err = fnc (r_result, s_data, s_skey);
+  leave_unlocked_crypto ();
+
+  return err;
+}
+
+
+/* This is gcry_kdf_derive run without holding the nPth lock; see
+ * agent_pk_compute.  It is used for the deliberately slow S2K
+ * function.  */
+gpg_error_t
+agent_kdf_derive (const void *passphrase, size_t passphraselen,
+                  int algo, int subalgo,
+                  const void *salt, size_t saltlen,
+                  unsigned long iterations,
+                  size_t keysize, void *keybuffer)
+{
+  gpg_error_t err;
+  struct timespec start;
+
+  agent_metrics_start (&start);
+  if (!opt.crypto_threads || !crypto_threads_ready)
+    err = gcry_kdf_derive (passphrase, passphraselen, algo, subalgo,
+                           salt, saltlen, iterations, keysize, keybuffer);
+  else
+    {
+      enter_unlocked_crypto ();
+      err = gcry_kdf_derive (passphrase, passphraselen, algo, subalgo,
+                             salt, saltlen, iterations, keysize, keybuffer);
+      leave_unlocked_crypto ();
+    }
+  agent_metrics_update ("s2k", NULL, &start);
+
+  return err;
+}
+
+
 /* Each thread has its own local variables conveyed by a control
    structure usually identified by an argument named CTRL.  This
    function is called immediately after allocating the control
@@ -2057,6 +2250,22 @@ get_agent_active_connection_count (void)
 }
 
 
+/* Store statistics about the connections at R_STATS.  */
+void
+get_agent_connection_stats (struct connection_stats_s *r_stats)
+{
+  memset (r_stats, 0, sizeof *r_stats);
+  r_stats->active = active_connections;
+  r_stats->threads = conn_pool.threads;
+  r_stats->idle = conn_pool.idle;
+  r_stats->accepted = conn_pool.accepted;
+  r_stats->spawned = conn_pool.spawned;
+  if (conn_pool.accepted)
+    r_stats->latency_avg = conn_pool.latency / conn_pool.accepted;
+  r_stats->latency_max = conn_pool.latency_max;
+}
+
+
 /* Under W32, this function returns the handle of the scdaemon
    notification event.  Calling it the first time creates that
    event.  */
@@ -2781,8 +2990,122 @@ start_connection_thread_ssh (void *arg)
 }
 
 
-/* Connection handler loop.  Wait for connection requests and spawn a
-   thread after accepting a connection.  */
+/* The main function of the threads in the connection pool.  ARG is
+ * the control object of the first connection to handle.  After a
+ * connection has been finished the thread waits for the next one,
+ * unless there are already enough idle threads.  */
+static void *
+connection_thread (void *arg)
+{
+  ctrl_t ctrl = arg;
+  struct timespec curtime, abstime;
+  unsigned long latency;
+  int rc;
+
+  for (;;)
+    {
+      npth_clock_gettime (&curtime);
+      latency = ((curtime.tv_sec - ctrl->thread_startup.accepted.tv_sec)
+                 * 1000000
+                 + (curtime.tv_nsec - ctrl->thread_startup.accepted.tv_nsec)
+                 / 1000);
+      conn_pool.latency += latency;
+      if (latency > conn_pool.latency_max)
+        conn_pool.latency_max = latency;
+
+      ctrl->thread_startup.func (ctrl);
+
+      npth_mutex_lock (&conn_pool.lock);
+      if (shutdown_pending
+          || (!conn_pool.queue && conn_pool.idle >= MAX_IDLE_CONNECTION_THREADS))
+        break;
+      conn_pool.idle++;
+      npth_clock_gettime (&abstime);
+      abstime.tv_sec += CONNECTION_THREAD_IDLE_TIME;
+      rc = 0;
+      while (!conn_pool.queue && !rc)
+        rc = npth_cond_timedwait (&conn_pool.cond, &conn_pool.lock, &abstime);
+      conn_pool.idle--;
+      if (!conn_pool.queue)
+        break;  /* Timeout or error.  */
+      ctrl = conn_pool.queue;
+      conn_pool.queue = ctrl->thread_startup.next;
+      if (!conn_pool.queue)
+        conn_pool.queue_tail = &conn_pool.queue;
+      conn_pool.queued--;
+      npth_mutex_unlock (&conn_pool.lock);
+    }
+
+  conn_pool.threads--;
+  npth_mutex_unlock (&conn_pool.lock);
+  return NULL;
+}
+
+
+/* Hand the accepted connection described by CTRL over to an idle
+ * connection thread or create a new thread using the attributes
+ * TATTR.  FUNC is the connection thread's main function.  */
+static int
+dispatch_connection (ctrl_t ctrl, void *(*func) (void *arg),
+                     npth_attr_t *tattr)
+{
+  npth_t thread;
+  int ret;
+
+  ctrl->thread_startup.func = func;
+  conn_pool.accepted++;
+
+  npth_mutex_lock (&conn_pool.lock);
+  if (conn_pool.idle > conn_pool.queued)
+    {
+      ctrl->thread_startup.next = NULL;
+      *conn_pool.queue_tail = ctrl;
+      conn_pool.queue_tail = &ctrl->thread_startup.next;
+      conn_pool.queued++;
+      npth_cond_signal (&conn_pool.cond);
+      npth_mutex_unlock (&conn_pool.lock);
+      return 0;
+    }
+  npth_mutex_unlock (&conn_pool.lock);
+
+  ret = npth_create (&thread, tattr, connection_thread, ctrl);
+  if (!ret)
+    {
+      conn_pool.threads++;
+      conn_pool.spawned++;
+    }
+  return ret;
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Wait for events on the file descriptors registered with EPFD but
+ * not longer than TIMEOUT and return the ready file descriptors in
+ * READ_FDSET.  Return value, errno, and the signal handling are the
+ * same as with npth_pselect.  */
+static int
+epoll_wait_fdset (int epfd, fd_set *read_fdset, struct timespec *timeout)
+{
+  struct epoll_event events[8];
+  int ret, i, msec, saved_errno;
+
+  msec = timeout->tv_sec * 1000 + (timeout->tv_nsec + 999999) / 1000000;
+  npth_unprotect ();
+  ret = epoll_pwait (epfd, events, DIM (events), msec, npth_sigev_sigmask ());
+  saved_errno = errno;
+  npth_protect ();
+
+  FD_ZERO (read_fdset);
+  for (i=0; i < ret; i++)
+    FD_SET (events[i].data.fd, read_fdset);
+  gpg_err_set_errno (saved_errno);
+  return ret;
+}
+#endif /*HAVE_SYS_EPOLL_H*/
+
+
+/* Connection handler loop.  Wait for connection requests and hand
+   them over to a connection thread after accepting a connection.  */
 static void
 handle_connections (gnupg_fd_t listen_fd,
                     gnupg_fd_t listen_fd_extra,
@@ -2804,6 +3127,9 @@ handle_connections (gnupg_fd_t listen_fd,
 #ifdef HAVE_W32_SYSTEM
   HANDLE events[2];
   unsigned int events_set;
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+  int epfd;
 #endif
   int sock_inotify_fd = -1;
   int home_inotify_fd = -1;
@@ -2825,6 +3151,14 @@ handle_connections (gnupg_fd_t listen_fd,
 	       strerror (ret));
   npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
 
+  ret = npth_mutex_init (&conn_pool.lock, NULL);
+  if (!ret)
+    ret = npth_cond_init (&conn_pool.cond, NULL);
+  if (ret)
+    log_fatal ("error initializing the connection pool: %s\n",
+               strerror (ret));
+  conn_pool.queue_tail = &conn_pool.queue;
+
 #ifndef HAVE_W32_SYSTEM
   npth_sigev_init ();
   npth_sigev_add (SIGHUP);
@@ -2924,6 +3258,31 @@ handle_connections (gnupg_fd_t listen_fd,
   listentbl[2].l_fd = listen_fd_browser;
   listentbl[3].l_fd = listen_fd_ssh;
 
+#ifdef HAVE_SYS_EPOLL_H
+  /* With many connections epoll is cheaper than pselect.  If it is
+   * not available at runtime we fall back to pselect.  */
+  epfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (epfd == -1)
+    log_info ("error creating epoll instance: %s - using pselect\n",
+              strerror (errno));
+  else
+    {
+      struct epoll_event ev;
+      int i;
+
+      for (i = 0; i <= nfd; i++)
+        if (FD_ISSET (i, &fdset))
+          {
+            memset (&ev, 0, sizeof ev);
+            ev.events = EPOLLIN;
+            ev.data.fd = i;
+            if (epoll_ctl (epfd, EPOLL_CTL_ADD, i, &ev))
+              log_fatal ("error adding fd %d to epoll: %s\n",
+                         i, strerror (errno));
+          }
+    }
+#endif /*HAVE_SYS_EPOLL_H*/
+
   npth_clock_gettime (&abstime);
   abstime.tv_sec += TIMERTICK_INTERVAL;
 
@@ -2955,6 +3314,17 @@ handle_connections (gnupg_fd_t listen_fd,
               if (home_inotify_fd > nfd)
                 nfd = home_inotify_fd;
             }
+#ifdef HAVE_SYS_EPOLL_H
+          if (epfd != -1)
+            {
+              int idx;
+
+              for (idx=0; idx < DIM(listentbl); idx++)
+                if (listentbl[idx].l_fd != GNUPG_INVALID_FD)
+                  epoll_ctl (epfd, EPOLL_CTL_DEL,
+                             FD2INT (listentbl[idx].l_fd), NULL);
+            }
+#endif
 	}
 
       /* POSIX says that fd_set should be implemented as a structure,
@@ -2972,8 +3342,13 @@ handle_connections (gnupg_fd_t listen_fd,
       npth_timersub (&abstime, &curtime, &timeout);
 
 #ifndef HAVE_W32_SYSTEM
-      ret = npth_pselect (nfd+1, &read_fdset, NULL, NULL, &timeout,
-                          npth_sigev_sigmask ());
+# ifdef HAVE_SYS_EPOLL_H
+      if (epfd != -1)
+        ret = epoll_wait_fdset (epfd, &read_fdset, &timeout);
+      else
+# endif
+        ret = npth_pselect (nfd+1, &read_fdset, NULL, NULL, &timeout,
+                            npth_sigev_sigmask ());
       saved_errno = errno;
 
       {
@@ -3029,8 +3404,8 @@ handle_connections (gnupg_fd_t listen_fd,
         {
           int idx;
           ctrl_t ctrl;
-          npth_t thread;
 
+          npth_clock_gettime (&curtime);
           for (idx=0; idx < DIM(listentbl); idx++)
             {
               if (listentbl[idx].l_fd == GNUPG_INVALID_FD)
@@ -3062,8 +3437,9 @@ handle_connections (gnupg_fd_t listen_fd,
               else
                 {
                   ctrl->thread_startup.fd = fd;
-                  ret = npth_create (&thread, &tattr,
-                                     listentbl[idx].func, ctrl);
+                  ctrl->thread_startup.accepted = curtime;
+                  ret = dispatch_connection (ctrl, listentbl[idx].func,
+                                             &tattr);
                   if (ret)
                     {
                       log_error ("error spawning connection handler for %s:"
@@ -3080,6 +3456,10 @@ handle_connections (gnupg_fd_t listen_fd,
     close (sock_inotify_fd);
   if (home_inotify_fd != -1)
     close (home_inotify_fd);
+#ifdef HAVE_SYS_EPOLL_H
+  if (epfd != -1)
+    close (epfd);
+#endif
   cleanup ();
   log_info (_("%s %s stopped\n"), gpgrt_strusage(11), gpgrt_strusage(13));
   npth_attr_destroy (&tattr);
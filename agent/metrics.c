@@ -0,0 +1,162 @@
+/* metrics.c - Latency metrics for gpg-agent
+ * Copyright (C) 2021 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0+
+ */
+
+/* This module keeps a latency histogram for each Assuan command and
+ * for a few internal operations.  The metrics are only updated while
+ * holding the nPth lock and thus no extra locking is required.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <npth.h>
+
+#include "agent.h"
+
+/* The maximum number of distinct metrics.  Further names are counted
+ * as "other".  */
+#define MAX_METRICS 128
+
+/* The upper bounds of the histogram buckets in microseconds.  The
+ * last bucket has no upper bound.  */
+static const unsigned long bucket_bounds[] =
+  {
+    100, 250, 500,
+    1000, 2500, 5000,
+    10000, 25000, 50000,
+    100000, 250000, 500000,
+    1000000, 2500000, 5000000,
+    10000000
+  };
+#define N_BUCKETS (DIM (bucket_bounds) + 1)
+
+/* The data for one metric.  */
+struct metric_s
+{
+  char name[48];            /* "CATEGORY.NAME" or "CATEGORY".  */
+  unsigned long count;      /* Number of updates.              */
+  unsigned long long sum;   /* Sum of the latencies in us.     */
+  unsigned long max;        /* Maximum latency in us.          */
+  unsigned long buckets[N_BUCKETS];
+};
+
+static struct metric_s metrics[MAX_METRICS];
+static int n_metrics;
+
+
+
+/* Return the metric with NAME; create it if needed.  */
+static struct metric_s *
+get_metric (const char *name)
+{
+  int i;
+
+  for (i=0; i < n_metrics; i++)
+    if (!strcmp (metrics[i].name, name))
+      return metrics + i;
+
+  if (n_metrics == MAX_METRICS - 1)
+    name = "other";
+  else if (n_metrics == MAX_METRICS)
+    return metrics + MAX_METRICS - 1;
+
+  i = n_metrics++;
+  strncpy (metrics[i].name, name, sizeof metrics[i].name - 1);
+  return metrics + i;
+}
+
+
+/* Store the current time at R_START for use by agent_metrics_update.  */
+void
+agent_metrics_start (struct timespec *r_start)
+{
+  npth_clock_gettime (r_start);
+}
+
+
+/* Add the time elapsed since START to the metric for CATEGORY and
+ * NAME.  NAME may be NULL to update the metric for the entire
+ * category.  */
+void
+agent_metrics_update (const char *category, const char *name,
+                      const struct timespec *start)
+{
+  struct timespec now;
+  struct metric_s *m;
+  char namebuf[48];
+  unsigned long usec;
+  int i;
+
+  npth_clock_gettime (&now);
+  if (now.tv_sec < start->tv_sec)
+    usec = 0;
+  else
+    usec = ((now.tv_sec - start->tv_sec) * 1000000
+            + (now.tv_nsec - start->tv_nsec) / 1000);
+
+  if (name)
+    {
+      snprintf (namebuf, sizeof namebuf, "%s.%s", category, name);
+      m = get_metric (namebuf);
+    }
+  else
+    m = get_metric (category);
+
+  m->count++;
+  m->sum += usec;
+  if (usec > m->max)
+    m->max = usec;
+  for (i=0; i < N_BUCKETS - 1 && usec > bucket_bounds[i]; i++)
+    ;
+  m->buckets[i]++;
+}
+
+
+/* Write all metrics to MB.  The first line lists the upper bounds of
+ * the histogram buckets:
+ *
+ *   buckets <bound_1> ... <bound_n> inf
+ *
+ * and then one line per metric follows:
+ *
+ *   <name> <count> <sum> <max> <bucket_1> ... <bucket_n+1>
+ *
+ * All times are given in microseconds.  */
+void
+agent_metrics_write (membuf_t *mb)
+{
+  int i, j;
+
+  put_membuf_str (mb, "buckets");
+  for (j=0; j < N_BUCKETS - 1; j++)
+    put_membuf_printf (mb, " %lu", bucket_bounds[j]);
+  put_membuf_str (mb, " inf\n");
+
+  for (i=0; i < n_metrics; i++)
+    {
+      put_membuf_printf (mb, "%s %lu %llu %lu", metrics[i].name,
+                         metrics[i].count, metrics[i].sum, metrics[i].max);
+      for (j=0; j < N_BUCKETS; j++)
+        put_membuf_printf (mb, " %lu", metrics[i].buckets[j]);
+      put_membuf (mb, "\n", 1);
+    }
+}
@@ -273,6 +273,80 @@ do_encode_raw_pkcs1 (const byte *md, size_t mdlen, unsigned int nbits,
 
 
 
+/* Sign DATA of DATALEN bytes using the plain private key S_SKEY and
+ * store the signature at R_SIG.  The hash algorithm and the raw flag
+ * are taken from CTRL.  */
+static gpg_error_t
+sign_with_skey (ctrl_t ctrl, gcry_sexp_t s_skey,
+                const unsigned char *data, int datalen, gcry_sexp_t *r_sig)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_hash = NULL;
+  gcry_sexp_t s_sig = NULL;
+  int dsaalgo = 0;
+
+  *r_sig = NULL;
+
+  /* Put the hash into a sexp */
+  if (agent_is_eddsa_key (s_skey))
+    err = do_encode_eddsa (data, datalen,
+                           &s_hash);
+  else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
+    err = do_encode_raw_pkcs1 (data, datalen,
+                               gcry_pk_get_nbits (s_skey),
+                               &s_hash);
+  else if ( (dsaalgo = agent_is_dsa_key (s_skey)) )
+    err = do_encode_dsa (data, datalen,
+                         dsaalgo, s_skey,
+                         &s_hash);
+  else
+    err = do_encode_md (data, datalen,
+                        ctrl->digest.algo,
+                        &s_hash,
+                        ctrl->digest.raw_value);
+  if (err)
+    goto leave;
+
+  if (DBG_CRYPTO)
+    {
+      gcry_log_debugsxp ("skey", s_skey);
+      gcry_log_debugsxp ("hash", s_hash);
+    }
+
+  /* sign */
+  err = agent_pk_compute (gcry_pk_sign, &s_sig, s_hash, s_skey);
+  if (err)
+    {
+      log_error ("signing failed: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  if (DBG_CRYPTO)
+    gcry_log_debugsxp ("rslt", s_sig);
+
+  if (dsaalgo == 0 && GCRYPT_VERSION_NUMBER < 0x010700)
+    {
+      /* It's RSA and Libgcrypt < 1.7 which does not check the
+       * created signature itself.  */
+      err = gcry_pk_verify (s_sig, s_hash, s_skey);
+      if (err)
+        {
+          log_error (_("checking created signature failed: %s\n"),
+                     gpg_strerror (err));
+          goto leave;
+        }
+    }
+
+  *r_sig = s_sig;
+  s_sig = NULL;
+
+ leave:
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_hash);
+  return err;
+}
+
+
 /* SIGN whatever information we have accumulated in CTRL and return
  * the signature S-expression.  LOOKUP is an optional function to
  * provide a way for lower layers to ask for the caching TTL.  If a
@@ -496,50 +570,9 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
   else
     {
       /* No smartcard, but a private key (in S_SKEY). */
-      int dsaalgo = 0;
-
-      /* Put the hash into a sexp */
-      if (agent_is_eddsa_key (s_skey))
-        err = do_encode_eddsa (data, datalen,
-                               &s_hash);
-      else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
-        err = do_encode_raw_pkcs1 (data, datalen,
-                                   gcry_pk_get_nbits (s_skey),
-                                   &s_hash);
-      else if ( (dsaalgo = agent_is_dsa_key (s_skey)) )
-        err = do_encode_dsa (data, datalen,
-                             dsaalgo, s_skey,
-                             &s_hash);
-      else
-        err = do_encode_md (data, datalen,
-                            ctrl->digest.algo,
-                            &s_hash,
-                            ctrl->digest.raw_value);
+      err = sign_with_skey (ctrl, s_skey, data, datalen, &s_sig);
       if (err)
         goto leave;
-
-      if (dsaalgo == 0 && GCRYPT_VERSION_NUMBER < 0x010700)
-        {
-          /* It's RSA and Libgcrypt < 1.7 */
-          check_signature = 1;
-        }
-
-      if (DBG_CRYPTO)
-        {
-          gcry_log_debugsxp ("skey", s_skey);
-          gcry_log_debugsxp ("hash", s_hash);
-        }
-
-      /* sign */
-      err = gcry_pk_sign (&s_sig, s_hash, s_skey);
-      if (err)
-        {
-          log_error ("signing failed: %s\n", gpg_strerror (err));
-          goto leave;
-        }
-
-      if (DBG_CRYPTO)
-        gcry_log_debugsxp ("rslt", s_sig);
     }
 
   /* Check that the signature verification worked and nothing is
@@ -621,3 +654,108 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 
   return err;
 }
+
+
+/* Helper for agent_pksign_batch to pass the canonical encoding of
+ * S_SIG to the SIG_CB callback.  */
+static gpg_error_t
+put_batch_signature (gcry_sexp_t s_sig,
+                     gpg_error_t (*sig_cb)(void *, const void *, size_t),
+                     void *opaque)
+{
+  gpg_error_t err;
+  char *buf;
+  size_t len;
+
+  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
+  log_assert (len);
+  buf = xtrymalloc (len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
+  log_assert (len);
+  err = sig_cb (opaque, buf, len);
+  xfree (buf);
+  return err;
+}
+
+
+/* Sign a series of digests with the key given by the keygrip in
+ * CTRL.  NEXT_CB is called to store the next digest into CTRL; it
+ * shall return GPG_ERR_EOF after the last one.  For each created
+ * signature SIG_CB is called with its canonical encoding.  Unlike
+ * calling agent_pksign for each digest the private key is read and
+ * unprotected only once for the entire batch.  Keys stored on a
+ * smartcard are handed to the card for each digest.  */
+gpg_error_t
+agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                    const char *desc_text, cache_mode_t cache_mode,
+                    gpg_error_t (*next_cb)(void *opaque, ctrl_t ctrl),
+                    gpg_error_t (*sig_cb)(void *opaque,
+                                          const void *sig, size_t siglen),
+                    void *opaque)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_skey = NULL;
+  gcry_sexp_t s_sig = NULL;
+  unsigned char *shadow_info = NULL;
+  int use_card = 0;
+  unsigned int count = 0;
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  /* Fetch the first digest before asking for a passphrase so that an
+   * empty batch does not cause a pinentry to pop up.  */
+  err = next_cb (opaque, ctrl);
+  if (gpg_err_code (err) == GPG_ERR_EOF)
+    return 0;
+  if (err)
+    return err;
+
+  err = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
+                             &shadow_info, cache_mode, NULL,
+                             &s_skey, NULL);
+  if (gpg_err_code (err) == GPG_ERR_NO_SECKEY || (!err && shadow_info))
+    {
+      /* The card code in agent_pksign_do takes care of this case
+       * including the creation of a missing stub file.  */
+      use_card = 1;
+      err = 0;
+    }
+  else if (err)
+    {
+      log_error ("failed to read the secret key\n");
+      goto leave;
+    }
+
+  do
+    {
+      if (use_card)
+        err = agent_pksign_do (ctrl, cache_nonce, desc_text, &s_sig,
+                               cache_mode, NULL, NULL, 0);
+      else
+        err = sign_with_skey (ctrl, s_skey,
+                              ctrl->digest.value, ctrl->digest.valuelen,
+                              &s_sig);
+      if (!err)
+        err = put_batch_signature (s_sig, sig_cb, opaque);
+      gcry_sexp_release (s_sig);
+      s_sig = NULL;
+      if (err)
+        goto leave;
+      count++;
+      err = next_cb (opaque, ctrl);
+    }
+  while (!err);
+  if (gpg_err_code (err) == GPG_ERR_EOF)
+    err = 0;
+
+ leave:
+  if (DBG_CRYPTO)
+    log_debug ("%s: %u signature(s) created%s%s\n", __func__, count,
+               use_card? " by the card":"", err? " (aborted)":"");
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
+  return err;
+}
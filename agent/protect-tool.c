@@ -762,6 +762,33 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
   return NULL;
 }
 
+gpg_error_t
+agent_get_cache_kek (const char *passphrase, int hashalgo,
+                     const unsigned char *s2ksalt, unsigned long s2kcount,
+                     unsigned char *key, size_t keylen)
+{
+  (void)passphrase;
+  (void)hashalgo;
+  (void)s2ksalt;
+  (void)s2kcount;
+  (void)key;
+  (void)keylen;
+  return gpg_error (GPG_ERR_NOT_FOUND);
+}
+
+void
+agent_put_cache_kek (const char *passphrase, int hashalgo,
+                     const unsigned char *s2ksalt, unsigned long s2kcount,
+                     const unsigned char *key, size_t keylen)
+{
+  (void)passphrase;
+  (void)hashalgo;
+  (void)s2ksalt;
+  (void)s2kcount;
+  (void)key;
+  (void)keylen;
+}
+
 gpg_error_t
 agent_askpin (ctrl_t ctrl,
               const char *desc_text, const char *prompt_text,
@@ -826,3 +853,16 @@ agent_write_private_key (const unsigned char *grip,
 
   return 0;
 }
+
+
+/* Replacement for the function in gpg-agent.c.  */
+gpg_error_t
+agent_kdf_derive (const void *passphrase, size_t passphraselen,
+                  int algo, int subalgo,
+                  const void *salt, size_t saltlen,
+                  unsigned long iterations,
+                  size_t keysize, void *keybuffer)
+{
+  return gcry_kdf_derive (passphrase, passphraselen, algo, subalgo,
+                          salt, saltlen, iterations, keysize, keybuffer);
+}
@@ -821,8 +821,21 @@ do_decryption (const unsigned char *aad_begin, size_t aad_len,
         rc = out_of_core ();
       else
         {
-          rc = hash_passphrase (passphrase, GCRY_MD_SHA1,
-                                3, s2ksalt, s2kcount, key, prot_cipher_keylen);
+          /* The S2K function is deliberately slow; thus we first
+           * check whether we have already derived the key from a
+           * cached passphrase.  */
+          if (agent_get_cache_kek (passphrase, GCRY_MD_SHA1,
+                                   s2ksalt, s2kcount,
+                                   key, prot_cipher_keylen))
+            {
+              rc = hash_passphrase (passphrase, GCRY_MD_SHA1,
+                                    3, s2ksalt, s2kcount,
+                                    key, prot_cipher_keylen);
+              if (!rc)
+                agent_put_cache_kek (passphrase, GCRY_MD_SHA1,
+                                     s2ksalt, s2kcount,
+                                     key, prot_cipher_keylen);
+            }
           if (!rc)
             rc = gcry_cipher_setkey (hd, key, prot_cipher_keylen);
           xfree (key);
@@ -1456,12 +1469,12 @@ hash_passphrase (const char *passphrase, int hashalgo,
      code than GPG_ERR_INV_DATA.  */
   if (!passphrase || !*passphrase)
     return gpg_error (GPG_ERR_NO_PASSPHRASE);
-  return gcry_kdf_derive (passphrase, strlen (passphrase),
-                          s2kmode == 3? GCRY_KDF_ITERSALTED_S2K :
-                          s2kmode == 1? GCRY_KDF_SALTED_S2K :
-                          s2kmode == 0? GCRY_KDF_SIMPLE_S2K : GCRY_KDF_NONE,
-                          hashalgo, s2ksalt, 8, s2kcount,
-                          keylen, key);
+  return agent_kdf_derive (passphrase, strlen (passphrase),
+                           s2kmode == 3? GCRY_KDF_ITERSALTED_S2K :
+                           s2kmode == 1? GCRY_KDF_SALTED_S2K :
+                           s2kmode == 0? GCRY_KDF_SIMPLE_S2K : GCRY_KDF_NONE,
+                           hashalgo, s2ksalt, 8, s2kcount,
+                           keylen, key);
 }
 
 
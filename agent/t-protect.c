@@ -349,3 +349,44 @@ convert_from_openpgp_native (gcry_sexp_t s_pgp, const char *passphrase,
   (void)r_key;
   return gpg_error (GPG_ERR_BUG);
 }
+
+/* Stub function.  */
+gpg_error_t
+agent_get_cache_kek (const char *passphrase, int hashalgo,
+                     const unsigned char *s2ksalt, unsigned long s2kcount,
+                     unsigned char *key, size_t keylen)
+{
+  (void)passphrase;
+  (void)hashalgo;
+  (void)s2ksalt;
+  (void)s2kcount;
+  (void)key;
+  (void)keylen;
+  return gpg_error (GPG_ERR_NOT_FOUND);
+}
+
+/* Stub function.  */
+void
+agent_put_cache_kek (const char *passphrase, int hashalgo,
+                     const unsigned char *s2ksalt, unsigned long s2kcount,
+                     const unsigned char *key, size_t keylen)
+{
+  (void)passphrase;
+  (void)hashalgo;
+  (void)s2ksalt;
+  (void)s2kcount;
+  (void)key;
+  (void)keylen;
+}
+
+/* Replacement for the function in gpg-agent.c.  */
+gpg_error_t
+agent_kdf_derive (const void *passphrase, size_t passphraselen,
+                  int algo, int subalgo,
+                  const void *salt, size_t saltlen,
+                  unsigned long iterations,
+                  size_t keysize, void *keybuffer)
+{
+  return gcry_kdf_derive (passphrase, passphraselen, algo, subalgo,
+                          salt, saltlen, iterations, keysize, keybuffer);
+}
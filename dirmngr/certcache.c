@@ -30,11 +30,20 @@
 #include "dirmngr.h"
 #include "misc.h"
 #include "../common/ksba-io-support.h"
+#include "../common/host2net.h"
 #include "crlfetch.h"
 #include "certcache.h"
 
 #define MAX_NONPERM_CACHED_CERTS 1000
 
+/* The maximum number of threads used to load the certificates at
+   startup.  */
+#define MAX_LOAD_THREADS 4
+
+/* The number of slots of the secondary indices.  Must be a power
+   of 2.  */
+#define CERT_INDEX_SIZE 1024
+
 /* Constants used to classify search patterns.  */
 enum pattern_class
   {
@@ -56,16 +65,30 @@ enum pattern_class
 /* A certificate cache item.  This consists of a the KSBA cert object
    and some meta data for easier lookup.  We use a hash table to keep
    track of all items and use the (randomly distributed) first byte of
-   the fingerprint directly as the hash which makes it pretty easy. */
+   the fingerprint directly as the hash which makes it pretty easy.
+   Valid items are also linked into secondary hash tables indexed by
+   the subject DN, the issuer DN, the issuer DN plus serial number,
+   the subject key identifier and the key id, i.e. the last 4 bytes
+   of the fingerprint.  */
 struct cert_item_s
 {
   struct cert_item_s *next; /* Next item with the same hash value. */
+  struct cert_item_s *subject_next; /* Next item in SUBJECT_INDEX.  */
+  struct cert_item_s *issuer_next;  /* Next item in ISSUER_INDEX.  */
+  struct cert_item_s *sn_next;      /* Next item in SN_INDEX.  */
+  struct cert_item_s *ski_next;     /* Next item in SKI_INDEX.  */
+  struct cert_item_s *kid_next;     /* Next item in KID_INDEX.  */
   ksba_cert_t cert;         /* The KSBA cert object or NULL is this is
                                not a valid item.  */
   unsigned char fpr[20];    /* The fingerprint of this object. */
   char *issuer_dn;          /* The malloced issuer DN.  */
   ksba_sexp_t sn;           /* The malloced serial number  */
   char *subject_dn;         /* The malloced subject DN - maybe NULL.  */
+  ksba_sexp_t ski;          /* The malloced subject key id - maybe NULL. */
+  unsigned int subject_hash; /* The hash values used for the indices.  */
+  unsigned int issuer_hash;
+  unsigned int sn_hash;
+  unsigned int ski_hash;
 
   /* If this field is set the certificate has been taken from some
    * configuration and shall not be flushed from the cache.  */
@@ -81,6 +104,14 @@ typedef struct cert_item_s *cert_item_t;
    the first byte of the fingerprint.  */
 static cert_item_t cert_cache[256];
 
+/* The secondary indices into CERT_CACHE.  Only valid items are
+   linked into these tables.  */
+static cert_item_t subject_index[CERT_INDEX_SIZE];
+static cert_item_t issuer_index[CERT_INDEX_SIZE];
+static cert_item_t sn_index[CERT_INDEX_SIZE];
+static cert_item_t ski_index[CERT_INDEX_SIZE];
+static cert_item_t kid_index[CERT_INDEX_SIZE];
+
 /* This is the global cache_lock variable. In general locking is not
    needed but it would take extra efforts to make sure that no
    indirect use of npth functions is done, so we simply lock it
@@ -195,6 +226,165 @@ hexsn_to_sexp (const char *hexsn)
 }
 
 
+/* Return a hash value for the string STRING continuing with HASH.
+   This is the FNV-1a algorithm.  */
+static unsigned int
+hash_string (unsigned int hash, const char *string)
+{
+  const unsigned char *s;
+
+  for (s = (const unsigned char *)string; *s; s++)
+    hash = (hash ^ *s) * 16777619;
+  return hash;
+}
+
+
+/* Return a hash value for the canonical S-expression SEXP continuing
+   with HASH.  */
+static unsigned int
+hash_sexp (unsigned int hash, ksba_const_sexp_t sexp)
+{
+  const unsigned char *s = sexp;
+  size_t n;
+
+  n = gcry_sexp_canon_len (s, 0, NULL, NULL);
+  for (; n; n--, s++)
+    hash = (hash ^ *s) * 16777619;
+  return hash;
+}
+
+#define HASH_INIT 2166136261U
+#define INDEX_SLOT(a) ((a) & (CERT_INDEX_SIZE - 1))
+
+
+/* Return the hash values used to lookup the indices.  */
+static unsigned int
+subject_hash (const char *subject_dn)
+{
+  return hash_string (HASH_INIT, subject_dn);
+}
+
+static unsigned int
+issuer_hash (const char *issuer_dn)
+{
+  return hash_string (HASH_INIT, issuer_dn);
+}
+
+static unsigned int
+sn_hash (const char *issuer_dn, ksba_const_sexp_t serialno)
+{
+  return hash_sexp (hash_string (HASH_INIT, issuer_dn), serialno);
+}
+
+static unsigned int
+ski_hash (ksba_const_sexp_t ski)
+{
+  return hash_sexp (HASH_INIT, ski);
+}
+
+/* The fingerprint is already randomly distributed; thus the key id
+   is used directly.  */
+static unsigned int
+kid_hash (const unsigned char *fpr)
+{
+  return buf32_to_uint (fpr + 16);
+}
+
+
+/* Link the valid item CI into the secondary indices.  */
+static void
+link_cache_slot (cert_item_t ci)
+{
+  unsigned int slot;
+
+  if (ci->subject_dn)
+    {
+      ci->subject_hash = subject_hash (ci->subject_dn);
+      slot = INDEX_SLOT (ci->subject_hash);
+      ci->subject_next = subject_index[slot];
+      subject_index[slot] = ci;
+    }
+
+  ci->issuer_hash = issuer_hash (ci->issuer_dn);
+  slot = INDEX_SLOT (ci->issuer_hash);
+  ci->issuer_next = issuer_index[slot];
+  issuer_index[slot] = ci;
+
+  ci->sn_hash = sn_hash (ci->issuer_dn, ci->sn);
+  slot = INDEX_SLOT (ci->sn_hash);
+  ci->sn_next = sn_index[slot];
+  sn_index[slot] = ci;
+
+  if (ci->ski)
+    {
+      ci->ski_hash = ski_hash (ci->ski);
+      slot = INDEX_SLOT (ci->ski_hash);
+      ci->ski_next = ski_index[slot];
+      ski_index[slot] = ci;
+    }
+
+  slot = INDEX_SLOT (kid_hash (ci->fpr));
+  ci->kid_next = kid_index[slot];
+  kid_index[slot] = ci;
+}
+
+
+/* Remove the item CI from the secondary indices.  */
+static void
+unlink_cache_slot (cert_item_t ci)
+{
+  cert_item_t *cip;
+
+  if (ci->subject_dn)
+    {
+      for (cip = &subject_index[INDEX_SLOT (ci->subject_hash)];
+           *cip; cip = &(*cip)->subject_next)
+        if (*cip == ci)
+          {
+            *cip = ci->subject_next;
+            break;
+          }
+    }
+
+  for (cip = &issuer_index[INDEX_SLOT (ci->issuer_hash)];
+       *cip; cip = &(*cip)->issuer_next)
+    if (*cip == ci)
+      {
+        *cip = ci->issuer_next;
+        break;
+      }
+
+  for (cip = &sn_index[INDEX_SLOT (ci->sn_hash)]; *cip; cip = &(*cip)->sn_next)
+    if (*cip == ci)
+      {
+        *cip = ci->sn_next;
+        break;
+      }
+
+  if (ci->ski)
+    {
+      for (cip = &ski_index[INDEX_SLOT (ci->ski_hash)];
+           *cip; cip = &(*cip)->ski_next)
+        if (*cip == ci)
+          {
+            *cip = ci->ski_next;
+            break;
+          }
+    }
+
+  for (cip = &kid_index[INDEX_SLOT (kid_hash (ci->fpr))];
+       *cip; cip = &(*cip)->kid_next)
+    if (*cip == ci)
+      {
+        *cip = ci->kid_next;
+        break;
+      }
+
+  ci->subject_next = ci->issuer_next = ci->sn_next = ci->ski_next = NULL;
+  ci->kid_next = NULL;
+}
+
+
 /* Compute the fingerprint of the certificate CERT and put it into
    the 20 bytes large buffer DIGEST.  Return address of this buffer.  */
 unsigned char *
@@ -234,6 +424,10 @@ clean_cache_slot (cert_item_t ci)
   if (!ci->cert)
     return; /* Already cleaned.  */
 
+  if (ci->issuer_dn && ci->sn)
+    unlink_cache_slot (ci);
+  ksba_free (ci->ski);
+  ci->ski = NULL;
   ksba_free (ci->sn);
   ci->sn = NULL;
   ksba_free (ci->issuer_dn);
@@ -250,6 +444,28 @@ clean_cache_slot (cert_item_t ci)
 }
 
 
+/* Store CERT and the data extracted from it in the unused item CI.
+ * The fingerprint is not set.  This function does not access the
+ * cache and may thus be called without holding the nPth lock.  */
+static gpg_error_t
+fill_cert_item (cert_item_t ci, ksba_cert_t cert)
+{
+  ksba_cert_ref (cert);
+  ci->cert = cert;
+  ci->sn = ksba_cert_get_serial (cert);
+  ci->issuer_dn = ksba_cert_get_issuer (cert, 0);
+  if (!ci->issuer_dn || !ci->sn)
+    {
+      clean_cache_slot (ci);
+      return gpg_error (GPG_ERR_INV_CERT_OBJ);
+    }
+  ci->subject_dn = ksba_cert_get_subject (cert, 0);
+  if (ksba_cert_get_subj_key_id (cert, NULL, &ci->ski))
+    ci->ski = NULL;
+  return 0;
+}
+
+
 /* Put the certificate CERT into the cache.  It is assumed that the
  * cache is locked while this function is called.
  *
@@ -333,19 +549,12 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
       cert_cache[*fpr] = ci;
     }
 
-  ksba_cert_ref (cert);
-  ci->cert = cert;
   memcpy (ci->fpr, fpr, 20);
-  ci->sn = ksba_cert_get_serial (cert);
-  ci->issuer_dn = ksba_cert_get_issuer (cert, 0);
-  if (!ci->issuer_dn || !ci->sn)
-    {
-      clean_cache_slot (ci);
-      return gpg_error (GPG_ERR_INV_CERT_OBJ);
-    }
-  ci->subject_dn = ksba_cert_get_subject (cert, 0);
+  if (fill_cert_item (ci, cert))
+    return gpg_error (GPG_ERR_INV_CERT_OBJ);
   ci->permanent = !!permanent;
   ci->trustclasses = trustclass;
+  link_cache_slot (ci);
 
   if (permanent)
     any_cert_of_class |= trustclass;
@@ -356,22 +565,116 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
 }
 
 
-/* Load certificates from the directory DIRNAME.  All certificates
+/* Put the permanent certificate described by ITEM into the cache.
+ * ITEM must have been filled by fill_cert_item and its fingerprint
+ * must be set.  On success the data of ITEM has been moved to the
+ * cache and the caller must only free ITEM itself.  It is assumed
+ * that the cache is locked while this function is called.  */
+static gpg_error_t
+put_cert_item (cert_item_t item, unsigned int trustclass)
+{
+  cert_item_t ci, next;
+
+  for (ci=cert_cache[*item->fpr]; ci; ci = ci->next)
+    if (ci->cert && !memcmp (ci->fpr, item->fpr, 20))
+      return gpg_error (GPG_ERR_DUP_VALUE);
+  /* Try to reuse an existing entry.  */
+  for (ci=cert_cache[*item->fpr]; ci; ci = ci->next)
+    if (!ci->cert)
+      break;
+  if (!ci)
+    { /* No: Create a new entry.  */
+      ci = xtrycalloc (1, sizeof *ci);
+      if (!ci)
+        return gpg_error_from_errno (errno);
+      ci->next = cert_cache[*item->fpr];
+      cert_cache[*item->fpr] = ci;
+    }
+
+  next = ci->next;
+  *ci = *item;
+  ci->next = next;
+  ci->permanent = 1;
+  ci->trustclasses = trustclass;
+  link_cache_slot (ci);
+
+  any_cert_of_class |= trustclass;
+  return 0;
+}
+
+
+/* A file with certificates to be loaded by load_queued_certs.  */
+struct cert_load_job_s
+{
+  struct cert_load_job_s *next;
+  unsigned int trustclass;  /* The CERTTRUST_CLASS values to set.  */
+  unsigned int is_bundle:1; /* A PEM file with several certificates.  */
+  unsigned int no_error:1;  /* Log a missing file only as info.  */
+  gpg_error_t err;          /* Error opening or parsing the file.  */
+  int err_stage;            /* One of the LOAD_ERR_ constants.  */
+  cert_item_t items;        /* The certificates read from the file.  */
+  cert_item_t *items_tail;
+  char fname[1];            /* The name of the file.  */
+};
+typedef struct cert_load_job_s *cert_load_job_t;
+
+/* Values for ERR_STAGE.  */
+#define LOAD_ERR_OPEN   1
+#define LOAD_ERR_READER 2
+#define LOAD_ERR_PARSE  3
+#define LOAD_ERR_CERT   4
+
+/* The list of files to load.  */
+struct cert_load_queue_s
+{
+  cert_load_job_t jobs;     /* The jobs in the order they were queued. */
+  cert_load_job_t *tail;
+  cert_load_job_t next_job; /* The next job to be taken by a thread.  */
+  unsigned int n_jobs;
+  unsigned int n_running;   /* Number of running threads.  */
+  npth_mutex_t lock;
+  npth_cond_t cond;
+};
+typedef struct cert_load_queue_s *cert_load_queue_t;
+
+
+/* Append the file FNAME to QUEUE.  */
+static void
+queue_cert_file (cert_load_queue_t queue, const char *fname,
+                 unsigned int trustclass, int is_bundle, int no_error)
+{
+  cert_load_job_t job;
+
+  job = xtrycalloc (1, sizeof *job + strlen (fname));
+  if (!job)
+    {
+      log_error (_("error loading certificate '%s': %s\n"),
+                 fname, gpg_strerror (gpg_error_from_syserror ()));
+      return;
+    }
+  strcpy (job->fname, fname);
+  job->trustclass = trustclass;
+  job->is_bundle = !!is_bundle;
+  job->no_error = !!no_error;
+  job->items_tail = &job->items;
+  *queue->tail = job;
+  queue->tail = &job->next;
+  queue->n_jobs++;
+}
+
+
+/* Queue certificates from the directory DIRNAME.  All certificates
    matching the pattern "*.crt" or "*.der"  are loaded.  We assume that
-   certificates are DER encoded and not PEM encapsulated.  The cache
-   should be in a locked state when calling this function.  */
+   certificates are DER encoded and not PEM encapsulated.  */
 static gpg_error_t
-load_certs_from_dir (const char *dirname, unsigned int trustclass)
+queue_certs_from_dir (cert_load_queue_t queue, const char *dirname,
+                      unsigned int trustclass)
 {
-  gpg_error_t err;
   DIR *dir;
   struct dirent *ep;
   char *p;
   size_t n;
-  estream_t fp;
-  ksba_reader_t reader;
-  ksba_cert_t cert;
-  char *fname = NULL;
+  char *fname;
 
   dir = opendir (dirname);
   if (!dir)
@@ -388,104 +691,84 @@ load_certs_from_dir (const char *dirname, unsigned int trustclass)
       if ( n < 5 || (strcmp (p+n-4,".crt") && strcmp (p+n-4,".der")))
         continue; /* Not the desired "*.crt" or "*.der" pattern.  */
 
-      xfree (fname);
       fname = make_filename (dirname, p, NULL);
-      fp = es_fopen (fname, "rb");
-      if (!fp)
-        {
-          log_error (_("can't open '%s': %s\n"),
-                     fname, strerror (errno));
-          continue;
-        }
-
-      err = create_estream_ksba_reader (&reader, fp);
-      if (err)
-        {
-          es_fclose (fp);
-          continue;
-        }
-
-      err = ksba_cert_new (&cert);
-      if (!err)
-        err = ksba_cert_read_der (cert, reader);
-      ksba_reader_release (reader);
-      es_fclose (fp);
-      if (err)
-        {
-          log_error (_("can't parse certificate '%s': %s\n"),
-                     fname, gpg_strerror (err));
-          ksba_cert_release (cert);
-          continue;
-        }
-
-      err = put_cert (cert, 1, trustclass, NULL);
-      if (gpg_err_code (err) == GPG_ERR_DUP_VALUE)
-        log_info (_("certificate '%s' already cached\n"), fname);
-      else if (!err)
-        {
-          if ((trustclass & CERTTRUST_CLASS_CONFIG))
-            http_register_cfg_ca (fname);
-
-          if (trustclass)
-            log_info (_("trusted certificate '%s' loaded\n"), fname);
-          else
-            log_info (_("certificate '%s' loaded\n"), fname);
-          if (opt.verbose)
-            {
-              p = get_fingerprint_hexstring_colon (cert);
-              log_info (_("  SHA1 fingerprint = %s\n"), p);
-              xfree (p);
-
-              cert_log_name (_("   issuer ="), cert);
-              cert_log_subject (_("  subject ="), cert);
-            }
-        }
-      else
-        log_error (_("error loading certificate '%s': %s\n"),
-                     fname, gpg_strerror (err));
-      ksba_cert_release (cert);
+      queue_cert_file (queue, fname, trustclass, 0, 0);
+      xfree (fname);
     }
 
-  xfree (fname);
   closedir (dir);
   return 0;
 }
 
 
-/* Load certificates from FILE.  The certificates are expected to be
+/* Queue certificates from FILE.  The certificates are expected to be
  * PEM encoded so that it is possible to load several certificates.
- * TRUSTCLASSES is used to mark the certificates as trusted.  The
- * cache should be in a locked state when calling this function.
- * NO_ERROR repalces an error message when FNAME was not found by an
+ * TRUSTCLASSES is used to mark the certificates as trusted.  NO_ERROR
+ * repalces an error message when FNAME was not found by an
  * information message.  */
 static gpg_error_t
-load_certs_from_file (const char *fname, unsigned int trustclasses,
-                      int no_error)
+queue_certs_from_file (cert_load_queue_t queue, const char *fname,
+                       unsigned int trustclasses, int no_error)
+{
+  queue_cert_file (queue, fname, trustclasses, 1, no_error);
+  return 0;
+}
+
+
+/* Add the certificate CERT to the list of JOB.  */
+static gpg_error_t
+add_loaded_cert (cert_load_job_t job, ksba_cert_t cert)
 {
   gpg_error_t err;
-  estream_t fp = NULL;
+  cert_item_t item;
+
+  item = xtrycalloc (1, sizeof *item);
+  if (!item)
+    return gpg_error_from_syserror ();
+  cert_compute_fpr (cert, item->fpr);
+  err = fill_cert_item (item, cert);
+  if (err)
+    {
+      xfree (item);
+      return err;
+    }
+  *job->items_tail = item;
+  job->items_tail = &item->next;
+  return 0;
+}
+
+
+/* Read and parse the certificates of JOB.  This does not access the
+ * cache and does not log anything; the results are stored in JOB.
+ * Thus this function may be called without holding the nPth lock.  */
+static void
+run_cert_load_job (cert_load_job_t job)
+{
+  gpg_error_t err;
+  estream_t fp;
   gnupg_ksba_io_t ioctx = NULL;
-  ksba_reader_t reader;
+  ksba_reader_t reader = NULL;
   ksba_cert_t cert = NULL;
 
-  fp = es_fopen (fname, "rb");
+  fp = es_fopen (job->fname, "rb");
   if (!fp)
     {
-      err = gpg_error_from_syserror ();
-      if (gpg_err_code (err) == GPG_ERR_ENONET && no_error)
-        log_info (_("can't open '%s': %s\n"), fname, gpg_strerror (err));
-      else
-        log_error (_("can't open '%s': %s\n"), fname, gpg_strerror (err));
-      goto leave;
+      job->err = gpg_error_from_syserror ();
+      job->err_stage = LOAD_ERR_OPEN;
+      return;
     }
 
-  err = gnupg_ksba_create_reader (&ioctx,
-                                  (GNUPG_KSBA_IO_AUTODETECT
-                                   | GNUPG_KSBA_IO_MULTIPEM),
-                                  fp, &reader);
+  if (job->is_bundle)
+    err = gnupg_ksba_create_reader (&ioctx,
+                                    (GNUPG_KSBA_IO_AUTODETECT
+                                     | GNUPG_KSBA_IO_MULTIPEM),
+                                    fp, &reader);
+  else
+    err = create_estream_ksba_reader (&reader, fp);
   if (err)
     {
-      log_error ("can't create reader: %s\n", gpg_strerror (err));
+      job->err = err;
+      job->err_stage = LOAD_ERR_READER;
       goto leave;
     }
 
@@ -499,32 +782,21 @@ load_certs_from_file (const char *fname, unsigned int trustclasses,
         err = ksba_cert_read_der (cert, reader);
       if (err)
         {
-          if (gpg_err_code (err) == GPG_ERR_EOF)
-            err = 0;
-          else
-            log_error (_("can't parse certificate '%s': %s\n"),
-                       fname, gpg_strerror (err));
+          if (!(job->is_bundle && gpg_err_code (err) == GPG_ERR_EOF))
+            {
+              job->err = err;
+              job->err_stage = LOAD_ERR_PARSE;
+            }
           goto leave;
         }
-
-      err = put_cert (cert, 1, trustclasses, NULL);
-      if (gpg_err_code (err) == GPG_ERR_DUP_VALUE)
-        log_info (_("certificate '%s' already cached\n"), fname);
-      else if (err)
-        log_error (_("error loading certificate '%s': %s\n"),
-                   fname, gpg_strerror (err));
-      else if (opt.verbose > 1)
+      err = add_loaded_cert (job, cert);
+      if (err && !job->err)
         {
-          char *p;
-
-          log_info (_("trusted certificate '%s' loaded\n"), fname);
-          p = get_fingerprint_hexstring_colon (cert);
-          log_info (_("  SHA1 fingerprint = %s\n"), p);
-          xfree (p);
-
-          cert_log_name    (_("   issuer ="), cert);
-          cert_log_subject (_("  subject ="), cert);
+          job->err = err;
+          job->err_stage = LOAD_ERR_CERT;
         }
+      if (!job->is_bundle)
+        break;
 
       ksba_reader_clear (reader, NULL, NULL);
     }
@@ -532,13 +804,197 @@ load_certs_from_file (const char *fname, unsigned int trustclasses,
 
  leave:
   ksba_cert_release (cert);
-  gnupg_ksba_destroy_reader (ioctx);
+  if (ioctx)
+    gnupg_ksba_destroy_reader (ioctx);
+  else
+    ksba_reader_release (reader);
   es_fclose (fp);
+}
 
-  return err;
+
+/* Take jobs from QUEUE until all have been processed.  The actual
+ * work is done without holding the nPth lock.  */
+static void
+process_cert_load_queue (cert_load_queue_t queue)
+{
+  cert_load_job_t job;
+  int unlocked;
+
+  for (;;)
+    {
+      npth_mutex_lock (&queue->lock);
+      job = queue->next_job;
+      if (job)
+        queue->next_job = job->next;
+      npth_mutex_unlock (&queue->lock);
+      if (!job)
+        break;
+
+      unlocked = dirmngr_enter_unlocked ();
+      run_cert_load_job (job);
+      if (unlocked)
+        dirmngr_leave_unlocked ();
+    }
+}
+
+
+/* The thread started by load_queued_certs.  */
+static void *
+cert_load_thread (void *arg)
+{
+  cert_load_queue_t queue = arg;
+
+  process_cert_load_queue (queue);
+
+  npth_mutex_lock (&queue->lock);
+  queue->n_running--;
+  npth_cond_signal (&queue->cond);
+  npth_mutex_unlock (&queue->lock);
+  return NULL;
+}
+
+
+/* Put the certificates read by JOB into the cache and log the
+ * result.  The cache should be in a locked state when calling this
+ * function.  */
+static void
+put_loaded_certs (cert_load_job_t job)
+{
+  gpg_error_t err;
+  cert_item_t item;
+  ksba_cert_t cert;
+  char *p;
+
+  while ((item = job->items))
+    {
+      job->items = item->next;
+      item->next = NULL;
+
+      cert = item->cert;
+      ksba_cert_ref (cert);
+      err = put_cert_item (item, job->trustclass);
+      if (gpg_err_code (err) == GPG_ERR_DUP_VALUE)
+        log_info (_("certificate '%s' already cached\n"), job->fname);
+      else if (err)
+        log_error (_("error loading certificate '%s': %s\n"),
+                   job->fname, gpg_strerror (err));
+      else if (!job->is_bundle || opt.verbose > 1)
+        {
+          if (!job->is_bundle && (job->trustclass & CERTTRUST_CLASS_CONFIG))
+            http_register_cfg_ca (job->fname);
+
+          if (job->trustclass)
+            log_info (_("trusted certificate '%s' loaded\n"), job->fname);
+          else
+            log_info (_("certificate '%s' loaded\n"), job->fname);
+          if (opt.verbose > 1 || (!job->is_bundle && opt.verbose))
+            {
+              p = get_fingerprint_hexstring_colon (cert);
+              log_info (_("  SHA1 fingerprint = %s\n"), p);
+              xfree (p);
+
+              cert_log_name (_("   issuer ="), cert);
+              cert_log_subject (_("  subject ="), cert);
+            }
+        }
+      if (err)
+        clean_cache_slot (item);
+      xfree (item);
+      ksba_cert_release (cert);
+    }
+
+  switch (job->err_stage)
+    {
+    case LOAD_ERR_OPEN:
+      if (gpg_err_code (job->err) == GPG_ERR_ENOENT && job->no_error)
+        log_info (_("can't open '%s': %s\n"),
+                  job->fname, gpg_strerror (job->err));
+      else
+        log_error (_("can't open '%s': %s\n"),
+                   job->fname, gpg_strerror (job->err));
+      break;
+    case LOAD_ERR_READER:
+      log_error ("can't create reader: %s\n", gpg_strerror (job->err));
+      break;
+    case LOAD_ERR_PARSE:
+      log_error (_("can't parse certificate '%s': %s\n"),
+                 job->fname, gpg_strerror (job->err));
+      break;
+    case LOAD_ERR_CERT:
+      log_error (_("error loading certificate '%s': %s\n"),
+                 job->fname, gpg_strerror (job->err));
+      break;
+    }
 }
 
 
+/* Load all files in QUEUE and release the queue.  The files are
+ * parsed by up to MAX_LOAD_THREADS threads in parallel but the
+ * certificates are put into the cache in the order of the queue.
+ * The cache should be in a locked state when calling this
+ * function.  */
+static void
+load_queued_certs (cert_load_queue_t queue)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+  cert_load_job_t job;
+  unsigned int i, n_threads;
+  int err;
+
+  queue->next_job = queue->jobs;
+  err = npth_mutex_init (&queue->lock, NULL);
+  if (!err)
+    err = npth_cond_init (&queue->cond, NULL);
+  if (err)
+    log_fatal ("error initializing the certificate loader: %s\n",
+               strerror (err));
+
+  /* The current thread does its share of the work; thus we start one
+   * thread less.  */
+  n_threads = queue->n_jobs < MAX_LOAD_THREADS? queue->n_jobs:MAX_LOAD_THREADS;
+  if (n_threads > 1 && !npth_attr_init (&tattr))
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+      for (i=1; i < n_threads; i++)
+        {
+          npth_mutex_lock (&queue->lock);
+          queue->n_running++;
+          npth_mutex_unlock (&queue->lock);
+          err = npth_create (&thread, &tattr, cert_load_thread, queue);
+          if (err)
+            {
+              log_error ("error spawning certificate loader thread: %s\n",
+                         strerror (err));
+              npth_mutex_lock (&queue->lock);
+              queue->n_running--;
+              npth_mutex_unlock (&queue->lock);
+              break;
+            }
+        }
+      npth_attr_destroy (&tattr);
+    }
+
+  process_cert_load_queue (queue);
+
+  npth_mutex_lock (&queue->lock);
+  while (queue->n_running)
+    npth_cond_wait (&queue->cond, &queue->lock);
+  npth_mutex_unlock (&queue->lock);
+
+  npth_cond_destroy (&queue->cond);
+  npth_mutex_destroy (&queue->lock);
+
+  while ((job = queue->jobs))
+    {
+      queue->jobs = job->next;
+      put_loaded_certs (job);
+      xfree (job);
+    }
+  queue->tail = &queue->jobs;
+  queue->n_jobs = 0;
+}
+
 #ifdef HAVE_W32_SYSTEM
 /* Load all certificates from the Windows store named STORENAME.  All
  * certificates are considered to be system provided trusted
@@ -654,12 +1110,15 @@ load_certs_from_w32_store (const char *storename)
 #endif /*HAVE_W32_SYSTEM*/
 
 
-/* Load the trusted certificates provided by the system.  */
+/* Load the trusted certificates provided by the system.  Files are
+   added to QUEUE.  */
 static gpg_error_t
-load_certs_from_system (void)
+load_certs_from_system (cert_load_queue_t queue)
 {
 #ifdef HAVE_W32_SYSTEM
 
+  (void)queue;
+
   load_certs_from_w32_store ("ROOT");
   load_certs_from_w32_store ("CA");
 
@@ -688,7 +1147,8 @@ load_certs_from_system (void)
     if (!access (table[idx].name, F_OK))
       {
         /* Take the first available bundle.  */
-        err = load_certs_from_file (table[idx].name, CERTTRUST_CLASS_SYSTEM, 0);
+        err = queue_certs_from_file (queue, table[idx].name,
+                                     CERTTRUST_CLASS_SYSTEM, 0);
         break;
       }
 
@@ -703,32 +1163,39 @@ cert_cache_init (strlist_t hkp_cacerts)
 {
   char *fname;
   strlist_t sl;
+  struct cert_load_queue_s queue;
 
   if (initialization_done)
     return;
   init_cache_lock ();
   acquire_cache_write_lock ();
 
-  load_certs_from_system ();
+  memset (&queue, 0, sizeof queue);
+  queue.tail = &queue.jobs;
+
+  load_certs_from_system (&queue);
 
   fname = make_filename_try (gnupg_sysconfdir (), "trusted-certs", NULL);
   if (fname)
-    load_certs_from_dir (fname, CERTTRUST_CLASS_CONFIG);
+    queue_certs_from_dir (&queue, fname, CERTTRUST_CLASS_CONFIG);
   xfree (fname);
 
   fname = make_filename_try (gnupg_sysconfdir (), "extra-certs", NULL);
   if (fname)
-    load_certs_from_dir (fname, 0);
+    queue_certs_from_dir (&queue, fname, 0);
   xfree (fname);
 
   fname = make_filename_try (gnupg_datadir (),
                              "sks-keyservers.netCA.pem", NULL);
   if (fname)
-    load_certs_from_file (fname, CERTTRUST_CLASS_HKPSPOOL, 1);
+    queue_certs_from_file (&queue, fname, CERTTRUST_CLASS_HKPSPOOL, 1);
   xfree (fname);
 
   for (sl = hkp_cacerts; sl; sl = sl->next)
-    load_certs_from_file (sl->d, CERTTRUST_CLASS_HKP, 0);
+    queue_certs_from_file (&queue, sl->d, CERTTRUST_CLASS_HKP, 0);
+
+  /* Now parse all the files.  */
+  load_queued_certs (&queue);
 
   initialization_done = 1;
   release_cache_lock ();
@@ -945,22 +1412,20 @@ get_cert_byhexfpr (const char *string)
 ksba_cert_t
 get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 {
-  /* Simple and inefficient implementation.   fixme! */
   cert_item_t ci;
-  int i;
+  unsigned int hash;
+
+  hash = sn_hash (issuer_dn, serialno);
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn)
-            && !compare_serialno (ci->sn, serialno))
-          {
-            ksba_cert_ref (ci->cert);
-            release_cache_lock ();
-            return ci->cert;
-          }
-    }
+  for (ci=sn_index[INDEX_SLOT (hash)]; ci; ci = ci->sn_next)
+    if (ci->sn_hash == hash && !strcmp (ci->issuer_dn, issuer_dn)
+        && !compare_serialno (ci->sn, serialno))
+      {
+        ksba_cert_ref (ci->cert);
+        release_cache_lock ();
+        return ci->cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -972,22 +1437,20 @@ get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 ksba_cert_t
 get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
+  unsigned int hash;
+
+  hash = issuer_hash (issuer_dn);
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci=issuer_index[INDEX_SLOT (hash)]; ci; ci = ci->issuer_next)
+    if (ci->issuer_hash == hash && !strcmp (ci->issuer_dn, issuer_dn))
+      if (!seq--)
+        {
+          ksba_cert_ref (ci->cert);
+          release_cache_lock ();
+          return ci->cert;
+        }
 
   release_cache_lock ();
   return NULL;
@@ -999,26 +1462,49 @@ get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 ksba_cert_t
 get_cert_bysubject (const char *subject_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
+  unsigned int hash;
 
   if (!subject_dn)
     return NULL;
 
+  hash = subject_hash (subject_dn);
+
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && ci->subject_dn
-            && !strcmp (ci->subject_dn, subject_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci=subject_index[INDEX_SLOT (hash)]; ci; ci = ci->subject_next)
+    if (ci->subject_hash == hash && !strcmp (ci->subject_dn, subject_dn))
+      if (!seq--)
+        {
+          ksba_cert_ref (ci->cert);
+          release_cache_lock ();
+          return ci->cert;
+        }
+
+  release_cache_lock ();
+  return NULL;
+}
+
+
+/* Return the certificate matching SUBJECT_DN and the subject key
+   identifier KEYID.  If SUBJECT_DN is NULL only KEYID is used.  */
+static ksba_cert_t
+get_cert_byski (const char *subject_dn, ksba_const_sexp_t keyid)
+{
+  cert_item_t ci;
+  unsigned int hash;
+
+  hash = ski_hash (keyid);
+
+  acquire_cache_read_lock ();
+  for (ci=ski_index[INDEX_SLOT (hash)]; ci; ci = ci->ski_next)
+    if (ci->ski_hash == hash && !cmp_simple_canon_sexp (keyid, ci->ski)
+        && (!subject_dn
+            || (ci->subject_dn && !strcmp (ci->subject_dn, subject_dn))))
+      {
+        ksba_cert_ref (ci->cert);
+        release_cache_lock ();
+        return ci->cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -1233,6 +1719,110 @@ classify_pattern (const char *pattern, size_t *r_offset, size_t *r_sn_offset)
 
 
 
+/* Collect all certificates matching PATTERN of class CLASS using the
+   secondary indices.  Only PATTERN_SUBJECT, PATTERN_ISSUER,
+   PATTERN_SHORT_KEYID and PATTERN_LONG_KEYID are supported.  On
+   success an array with references to the certificates is stored at
+   R_CERTS and the number of certificates at R_NCERTS; the caller must
+   release the certificates and the array.  All matches are collected
+   in one walk so that the callback is not run with the cache lock
+   held.  */
+static gpg_error_t
+collect_certs_byindex (enum pattern_class class, const char *pattern,
+                       ksba_cert_t **r_certs, size_t *r_ncerts)
+{
+  gpg_error_t err = 0;
+  cert_item_t ci, next;
+  unsigned int hash;
+  unsigned char kid[8];
+  size_t kidlen = 0;
+  ksba_cert_t *certs = NULL;
+  ksba_cert_t *tmp;
+  size_t ncerts = 0;
+  size_t size = 0;
+  int match;
+
+  *r_certs = NULL;
+  *r_ncerts = 0;
+
+  switch (class)
+    {
+    case PATTERN_SUBJECT:
+      hash = subject_hash (pattern);
+      break;
+    case PATTERN_ISSUER:
+      hash = issuer_hash (pattern);
+      break;
+    case PATTERN_SHORT_KEYID:
+    case PATTERN_LONG_KEYID:
+      kidlen = class == PATTERN_SHORT_KEYID? 4 : 8;
+      if (hex2bin (pattern, kid, kidlen) < 0)
+        return gpg_error (GPG_ERR_INV_NAME);
+      hash = buf32_to_uint (kid + kidlen - 4);
+      break;
+    default:
+      return gpg_error (GPG_ERR_BUG);
+    }
+
+  acquire_cache_read_lock ();
+  if (class == PATTERN_SUBJECT)
+    ci = subject_index[INDEX_SLOT (hash)];
+  else if (class == PATTERN_ISSUER)
+    ci = issuer_index[INDEX_SLOT (hash)];
+  else
+    ci = kid_index[INDEX_SLOT (hash)];
+  for (; ci; ci = next)
+    {
+      if (class == PATTERN_SUBJECT)
+        {
+          next = ci->subject_next;
+          match = (ci->subject_hash == hash
+                   && !strcmp (ci->subject_dn, pattern));
+        }
+      else if (class == PATTERN_ISSUER)
+        {
+          next = ci->issuer_next;
+          match = (ci->issuer_hash == hash
+                   && !strcmp (ci->issuer_dn, pattern));
+        }
+      else
+        {
+          next = ci->kid_next;
+          match = !memcmp (ci->fpr + 20 - kidlen, kid, kidlen);
+        }
+      if (!match)
+        continue;
+
+      if (ncerts == size)
+        {
+          size += 16;
+          tmp = xtryrealloc (certs, size * sizeof *certs);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+          certs = tmp;
+        }
+      ksba_cert_ref (ci->cert);
+      certs[ncerts++] = ci->cert;
+    }
+  release_cache_lock ();
+
+  if (err)
+    {
+      while (ncerts)
+        ksba_cert_release (certs[--ncerts]);
+      xfree (certs);
+      return err;
+    }
+
+  *r_certs = certs;
+  *r_ncerts = ncerts;
+  return 0;
+}
+
+
 /* Given PATTERN, which is a string as used by GnuPG to specify a
    certificate, return all matching certificates by calling the
    supplied function RETFNC.  */
@@ -1247,7 +1837,8 @@ get_certs_bypattern (const char *pattern,
   const char *hexserialno;
   ksba_sexp_t serialno = NULL;
   ksba_cert_t cert = NULL;
-  unsigned int seq;
+  ksba_cert_t *certs;
+  size_t ncerts, idx;
 
   if (!pattern || !retfnc)
     return gpg_error (GPG_ERR_INV_ARG);
@@ -1278,32 +1869,24 @@ get_certs_bypattern (const char *pattern,
       break;
 
     case PATTERN_ISSUER:
-      for (seq=0,err=0; !err && (cert = get_cert_byissuer (pattern, seq)); seq++)
-        {
-          err = retfnc (retfnc_data, cert);
-          ksba_cert_release (cert);
-          cert = NULL;
-        }
-      if (!err && !seq)
-        err = gpg_error (GPG_ERR_NOT_FOUND);
-      break;
-
     case PATTERN_SUBJECT:
-      for (seq=0,err=0; !err && (cert = get_cert_bysubject (pattern, seq));seq++)
-        {
-          err = retfnc (retfnc_data, cert);
-          ksba_cert_release (cert);
-          cert = NULL;
-        }
-      if (!err && !seq)
+    case PATTERN_SHORT_KEYID:
+    case PATTERN_LONG_KEYID:
+      err = collect_certs_byindex (class, pattern, &certs, &ncerts);
+      if (err)
+        break;
+      for (idx=0; idx < ncerts && !err; idx++)
+        err = retfnc (retfnc_data, certs[idx]);
+      for (idx=0; idx < ncerts; idx++)
+        ksba_cert_release (certs[idx]);
+      xfree (certs);
+      if (!err && !ncerts)
         err = gpg_error (GPG_ERR_NOT_FOUND);
       break;
 
     case PATTERN_EMAIL:
     case PATTERN_EMAIL_SUBSTR:
     case PATTERN_FINGERPRINT16:
-    case PATTERN_SHORT_KEYID:
-    case PATTERN_LONG_KEYID:
     case PATTERN_SUBSTR:
     case PATTERN_SERIALNO:
       /* Not supported.  */
@@ -1443,7 +2026,6 @@ ksba_cert_t
 find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
 {
   gpg_error_t err;
-  int seq;
   ksba_cert_t cert = NULL;
   cert_fetch_context_t context = NULL;
   ksba_sexp_t subj;
@@ -1458,77 +2040,42 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
     {
       cert_item_t ci;
       cert_ref_t cr;
-      int i;
+      unsigned int hash;
 
       /* For efficiency reasons we won't use get_cert_bysubject here. */
+      hash = subject_hash (subject_dn);
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && ci->subject_dn
-              && !strcmp (ci->subject_dn, subject_dn))
-            for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
-              if (!memcmp (ci->fpr, cr->fpr, 20))
-                {
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  if (DBG_LOOKUP)
-                    log_debug ("%s: certificate found in the cache"
-                               " via ocsp_certs\n", __func__);
-                  return ci->cert; /* We use this certificate. */
-                }
+      for (ci=subject_index[INDEX_SLOT (hash)]; ci; ci = ci->subject_next)
+        if (ci->subject_hash == hash && !strcmp (ci->subject_dn, subject_dn))
+          for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
+            if (!memcmp (ci->fpr, cr->fpr, 20))
+              {
+                ksba_cert_ref (ci->cert);
+                release_cache_lock ();
+                if (DBG_LOOKUP)
+                  log_debug ("%s: certificate found in the cache"
+                             " via ocsp_certs\n", __func__);
+                return ci->cert; /* We use this certificate. */
+              }
       release_cache_lock ();
       if (DBG_LOOKUP)
         log_debug ("find_cert_bysubject: certificate not in ocsp_certs\n");
     }
 
-  /* Now check whether the certificate is cached.  */
-  for (seq=0; (cert = get_cert_bysubject (subject_dn, seq)); seq++)
+  /* Now check whether the certificate is cached.  If we do not have
+   * a subject DN but have a keyid, try to locate it by keyid.  */
+  if (keyid)
     {
-      if (!keyid)
-        break; /* No keyid requested, so return the first one found. */
-      if (!ksba_cert_get_subj_key_id (cert, NULL, &subj)
-          && !cmp_simple_canon_sexp (keyid, subj))
-        {
-          xfree (subj);
-          if (DBG_LOOKUP)
-            log_debug ("%s: certificate found in the cache"
-                       " via subject DN\n", __func__);
-          break; /* Found matching cert. */
-        }
-      xfree (subj);
-      ksba_cert_release (cert);
+      cert = get_cert_byski (subject_dn, keyid);
+      if (cert && DBG_LOOKUP)
+        log_debug ("%s: certificate found in the cache"
+                   " via %s\n", __func__, subject_dn? "subject DN":"ski");
     }
+  else
+    cert = get_cert_bysubject (subject_dn, 0);
   if (cert)
     return cert; /* Done.  */
 
-  /* If we do not have a subject DN but have a keyid, try to locate it
-   * by keyid.  */
-  if (!subject_dn && keyid)
-    {
-      int i;
-      cert_item_t ci;
-      ksba_sexp_t ski;
-
-      acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && !ksba_cert_get_subj_key_id (ci->cert, NULL, &ski))
-            {
-              if (!cmp_simple_canon_sexp (keyid, ski))
-                {
-                  ksba_free (ski);
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  if (DBG_LOOKUP)
-                    log_debug ("%s: certificate found in the cache"
-                               " via ski\n", __func__);
-                  return ci->cert;
-                }
-              ksba_free (ski);
-            }
-      release_cache_lock ();
-    }
-
   if (DBG_LOOKUP)
     log_debug ("find_cert_bysubject: certificate not in cache\n");
 
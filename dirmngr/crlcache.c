@@ -62,7 +62,7 @@
         Field 4: URL used to retrieve the corresponding CRL.
         Field 5: 15 character ISO timestamp with THIS_UPDATE.
         Field 6: 15 character ISO timestamp with NEXT_UPDATE.
-        Field 7: Hexadecimal encoded MD-5 hash of the DB file to detect
+        Field 7: Hexadecimal encoded identifier of the DB file to detect
                  accidental modified (i.e. deleted and created) cache files.
         Field 8: optional CRL number as a hex string.
         Field 9:  AuthorityKeyID.issuer, each Name separated by 0x01
@@ -71,14 +71,11 @@
 
    2. Layout of the standard CRL Cache DB file:
 
-      We use records of variable length with this structure
-
-      n  bytes  Serialnumber (binary) used as key
-                thus there is no need to store the length explicitly with DB2.
-      1  byte   Reason for revocation
-                (currently the KSBA reason flags are used)
-      15 bytes  ISO date of revocation (e.g. 19980815T142000)
-                Note that there is no terminating 0 stored.
+      The revoked serial numbers are stored sorted by serial number
+      in records of fixed length, so that a lookup is a binary search
+      in the memory mapped file; see crldb.c for the details.  The
+      random file identifier stored in the header of the file is also
+      stored in field 7 of the CRL cache record.
 
       The filename used is the hexadecimal (using uppercase letters)
       SHA-1 hash value of the issuer DN prefixed with a "crl-" and
@@ -112,12 +109,12 @@
 #include "crlcache.h"
 #include "crlfetch.h"
 #include "misc.h"
-#include "cdb.h"
+#include "crldb.h"
 
 /* Change this whenever the format changes */
 #define DBDIR_D "crls.d"
 #define DBDIRFILE "DIR.txt"
-#define DBDIRVERSION 1
+#define DBDIRVERSION 2
 
 /* The number of DB files we may have open at one time.  We need to
    limit this because there is no guarantee that the number of issuers
@@ -132,6 +129,7 @@
 static const char oidstr_crlNumber[] = "2.5.29.20";
 /* static const char oidstr_issuingDistributionPoint[] = "2.5.29.28"; */
 static const char oidstr_authorityKeyIdentifier[] = "2.5.29.35";
+static const char oidstr_deltaCRLIndicator[] = "2.5.29.27";
 
 
 /* Definition of one cached item. */
@@ -145,7 +143,8 @@ struct crl_cache_entry_s
   char *url;          /* Points into RELEASE_PTR. */
   char *issuer;       /* Ditto. */
   char *issuer_hash;  /* Ditto. */
-  char *dbfile_hash;  /* MD5 sum of the cache file, points into RELEASE_PTR.*/
+  char *dbfile_hash;  /* Hex encoded identifier of the cache file,
+                         points into RELEASE_PTR.*/
   int invalid;        /* Can't use this CRL. */
   int user_trust_req; /* User supplied root certificate required.  */
   char *check_trust_anchor;  /* Malloced fingerprint.  */
@@ -156,10 +155,10 @@ struct crl_cache_entry_s
   char *authority_issuer;
   char *authority_serialno;
 
-  struct cdb *cdb;             /* The cache file handle or NULL if not open. */
+  crldb_t db;                  /* The cache file handle or NULL if not open. */
 
-  unsigned int cdb_use_count;  /* Current use count. */
-  unsigned int cdb_lru_count;  /* Used for LRU purposes. */
+  unsigned int db_use_count;   /* Current use count. */
+  unsigned int db_lru_count;   /* Used for LRU purposes. */
   int dbfile_checked;          /* Set to true if the dbfile_hash value has
                                   been checked one. */
 };
@@ -367,14 +366,7 @@ release_one_cache_entry (crl_cache_entry_t entry)
 {
   if (entry)
     {
-      if (entry->cdb)
-        {
-          int fd = cdb_fileno (entry->cdb);
-          cdb_free (entry->cdb);
-          xfree (entry->cdb);
-          if (close (fd))
-            log_error (_("error closing cache file: %s\n"), strerror(errno));
-        }
+      crldb_close (entry->db);
       xfree (entry->release_ptr);
       xfree (entry->check_trust_anchor);
       xfree (entry);
@@ -987,109 +979,42 @@ make_db_file_name (const char *issuer_hash)
 }
 
 
-/* Hash the file FNAME and return the MD5 digest in MD5BUFFER. The
-   caller must allocate MD%buffer wityh at least 16 bytes. Returns 0
-   on success. */
-static int
-hash_dbfile (const char *fname, unsigned char *md5buffer)
-{
-  estream_t fp;
-  char *buffer;
-  size_t n;
-  gcry_md_hd_t md5;
-  gpg_error_t err;
-
-  buffer = xtrymalloc (65536);
-  fp = buffer? es_fopen (fname, "rb") : NULL;
-  if (!fp)
-    {
-      log_error (_("can't hash '%s': %s\n"), fname, strerror (errno));
-      xfree (buffer);
-      return -1;
-    }
-
-  err = gcry_md_open (&md5, GCRY_MD_MD5, 0);
-  if (err)
-    {
-      log_error (_("error setting up MD5 hash context: %s\n"),
-                 gpg_strerror (err));
-      xfree (buffer);
-      es_fclose (fp);
-      return -1;
-    }
-
-  /* We better hash some information about the cache file layout in. */
-  sprintf (buffer, "%.100s/%.100s:%d", DBDIR_D, DBDIRFILE, DBDIRVERSION);
-  gcry_md_write (md5, buffer, strlen (buffer));
-
-  for (;;)
-    {
-      n = es_fread (buffer, 1, 65536, fp);
-      if (n < 65536 && es_ferror (fp))
-        {
-          log_error (_("error hashing '%s': %s\n"), fname, strerror (errno));
-          xfree (buffer);
-          es_fclose (fp);
-          gcry_md_close (md5);
-          return -1;
-        }
-      if (!n)
-        break;
-      gcry_md_write (md5, buffer, n);
-    }
-  es_fclose (fp);
-  xfree (buffer);
-  gcry_md_final (md5);
-
-  memcpy (md5buffer, gcry_md_read (md5, GCRY_MD_MD5), 16);
-  gcry_md_close (md5);
-  return 0;
-}
-
-/* Compare the file FNAME against the dexified MD5 hash MD5HASH and
-   return 0 if they match. */
+/* Compare the identifier of the database DB against the hex encoded
+   identifier IDHEX and return 0 if they match. */
 static int
-check_dbfile (const char *fname, const char *md5hexvalue)
+check_dbfile (crldb_t db, const char *idhex)
 {
-  unsigned char buffer1[16], buffer2[16];
+  unsigned char buffer[CRLDB_ID_LEN];
 
-  if (strlen (md5hexvalue) != 32)
-    {
-      log_error (_("invalid formatted checksum for '%s'\n"), fname);
-      return -1;
-    }
-  unhexify (buffer1, md5hexvalue);
-
-  if (hash_dbfile (fname, buffer2))
+  if (strlen (idhex) != 2*CRLDB_ID_LEN
+      || hex2bin (idhex, buffer, sizeof buffer) < 0)
     return -1;
 
-  return memcmp (buffer1, buffer2, 16);
+  return memcmp (buffer, crldb_get_id (db), CRLDB_ID_LEN);
 }
 
 
 /* Open the cache file for ENTRY.  This function implements a caching
    strategy and might close unused cache files. It is required to use
    unlock_db_file after using the file. */
-static struct cdb *
+static crldb_t
 lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
 {
+  gpg_error_t err;
   char *fname;
-  int fd;
   int open_count;
   crl_cache_entry_t e;
 
-  if (entry->cdb)
+  if (entry->db)
     {
-      entry->cdb_use_count++;
-      return entry->cdb;
+      entry->db_use_count++;
+      return entry->db;
     }
 
   for (open_count = 0, e = cache->entries; e; e = e->next)
     {
-      if (e->cdb)
+      if (e->db)
         open_count++;
-/*       log_debug ("CACHE: cdb=%p use_count=%u lru_count=%u\n", */
-/*                  e->cdb,e->cdb_use_count,e->cdb_lru_count); */
     }
 
   /* If there are too many file open, find the least recent used DB
@@ -1101,9 +1026,9 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
       unsigned int last_lru = (unsigned int)(-1);
 
       for (e = cache->entries; e; e = e->next)
-        if (e->cdb && !e->cdb_use_count && e->cdb_lru_count < last_lru)
+        if (e->db && !e->db_use_count && e->db_lru_count < last_lru)
           {
-            last_lru = e->cdb_lru_count;
+            last_lru = e->db_lru_count;
             last_e = e;
           }
       if (!last_e)
@@ -1112,14 +1037,8 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
           return NULL;
         }
 
-/*       log_debug ("CACHE: closing file at cdb=%p\n", last_e->cdb); */
-
-      fd = cdb_fileno (last_e->cdb);
-      cdb_free (last_e->cdb);
-      xfree (last_e->cdb);
-      last_e->cdb = NULL;
-      if (close (fd))
-        log_error (_("error closing cache file: %s\n"), strerror(errno));
+      crldb_close (last_e->db);
+      last_e->db = NULL;
       open_count--;
     }
 
@@ -1128,65 +1047,44 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   if (opt.verbose)
     log_info (_("opening cache file '%s'\n"), fname );
 
-  if (!entry->dbfile_checked)
-    {
-      if (!check_dbfile (fname, entry->dbfile_hash))
-        entry->dbfile_checked = 1;
-      /* Note, in case of an error we don't print an error here but
-         let require the caller to do that check. */
-    }
-
-  entry->cdb = xtrycalloc (1, sizeof *entry->cdb);
-  if (!entry->cdb)
-    {
-      xfree (fname);
-      return NULL;
-    }
-  fd = open (fname, O_RDONLY | O_BINARY);
-  if (fd == -1)
+  err = crldb_open (fname, &entry->db);
+  if (err)
     {
       log_error (_("error opening cache file '%s': %s\n"),
-                 fname, strerror (errno));
-      xfree (entry->cdb);
-      entry->cdb = NULL;
-      xfree (fname);
-      return NULL;
-    }
-  if (cdb_init (entry->cdb, fd))
-    {
-      log_error (_("error initializing cache file '%s' for reading: %s\n"),
-                 fname, strerror (errno));
-      xfree (entry->cdb);
-      entry->cdb = NULL;
-      close (fd);
+                 fname, gpg_strerror (err));
       xfree (fname);
       return NULL;
     }
   xfree (fname);
 
-  entry->cdb_use_count = 1;
-  entry->cdb_lru_count = 0;
+  /* Note, in case of an error we don't print an error here but let
+     require the caller to do that check. */
+  if (!entry->dbfile_checked && !check_dbfile (entry->db, entry->dbfile_hash))
+    entry->dbfile_checked = 1;
 
-  return entry->cdb;
+  entry->db_use_count = 1;
+  entry->db_lru_count = 0;
+
+  return entry->db;
 }
 
 /* Unlock a cache file, so that it can be reused. */
 static void
 unlock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
 {
-  if (!entry->cdb)
+  if (!entry->db)
     log_error (_("calling unlock_db_file on a closed file\n"));
-  else if (!entry->cdb_use_count)
+  else if (!entry->db_use_count)
     log_error (_("calling unlock_db_file on an unlocked file\n"));
   else
     {
-      entry->cdb_use_count--;
-      entry->cdb_lru_count++;
+      entry->db_use_count--;
+      entry->db_lru_count++;
     }
 
   /* If the entry was marked for deletion in the meantime do it now.
      We do this for the sake of Pth thread safeness. */
-  if (!entry->cdb_use_count && entry->deleted)
+  if (!entry->db_use_count && entry->deleted)
     {
       crl_cache_entry_t eprev, enext;
 
@@ -1264,32 +1162,23 @@ crl_cache_flush (void)
 }
 
 
-/* Check whether the certificate identified by ISSUER_HASH and
-   SN/SNLEN is valid; i.e. not listed in our cache.  With
-   FORCE_REFRESH set to true, a new CRL will be retrieved even if the
-   cache has not yet expired.  We use a 30 minutes threshold here so
-   that invoking this function several times won't load the CRL over
-   and over.  */
-static crl_cache_result_t
-cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
-               const unsigned char *sn, size_t snlen,
-               int force_refresh)
+/* Return the cache entry for ISSUER_HASH if it may be used for a
+   check.  If not, NULL is returned and the reason is stored at
+   R_RESULT.  See cache_isvalid for FORCE_REFRESH.  */
+static crl_cache_entry_t
+find_usable_entry (crl_cache_t cache, const char *issuer_hash,
+                   int force_refresh, crl_cache_result_t *r_result)
 {
-  crl_cache_t cache = get_current_cache ();
-  crl_cache_result_t retval;
-  struct cdb *cdb;
-  int rc;
   crl_cache_entry_t entry;
   gnupg_isotime_t current_time;
-  size_t n;
 
-  (void)ctrl;
+  *r_result = CRL_CACHE_DONTKNOW;
 
   entry = find_entry (cache->entries, issuer_hash);
   if (!entry)
     {
       log_info (_("no CRL available for issuer id %s\n"), issuer_hash );
-      return CRL_CACHE_DONTKNOW;
+      return NULL;
     }
 
   gnupg_get_isotime (current_time);
@@ -1297,7 +1186,7 @@ cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
     {
       log_info (_("cached CRL for issuer id %s too old; update required\n"),
                 issuer_hash);
-      return CRL_CACHE_DONTKNOW;
+      return NULL;
     }
   if (force_refresh)
     {
@@ -1312,7 +1201,7 @@ cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
               log_info (_("force-crl-refresh active and %d minutes passed for"
                           " issuer id %s; update required\n"),
                         30, issuer_hash);
-              return CRL_CACHE_DONTKNOW;
+              return NULL;
             }
         }
       else
@@ -1320,7 +1209,7 @@ cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
           log_info (_("force-crl-refresh active for"
                       " issuer id %s; update required\n"),
                     issuer_hash);
-          return CRL_CACHE_DONTKNOW;
+          return NULL;
         }
     }
 
@@ -1328,65 +1217,49 @@ cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
     {
       log_info (_("available CRL for issuer ID %s can't be used\n"),
                 issuer_hash);
-      return CRL_CACHE_CANTUSE;
+      *r_result = CRL_CACHE_CANTUSE;
+      return NULL;
     }
 
-  cdb = lock_db_file (cache, entry);
-  if (!cdb)
-    return CRL_CACHE_DONTKNOW; /* Hmmm, not the best error code. */
+  return entry;
+}
 
-  if (!entry->dbfile_checked)
-    {
-      log_error (_("cached CRL for issuer id %s tampered; we need to update\n")
-                 , issuer_hash);
-      unlock_db_file (cache, entry);
-      return CRL_CACHE_DONTKNOW;
-    }
 
-  rc = cdb_find (cdb, sn, snlen);
-  if (rc == 1)
-    {
-      n = cdb_datalen (cdb);
-      if (n != 16)
-        {
-          log_error (_("WARNING: invalid cache record length for S/N "));
-          log_printf ("0x");
-          log_printhex (sn, snlen, "");
-        }
-      else if (opt.verbose)
-        {
-          unsigned char record[16];
-          char *tmp = hexify_data (sn, snlen, 1);
+/* Look up the serial number SN/SNLEN in the cache file DB.  */
+static crl_cache_result_t
+lookup_serial (crldb_t db, const unsigned char *sn, size_t snlen)
+{
+  struct crldb_item_s item;
+  char *tmp;
 
-          if (cdb_read (cdb, record, n, cdb_datapos (cdb)))
-            log_error (_("problem reading cache record for S/N %s: %s\n"),
-                       tmp, strerror (errno));
-          else
-            log_info (_("S/N %s is not valid; reason=%02X  date=%.15s\n"),
-                      tmp, *record, record+1);
-          xfree (tmp);
-        }
-      retval = CRL_CACHE_INVALID;
-    }
-  else if (!rc)
+  if (crldb_find (db, sn, snlen, &item))
     {
       if (opt.verbose)
         {
-          char *serialno = hexify_data (sn, snlen, 1);
-          log_info (_("S/N %s is valid, it is not listed in the CRL\n"),
-                    serialno );
-          xfree (serialno);
+          tmp = hexify_data (sn, snlen, 1);
+          log_info (_("S/N %s is not valid; reason=%02X  date=%.15s\n"),
+                    tmp, item.reason, item.rdate);
+          xfree (tmp);
         }
-      retval = CRL_CACHE_VALID;
+      return CRL_CACHE_INVALID;
     }
-  else
+
+  if (opt.verbose)
     {
-      log_error (_("error getting data from cache file: %s\n"),
-                 strerror (errno));
-      retval = CRL_CACHE_DONTKNOW;
+      tmp = hexify_data (sn, snlen, 1);
+      log_info (_("S/N %s is valid, it is not listed in the CRL\n"), tmp);
+      xfree (tmp);
     }
+  return CRL_CACHE_VALID;
+}
 
 
+/* Check whether the result RETVAL taken from the CRL of ENTRY may be
+   used.  Returns the final result.  */
+static crl_cache_result_t
+check_user_trust (ctrl_t ctrl, crl_cache_entry_t entry,
+                  crl_cache_result_t retval)
+{
   if (entry->user_trust_req
       && (retval == CRL_CACHE_VALID || retval == CRL_CACHE_INVALID))
     {
@@ -1408,12 +1281,115 @@ cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
         }
     }
 
+  return retval;
+}
+
+
+/* Check whether the certificate identified by ISSUER_HASH and
+   SN/SNLEN is valid; i.e. not listed in our cache.  With
+   FORCE_REFRESH set to true, a new CRL will be retrieved even if the
+   cache has not yet expired.  We use a 30 minutes threshold here so
+   that invoking this function several times won't load the CRL over
+   and over.  */
+static crl_cache_result_t
+cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
+               const unsigned char *sn, size_t snlen,
+               int force_refresh)
+{
+  crl_cache_t cache = get_current_cache ();
+  crl_cache_result_t retval;
+  crl_cache_entry_t entry;
+  crldb_t db;
+
+  entry = find_usable_entry (cache, issuer_hash, force_refresh, &retval);
+  if (!entry)
+    return retval;
+
+  db = lock_db_file (cache, entry);
+  if (!db)
+    return CRL_CACHE_DONTKNOW; /* Hmmm, not the best error code. */
+
+  if (!entry->dbfile_checked)
+    {
+      log_error (_("cached CRL for issuer id %s tampered; we need to update\n")
+                 , issuer_hash);
+      unlock_db_file (cache, entry);
+      return CRL_CACHE_DONTKNOW;
+    }
+
+  retval = lookup_serial (db, sn, snlen);
+  retval = check_user_trust (ctrl, entry, retval);
+
   unlock_db_file (cache, entry);
 
   return retval;
 }
 
 
+/* Check the NSERIALS hex encoded serial numbers SERIALNOS of
+   certificates issued by the issuer with ISSUER_HASH in one go and
+   store the results in the caller provided array RESULTS.  This is
+   the same as calling crl_cache_isvalid for each serial number but
+   the CRL is looked up and checked only once.  */
+void
+crl_cache_isvalid_many (ctrl_t ctrl, const char *issuer_hash,
+                        const char **serialnos, int nserials,
+                        crl_cache_result_t *results, int force_refresh)
+{
+  crl_cache_t cache = get_current_cache ();
+  crl_cache_result_t retval;
+  crl_cache_entry_t entry;
+  crldb_t db;
+  unsigned char snbuf[CRLDB_MAX_SNLEN];
+  size_t n;
+  int i;
+
+  entry = find_usable_entry (cache, issuer_hash, force_refresh, &retval);
+  if (entry)
+    {
+      db = lock_db_file (cache, entry);
+      if (db && !entry->dbfile_checked)
+        {
+          log_error (_("cached CRL for issuer id %s tampered;"
+                       " we need to update\n"), issuer_hash);
+          unlock_db_file (cache, entry);
+          db = NULL;
+        }
+    }
+  else
+    db = NULL;
+
+  if (!db)
+    {
+      if (entry)
+        retval = CRL_CACHE_DONTKNOW;
+      for (i=0; i < nserials; i++)
+        results[i] = retval;
+      return;
+    }
+
+  for (i=0; i < nserials; i++)
+    {
+      if (strlen (serialnos[i]) > 2*CRLDB_MAX_SNLEN)
+        results[i] = CRL_CACHE_VALID;  /* Can't be listed.  */
+      else
+        {
+          n = unhexify (snbuf, serialnos[i]);
+          results[i] = lookup_serial (db, snbuf, n);
+        }
+    }
+
+  /* The user trust check is the same for all serial numbers; thus
+     we do it only once.  */
+  retval = check_user_trust (ctrl, entry, CRL_CACHE_VALID);
+  if (retval != CRL_CACHE_VALID)
+    for (i=0; i < nserials; i++)
+      results[i] = retval;
+
+  unlock_db_file (cache, entry);
+}
+
+
 /* Check whether the certificate identified by ISSUER_HASH and
    SERIALNO is valid; i.e. not listed in our cache.  With
    FORCE_REFRESH set to true, a new CRL will be retrieved even if the
@@ -1662,10 +1638,10 @@ abort_sig_check (ksba_crl_t crl, gcry_md_hd_t md)
 
 
 /* Workhorse of the CRL loading machinery.  The CRL is read using the
-   CRL object and stored in the data base file DB with the name FNAME
-   (only used for printing error messages).  That DB should be a
-   temporary one and not the actual one.  If the function fails the
-   caller should delete this temporary database file.  CTRL is
+   CRL object and its items are collected in MK, which is used to
+   create a temporary data base file with the name FNAME (only used
+   for printing error messages).  If the function fails the caller
+   should delete this temporary database file.  CTRL is
    required to retrieve certificates using the general dirmngr
    callback service.  R_CRLISSUER returns an allocated string with the
    crl-issuer DN, THIS_UPDATE and NEXT_UPDATE are filled with the
@@ -1678,7 +1654,7 @@ abort_sig_check (ksba_crl_t crl, gcry_md_hd_t md)
 */
 static int
 crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
-                  struct cdb_make *cdb, const char *fname,
+                  crldb_make_t mk, const char *fname,
                   char **r_crlissuer,
                   ksba_isotime_t thisupdate, ksba_isotime_t nextupdate,
                   char **r_trust_anchor)
@@ -1742,8 +1718,6 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
             const unsigned char *p;
             ksba_isotime_t rdate;
             ksba_crl_reason_t reason;
-            int rc;
-            unsigned char record[1+15];
 
             err = ksba_crl_get_item (crl, &serial, rdate, &reason);
             if (err)
@@ -1757,15 +1731,19 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
             p = serial_to_buffer (serial, &n);
             if (!p)
               BUG ();
-            record[0] = (reason & 0xff);
-            memcpy (record+1, rdate, 15);
-            rc = cdb_make_add (cdb, p, n, record, 1+15);
-            if (rc)
+            /* An item with the reason removeFromCRL may only show
+               up in a delta CRL; it tells us to remove the serial
+               number from the base CRL.  */
+            if ((reason & KSBA_CRLREASON_REMOVE_FROM_CRL))
+              err = crldb_make_remove (mk, p, n);
+            else
+              err = crldb_make_add (mk, p, n, reason, rdate);
+            if (err)
               {
-                err = gpg_error_from_errno (errno);
                 log_error (_("error inserting item into "
                              "temporary cache file: %s\n"),
-                           strerror (errno));
+                           gpg_strerror (err));
+                ksba_free (serial);
                 goto failure;
               }
 
@@ -1908,6 +1886,35 @@ get_crl_number (ksba_crl_t crl)
 }
 
 
+/* Store the BaseCRLNumber of a delta CRL as an allocated hex string
+   at R_NUMBER.  NULL is stored if CRL is not a delta CRL.  */
+static gpg_error_t
+get_delta_base_number (ksba_crl_t crl, char **r_number)
+{
+  gpg_error_t err;
+  int idx;
+  const char *oid;
+  int critical;
+  const unsigned char *der;
+  size_t derlen;
+
+  *r_number = NULL;
+  for (idx=0; !ksba_crl_get_extension (crl, idx, &oid, &critical,
+                                       &der, &derlen); idx++)
+    {
+      if (strcmp (oid, oidstr_deltaCRLIndicator))
+        continue;
+
+      err = crldb_parse_base_number (der, derlen, r_number);
+      if (gpg_err_code (err) == GPG_ERR_INV_CRL)
+        log_error (_("invalid deltaCRLIndicator in CRL\n"));
+      return err;
+    }
+
+  return 0;
+}
+
+
 /* Return the authorityKeyIdentifier or NULL if it is not available.
    The issuer name may consists of several parts - they are delimited by
    0x01. */
@@ -1960,7 +1967,8 @@ get_auth_key_id (ksba_crl_t crl, char **serialno)
 
 /* Insert the CRL retrieved using URL into the cache specified by
    CACHE.  The CRL itself will be read from the stream FP and is
-   expected in binary format.
+   expected in binary format.  A delta CRL is merged with the cached
+   base CRL of the same issuer.
 
    Called by:
       crl_cache_load
@@ -1981,14 +1989,18 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   ksba_crl_t crl;
   char *fname = NULL;
   char *newfname = NULL;
-  struct cdb_make cdb;
-  int fd_cdb = -1;
+  crldb_make_t mk = NULL;
+  int fd_db = -1;
   char *issuer = NULL;
   char *issuer_hash = NULL;
   ksba_isotime_t thisupdate, nextupdate;
   crl_cache_entry_t entry = NULL;
   crl_cache_entry_t e;
+  crl_cache_entry_t base_entry = NULL;
+  char *base_number = NULL;
+  char *crl_number = NULL;
   gnupg_isotime_t current_time;
+  unsigned char dbid[CRLDB_ID_LEN];
   char *checksum = NULL;
   int invalidate_crl = 0;
   int idx;
@@ -2056,56 +2068,17 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
       }
   }
 
-  fd_cdb = open (fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
-  if (fd_cdb == -1)
-    {
-      err = gpg_error_from_errno (errno);
-      log_error (_("error creating temporary cache file '%s': %s\n"),
-                 fname, strerror (errno));
-      goto leave;
-    }
-  cdb_make_start(&cdb, fd_cdb);
+  err = crldb_make_new (&mk);
+  if (err)
+    goto leave;
 
-  err = crl_parse_insert (ctrl, crl, &cdb, fname,
+  err = crl_parse_insert (ctrl, crl, mk, fname,
                           &issuer, thisupdate, nextupdate, &trust_anchor);
   if (err)
     {
       log_error (_("crl_parse_insert failed: %s\n"), gpg_strerror (err));
-      /* Error in cleanup ignored.  */
-      cdb_make_finish (&cdb);
-      goto leave;
-    }
-
-  /* Finish the database. */
-  if (cdb_make_finish (&cdb))
-    {
-      err = gpg_error_from_errno (errno);
-      log_error (_("error finishing temporary cache file '%s': %s\n"),
-                 fname, strerror (errno));
       goto leave;
     }
-  if (close (fd_cdb))
-    {
-      err = gpg_error_from_errno (errno);
-      log_error (_("error closing temporary cache file '%s': %s\n"),
-                 fname, strerror (errno));
-      goto leave;
-    }
-  fd_cdb = -1;
-
-
-  /* Create a checksum. */
-  {
-    unsigned char md5buf[16];
-
-    if (hash_dbfile (fname, md5buf))
-      {
-        err = gpg_error (GPG_ERR_CHECKSUM);
-        goto leave;
-      }
-    checksum = hexify_data (md5buf, 16, 0);
-  }
-
 
   /* Check whether that new CRL is still not expired. */
   gnupg_get_isotime (current_time);
@@ -2130,7 +2103,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     {
       if (!critical
           || !strcmp (oid, oidstr_authorityKeyIdentifier)
-          || !strcmp (oid, oidstr_crlNumber) )
+          || !strcmp (oid, oidstr_crlNumber)
+          || !strcmp (oid, oidstr_deltaCRLIndicator))
         continue;
       log_error (_("unknown critical CRL extension %s\n"), oid);
       if (!err2)
@@ -2143,7 +2117,9 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   if (err)
     {
       log_error (_("error reading CRL extensions: %s\n"), gpg_strerror (err));
-      err = gpg_error (GPG_ERR_INV_CRL);
+      if (!err2)
+        err2 = gpg_error (GPG_ERR_INV_CRL);
+      err = 0;
     }
 
 
@@ -2151,6 +2127,87 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
      used as the key for the cache. */
   issuer_hash = hashify_data (issuer, strlen (issuer));
 
+  /* A delta CRL lists only the changes to a base CRL.  We can use it
+     only if we have a complete CRL cached whose number is at least
+     the BaseCRLNumber of the delta CRL (RFC-5280, 5.2.4).  */
+  crl_number = get_crl_number (crl);
+  err = get_delta_base_number (crl, &base_number);
+  if (err)
+    goto leave;
+  if (base_number)
+    {
+      base_entry = find_entry (cache->entries, issuer_hash);
+      if (base_entry && base_entry->invalid)
+        base_entry = NULL;
+      err = crldb_check_delta (base_entry? base_entry->crl_number : NULL,
+                               base_number, crl_number);
+      if (gpg_err_code (err) == GPG_ERR_TOO_OLD)
+        {
+          log_info (_("delta CRL for issuer id %s is not newer than"
+                      " the cached CRL\n"), issuer_hash);
+          err = 0;
+          base_entry = NULL;
+          goto leave;
+        }
+      else if (err)
+        {
+          log_error (_("no base CRL for delta CRL of issuer id %s\n"),
+                     issuer_hash);
+          base_entry = NULL;
+          goto leave;
+        }
+      if (!lock_db_file (cache, base_entry))
+        {
+          err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+          base_entry = NULL;
+          goto leave;
+        }
+      if (!base_entry->dbfile_checked)
+        {
+          log_error (_("cached CRL for issuer id %s tampered;"
+                       " we need to update\n"), issuer_hash);
+          err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+          goto leave;
+        }
+      if (opt.verbose)
+        log_info (_("merging delta CRL %s with base CRL %s\n"),
+                  crl_number, base_entry->crl_number);
+      crldb_make_set_base (mk, base_entry->db);
+    }
+
+  /* Write the database. */
+  fd_db = open (fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  if (fd_db == -1)
+    {
+      err = gpg_error_from_errno (errno);
+      log_error (_("error creating temporary cache file '%s': %s\n"),
+                 fname, strerror (errno));
+      goto leave;
+    }
+  err = crldb_make_finish (mk, fd_db, dbid);
+  if (err)
+    {
+      log_error (_("error finishing temporary cache file '%s': %s\n"),
+                 fname, gpg_strerror (err));
+      goto leave;
+    }
+  if (close (fd_db))
+    {
+      err = gpg_error_from_errno (errno);
+      log_error (_("error closing temporary cache file '%s': %s\n"),
+                 fname, strerror (errno));
+      goto leave;
+    }
+  fd_db = -1;
+  crldb_make_release (mk);
+  mk = NULL;
+  if (base_entry)
+    {
+      unlock_db_file (cache, base_entry);
+      base_entry = NULL;
+    }
+  checksum = hexify_data (dbid, CRLDB_ID_LEN, 0);
+
   /* Create an ENTRY. */
   entry = xtrycalloc (1, sizeof *entry);
   if (!entry)
@@ -2177,7 +2234,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   gnupg_copy_time (entry->this_update, thisupdate);
   gnupg_copy_time (entry->next_update, nextupdate);
   gnupg_copy_time (entry->last_refresh, current_time);
-  entry->crl_number = get_crl_number (crl);
+  entry->crl_number = crl_number;
+  crl_number = NULL;
   entry->authority_issuer = get_auth_key_id (crl, &entry->authority_serialno);
   entry->invalid = invalidate_crl;
   entry->user_trust_req = !!trust_anchor;
@@ -2203,16 +2261,11 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
       {
         any = 0;
         for (e = cache->entries; e; e = e->next)
-          if (!e->cdb_use_count && e->cdb
+          if (!e->db_use_count && e->db
               && !strcmp (e->issuer_hash, entry->issuer_hash))
             {
-              int fd = cdb_fileno (e->cdb);
-              cdb_free (e->cdb);
-              xfree (e->cdb);
-              e->cdb = NULL;
-              if (close (fd))
-                log_error (_("error closing cache file: %s\n"),
-                           strerror(errno));
+              crldb_close (e->db);
+              e->db = NULL;
               any = 1;
               break;
             }
@@ -2247,8 +2300,11 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
 
  leave:
   release_one_cache_entry (entry);
-  if (fd_cdb != -1)
-    close (fd_cdb);
+  if (base_entry)
+    unlock_db_file (cache, base_entry);
+  crldb_make_release (mk);
+  if (fd_db != -1)
+    close (fd_db);
   if (fname)
     {
       gnupg_remove (fname);
@@ -2260,6 +2316,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   xfree (issuer_hash);
   xfree (checksum);
   xfree (trust_anchor);
+  xfree (base_number);
+  xfree (crl_number);
   return err ? err : err2;
 }
 
@@ -2269,10 +2327,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
 static gpg_error_t
 list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
 {
-  struct cdb_find cdbfp;
-  struct cdb *cdb;
-  int rc;
-  int warn = 0;
+  crldb_t db;
+  size_t idx;
   const unsigned char *s;
 
   es_fputs ("--------------------------------------------------------\n", fp );
@@ -2307,8 +2363,8 @@ list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
   if ((e->invalid & ~3))
     es_fprintf (fp, _(" ERROR: The CRL will not be used\n"));
 
-  cdb = lock_db_file (cache, e);
-  if (!cdb)
+  db = lock_db_file (cache, e);
+  if (!db)
     return gpg_error (GPG_ERR_GENERAL);
 
   if (!e->dbfile_checked)
@@ -2316,47 +2372,18 @@ list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
 
   es_putc ('\n', fp);
 
-  rc = cdb_findinit (&cdbfp, cdb, NULL, 0);
-  while (!rc && (rc=cdb_findnext (&cdbfp)) > 0 )
+  for (idx=0; idx < crldb_count (db); idx++)
     {
-      unsigned char keyrecord[256];
-      unsigned char record[16];
+      struct crldb_item_s item;
       int reason;
       int any = 0;
-      cdbi_t n;
-      cdbi_t i;
-
-      rc = 0;
-      n = cdb_datalen (cdb);
-      if (n != 16)
-        {
-          log_error (_(" WARNING: invalid cache record length\n"));
-          warn = 1;
-          continue;
-        }
-
-      if (cdb_read (cdb, record, n, cdb_datapos (cdb)))
-        {
-          log_error (_("problem reading cache record: %s\n"),
-                     strerror (errno));
-          warn = 1;
-          continue;
-        }
+      size_t i;
 
-      n = cdb_keylen (cdb);
-      if (n > sizeof keyrecord)
-        n = sizeof keyrecord;
-      if (cdb_read (cdb, keyrecord, n, cdb_keypos (cdb)))
-        {
-          log_error (_("problem reading cache key: %s\n"), strerror (errno));
-          warn = 1;
-          continue;
-        }
-
-      reason = *record;
+      crldb_get (db, idx, &item);
+      reason = item.reason;
       es_fputs ("  ", fp);
-      for (i = 0; i < n; i++)
-        es_fprintf (fp, "%02X", keyrecord[i]);
+      for (i = 0; i < item.snlen; i++)
+        es_fprintf (fp, "%02X", item.sn[i]);
       es_fputs (":\t reasons( ", fp);
 
       if (reason & KSBA_CRLREASON_UNSPECIFIED)
@@ -2376,16 +2403,14 @@ list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
       if (reason && !any)
         es_fputs( "other", fp );
 
-      es_fprintf (fp, ") rdate: %.15s\n", record+1);
+      es_fprintf (fp, ") rdate: %.15s\n", item.rdate);
     }
-  if (rc)
-    log_error (_("error reading cache entry from db: %s\n"), strerror (rc));
 
   unlock_db_file (cache, e);
   es_fprintf (fp, _("End CRL dump\n") );
   es_putc ('\n', fp);
 
-  return (rc||warn)? gpg_error (GPG_ERR_GENERAL) : 0;
+  return 0;
 }
 
 
@@ -57,6 +57,10 @@ crl_cache_result_t crl_cache_isvalid (ctrl_t ctrl,
 gpg_error_t crl_cache_cert_isvalid (ctrl_t ctrl, ksba_cert_t cert,
                                     int force_refresh);
 
+void crl_cache_isvalid_many (ctrl_t ctrl, const char *issuer_hash,
+                             const char **serialnos, int nserials,
+                             crl_cache_result_t *results, int force_refresh);
+
 gpg_error_t crl_cache_insert (ctrl_t ctrl, const char *url,
                               ksba_reader_t reader);
 
@@ -0,0 +1,1023 @@
+/* crldb.c - Sorted and memory mapped CRL database files
+ * Copyright (C) 2021 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0+
+ */
+
+/* A CRL database file holds the revoked serial numbers of one CRL
+ * sorted by serial number so that a lookup is a binary search in the
+ * memory mapped file.  The layout is:
+ *
+ *   8 bytes  Magic "DMCRLDB1"
+ *   4 bytes  Length of a record (RECLEN) in network byte order
+ *   4 bytes  Number of records in network byte order
+ *  16 bytes  Random file identifier
+ *
+ * followed by the records of RECLEN bytes each:
+ *
+ *   1 byte   Length of the serial number (SNLEN)
+ *   n bytes  Serial number padded with zeroes to RECLEN-17 bytes
+ *   1 byte   Reason for revocation (the lower 8 bits of the KSBA
+ *            reason flags)
+ *  15 bytes  ISO date of revocation (e.g. 19980815T142000) without a
+ *            terminating 0.
+ *
+ * The records are sorted by SNLEN and then by the serial number.
+ * The file identifier is stored in the DIR file and used to detect
+ * accidentally replaced database files without the need to hash the
+ * entire file.
+ *
+ * A new file is created from the items of a CRL; these are collected
+ * in memory.  If they exceed a memory limit they are sorted and
+ * written to a temporary file (a run) so that the memory required for
+ * large CRLs is bounded.  To finish the file all runs and the items
+ * still in memory are merged; for a delta CRL the records of the base
+ * CRL's file are merged in the same single pass.  The header is
+ * written last because the number of records is only known then.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_W32_SYSTEM
+# ifdef HAVE_WINSOCK2_H
+#  include <winsock2.h>
+# endif
+# include <windows.h>
+#else
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+#endif
+
+#include "dirmngr-err.h"
+#include "../common/util.h"
+#include "../common/host2net.h"
+#include "crldb.h"
+
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+#define CRLDB_MAGIC      "DMCRLDB1"
+#define CRLDB_HDRLEN     (8 + 4 + 4 + CRLDB_ID_LEN)
+#define CRLDB_MIN_RECLEN (1 + 1 + 1 + 15)
+#define CRLDB_MAX_RECLEN (1 + CRLDB_MAX_SNLEN + 1 + 15)
+
+/* The default memory limit for collecting items and the maximum
+ * number of runs.  If there are more runs, all runs are merged into
+ * one.  */
+#define CRLDB_MAKE_LIMIT (8*1024*1024)
+#define CRLDB_MAX_RUNS   32
+
+/* The operation codes for the collected items.  */
+#define OP_ADD    'a'
+#define OP_REMOVE 'r'
+
+
+/* An open database file.  */
+struct crldb_s
+{
+#ifdef HAVE_W32_SYSTEM
+  HANDLE mapping;            /* The mapping handle.  */
+#endif
+  const unsigned char *mem;  /* The mapped file.  */
+  size_t memlen;             /* The length of the file.  */
+  unsigned int reclen;       /* The length of one record.  */
+  size_t nrecords;           /* The number of records.  */
+};
+
+
+/* The object used to create a database file.  */
+struct crldb_make_s
+{
+  /* The collected items.  Each item is stored as
+   *   1 byte   op code (OP_ADD or OP_REMOVE)
+   *   1 byte   SNLEN
+   *   n bytes  serial number
+   *   1 byte   reason
+   *  15 bytes  revocation date  */
+  unsigned char *buffer;
+  size_t buflen;     /* Used length of BUFFER.  */
+  size_t bufsize;    /* Allocated length of BUFFER.  */
+  size_t nitems;     /* Number of items in BUFFER.  */
+  size_t maxsnlen;   /* Longest serial number to add.  */
+  size_t limit;      /* Memory limit for BUFFER and its sort array.  */
+
+  /* The runs in the order they have been written.  Each run holds
+   * sorted items in the above format with only the last item of the
+   * same serial number.  */
+  estream_t runs[CRLDB_MAX_RUNS];
+  int nruns;
+
+  crldb_t base;      /* The base CRL or NULL.  */
+};
+
+/* The length of the item at P.  */
+#define ITEMLEN(p) (1 + 1 + (p)[1] + 1 + 15)
+#define MAX_ITEMLEN (1 + 1 + CRLDB_MAX_SNLEN + 1 + 15)
+
+
+/* A source of sorted items for the merge.  This is either a run or
+ * the sorted array of the items in memory.  */
+struct source_s
+{
+  estream_t fp;              /* The run or NULL.  */
+  unsigned char **items;     /* The array of items if FP is NULL.  */
+  size_t nitems;
+  size_t idx;
+  const unsigned char *cur;  /* The current item or NULL at the end.  */
+  unsigned char buf[MAX_ITEMLEN];
+};
+
+
+/* The output of the final merge.  */
+struct output_s
+{
+  struct writer_s *w;
+  unsigned int reclen;
+  crldb_t base;
+  size_t baseidx;
+  size_t count;
+};
+
+
+/* Helper for writing a file with buffering.  */
+struct writer_s
+{
+  int fd;
+  gpg_error_t err;
+  size_t len;
+  unsigned char buf[16384];
+};
+
+
+
+/* Compare the serial number SN of length SNLEN against the serial
+ * number of the record REC.  */
+static int
+compare_sn (const unsigned char *sn, size_t snlen, const unsigned char *rec)
+{
+  if (snlen != *rec)
+    return snlen < *rec? -1 : 1;
+  return memcmp (sn, rec + 1, snlen);
+}
+
+
+/* Open the database file FNAME and store a handle at R_DB.  */
+gpg_error_t
+crldb_open (const char *fname, crldb_t *r_db)
+{
+  gpg_error_t err;
+  crldb_t db;
+  int fd;
+  struct stat st;
+  unsigned char *mem;
+  size_t memlen;
+#ifdef HAVE_W32_SYSTEM
+  HANDLE hfile, hmapping;
+#endif
+
+  *r_db = NULL;
+
+  fd = open (fname, O_RDONLY | O_BINARY);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+  if (fstat (fd, &st))
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+  memlen = (size_t)st.st_size;
+  if (st.st_size < CRLDB_HDRLEN || (off_t)memlen != st.st_size)
+    {
+      close (fd);
+      return gpg_error (GPG_ERR_INV_OBJ);
+    }
+
+#ifdef HAVE_W32_SYSTEM
+  hfile = (HANDLE) _get_osfhandle (fd);
+  if (hfile == INVALID_HANDLE_VALUE)
+    {
+      close (fd);
+      return gpg_error (GPG_ERR_EIO);
+    }
+  hmapping = CreateFileMapping (hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!hmapping)
+    {
+      close (fd);
+      return gpg_error (GPG_ERR_EIO);
+    }
+  mem = MapViewOfFile (hmapping, FILE_MAP_READ, 0, 0, 0);
+  if (!mem)
+    {
+      CloseHandle (hmapping);
+      close (fd);
+      return gpg_error (GPG_ERR_EIO);
+    }
+#else /*!HAVE_W32_SYSTEM*/
+  mem = mmap (NULL, memlen, PROT_READ, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED)
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+#endif /*!HAVE_W32_SYSTEM*/
+  /* The mapping stays valid after closing the file.  */
+  close (fd);
+
+  db = xtrycalloc (1, sizeof *db);
+  if (!db)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+#ifdef HAVE_W32_SYSTEM
+  db->mapping = hmapping;
+#endif
+  db->mem = mem;
+  db->memlen = memlen;
+  db->reclen = buf32_to_uint (mem + 8);
+  db->nrecords = buf32_to_size_t (mem + 12);
+
+  if (memcmp (mem, CRLDB_MAGIC, 8)
+      || db->reclen < CRLDB_MIN_RECLEN || db->reclen > CRLDB_MAX_RECLEN
+      || (memlen - CRLDB_HDRLEN) / db->reclen != db->nrecords
+      || (memlen - CRLDB_HDRLEN) % db->reclen)
+    {
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto leave;
+    }
+
+  *r_db = db;
+  db = NULL;
+  err = 0;
+
+ leave:
+  if (err)
+    {
+#ifdef HAVE_W32_SYSTEM
+      UnmapViewOfFile (mem);
+      CloseHandle (hmapping);
+#else
+      munmap (mem, memlen);
+#endif
+      xfree (db);
+    }
+  return err;
+}
+
+
+/* Close the database DB.  */
+void
+crldb_close (crldb_t db)
+{
+  if (!db)
+    return;
+
+#ifdef HAVE_W32_SYSTEM
+  UnmapViewOfFile ((void*)db->mem);
+  CloseHandle (db->mapping);
+#else
+  munmap ((void*)db->mem, db->memlen);
+#endif
+  xfree (db);
+}
+
+
+/* Return the file identifier of DB.  The returned buffer has a length
+ * of CRLDB_ID_LEN.  */
+const unsigned char *
+crldb_get_id (crldb_t db)
+{
+  return db->mem + 16;
+}
+
+
+/* Return the number of records in DB.  */
+size_t
+crldb_count (crldb_t db)
+{
+  return db->nrecords;
+}
+
+
+/* Store the record at REC into R_ITEM.  */
+static void
+record_to_item (crldb_t db, const unsigned char *rec, crldb_item_t r_item)
+{
+  r_item->sn = rec + 1;
+  r_item->snlen = *rec;
+  r_item->reason = rec[db->reclen - 16];
+  r_item->rdate = (const char *)rec + db->reclen - 15;
+}
+
+
+/* Store the record with index IDX into R_ITEM.  IDX must be less
+ * than crldb_count.  */
+void
+crldb_get (crldb_t db, size_t idx, crldb_item_t r_item)
+{
+  record_to_item (db, db->mem + CRLDB_HDRLEN + idx * db->reclen, r_item);
+}
+
+
+/* Look up the serial number SN of length SNLEN in DB.  Returns true
+ * if it is listed and stores the record at R_ITEM if that is not
+ * NULL.  */
+int
+crldb_find (crldb_t db, const void *sn, size_t snlen, crldb_item_t r_item)
+{
+  const unsigned char *records = db->mem + CRLDB_HDRLEN;
+  const unsigned char *rec;
+  size_t lo, hi, mid;
+  int cmp;
+
+  if (snlen + CRLDB_MIN_RECLEN - 1 > db->reclen)
+    return 0;  /* Longer than any listed serial number.  */
+
+  lo = 0;
+  hi = db->nrecords;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      rec = records + mid * db->reclen;
+      cmp = compare_sn (sn, snlen, rec);
+      if (!cmp)
+        {
+          if (r_item)
+            record_to_item (db, rec, r_item);
+          return 1;
+        }
+      if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return 0;
+}
+
+
+
+/* Create a new object to build a database file.  */
+gpg_error_t
+crldb_make_new (crldb_make_t *r_mk)
+{
+  *r_mk = xtrycalloc (1, sizeof **r_mk);
+  if (!*r_mk)
+    return gpg_error_from_syserror ();
+  (*r_mk)->limit = CRLDB_MAKE_LIMIT;
+  return 0;
+}
+
+
+/* Release the object MK.  A base database is not closed.  */
+void
+crldb_make_release (crldb_make_t mk)
+{
+  int i;
+
+  if (!mk)
+    return;
+  for (i=0; i < mk->nruns; i++)
+    es_fclose (mk->runs[i]);
+  xfree (mk->buffer);
+  xfree (mk);
+}
+
+
+/* Limit the memory used by MK for collecting items to about LIMIT
+ * bytes; further items are written to temporary files.  A value of 0
+ * selects the default.  This is mainly useful for testing.  */
+void
+crldb_make_set_limit (crldb_make_t mk, size_t limit)
+{
+  mk->limit = limit? limit : CRLDB_MAKE_LIMIT;
+}
+
+
+/* Sort function for the items.  Items with the same serial number are
+ * sorted in insertion order.  */
+static int
+compare_items (const void *arg_a, const void *arg_b)
+{
+  const unsigned char *a = *(const unsigned char **)arg_a;
+  const unsigned char *b = *(const unsigned char **)arg_b;
+  int cmp;
+
+  cmp = compare_sn (a + 2, a[1], b + 1);
+  if (cmp)
+    return cmp;
+  return a < b? -1 : a > b? 1 : 0;
+}
+
+
+/* Sort the items in the buffer of MK and store an allocated array
+ * with pointers to them at R_ITEMS.  */
+static gpg_error_t
+sort_buffer (crldb_make_t mk, unsigned char ***r_items)
+{
+  unsigned char **items;
+  unsigned char *p;
+  size_t idx;
+
+  items = xtrycalloc (mk->nitems? mk->nitems : 1, sizeof *items);
+  if (!items)
+    return gpg_error_from_syserror ();
+  for (p = mk->buffer, idx=0; idx < mk->nitems; idx++)
+    {
+      items[idx] = p;
+      p += ITEMLEN (p);
+    }
+  qsort (items, mk->nitems, sizeof *items, compare_items);
+  *r_items = items;
+  return 0;
+}
+
+
+/* Advance SRC to its next item.  */
+static gpg_error_t
+source_next (struct source_s *src)
+{
+  size_t n, nread;
+
+  if (!src->fp)
+    {
+      src->cur = src->idx < src->nitems? src->items[src->idx++] : NULL;
+      return 0;
+    }
+
+  src->cur = NULL;
+  if (es_read (src->fp, src->buf, 2, &nread))
+    return gpg_error_from_syserror ();
+  if (!nread)
+    return 0;  /* End of the run.  */
+  if (nread != 2 || !src->buf[1] || src->buf[1] > CRLDB_MAX_SNLEN)
+    return gpg_error (GPG_ERR_EIO);
+  n = ITEMLEN (src->buf) - 2;
+  if (es_read (src->fp, src->buf + 2, n, &nread))
+    return gpg_error_from_syserror ();
+  if (nread != n)
+    return gpg_error (GPG_ERR_EIO);
+  src->cur = src->buf;
+  return 0;
+}
+
+
+/* Return true if the current item of the source A sorts before the
+ * one of source B.  For the same serial number the source created
+ * first sorts first.  */
+static int
+source_less (struct source_s *srcs, int a, int b)
+{
+  int cmp;
+
+  cmp = compare_sn (srcs[a].cur + 2, srcs[a].cur[1], srcs[b].cur + 1);
+  return cmp < 0 || (!cmp && a < b);
+}
+
+
+/* Restore the heap property of the N source indices at HEAP starting
+ * at position I.  */
+static void
+sift_down (struct source_s *srcs, int *heap, int n, int i)
+{
+  int child, tmp;
+
+  for (; (child = 2 * i + 1) < n; i = child)
+    {
+      if (child + 1 < n && source_less (srcs, heap[child+1], heap[child]))
+        child++;
+      if (!source_less (srcs, heap[child], heap[i]))
+        break;
+      tmp = heap[i];
+      heap[i] = heap[child];
+      heap[child] = tmp;
+    }
+}
+
+
+/* Merge the NSRCS sources at SRCS and call EMIT with OPAQUE for each
+ * item in sort order.  Of the items with the same serial number only
+ * the last one added is emitted; for this the sources must be given
+ * in the order they have been created.  NSRCS may not be larger than
+ * CRLDB_MAX_RUNS + 1.  */
+static gpg_error_t
+merge_sources (struct source_s *srcs, int nsrcs,
+               gpg_error_t (*emit) (void *, const unsigned char *),
+               void *opaque)
+{
+  gpg_error_t err;
+  unsigned char pending[MAX_ITEMLEN];
+  int have_pending = 0;
+  int heap[CRLDB_MAX_RUNS + 1];
+  int i, n, best;
+
+  /* Build a heap of the sources to pick the lowest item.  */
+  for (i=n=0; i < nsrcs; i++)
+    {
+      err = source_next (srcs + i);
+      if (err)
+        return err;
+      if (srcs[i].cur)
+        heap[n++] = i;
+    }
+  for (i = n / 2 - 1; i >= 0; i--)
+    sift_down (srcs, heap, n, i);
+
+  while (n)
+    {
+      best = heap[0];
+      if (have_pending
+          && compare_sn (srcs[best].cur + 2, srcs[best].cur[1], pending + 1))
+        {
+          err = emit (opaque, pending);
+          if (err)
+            return err;
+        }
+      memcpy (pending, srcs[best].cur, ITEMLEN (srcs[best].cur));
+      have_pending = 1;
+
+      err = source_next (srcs + best);
+      if (err)
+        return err;
+      if (!srcs[best].cur)
+        heap[0] = heap[--n];
+      sift_down (srcs, heap, n, 0);
+    }
+
+  if (have_pending)
+    return emit (opaque, pending);
+  return 0;
+}
+
+
+/* Merge all runs of MK and the NITEMS sorted ITEMS and call EMIT with
+ * OPAQUE for each resulting item.  */
+static gpg_error_t
+merge_all (crldb_make_t mk, unsigned char **items, size_t nitems,
+           gpg_error_t (*emit) (void *, const unsigned char *),
+           void *opaque)
+{
+  gpg_error_t err;
+  struct source_s *srcs;
+  int i;
+
+  srcs = xtrycalloc (mk->nruns + 1, sizeof *srcs);
+  if (!srcs)
+    return gpg_error_from_syserror ();
+
+  for (i=0; i < mk->nruns; i++)
+    {
+      if (es_fseek (mk->runs[i], 0, SEEK_SET))
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      srcs[i].fp = mk->runs[i];
+    }
+  srcs[i].items = items;
+  srcs[i].nitems = nitems;
+
+  err = merge_sources (srcs, mk->nruns + 1, emit, opaque);
+
+ leave:
+  xfree (srcs);
+  return err;
+}
+
+
+/* Emit function to write ITEM to the run OPAQUE.  */
+static gpg_error_t
+emit_to_run (void *opaque, const unsigned char *item)
+{
+  if (es_write ((estream_t)opaque, item, ITEMLEN (item), NULL))
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Write the items in the buffer of MK to a new run and empty the
+ * buffer.  If the maximum number of runs has been reached all runs
+ * are first merged into one.  */
+static gpg_error_t
+spill_buffer (crldb_make_t mk)
+{
+  gpg_error_t err;
+  unsigned char **items = NULL;
+  estream_t fp = NULL;
+  int i;
+
+  if (mk->nruns == CRLDB_MAX_RUNS)
+    {
+      fp = es_tmpfile ();
+      if (!fp)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      err = merge_all (mk, NULL, 0, emit_to_run, fp);
+      if (err)
+        goto leave;
+      for (i=0; i < mk->nruns; i++)
+        es_fclose (mk->runs[i]);
+      mk->runs[0] = fp;
+      mk->nruns = 1;
+      fp = NULL;
+    }
+
+  err = sort_buffer (mk, &items);
+  if (err)
+    goto leave;
+
+  fp = es_tmpfile ();
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  {
+    struct source_s src;
+
+    memset (&src, 0, sizeof src);
+    src.items = items;
+    src.nitems = mk->nitems;
+    err = merge_sources (&src, 1, emit_to_run, fp);
+  }
+  if (err)
+    goto leave;
+
+  mk->runs[mk->nruns++] = fp;
+  fp = NULL;
+  mk->buflen = 0;
+  mk->nitems = 0;
+
+ leave:
+  if (fp)
+    es_fclose (fp);
+  xfree (items);
+  return err;
+}
+
+
+/* Append an item to MK.  */
+static gpg_error_t
+make_append (crldb_make_t mk, int op, const void *sn, size_t snlen,
+             int reason, const char *rdate)
+{
+  gpg_error_t err;
+  size_t n = 1 + 1 + snlen + 1 + 15;
+  unsigned char *p;
+
+  if (!snlen || snlen > CRLDB_MAX_SNLEN)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  /* Account for the array used to sort the items.  */
+  if (mk->nitems
+      && (mk->buflen + n + (mk->nitems + 1) * sizeof (unsigned char *)
+          > mk->limit))
+    {
+      err = spill_buffer (mk);
+      if (err)
+        return err;
+    }
+
+  if (mk->buflen + n > mk->bufsize)
+    {
+      size_t newsize = mk->bufsize? 2 * mk->bufsize : 65536;
+
+      if (newsize > mk->limit)
+        newsize = mk->limit;
+      if (newsize < mk->buflen + n)
+        newsize = mk->buflen + n;
+      p = xtryrealloc (mk->buffer, newsize);
+      if (!p)
+        return gpg_error_from_syserror ();
+      mk->buffer = p;
+      mk->bufsize = newsize;
+    }
+
+  p = mk->buffer + mk->buflen;
+  *p++ = op;
+  *p++ = snlen;
+  memcpy (p, sn, snlen);
+  p += snlen;
+  *p++ = reason;
+  if (rdate)
+    memcpy (p, rdate, 15);
+  else
+    memset (p, 0, 15);
+
+  mk->buflen += n;
+  mk->nitems++;
+  return 0;
+}
+
+
+/* Add the serial number SN of length SNLEN with the REASON and the
+ * 15 byte revocation date RDATE to MK.  */
+gpg_error_t
+crldb_make_add (crldb_make_t mk, const void *sn, size_t snlen,
+                int reason, const char *rdate)
+{
+  gpg_error_t err;
+
+  err = make_append (mk, OP_ADD, sn, snlen, reason & 0xff, rdate);
+  if (!err && snlen > mk->maxsnlen)
+    mk->maxsnlen = snlen;
+  return err;
+}
+
+
+/* Remove the serial number SN of length SNLEN from the base database.
+ * This is used for delta CRL items with the reason removeFromCRL.
+ * Without a base database this is a no-op.  */
+gpg_error_t
+crldb_make_remove (crldb_make_t mk, const void *sn, size_t snlen)
+{
+  return make_append (mk, OP_REMOVE, sn, snlen, 0, NULL);
+}
+
+
+/* Use the database BASE as the base for the new file.  The items
+ * added to MK are then taken as changes to BASE.  BASE must be kept
+ * open until crldb_make_finish returns.  */
+void
+crldb_make_set_base (crldb_make_t mk, crldb_t base)
+{
+  mk->base = base;
+}
+
+
+/* Write LEN bytes from BUF using the writer W.  With BUF given as
+ * NULL the buffer is flushed.  */
+static void
+write_buffered (struct writer_s *w, const void *buf, size_t len)
+{
+  const unsigned char *p;
+  size_t n;
+  ssize_t nwritten;
+
+  if (w->err)
+    return;
+
+  if (buf && w->len + len <= sizeof w->buf)
+    {
+      memcpy (w->buf + w->len, buf, len);
+      w->len += len;
+      return;
+    }
+
+  /* Flush.  */
+  for (p = w->buf, n = w->len; n; p += nwritten, n -= nwritten)
+    {
+      nwritten = write (w->fd, p, n);
+      if (nwritten < 0 && errno == EINTR)
+        nwritten = 0;
+      else if (nwritten < 0)
+        {
+          w->err = gpg_error_from_syserror ();
+          return;
+        }
+    }
+  w->len = 0;
+
+  if (buf)
+    write_buffered (w, buf, len);
+}
+
+
+/* Write one record with the serial number SN and the reason and date
+ * taken from TAIL using the writer W.  */
+static void
+write_record (struct writer_s *w, unsigned int reclen,
+              const unsigned char *sn, size_t snlen,
+              const unsigned char *tail)
+{
+  unsigned char rec[CRLDB_MAX_RECLEN];
+
+  memset (rec, 0, reclen);
+  rec[0] = snlen;
+  memcpy (rec + 1, sn, snlen);
+  memcpy (rec + reclen - 16, tail, 16);
+  write_buffered (w, rec, reclen);
+}
+
+
+/* Emit function for the final merge.  Write the records of the base
+ * database sorting before ITEM and then the record for ITEM to the
+ * output OPAQUE.  */
+static gpg_error_t
+output_item (void *opaque, const unsigned char *item)
+{
+  struct output_s *out = opaque;
+  crldb_t base = out->base;
+  const unsigned char *rec;
+  int cmp = -1;
+
+  for (; base && out->baseidx < base->nrecords; out->baseidx++)
+    {
+      rec = base->mem + CRLDB_HDRLEN + out->baseidx * base->reclen;
+      cmp = compare_sn (item + 2, item[1], rec);
+      if (cmp <= 0)
+        break;
+      write_record (out->w, out->reclen, rec + 1, *rec,
+                    rec + base->reclen - 16);
+      out->count++;
+    }
+  if (!cmp)
+    out->baseidx++;  /* Replaced or removed by the item.  */
+
+  if (*item == OP_ADD)
+    {
+      write_record (out->w, out->reclen, item + 2, item[1],
+                    item + 2 + item[1]);
+      out->count++;
+    }
+
+  return out->w->err;
+}
+
+
+/* Write the remaining records of the base database to OUT.  */
+static void
+output_rest (struct output_s *out)
+{
+  crldb_t base = out->base;
+  const unsigned char *rec;
+
+  for (; base && out->baseidx < base->nrecords; out->baseidx++)
+    {
+      rec = base->mem + CRLDB_HDRLEN + out->baseidx * base->reclen;
+      write_record (out->w, out->reclen, rec + 1, *rec,
+                    rec + base->reclen - 16);
+      out->count++;
+    }
+}
+
+
+/* Merge the items of MK with the base database if one has been set
+ * and write the database file to FD.  FD must be seekable.  On
+ * success the file identifier is stored at R_ID which must provide
+ * CRLDB_ID_LEN bytes.  The caller needs to close FD.  */
+gpg_error_t
+crldb_make_finish (crldb_make_t mk, int fd, unsigned char *r_id)
+{
+  gpg_error_t err;
+  unsigned char **items = NULL;
+  unsigned char hdr[CRLDB_HDRLEN];
+  struct output_s out;
+  size_t maxsnlen;
+
+  memset (&out, 0, sizeof out);
+
+  err = sort_buffer (mk, &items);
+  if (err)
+    goto leave;
+
+  maxsnlen = mk->maxsnlen;
+  if (mk->base && mk->base->reclen - (CRLDB_MIN_RECLEN - 1) > maxsnlen)
+    maxsnlen = mk->base->reclen - (CRLDB_MIN_RECLEN - 1);
+  if (!maxsnlen)
+    maxsnlen = 1;
+  out.reclen = maxsnlen + CRLDB_MIN_RECLEN - 1;
+  out.base = mk->base;
+
+  out.w = xtrymalloc (sizeof *out.w);
+  if (!out.w)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  out.w->fd = fd;
+  out.w->err = 0;
+  out.w->len = 0;
+
+  /* The number of records is not yet known; it is written after the
+   * records.  Until then the file is not valid.  */
+  memcpy (hdr, CRLDB_MAGIC, 8);
+  ulongtobuf (hdr + 8, out.reclen);
+  ulongtobuf (hdr + 12, 0);
+  gcry_create_nonce (hdr + 16, CRLDB_ID_LEN);
+  write_buffered (out.w, hdr, sizeof hdr);
+
+  err = merge_all (mk, items, mk->nitems, output_item, &out);
+  if (err)
+    goto leave;
+  output_rest (&out);
+  write_buffered (out.w, NULL, 0);
+  err = out.w->err;
+  if (err)
+    goto leave;
+
+  if (out.count > 0xffffffff)
+    {
+      err = gpg_error (GPG_ERR_TOO_LARGE);
+      goto leave;
+    }
+  if (lseek (fd, 12, SEEK_SET) == (off_t)-1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  ulongtobuf (hdr + 12, out.count);
+  write_buffered (out.w, hdr + 12, 4);
+  write_buffered (out.w, NULL, 0);
+  err = out.w->err;
+  if (!err)
+    memcpy (r_id, hdr + 16, CRLDB_ID_LEN);
+
+ leave:
+  xfree (out.w);
+  xfree (items);
+  return err;
+}
+
+
+
+/* Parse the DER encoded value DER of length DERLEN of a
+ * deltaCRLIndicator extension and store the BaseCRLNumber as an
+ * allocated hex string at R_NUMBER.  */
+gpg_error_t
+crldb_parse_base_number (const unsigned char *der, size_t derlen,
+                         char **r_number)
+{
+  *r_number = NULL;
+
+  /* The value is an INTEGER; CRL numbers are at most 20 octets and
+   * thus we only need to handle the short length form.  */
+  if (derlen < 3 || der[0] != 0x02 || (der[1] & 0x80)
+      || der[1] + 2 != derlen)
+    return gpg_error (GPG_ERR_INV_CRL);
+
+  *r_number = xtrymalloc (2 * (derlen - 2) + 1);
+  if (!*r_number)
+    return gpg_error_from_syserror ();
+  bin2hex (der + 2, derlen - 2, *r_number);
+  return 0;
+}
+
+
+/* Compare the two hex encoded CRL numbers A and B.  Returns a value
+ * less than, equal to, or greater than zero as strcmp does.  */
+int
+crldb_compare_numbers (const char *a, const char *b)
+{
+  size_t alen, blen;
+
+  while (*a == '0')
+    a++;
+  while (*b == '0')
+    b++;
+  alen = strlen (a);
+  blen = strlen (b);
+  if (alen != blen)
+    return alen < blen? -1 : 1;
+  return ascii_strcasecmp (a, b);
+}
+
+
+/* Check whether a delta CRL with the CRL number NUMBER (NULL if not
+ * known) and the BaseCRLNumber BASE_NUMBER may be merged with a
+ * complete CRL whose number is CACHED_NUMBER (NULL if no complete CRL
+ * is available).  The delta CRL can only be used if the complete CRL
+ * is at least as new as its base (RFC-5280, 5.2.4).  Returns 0 if the
+ * CRLs may be merged, GPG_ERR_NO_CRL_KNOWN if there is no suitable
+ * complete CRL, and GPG_ERR_TOO_OLD if the delta CRL is not newer
+ * than the complete CRL.  */
+gpg_error_t
+crldb_check_delta (const char *cached_number, const char *base_number,
+                   const char *number)
+{
+  if (!cached_number || crldb_compare_numbers (cached_number, base_number) < 0)
+    return gpg_error (GPG_ERR_NO_CRL_KNOWN);
+  if (!number || crldb_compare_numbers (number, cached_number) <= 0)
+    return gpg_error (GPG_ERR_TOO_OLD);
+  return 0;
+}
@@ -0,0 +1,81 @@
+/* crldb.h - Sorted and memory mapped CRL database files
+ * Copyright (C) 2021 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0+
+ */
+
+#ifndef DIRMNGR_CRLDB_H
+#define DIRMNGR_CRLDB_H
+
+/* The maximum length of a serial number.  RFC-5280 limits this to 20
+ * octets but we allow for some non-conforming CAs.  */
+#define CRLDB_MAX_SNLEN 64
+
+/* The length of the random file identifier.  */
+#define CRLDB_ID_LEN 16
+
+/* One revoked certificate as returned by crldb_find and crldb_get.
+ * The pointers reference the mapped file and are valid until the
+ * database is closed.  */
+struct crldb_item_s
+{
+  const unsigned char *sn;  /* The serial number.                   */
+  size_t snlen;             /* The length of SN.                    */
+  int reason;               /* The reason flags (lower 8 bits only). */
+  const char *rdate;        /* The 15 byte revocation date; this is
+                             * not a string.  */
+};
+typedef struct crldb_item_s *crldb_item_t;
+
+struct crldb_s;
+typedef struct crldb_s *crldb_t;
+
+struct crldb_make_s;
+typedef struct crldb_make_s *crldb_make_t;
+
+
+/*-- crldb.c --*/
+
+/* Reading.  */
+gpg_error_t crldb_open (const char *fname, crldb_t *r_db);
+void crldb_close (crldb_t db);
+const unsigned char *crldb_get_id (crldb_t db);
+size_t crldb_count (crldb_t db);
+int crldb_find (crldb_t db, const void *sn, size_t snlen, crldb_item_t r_item);
+void crldb_get (crldb_t db, size_t idx, crldb_item_t r_item);
+
+/* Creation.  */
+gpg_error_t crldb_make_new (crldb_make_t *r_mk);
+void crldb_make_release (crldb_make_t mk);
+gpg_error_t crldb_make_add (crldb_make_t mk, const void *sn, size_t snlen,
+                            int reason, const char *rdate);
+gpg_error_t crldb_make_remove (crldb_make_t mk, const void *sn, size_t snlen);
+void crldb_make_set_base (crldb_make_t mk, crldb_t base);
+void crldb_make_set_limit (crldb_make_t mk, size_t limit);
+gpg_error_t crldb_make_finish (crldb_make_t mk, int fd,
+                               unsigned char *r_id);
+
+/* Delta CRLs.  */
+gpg_error_t crldb_parse_base_number (const unsigned char *der, size_t derlen,
+                                     char **r_number);
+int crldb_compare_numbers (const char *a, const char *b);
+gpg_error_t crldb_check_delta (const char *cached_number,
+                               const char *base_number, const char *number);
+
+
+#endif /*DIRMNGR_CRLDB_H*/
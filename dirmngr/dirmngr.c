@@ -63,6 +63,7 @@
 #include "certcache.h"
 #include "crlcache.h"
 #include "crlfetch.h"
+#include "ocsp.h"
 #include "misc.h"
 #if USE_LDAP
 # include "ldapserver.h"
@@ -403,6 +404,13 @@ union int_and_ptr_u
 static npth_key_t my_tlskey_current_fd;
 #endif
 
+/* Key to mark a thread which currently runs without holding the nPth
+   lock; see dirmngr_enter_unlocked.  */
+#ifndef HAVE_W32_SYSTEM
+static npth_key_t unlocked_key;
+static int unlocked_key_ready;
+#endif
+
 /* Prototypes. */
 static void cleanup (void);
 #if USE_LDAP
@@ -833,12 +841,40 @@ my_ntbtls_log_handler (void *opaque, int level, const char *fmt, va_list argv)
 #endif
 
 
+#ifndef HAVE_W32_SYSTEM
+/* The system call clamp functions.  These are the nPth functions to
+   release and re-acquire the nPth lock unless the current thread
+   already runs without that lock.  */
+static void
+syscall_clamp_pre (void)
+{
+  if (!npth_getspecific (unlocked_key))
+    npth_unprotect ();
+}
+
+static void
+syscall_clamp_post (void)
+{
+  if (!npth_getspecific (unlocked_key))
+    npth_protect ();
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 static void
 thread_init (void)
 {
   npth_init ();
   assuan_set_system_hooks (ASSUAN_SYSTEM_NPTH);
-  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+#ifndef HAVE_W32_SYSTEM
+  if (!npth_key_create (&unlocked_key, NULL))
+    {
+      unlocked_key_ready = 1;
+      gpgrt_set_syscall_clamp (syscall_clamp_pre, syscall_clamp_post);
+    }
+  else
+#endif
+    gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
 
   /* Now with NPth running we can set the logging callback.  Our
      windows implementation does not yet feature the NPth TLS
@@ -851,6 +887,37 @@ thread_init (void)
 }
 
 
+/* Release the nPth lock so that the calling thread can do CPU bound
+   work while other threads run.  Returns false if this is not
+   possible.  Until dirmngr_leave_unlocked is called only thread-safe
+   functions may be used; Libksba, Libgcrypt, estream and the logging
+   functions are fine but no shared data may be accessed.  */
+int
+dirmngr_enter_unlocked (void)
+{
+#ifndef HAVE_W32_SYSTEM
+  if (!unlocked_key_ready)
+    return 0;
+  npth_setspecific (unlocked_key, (void*)1);
+  npth_unprotect ();
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+
+/* Counterpart to a successful dirmngr_enter_unlocked.  */
+void
+dirmngr_leave_unlocked (void)
+{
+#ifndef HAVE_W32_SYSTEM
+  npth_protect ();
+  npth_setspecific (unlocked_key, NULL);
+#endif
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -1527,7 +1594,9 @@ static void
 cleanup (void)
 {
   crl_cache_deinit ();
+  ocsp_cache_deinit ();
   cert_cache_deinit (1);
+  http_pool_flush ();
   reload_dns_stuff (1);
 
 #if USE_LDAP
@@ -1841,9 +1910,11 @@ dirmngr_sighup_action (void)
   set_tor_mode ();
   cert_cache_deinit (0);
   crl_cache_deinit ();
+  ocsp_cache_deinit ();
   cert_cache_init (hkp_cacert_filenames);
   crl_cache_init ();
   reload_dns_stuff (0);
+  http_pool_flush ();
   ks_hkp_reload ();
 }
 
@@ -1934,6 +2005,7 @@ housekeeping_thread (void *arg)
 
   dns_stuff_housekeeping ();
   ks_hkp_housekeeping (curtime);
+  ocsp_cache_save ();
   if (network_activity_seen)
     {
       network_activity_seen = 0;
@@ -72,6 +72,12 @@ static void npth_protect (void) { }
 
 #define DEFAULT_LDAP_TIMEOUT 15 /* Arbitrary long timeout. */
 
+/* The maximum number of LDAP connections kept open in server mode.  */
+#define MAX_CONNECTIONS 8
+
+/* The maximum length of a request line in server mode.  */
+#define MAX_REQUEST_LINE 65536
+
 
 /* Constants for the options.  */
 enum
@@ -93,7 +99,8 @@ enum
     oTls,
 
     oOnlySearchTimeout,
-    oLogWithPID
+    oLogWithPID,
+    oServer
   };
 
 
@@ -118,6 +125,7 @@ static gpgrt_opt_t opts[] = {
   { oAttr,     "attr",      2, N_("|STRING|return the attribute STRING")},
   { oOnlySearchTimeout, "only-search-timeout", 0, "@"},
   { oLogWithPID,"log-with-pid", 0, "@"},
+  { oServer,   "server",    0, "@"},
   ARGPARSE_end ()
 };
 
@@ -146,15 +154,39 @@ struct my_opt_s
   char *dn;    /* Override DN.  */
   char *filter;/* Override filter.  */
   char *attr;  /* Override attribute.  */
+
+  char *hostbuf;  /* Malloced buffer for HOST and PORT from PROXY.  */
 };
 typedef struct my_opt_s *my_opt_t;
 
 
+/* An LDAP connection kept open in server mode.  */
+struct conn_s
+{
+  struct conn_s *next;
+  LDAP *ld;
+  char *host;
+  int port;
+  int usetls;
+  char *user;  /* NULL if not given.  */
+  char *pass;  /* NULL if not given.  */
+};
+typedef struct conn_s *conn_t;
+
+/* True if running in server mode.  */
+static int server_mode;
+
+/* The list of open connections in server mode, most recently used
+ * first.  */
+static conn_t conn_list;
+
+
 /* Prototypes.  */
 #ifndef HAVE_W32_SYSTEM
 static void catch_alarm (int dummy);
 #endif
 static int process_url (my_opt_t myopt, const char *url);
+static int run_server (void);
 
 
 
@@ -190,40 +222,26 @@ my_strusage (int level)
 }
 
 
-int
-main (int argc, char **argv)
+/* Parse the options in ARGC and ARGV and store them at MYOPT.  On
+ * return ARGC and ARGV describe the remaining arguments.  Returns
+ * true on error.  */
+static int
+parse_options (my_opt_t myopt, int *argc, char ***argv)
 {
   gpgrt_argparse_t pargs;
-  int any_err = 0;
-  char *p;
+  unsigned int errorcount = log_get_errorcount (0);
   int only_search_timeout = 0;
-  struct my_opt_s my_opt_buffer;
-  my_opt_t myopt = &my_opt_buffer;
-  char *malloced_buffer1 = NULL;
-
-  memset (&my_opt_buffer, 0, sizeof my_opt_buffer);
-
-  early_system_init ();
-
-  gpgrt_set_strusage (my_strusage);
-  log_set_prefix ("dirmngr_ldap", GPGRT_LOG_WITH_PREFIX);
-
-  /* Setup I18N and common subsystems. */
-  i18n_init();
-
-  init_common_subsystems (&argc, &argv);
-
-  es_set_binary (es_stdout);
-  myopt->outstream = es_stdout;
+  int bad_option = 0;
+  char *p;
 
   /* LDAP defaults */
   myopt->timeout.tv_sec = DEFAULT_LDAP_TIMEOUT;
   myopt->timeout.tv_usec = 0;
   myopt->alarm_timeout = 0;
 
-  /* Parse the command line.  */
-  pargs.argc = &argc;
-  pargs.argv = &argv;
+  memset (&pargs, 0, sizeof pargs);
+  pargs.argc = argc;
+  pargs.argv = argv;
   pargs.flags= ARGPARSE_FLAG_KEEP;
   while (gpgrt_argparse (NULL, &pargs, opts))
     {
@@ -257,9 +275,18 @@ main (int argc, char **argv)
             log_set_prefix (NULL, oldflags | GPGRT_LOG_WITH_PID);
           }
           break;
+        case oServer:
+          if (server_mode)
+            log_error ("option '%s' not allowed in a request\n", "--server");
+          else
+            server_mode = 1;
+          break;
 
         default :
-          pargs.err = ARGPARSE_PRINT_ERROR;
+          /* In server mode we must not exit on a bad option.  */
+          pargs.err = server_mode? ARGPARSE_PRINT_WARNING
+                                 : ARGPARSE_PRINT_ERROR;
+          bad_option = 1;
           break;
 	}
     }
@@ -270,13 +297,13 @@ main (int argc, char **argv)
 
   if (myopt->proxy)
     {
-      malloced_buffer1 = xtrystrdup (myopt->proxy);
-      if (!malloced_buffer1)
+      myopt->hostbuf = xtrystrdup (myopt->proxy);
+      if (!myopt->hostbuf)
         {
           log_error ("error copying string: %s\n", strerror (errno));
           return 1;
         }
-      myopt->host = malloced_buffer1;
+      myopt->host = myopt->hostbuf;
       p = strchr (myopt->host, ':');
       if (p)
         {
@@ -290,11 +317,6 @@ main (int argc, char **argv)
   if (myopt->port < 0 || myopt->port > 65535)
     log_error (_("invalid port number %d\n"), myopt->port);
 
-  if (log_get_errorcount (0))
-    exit (2);
-  if (argc < 1)
-    gpgrt_usage (1);
-
   if (myopt->alarm_timeout)
     {
 #ifndef HAVE_W32_SYSTEM
@@ -312,11 +334,52 @@ main (int argc, char **argv)
 #endif
     }
 
+  return bad_option || log_get_errorcount (0) != errorcount;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int any_err = 0;
+  struct my_opt_s my_opt_buffer;
+  my_opt_t myopt = &my_opt_buffer;
+
+  memset (&my_opt_buffer, 0, sizeof my_opt_buffer);
+
+  early_system_init ();
+
+  gpgrt_set_strusage (my_strusage);
+  log_set_prefix ("dirmngr_ldap", GPGRT_LOG_WITH_PREFIX);
+
+  /* Setup I18N and common subsystems. */
+  i18n_init();
+
+  init_common_subsystems (&argc, &argv);
+
+  es_set_binary (es_stdout);
+  myopt->outstream = es_stdout;
+
+  /* Parse the command line.  */
+  if (parse_options (myopt, &argc, &argv))
+    exit (2);
+
+  if (server_mode)
+    {
+      if (argc)
+        gpgrt_usage (1);
+      xfree (myopt->hostbuf);
+      return run_server ();
+    }
+
+  if (argc < 1)
+    gpgrt_usage (1);
+
   for (; argc; argc--, argv++)
     if (process_url (myopt, *argv))
       any_err = 1;
 
-  xfree (malloced_buffer1);
+  xfree (myopt->hostbuf);
   return any_err;
 }
 
@@ -331,6 +394,9 @@ catch_alarm (int dummy)
 
 
 #ifdef HAVE_W32_SYSTEM
+/* The timer used by set_timeout.  */
+static HANDLE alarm_timer;
+
 static DWORD CALLBACK
 alarm_thread (void *arg)
 {
@@ -350,13 +416,12 @@ set_timeout (my_opt_t myopt)
   if (myopt->alarm_timeout)
     {
 #ifdef HAVE_W32_SYSTEM
-      static HANDLE timer;
       LARGE_INTEGER due_time;
 
       /* A negative value is a relative time.  */
       due_time.QuadPart = (unsigned long long)-10000000 * myopt->alarm_timeout;
 
-      if (!timer)
+      if (!alarm_timer)
         {
           SECURITY_ATTRIBUTES sec_attr;
           DWORD tid;
@@ -366,15 +431,15 @@ set_timeout (my_opt_t myopt)
           sec_attr.bInheritHandle = FALSE;
 
           /* Create a manual resettable timer.  */
-          timer = CreateWaitableTimer (NULL, TRUE, NULL);
+          alarm_timer = CreateWaitableTimer (NULL, TRUE, NULL);
           /* Initially set the timer.  */
-          SetWaitableTimer (timer, &due_time, 0, NULL, NULL, 0);
+          SetWaitableTimer (alarm_timer, &due_time, 0, NULL, NULL, 0);
 
-          if (CreateThread (&sec_attr, 0, alarm_thread, timer, 0, &tid))
+          if (CreateThread (&sec_attr, 0, alarm_thread, alarm_timer, 0, &tid))
             log_error ("failed to create alarm thread\n");
         }
       else /* Retrigger the timer.  */
-        SetWaitableTimer (timer, &due_time, 0, NULL, NULL, 0);
+        SetWaitableTimer (alarm_timer, &due_time, 0, NULL, NULL, 0);
 #else
       alarm (myopt->alarm_timeout);
 #endif
@@ -382,6 +447,19 @@ set_timeout (my_opt_t myopt)
 }
 
 
+/* Cancel the timeout set by set_timeout.  */
+static void
+clear_timeout (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  if (alarm_timer)
+    CancelWaitableTimer (alarm_timer);
+#else
+  alarm (0);
+#endif
+}
+
+
 /* Helper for fetch_ldap().  */
 static int
 print_ldap_entries (my_opt_t myopt, LDAP *ld, LDAPMessage *msg, char *want_attr)
@@ -551,80 +629,17 @@ print_ldap_entries (my_opt_t myopt, LDAP *ld, LDAPMessage *msg, char *want_attr)
 
 
 
-/* Helper for the URL based LDAP query. */
-static int
-fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
+/* Create a new LDAP connection to HOST and PORT using TLS if USETLS
+ * is set and bind using the credentials from MYOPT.  Returns NULL on
+ * error.  */
+static LDAP *
+open_connection (my_opt_t myopt, char *host, int port, int usetls)
 {
   LDAP *ld;
-  LDAPMessage *msg;
-  int rc = 0;
-  char *host, *dn, *filter, *attrs[2], *attr;
-  int port;
   int ret;
-  int usetls;
-
-  host     = myopt->host?   myopt->host   : ludp->lud_host;
-  port     = myopt->port?   myopt->port   : ludp->lud_port;
-  dn       = myopt->dn?     myopt->dn     : ludp->lud_dn;
-  filter   = myopt->filter? myopt->filter : ludp->lud_filter;
-  attrs[0] = myopt->attr?   myopt->attr   : ludp->lud_attrs? ludp->lud_attrs[0]:NULL;
-  attrs[1] = NULL;
-  attr = attrs[0];
-
-  if (!port && myopt->force_tls)
-    port = 636;
-  else if (!port)
-    port = (ludp->lud_scheme && !strcmp (ludp->lud_scheme, "ldaps"))? 636:389;
-
-  if (myopt->verbose)
-    {
-      log_info (_("processing url '%s'\n"), url);
-      if (myopt->force_tls)
-        log_info ("forcing tls\n");
-      else
-        log_info ("not forcing tls\n");
-
-      if (myopt->user)
-        log_info (_("          user '%s'\n"), myopt->user);
-      if (myopt->pass)
-        log_info (_("          pass '%s'\n"), *myopt->pass?"*****":"");
-      if (host)
-        log_info (_("          host '%s'\n"), host);
-      log_info (_("          port %d\n"), port);
-      if (dn)
-        log_info (_("            DN '%s'\n"), dn);
-      if (filter)
-        log_info (_("        filter '%s'\n"), filter);
-      if (myopt->multi && !myopt->attr && ludp->lud_attrs)
-        {
-          int i;
-          for (i=0; ludp->lud_attrs[i]; i++)
-            log_info (_("          attr '%s'\n"), ludp->lud_attrs[i]);
-        }
-      else if (attr)
-        log_info (_("          attr '%s'\n"), attr);
-    }
-
-
-  if (!host || !*host)
-    {
-      log_error (_("no host name in '%s'\n"), url);
-      return -1;
-    }
-  if (!myopt->multi && !attr)
-    {
-      log_error (_("no attribute given for query '%s'\n"), url);
-      return -1;
-    }
-
-  if (!myopt->multi && !myopt->attr
-      && ludp->lud_attrs && ludp->lud_attrs[0] && ludp->lud_attrs[1])
-    log_info (_("WARNING: using first attribute only\n"));
 
   set_timeout (myopt);
 
-  usetls = (myopt->force_tls
-            || (ludp->lud_scheme && !strcmp (ludp->lud_scheme, "ldaps")));
 #if HAVE_W32_SYSTEM
   if (1)
     {
@@ -636,7 +651,7 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
           ret = LdapGetLastError ();
           log_error (_("LDAP init to '%s:%d' failed: %s\n"),
                      host, port, ldap_err2string (ret));
-          return -1;
+          return NULL;
         }
     }
 #else /*!W32*/
@@ -649,7 +664,7 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
         {
           log_error (_("error allocating memory: %s\n"),
                      gpg_strerror (gpg_error_from_syserror ()));
-          return -1;
+          return NULL;
         }
       npth_unprotect ();
       ret = ldap_initialize (&ld, uri);
@@ -659,7 +674,7 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
           log_error (_("LDAP init to '%s' failed: %s\n"),
                      uri, ldap_err2string (ret));
           xfree (uri);
-          return -1;
+          return NULL;
         }
       else if (myopt->verbose)
         log_info (_("LDAP init to '%s' done\n"), uri);
@@ -677,7 +692,7 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
         {
           log_error (_("LDAP init to '%s:%d' failed: %s\n"),
                      host, port, strerror (errno));
-          return -1;
+          return NULL;
         }
     }
 #endif /*!W32*/
@@ -704,22 +719,253 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
       log_error (_("binding to '%s:%d' failed: %s\n"),
                  host, port, ldap_err2string (ret));
       ldap_unbind (ld);
+      return NULL;
+    }
+
+  return ld;
+}
+
+
+/* Return true if the strings A and B are equal; both may be NULL.  */
+static int
+same_string (const char *a, const char *b)
+{
+  if (!a || !b)
+    return a == b;
+  return !strcmp (a, b);
+}
+
+
+/* Close the connection of CONN and release CONN.  */
+static void
+release_conn (conn_t conn)
+{
+  if (!conn)
+    return;
+  if (conn->ld)
+    ldap_unbind (conn->ld);
+  xfree (conn->host);
+  xfree (conn->user);
+  if (conn->pass)
+    {
+      wipememory (conn->pass, strlen (conn->pass));
+      xfree (conn->pass);
+    }
+  xfree (conn);
+}
+
+
+/* Return an LDAP connection to HOST and PORT using TLS if USETLS is
+ * set and bound with the credentials from MYOPT.  In server mode an
+ * already open connection is returned if possible; R_CACHED is then
+ * set to true.  The connection must be returned using put_connection.
+ * Returns NULL on error.  */
+static LDAP *
+get_connection (my_opt_t myopt, char *host, int port, int usetls,
+                int *r_cached)
+{
+  conn_t conn, prev;
+  LDAP *ld;
+  int n;
+
+  *r_cached = 0;
+
+  if (server_mode)
+    {
+      for (prev=NULL, conn=conn_list; conn; prev=conn, conn=conn->next)
+        if (conn->port == port && conn->usetls == usetls
+            && !ascii_strcasecmp (conn->host, host)
+            && same_string (conn->user, myopt->user)
+            && same_string (conn->pass, myopt->pass))
+          {
+            /* Move it to the front of the list.  */
+            if (prev)
+              {
+                prev->next = conn->next;
+                conn->next = conn_list;
+                conn_list = conn;
+              }
+            if (myopt->verbose)
+              log_info ("reusing connection to '%s:%d'\n", host, port);
+            *r_cached = 1;
+            return conn->ld;
+          }
+    }
+
+  ld = open_connection (myopt, host, port, usetls);
+  if (!ld || !server_mode)
+    return ld;
+
+  conn = xtrycalloc (1, sizeof *conn);
+  if (!conn
+      || !(conn->host = xtrystrdup (host))
+      || (myopt->user && !(conn->user = xtrystrdup (myopt->user)))
+      || (myopt->pass && !(conn->pass = xtrystrdup (myopt->pass))))
+    {
+      log_error (_("error allocating memory: %s\n"),
+                 gpg_strerror (gpg_error_from_syserror ()));
+      release_conn (conn);
+      ldap_unbind (ld);
+      return NULL;
+    }
+  conn->ld = ld;
+  conn->port = port;
+  conn->usetls = usetls;
+  conn->next = conn_list;
+  conn_list = conn;
+
+  /* Close the least recently used connections.  */
+  for (n=1, prev=conn_list; prev->next && n < MAX_CONNECTIONS; n++)
+    prev = prev->next;
+  conn = prev->next;
+  prev->next = NULL;
+  while (conn)
+    {
+      prev = conn->next;
+      release_conn (conn);
+      conn = prev;
+    }
+
+  return ld;
+}
+
+
+/* Return the connection LD obtained by get_connection.  The
+ * connection is closed unless it is kept for later use in server
+ * mode.  If FAILED is set it is always closed.  */
+static void
+put_connection (LDAP *ld, int failed)
+{
+  conn_t conn, prev;
+
+  if (!server_mode)
+    {
+      ldap_unbind (ld);
+      return;
+    }
+  if (!failed)
+    return;
+
+  for (prev=NULL, conn=conn_list; conn; prev=conn, conn=conn->next)
+    if (conn->ld == ld)
+      {
+        if (prev)
+          prev->next = conn->next;
+        else
+          conn_list = conn->next;
+        release_conn (conn);
+        return;
+      }
+}
+
+
+/* Helper for the URL based LDAP query. */
+static int
+fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
+{
+  LDAP *ld;
+  LDAPMessage *msg;
+  int rc = 0;
+  char *host, *dn, *filter, *attrs[2], *attr;
+  int port;
+  int usetls;
+  int cached;
+
+  host     = myopt->host?   myopt->host   : ludp->lud_host;
+  port     = myopt->port?   myopt->port   : ludp->lud_port;
+  dn       = myopt->dn?     myopt->dn     : ludp->lud_dn;
+  filter   = myopt->filter? myopt->filter : ludp->lud_filter;
+  attrs[0] = myopt->attr?   myopt->attr   : ludp->lud_attrs? ludp->lud_attrs[0]:NULL;
+  attrs[1] = NULL;
+  attr = attrs[0];
+
+  if (!port && myopt->force_tls)
+    port = 636;
+  else if (!port)
+    port = (ludp->lud_scheme && !strcmp (ludp->lud_scheme, "ldaps"))? 636:389;
+
+  if (myopt->verbose)
+    {
+      log_info (_("processing url '%s'\n"), url);
+      if (myopt->force_tls)
+        log_info ("forcing tls\n");
+      else
+        log_info ("not forcing tls\n");
+
+      if (myopt->user)
+        log_info (_("          user '%s'\n"), myopt->user);
+      if (myopt->pass)
+        log_info (_("          pass '%s'\n"), *myopt->pass?"*****":"");
+      if (host)
+        log_info (_("          host '%s'\n"), host);
+      log_info (_("          port %d\n"), port);
+      if (dn)
+        log_info (_("            DN '%s'\n"), dn);
+      if (filter)
+        log_info (_("        filter '%s'\n"), filter);
+      if (myopt->multi && !myopt->attr && ludp->lud_attrs)
+        {
+          int i;
+          for (i=0; ludp->lud_attrs[i]; i++)
+            log_info (_("          attr '%s'\n"), ludp->lud_attrs[i]);
+        }
+      else if (attr)
+        log_info (_("          attr '%s'\n"), attr);
+    }
+
+
+  if (!host || !*host)
+    {
+      log_error (_("no host name in '%s'\n"), url);
+      return -1;
+    }
+  if (!myopt->multi && !attr)
+    {
+      log_error (_("no attribute given for query '%s'\n"), url);
       return -1;
     }
 
-  set_timeout (myopt);
-  npth_unprotect ();
-  rc = ldap_search_st (ld, dn, ludp->lud_scope, filter,
-                       myopt->multi && !myopt->attr && ludp->lud_attrs?
-                       ludp->lud_attrs:attrs,
-                       0,
-                       &myopt->timeout, &msg);
-  npth_protect ();
+  if (!myopt->multi && !myopt->attr
+      && ludp->lud_attrs && ludp->lud_attrs[0] && ludp->lud_attrs[1])
+    log_info (_("WARNING: using first attribute only\n"));
+
+  usetls = (myopt->force_tls
+            || (ludp->lud_scheme && !strcmp (ludp->lud_scheme, "ldaps")));
+
+  for (;;)
+    {
+      ld = get_connection (myopt, host, port, usetls, &cached);
+      if (!ld)
+        return -1;
+
+      set_timeout (myopt);
+      msg = NULL;
+      npth_unprotect ();
+      rc = ldap_search_st (ld, dn, ludp->lud_scope, filter,
+                           myopt->multi && !myopt->attr && ludp->lud_attrs?
+                           ludp->lud_attrs:attrs,
+                           0,
+                           &myopt->timeout, &msg);
+      npth_protect ();
+      if (!cached || (rc != LDAP_SERVER_DOWN && rc != LDAP_CONNECT_ERROR))
+        break;
+
+      /* The server closed the connection we kept open.  Try again
+       * with a new connection.  */
+      if (myopt->verbose)
+        log_info ("connection to '%s:%d' lost - reconnecting\n", host, port);
+      if (msg)
+        ldap_msgfree (msg);
+      put_connection (ld, 1);
+    }
+
   if (rc == LDAP_SIZELIMIT_EXCEEDED && myopt->multi)
     {
       if (es_fwrite ("E\0\0\0\x09truncated", 14, 1, myopt->outstream) != 1)
         {
           log_error (_("error writing to stdout: %s\n"), strerror (errno));
+          ldap_msgfree (msg);
+          put_connection (ld, 0);
           return -1;
         }
     }
@@ -729,8 +975,9 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
                  url, ldap_err2string (rc));
       if (rc != LDAP_NO_SUCH_OBJECT)
         {
-          /* FIXME: Need deinit (ld)?  */
-          /* Hmmm: Do we need to released MSG in case of an error? */
+          if (msg)
+            ldap_msgfree (msg);
+          put_connection (ld, 1);
           return -1;
         }
     }
@@ -738,7 +985,7 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
   rc = print_ldap_entries (myopt, ld, msg, myopt->multi? NULL:attr);
 
   ldap_msgfree (msg);
-  ldap_unbind (ld);
+  put_connection (ld, 0);
   return rc;
 }
 
@@ -771,3 +1018,153 @@ process_url (my_opt_t myopt, const char *url)
   ldap_free_urldesc (ludp);
   return rc;
 }
+
+
+
+/* The write function for the output stream in server mode.  Wraps
+ * the data into 'D' frames on stdout.  */
+static gpgrt_ssize_t
+frame_writer (void *cookie, const void *buffer, size_t size)
+{
+  unsigned char hdr[5];
+
+  (void)cookie;
+
+  if (!buffer || !size)
+    return 0;  /* Flush - nothing to do.  */
+
+  hdr[0] = 'D';
+  hdr[1] = (size >> 24);
+  hdr[2] = (size >> 16);
+  hdr[3] = (size >> 8);
+  hdr[4] = (size);
+  if (es_fwrite (hdr, 5, 1, es_stdout) != 1
+      || es_fwrite (buffer, size, 1, es_stdout) != 1)
+    return -1;
+  return size;
+}
+
+
+/* Run the LDAP helper as a server.  Requests are read from stdin and
+ * the responses are written to stdout.  A request is a line with the
+ * same arguments as used on the command line; each argument is
+ * percent-plus escaped and separated from the next by a single space.
+ * The response is a sequence of frames; each frame starts with a type
+ * octet followed by a 4 octet value in network byte order:
+ *
+ *   'D' <n>   The next n octets are output data.
+ *   'E' <rc>  End of the response.  RC is the exit code the helper
+ *             would return when not running as a server.
+ *
+ * LDAP connections are kept open so that the next request to the
+ * same server with the same credentials saves the connect and bind.
+ * The server terminates at EOF on stdin.  */
+static int
+run_server (void)
+{
+  static es_cookie_io_functions_t frame_functions =
+    { NULL, frame_writer, NULL, NULL };
+  estream_t instream, outstream;
+  struct my_opt_s my_opt_buffer;
+  my_opt_t myopt = &my_opt_buffer;
+  char *line = NULL;
+  size_t linesize = 0;
+  size_t maxlen;
+  gpgrt_ssize_t len;
+  char **argbuf = NULL;
+  char **argv;
+  char *p;
+  int argc, idx, rc;
+  unsigned char tmp[5];
+  conn_t conn;
+
+  /* We can't use es_stdin because its stdio based reading would wait
+   * for more than one request.  */
+  instream = es_fdopen_nc (0, "rb");
+  outstream = es_fopencookie (NULL, "wb", frame_functions);
+  if (!instream || !outstream)
+    {
+      log_error ("error creating stream: %s\n", strerror (errno));
+      es_fclose (instream);
+      return 2;
+    }
+
+  for (;;)
+    {
+      maxlen = MAX_REQUEST_LINE;
+      len = es_read_line (instream, &line, &linesize, &maxlen);
+      if (len < 0)
+        {
+          log_error ("error reading request: %s\n", strerror (errno));
+          break;
+        }
+      if (!len)
+        break;  /* EOF.  */
+      if (!maxlen)
+        {
+          log_error ("request line too long\n");
+          break;
+        }
+      if (line[len-1] == '\n')
+        line[--len] = 0;
+
+      /* Build the argument vector.  Note that argparse expects the
+       * program name as the first element.  */
+      for (argc=2, p=line; (p = strchr (p, ' ')); p++)
+        argc++;
+      xfree (argbuf);
+      argv = argbuf = xtrycalloc (argc + 1, sizeof *argv);
+      if (!argv)
+        {
+          log_error (_("error allocating memory: %s\n"), strerror (errno));
+          break;
+        }
+      argv[0] = (char *)"dirmngr_ldap";
+      for (argc=1, p=line; p; argc++)
+        {
+          argv[argc] = p;
+          p = strchr (p, ' ');
+          if (p)
+            *p++ = 0;
+          percent_plus_unescape_inplace (argv[argc], 0);
+        }
+      argv[argc] = NULL;
+
+      memset (&my_opt_buffer, 0, sizeof my_opt_buffer);
+      myopt->outstream = outstream;
+
+      rc = 0;
+      if (parse_options (myopt, &argc, &argv))
+        rc = 2;
+      else
+        {
+          for (idx=0; idx < argc; idx++)
+            if (process_url (myopt, argv[idx]))
+              rc = 1;
+        }
+      clear_timeout ();
+      xfree (myopt->hostbuf);
+
+      tmp[0] = 'E';
+      tmp[1] = tmp[2] = tmp[3] = 0;
+      tmp[4] = rc;
+      if (es_fflush (outstream)
+          || es_fwrite (tmp, 5, 1, es_stdout) != 1
+          || es_fflush (es_stdout))
+        {
+          log_error (_("error writing to stdout: %s\n"), strerror (errno));
+          break;
+        }
+    }
+
+  while ((conn = conn_list))
+    {
+      conn_list = conn->next;
+      release_conn (conn);
+    }
+  es_fclose (outstream);
+  es_fclose (instream);
+  xfree (argbuf);
+  xfree (line);
+  return 0;
+}
@@ -179,6 +179,9 @@ static int libdns_tor_port;
 #endif /*USE_LIBDNS*/
 
 
+static void dns_cache_flush (void);
+
+
 /* Calling this function with YES set to True forces the use of the
  * standard resolver even if dirmngr has been built with support for
  * an alternative resolver.  */
@@ -235,7 +238,10 @@ enable_dns_tormode (int new_circuit)
       gpgrt_snprintf (tor_socks_password, sizeof tor_socks_password,
                       "p%u", counter);
       counter++;
+      dns_cache_flush ();
     }
+  if (!tor_mode)
+    dns_cache_flush ();
   tor_mode = 1;
 }
 
@@ -244,6 +250,8 @@ enable_dns_tormode (int new_circuit)
 void
 disable_dns_tormode (void)
 {
+  if (tor_mode)
+    dns_cache_flush ();
   tor_mode = 0;
 }
 
@@ -262,6 +270,8 @@ set_dns_verbose (int verbose, int debug)
 void
 set_dns_disable_ipv4 (int yes)
 {
+  if (opt_disable_ipv4 != !!yes)
+    dns_cache_flush ();
   opt_disable_ipv4 = !!yes;
 }
 
@@ -271,6 +281,8 @@ set_dns_disable_ipv4 (int yes)
 void
 set_dns_disable_ipv6 (int yes)
 {
+  if (opt_disable_ipv6 != !!yes)
+    dns_cache_flush ();
   opt_disable_ipv6 = !!yes;
 }
 
@@ -676,6 +688,287 @@ libdns_deinit (void)
 #endif /*USE_LIBDNS*/
 
 
+/* The DNS cache.  The results of resolve_dns_name, get_dns_srv and
+ * get_dns_cert are kept until the TTL of the records expires;
+ * negative answers are kept for DNS_CACHE_NEG_TTL seconds.  The
+ * cache is shared by all threads but it is only accessed by code
+ * which does not yield and thus no locking is required.  */
+#define DNS_CACHE_SIZE      256   /* Number of hash buckets.  */
+#define DNS_CACHE_MAX_ITEMS 1000  /* Maximum number of cached items.  */
+#define DNS_CACHE_MAX_TTL   3600  /* Upper limit for the TTL.  */
+#define DNS_CACHE_NEG_TTL   60    /* TTL for negative answers.  */
+
+/* The TTL used for address lookups.  Neither getaddrinfo nor the
+ * libdns addrinfo interface return the TTL of the records.  */
+#define DNS_CACHE_ADDR_TTL  60
+
+/* The types of cached items.  */
+enum dns_cache_types
+  {
+    DNS_CACHE_ADDR = 1,
+    DNS_CACHE_SRV,
+    DNS_CACHE_CERT
+  };
+
+struct dns_cache_item_s
+{
+  struct dns_cache_item_s *next;
+  enum dns_cache_types type;
+  time_t expires;         /* Time the item may no longer be used.  */
+  gpg_error_t err;        /* The error code of a negative answer.  */
+  union {
+    struct {
+      dns_addrinfo_t ai;
+      char *canonname;
+    } addr;
+    struct {
+      struct srventry *list;
+      unsigned int count;
+    } srv;
+    struct {
+      void *key;
+      size_t keylen;
+      unsigned char *fpr;
+      size_t fprlen;
+      char *url;
+    } cert;
+  } u;
+  char key[1];            /* The lookup key.  */
+};
+typedef struct dns_cache_item_s *dns_cache_item_t;
+
+static dns_cache_item_t dns_cache[DNS_CACHE_SIZE];
+static struct dns_cache_stats_s dns_cache_stats;
+
+
+/* Return the bucket for KEY.  DNS names are case-insensitive.  */
+static dns_cache_item_t *
+dns_cache_bucket (const char *key)
+{
+  const unsigned char *s;
+  unsigned int hash = 0;
+
+  for (s = (const unsigned char *)key; *s; s++)
+    hash = hash * 31 + ascii_tolower (*s);
+  return dns_cache + (hash % DNS_CACHE_SIZE);
+}
+
+
+/* Release ITEM.  */
+static void
+release_dns_cache_item (dns_cache_item_t item)
+{
+  if (!item)
+    return;
+  switch (item->type)
+    {
+    case DNS_CACHE_ADDR:
+      free_dns_addrinfo (item->u.addr.ai);
+      xfree (item->u.addr.canonname);
+      break;
+    case DNS_CACHE_SRV:
+      xfree (item->u.srv.list);
+      break;
+    case DNS_CACHE_CERT:
+      xfree (item->u.cert.key);
+      xfree (item->u.cert.fpr);
+      xfree (item->u.cert.url);
+      break;
+    }
+  xfree (item);
+}
+
+
+/* Remove all items from the DNS cache.  */
+static void
+dns_cache_flush (void)
+{
+  dns_cache_item_t item;
+  int i;
+
+  for (i=0; i < DIM (dns_cache); i++)
+    while ((item = dns_cache[i]))
+      {
+        dns_cache[i] = item->next;
+        release_dns_cache_item (item);
+      }
+  if (dns_cache_stats.entries)
+    dns_cache_stats.flushes++;
+  dns_cache_stats.entries = 0;
+}
+
+
+/* Remove all expired items from the DNS cache.  */
+static void
+dns_cache_purge (time_t now)
+{
+  dns_cache_item_t item, *itemp;
+  int i;
+
+  for (i=0; i < DIM (dns_cache); i++)
+    for (itemp = dns_cache + i; (item = *itemp); )
+      if (item->expires <= now)
+        {
+          *itemp = item->next;
+          release_dns_cache_item (item);
+          dns_cache_stats.entries--;
+          dns_cache_stats.expired++;
+        }
+      else
+        itemp = &item->next;
+}
+
+
+/* Return the cached item of TYPE for KEY or NULL.  The returned item
+ * is only valid until the next yield.  */
+static dns_cache_item_t
+dns_cache_get (enum dns_cache_types type, const char *key)
+{
+  dns_cache_item_t item, *itemp;
+
+  for (itemp = dns_cache_bucket (key); (item = *itemp); itemp = &item->next)
+    if (item->type == type && !ascii_strcasecmp (item->key, key))
+      break;
+  if (!item)
+    {
+      dns_cache_stats.misses++;
+      return NULL;
+    }
+
+  if (item->expires <= gnupg_get_time ())
+    {
+      *itemp = item->next;
+      release_dns_cache_item (item);
+      dns_cache_stats.entries--;
+      dns_cache_stats.expired++;
+      dns_cache_stats.misses++;
+      return NULL;
+    }
+
+  if (item->err)
+    dns_cache_stats.neg_hits++;
+  else
+    dns_cache_stats.hits++;
+  return item;
+}
+
+
+/* Return a new item of TYPE for KEY to be stored with dns_cache_put.
+ * TTL is the time to live in seconds and ERR the error code for a
+ * negative answer.  Returns NULL if the item shall not be cached.  */
+static dns_cache_item_t
+dns_cache_new (enum dns_cache_types type, const char *key,
+               unsigned int ttl, gpg_error_t err)
+{
+  dns_cache_item_t item;
+
+  if (!ttl)
+    return NULL;
+  if (ttl > DNS_CACHE_MAX_TTL)
+    ttl = DNS_CACHE_MAX_TTL;
+
+  item = xtrycalloc (1, sizeof *item + strlen (key));
+  if (!item)
+    return NULL;
+  item->type = type;
+  item->expires = gnupg_get_time () + ttl;
+  item->err = err;
+  strcpy (item->key, key);
+  return item;
+}
+
+
+/* Store ITEM in the cache and replace an older item with the same
+ * key.  ITEM may be NULL.  */
+static void
+dns_cache_put (dns_cache_item_t item)
+{
+  dns_cache_item_t old, *itemp;
+
+  if (!item)
+    return;
+
+  itemp = dns_cache_bucket (item->key);
+  for (; (old = *itemp); itemp = &old->next)
+    if (old->type == item->type && !ascii_strcasecmp (old->key, item->key))
+      {
+        *itemp = old->next;
+        release_dns_cache_item (old);
+        dns_cache_stats.entries--;
+        break;
+      }
+
+  if (dns_cache_stats.entries >= DNS_CACHE_MAX_ITEMS)
+    {
+      dns_cache_purge (gnupg_get_time ());
+      if (dns_cache_stats.entries >= DNS_CACHE_MAX_ITEMS)
+        {
+          release_dns_cache_item (item);
+          return;
+        }
+    }
+
+  itemp = dns_cache_bucket (item->key);
+  item->next = *itemp;
+  *itemp = item;
+  dns_cache_stats.entries++;
+}
+
+
+/* Return true if ERR is a definite negative answer which may be
+ * cached.  */
+static int
+dns_cache_negative_p (gpg_error_t err)
+{
+  switch (gpg_err_code (err))
+    {
+    case GPG_ERR_NO_NAME:
+    case GPG_ERR_NOT_FOUND:
+    case GPG_ERR_NO_DATA:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+
+/* Return a copy of the address list AI at R_AI.  */
+static gpg_error_t
+copy_dns_addrinfo (dns_addrinfo_t ai, dns_addrinfo_t *r_ai)
+{
+  dns_addrinfo_t head = NULL;
+  dns_addrinfo_t *tail = &head;
+  dns_addrinfo_t dai;
+
+  for (; ai; ai = ai->next)
+    {
+      dai = xtrymalloc (sizeof *dai);
+      if (!dai)
+        {
+          gpg_error_t err = gpg_error_from_syserror ();
+          free_dns_addrinfo (head);
+          *r_ai = NULL;
+          return err;
+        }
+      *dai = *ai;
+      dai->next = NULL;
+      *tail = dai;
+      tail = &dai->next;
+    }
+  *r_ai = head;
+  return 0;
+}
+
+
+/* Store the statistics of the DNS cache at R_STATS.  */
+void
+dns_cache_get_stats (struct dns_cache_stats_s *r_stats)
+{
+  *r_stats = dns_cache_stats;
+}
+
+
+
 /* SIGHUP action handler for this module.  With FORCE set objects are
  * all immediately released. */
 void
@@ -698,6 +991,8 @@ reload_dns_stuff (int force)
 
   /* We also flush the IPv4/v6 support flag cache.  */
   cached_inet_support.valid = 0;
+
+  dns_cache_flush ();
 }
 
 
@@ -710,6 +1005,8 @@ dns_stuff_housekeeping (void)
    * later than 10 minutes after it changed.  This way the user does
    * not need a reload.  */
   cached_inet_support.valid = 0;
+
+  dns_cache_purge (gnupg_get_time ());
 }
 
 
@@ -1099,6 +1396,37 @@ resolve_dns_name (ctrl_t ctrl, const char *name, unsigned short port,
                   dns_addrinfo_t *r_ai, char **r_canonname)
 {
   gpg_error_t err;
+  char *cachekey = NULL;
+  dns_cache_item_t item;
+
+  /* Numerical addresses are not worth caching.  */
+  if (!is_ip_address (name))
+    cachekey = xtryasprintf ("%d:%d:%hu:%d:%s", want_family, want_socktype,
+                             port, !!r_canonname, name);
+  if (cachekey && (item = dns_cache_get (DNS_CACHE_ADDR, cachekey)))
+    {
+      *r_ai = NULL;
+      if (r_canonname)
+        *r_canonname = NULL;
+      err = item->err;
+      if (!err)
+        err = copy_dns_addrinfo (item->u.addr.ai, r_ai);
+      if (!err && r_canonname && item->u.addr.canonname)
+        {
+          *r_canonname = xtrystrdup (item->u.addr.canonname);
+          if (!*r_canonname)
+            {
+              err = gpg_error_from_syserror ();
+              free_dns_addrinfo (*r_ai);
+              *r_ai = NULL;
+            }
+        }
+      if (opt_debug)
+        log_debug ("dns: resolve_dns_name(%s): %s (cached)\n",
+                   name, gpg_strerror (err));
+      xfree (cachekey);
+      return err;
+    }
 
 #ifdef USE_LIBDNS
   if (!standard_resolver)
@@ -1115,6 +1443,24 @@ resolve_dns_name (ctrl_t ctrl, const char *name, unsigned short port,
                                  r_ai, r_canonname);
   if (opt_debug)
     log_debug ("dns: resolve_dns_name(%s): %s\n", name, gpg_strerror (err));
+
+  if (cachekey && !err)
+    {
+      item = dns_cache_new (DNS_CACHE_ADDR, cachekey, DNS_CACHE_ADDR_TTL, 0);
+      if (item && (copy_dns_addrinfo (*r_ai, &item->u.addr.ai)
+                   || (r_canonname && *r_canonname
+                       && !(item->u.addr.canonname
+                            = xtrystrdup (*r_canonname)))))
+        {
+          release_dns_cache_item (item);
+          item = NULL;
+        }
+      dns_cache_put (item);
+    }
+  else if (cachekey && dns_cache_negative_p (err))
+    dns_cache_put (dns_cache_new (DNS_CACHE_ADDR, cachekey,
+                                  DNS_CACHE_NEG_TTL, err));
+  xfree (cachekey);
   return err;
 }
 
@@ -1431,7 +1777,8 @@ is_onion_address (const char *name)
 static gpg_error_t
 get_dns_cert_libdns (ctrl_t ctrl, const char *name, int want_certtype,
                      void **r_key, size_t *r_keylen,
-                     unsigned char **r_fpr, size_t *r_fprlen, char **r_url)
+                     unsigned char **r_fpr, size_t *r_fprlen, char **r_url,
+                     unsigned int *r_ttl)
 {
   gpg_error_t err;
   struct dns_resolver *res = NULL;
@@ -1497,6 +1844,8 @@ get_dns_cert_libdns (ctrl_t ctrl, const char *name, int want_certtype,
       unsigned short len = rr.rd.len;
       u16 subtype;
 
+      *r_ttl = rr.ttl;
+
        if (!len)
         {
           /* Definitely too short - skip.  */
@@ -1605,7 +1954,8 @@ get_dns_cert_libdns (ctrl_t ctrl, const char *name, int want_certtype,
 static gpg_error_t
 get_dns_cert_standard (const char *name, int want_certtype,
                        void **r_key, size_t *r_keylen,
-                       unsigned char **r_fpr, size_t *r_fprlen, char **r_url)
+                       unsigned char **r_fpr, size_t *r_fprlen, char **r_url,
+                       unsigned int *r_ttl)
 {
 #ifdef HAVE_SYSTEM_RESOLVER
   gpg_error_t err;
@@ -1680,6 +2030,7 @@ get_dns_cert_standard (const char *name, int want_certtype,
             break;
 
           /* ttl */
+          *r_ttl = buf32_to_uint (pt);
           pt += 4;
 
           /* data length */
@@ -1798,6 +2149,7 @@ get_dns_cert_standard (const char *name, int want_certtype,
   (void)r_fpr;
   (void)r_fprlen;
   (void)r_url;
+  (void)r_ttl;
   return gpg_error (GPG_ERR_NOT_SUPPORTED);
 
 #endif /*!HAVE_SYSTEM_RESOLVER*/
@@ -1820,6 +2172,9 @@ get_dns_cert (ctrl_t ctrl, const char *name, int want_certtype,
               unsigned char **r_fpr, size_t *r_fprlen, char **r_url)
 {
   gpg_error_t err;
+  char *cachekey;
+  dns_cache_item_t item;
+  unsigned int ttl = 0;
 
   if (r_key)
     *r_key = NULL;
@@ -1829,22 +2184,109 @@ get_dns_cert (ctrl_t ctrl, const char *name, int want_certtype,
   *r_fprlen = 0;
   *r_url = NULL;
 
+  /* The result depends on whether the caller wants a key.  */
+  cachekey = xtryasprintf ("%d:%d:%s", want_certtype,
+                           (r_key && r_keylen), name);
+  if (cachekey && (item = dns_cache_get (DNS_CACHE_CERT, cachekey)))
+    {
+      err = item->err;
+      if (!err && item->u.cert.key && r_key && r_keylen)
+        {
+          if (!(*r_key = xtrymalloc (item->u.cert.keylen)))
+            err = gpg_error_from_syserror ();
+          else
+            {
+              memcpy (*r_key, item->u.cert.key, item->u.cert.keylen);
+              *r_keylen = item->u.cert.keylen;
+            }
+        }
+      if (!err && item->u.cert.fpr)
+        {
+          if (!(*r_fpr = xtrymalloc (item->u.cert.fprlen)))
+            err = gpg_error_from_syserror ();
+          else
+            {
+              memcpy (*r_fpr, item->u.cert.fpr, item->u.cert.fprlen);
+              *r_fprlen = item->u.cert.fprlen;
+            }
+        }
+      if (!err && item->u.cert.url && !(*r_url = xtrystrdup (item->u.cert.url)))
+        err = gpg_error_from_syserror ();
+      if (err && !item->err)
+        {
+          if (r_key)
+            {
+              xfree (*r_key);
+              *r_key = NULL;
+            }
+          xfree (*r_fpr);
+          *r_fpr = NULL;
+          *r_fprlen = 0;
+        }
+      if (opt_debug)
+        log_debug ("dns: get_dns_cert(%s): %s (cached)\n",
+                   name, gpg_strerror (err));
+      xfree (cachekey);
+      return err;
+    }
+
 #ifdef USE_LIBDNS
   if (!standard_resolver)
     {
       err = get_dns_cert_libdns (ctrl, name, want_certtype, r_key, r_keylen,
-                                 r_fpr, r_fprlen, r_url);
+                                 r_fpr, r_fprlen, r_url, &ttl);
       if (err && libdns_switch_port_p (err))
         err = get_dns_cert_libdns (ctrl, name, want_certtype, r_key, r_keylen,
-                                   r_fpr, r_fprlen, r_url);
+                                   r_fpr, r_fprlen, r_url, &ttl);
     }
   else
 #endif /*USE_LIBDNS*/
     err = get_dns_cert_standard (name, want_certtype, r_key, r_keylen,
-                                 r_fpr, r_fprlen, r_url);
+                                 r_fpr, r_fprlen, r_url, &ttl);
 
   if (opt_debug)
     log_debug ("dns: get_dns_cert(%s): %s\n", name, gpg_strerror (err));
+
+  if (cachekey && !err)
+    {
+      item = dns_cache_new (DNS_CACHE_CERT, cachekey, ttl, 0);
+      if (item && r_key && *r_key)
+        {
+          if ((item->u.cert.key = xtrymalloc (*r_keylen)))
+            {
+              memcpy (item->u.cert.key, *r_key, *r_keylen);
+              item->u.cert.keylen = *r_keylen;
+            }
+          else
+            {
+              release_dns_cache_item (item);
+              item = NULL;
+            }
+        }
+      if (item && *r_fpr)
+        {
+          if ((item->u.cert.fpr = xtrymalloc (*r_fprlen)))
+            {
+              memcpy (item->u.cert.fpr, *r_fpr, *r_fprlen);
+              item->u.cert.fprlen = *r_fprlen;
+            }
+          else
+            {
+              release_dns_cache_item (item);
+              item = NULL;
+            }
+        }
+      if (item && *r_url && !(item->u.cert.url = xtrystrdup (*r_url)))
+        {
+          release_dns_cache_item (item);
+          item = NULL;
+        }
+      dns_cache_put (item);
+    }
+  else if (cachekey && dns_cache_negative_p (err))
+    dns_cache_put (dns_cache_new (DNS_CACHE_CERT, cachekey,
+                                  DNS_CACHE_NEG_TTL, err));
+  xfree (cachekey);
   return err;
 }
 
@@ -1864,11 +2306,12 @@ priosort(const void *a,const void *b)
 
 /* Libdns based helper for getsrv.  Note that it is expected that NULL
  * is stored at the address of LIST and 0 is stored at the address of
- * R_COUNT.  */
+ * R_COUNT.  The lowest TTL of the records is stored at R_TTL.  */
 #ifdef USE_LIBDNS
 static gpg_error_t
 getsrv_libdns (ctrl_t ctrl,
-               const char *name, struct srventry **list, unsigned int *r_count)
+               const char *name, struct srventry **list, unsigned int *r_count,
+               unsigned int *r_ttl)
 {
   gpg_error_t err;
   struct dns_resolver *res = NULL;
@@ -1940,6 +2383,8 @@ getsrv_libdns (ctrl_t ctrl,
       memset (&(*list)[srvcount], 0, sizeof(struct srventry));
       srv = &(*list)[srvcount];
       srvcount++;
+      if (rr.ttl < *r_ttl)
+        *r_ttl = rr.ttl;
       srv->priority = dsrv.priority;
       srv->weight   = dsrv.weight;
       srv->port     = dsrv.port;
@@ -1967,10 +2412,12 @@ getsrv_libdns (ctrl_t ctrl,
 
 /* Standard resolver based helper for getsrv.  Note that it is
  * expected that NULL is stored at the address of LIST and 0 is stored
- * at the address of R_COUNT.  */
+ * at the address of R_COUNT.  The lowest TTL of the records is stored
+ * at R_TTL.  */
 static gpg_error_t
 getsrv_standard (const char *name,
-                 struct srventry **list, unsigned int *r_count)
+                 struct srventry **list, unsigned int *r_count,
+                 unsigned int *r_ttl)
 {
 #ifdef HAVE_SYSTEM_RESOLVER
   union {
@@ -2046,6 +2493,8 @@ getsrv_standard (const char *name,
       if (class != C_IN)
         goto fail;
 
+      if (buf32_to_uint (pt) < *r_ttl)
+        *r_ttl = buf32_to_uint (pt);
       pt += 4; /* ttl */
       dlen = buf16_to_u16 (pt);
       pt += 2;
@@ -2087,6 +2536,7 @@ getsrv_standard (const char *name,
   (void)name;
   (void)list;
   (void)r_count;
+  (void)r_ttl;
   return gpg_error (GPG_ERR_NOT_SUPPORTED);
 
 #endif /*!HAVE_SYSTEM_RESOLVER*/
@@ -2105,6 +2555,8 @@ get_dns_srv (ctrl_t ctrl,
   gpg_error_t err;
   char *namebuffer = NULL;
   unsigned int srvcount;
+  unsigned int ttl = DNS_CACHE_MAX_TTL;
+  dns_cache_item_t item;
   int i;
 
   *list = NULL;
@@ -2125,22 +2577,69 @@ get_dns_srv (ctrl_t ctrl,
     }
 
 
-#ifdef USE_LIBDNS
-  if (!standard_resolver)
+  if ((item = dns_cache_get (DNS_CACHE_SRV, name)))
     {
-      err = getsrv_libdns (ctrl, name, list, &srvcount);
-      if (err && libdns_switch_port_p (err))
-        err = getsrv_libdns (ctrl, name, list, &srvcount);
+      err = 0;
+      if (item->u.srv.count)
+        {
+          *list = xtrymalloc (item->u.srv.count * sizeof **list);
+          if (!*list)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          memcpy (*list, item->u.srv.list, item->u.srv.count * sizeof **list);
+          srvcount = item->u.srv.count;
+        }
+      if (opt_debug)
+        log_debug ("dns: getsrv(%s): using cached result\n", name);
+      if (!srvcount)
+        goto leave;
     }
   else
+    {
+#ifdef USE_LIBDNS
+      if (!standard_resolver)
+        {
+          err = getsrv_libdns (ctrl, name, list, &srvcount, &ttl);
+          if (err && libdns_switch_port_p (err))
+            err = getsrv_libdns (ctrl, name, list, &srvcount, &ttl);
+        }
+      else
 #endif /*USE_LIBDNS*/
-    err = getsrv_standard (name, list, &srvcount);
+        err = getsrv_standard (name, list, &srvcount, &ttl);
 
-  if (err)
-    {
-      if (gpg_err_code (err) == GPG_ERR_NO_NAME)
-        err = 0;
-      goto leave;
+      if (err)
+        {
+          if (gpg_err_code (err) == GPG_ERR_NO_NAME)
+            {
+              err = 0;
+              dns_cache_put (dns_cache_new (DNS_CACHE_SRV, name,
+                                            DNS_CACHE_NEG_TTL,
+                                            gpg_error (GPG_ERR_NO_NAME)));
+            }
+          goto leave;
+        }
+
+      /* Cache the records in the order as received; the weighting
+       * below is done anew for each request.  */
+      item = dns_cache_new (DNS_CACHE_SRV, name,
+                            srvcount? ttl : DNS_CACHE_NEG_TTL, 0);
+      if (item && srvcount)
+        {
+          item->u.srv.list = xtrymalloc (srvcount * sizeof **list);
+          if (item->u.srv.list)
+            {
+              memcpy (item->u.srv.list, *list, srvcount * sizeof **list);
+              item->u.srv.count = srvcount;
+            }
+          else
+            {
+              release_dns_cache_item (item);
+              item = NULL;
+            }
+        }
+      dns_cache_put (item);
     }
 
   /* Now we have an array of all the srv records. */
@@ -137,6 +137,20 @@ void reload_dns_stuff (int force);
 /* Housekeeping for this module.  */
 void dns_stuff_housekeeping (void);
 
+/* Statistics of the DNS cache.  */
+struct dns_cache_stats_s
+{
+  unsigned int entries;     /* Number of cached answers.  */
+  unsigned long hits;       /* Number of positive answers from the cache. */
+  unsigned long neg_hits;   /* Number of negative answers from the cache. */
+  unsigned long misses;     /* Number of lookups not in the cache.  */
+  unsigned long expired;    /* Number of answers dropped due to the TTL. */
+  unsigned long flushes;    /* Number of times the cache was flushed.  */
+};
+
+/* Return the statistics of the DNS cache.  */
+void dns_cache_get_stats (struct dns_cache_stats_s *r_stats);
+
 void free_dns_addrinfo (dns_addrinfo_t ai);
 
 /* Function similar to getaddrinfo.  */
@@ -71,6 +71,7 @@
 # include <time.h>
 # include <fcntl.h>
 # include <netinet/in.h>
+# include <netinet/tcp.h>
 # include <arpa/inet.h>
 # include <netdb.h>
 #endif /*!HAVE_W32_SYSTEM*/
@@ -128,6 +129,8 @@
 
 #define HTTP_PROXY_ENV           "http_proxy"
 #define MAX_LINELEN 20000  /* Max. length of a HTTP header line. */
+#define CONNECT_ATTEMPT_DELAY 250 /* Delay between connects in ms.  */
+#define MAX_CONNECT_ATTEMPTS   16 /* Max. number of parallel connects. */
 #define VALID_URI_CHARS "abcdefghijklmnopqrstuvwxyz"   \
                         "ABCDEFGHIJKLMNOPQRSTUVWXYZ"   \
                         "01234567890@"                 \
@@ -167,6 +170,9 @@ static gpgrt_ssize_t cookie_read (void *cookie, void *buffer, size_t size);
 static gpgrt_ssize_t cookie_write (void *cookie,
                                    const void *buffer, size_t size);
 static int cookie_close (void *cookie);
+#ifdef HTTP_USE_GNUTLS
+static void send_gnutls_bye (void *opaque);
+#endif
 #if defined(HAVE_W32_SYSTEM) && defined(HTTP_USE_NTBTLS)
 static gpgrt_ssize_t simple_cookie_read (void *cookie,
                                          void *buffer, size_t size);
@@ -208,6 +214,22 @@ struct cookie_s
      the content length.  */
   uint64_t content_length;
   unsigned int content_length_valid:1;
+
+  /* The fields below are used for persistent connections.  If
+     BUFFERED is set all reads go through RBUF so that we never
+     consume more than the current response from the socket.  */
+  unsigned int buffered:1;
+  unsigned int keep_alive:1; /* The connection may be put into the pool. */
+  unsigned int in_header:1;  /* Still reading the response header.  */
+  unsigned int chunked:1;    /* Chunked transfer encoding is used.  */
+  unsigned int chunk_crlf:1; /* A CRLF follows the current chunk.  */
+  unsigned int chunk_eof:1;  /* The last chunk has been read.  */
+  unsigned int header_nl;    /* Number of consecutive LFs in the header. */
+  uint64_t chunk_left;       /* Bytes left in the current chunk.  */
+  char *pool_key;            /* Malloced key for the connection pool.  */
+  size_t rbuf_pos;           /* Read position in RBUF.  */
+  size_t rbuf_len;           /* Number of valid bytes in RBUF.  */
+  char rbuf[1024];
 };
 typedef struct cookie_s *cookie_t;
 
@@ -291,6 +313,9 @@ struct http_context_s
   my_socket_t sock;
   unsigned int in_data:1;
   unsigned int is_http_0_9:1;
+  unsigned int keep_alive:1; /* The connection shall be kept open.  */
+  unsigned int reused:1;     /* The connection was taken from the pool. */
+  char *pool_key;            /* The key into the connection pool or NULL. */
   estream_t fp_read;
   estream_t fp_write;
   void *write_cookie;
@@ -320,6 +345,25 @@ static strlist_t tls_ca_certlist;
 /* The list of files with extra trusted CA certificates.  */
 static strlist_t cfg_ca_certlist;
 
+/* Limits for the pool of persistent connections.  */
+#define HTTP_POOL_MAX          16  /* Max. number of idle connections.  */
+#define HTTP_POOL_MAX_PER_KEY   4  /* Max. idle connections per server. */
+#define HTTP_POOL_IDLE_TIME    30  /* Seconds to keep an idle connection. */
+
+/* An idle persistent connection.  */
+struct pool_conn_s
+{
+  struct pool_conn_s *next;
+  my_socket_t sock;         /* The socket object.  */
+  http_session_t session;   /* The TLS session or NULL.  */
+  time_t since;             /* Time the connection was put into the pool. */
+  char key[1];              /* The key as returned by make_pool_key.  */
+};
+typedef struct pool_conn_s *pool_conn_t;
+
+/* The list of idle connections with the most recently used first.  */
+static pool_conn_t conn_pool;
+
 /* The global callback for net activity.  */
 static void (*netactivity_cb)(void);
 
@@ -969,6 +1013,7 @@ http_open (ctrl_t ctrl, http_t *r_hd, http_req_t reqtype, const char *url,
       if (hd->fp_write)
         es_fclose (hd->fp_write);
       http_session_unref (hd->session);
+      xfree (hd->pool_key);
       xfree (hd);
     }
   else
@@ -1145,6 +1190,13 @@ http_wait_response (http_t hd)
   cookie->sock = my_socket_ref (hd->sock);
   cookie->session = http_session_ref (hd->session);
   cookie->use_tls = use_tls;
+  if (hd->keep_alive)
+    {
+      /* With a persistent connection we must not read beyond the
+       * response; thus the header is read through our buffer.  */
+      cookie->buffered = 1;
+      cookie->in_header = 1;
+    }
 
   hd->read_cookie = cookie;
   hd->fp_read = es_fopencookie (cookie, "r", cookie_functions);
@@ -1159,6 +1211,15 @@ http_wait_response (http_t hd)
     }
 
   err = parse_response (hd);
+  cookie->in_header = 0;
+  if (!err && hd->keep_alive)
+    {
+      /* Let the close of the read stream put the connection into the
+       * pool.  */
+      cookie->keep_alive = 1;
+      cookie->pool_key = hd->pool_key;
+      hd->pool_key = NULL;
+    }
 
   if (!err)
     err = es_onclose (hd->fp_read, 1, fp_onclose_notification, hd);
@@ -1223,10 +1284,201 @@ http_close (http_t hd, int keep_read_stream)
       hd->headers = tmp;
     }
   xfree (hd->buffer);
+  xfree (hd->pool_key);
   xfree (hd);
 }
 
 
+/* Close the idle connection CONN and release it.  */
+static void
+pool_conn_release (pool_conn_t conn)
+{
+  if (!conn)
+    return;
+
+  if (opt_debug)
+    log_debug ("http.c:pool: closing connection %p to %s\n", conn, conn->key);
+#if HTTP_USE_GNUTLS
+  if (conn->session && conn->session->tls_session)
+    my_socket_unref (conn->sock, send_gnutls_bye,
+                     conn->session->tls_session);
+  else
+#endif /*HTTP_USE_GNUTLS*/
+    my_socket_unref (conn->sock, NULL, NULL);
+  http_session_unref (conn->session);
+  xfree (conn);
+}
+
+
+/* Release all connections in the list LIST.  */
+static void
+pool_release_list (pool_conn_t list)
+{
+  pool_conn_t conn;
+
+  while ((conn = list))
+    {
+      list = conn->next;
+      pool_conn_release (conn);
+    }
+}
+
+
+/* Remove all connections from the pool which have been idle for too
+ * long.  NOW is the current time.  */
+static void
+pool_purge (time_t now)
+{
+  pool_conn_t conn, *connp;
+  pool_conn_t victims = NULL;
+
+  for (connp = &conn_pool; (conn = *connp); )
+    {
+      if (conn->since > now || conn->since + HTTP_POOL_IDLE_TIME <= now)
+        {
+          *connp = conn->next;
+          conn->next = victims;
+          victims = conn;
+        }
+      else
+        connp = &conn->next;
+    }
+
+  /* Releasing a TLS connection may let other threads run, thus we do
+   * this only after the list has been updated.  */
+  pool_release_list (victims);
+}
+
+
+/* Return true if the idle connection CONN looks usable.  If a server
+ * closes a connection while it is in the pool the socket becomes
+ * readable; the same is true if it sent unexpected data.  In both
+ * cases the connection can't be used for another request.  */
+static int
+pool_conn_alive (pool_conn_t conn)
+{
+  fd_set rfds;
+  struct timeval tv;
+  int fd = FD2INT (conn->sock->fd);
+
+#if HTTP_USE_GNUTLS
+  if (conn->session && !conn->session->tls_session)
+    return 0;
+  if (conn->session
+      && gnutls_record_check_pending (conn->session->tls_session))
+    return 0;
+#endif /*HTTP_USE_GNUTLS*/
+
+#ifndef HAVE_W32_SYSTEM
+  if (fd >= FD_SETSIZE)
+    return 0;
+#endif
+  FD_ZERO (&rfds);
+  FD_SET (fd, &rfds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  return !my_select (fd + 1, &rfds, NULL, NULL, &tv);
+}
+
+
+/* Take an idle connection matching KEY from the pool.  Returns NULL
+ * if no usable connection is available.  */
+static pool_conn_t
+pool_get (const char *key)
+{
+  pool_conn_t conn, *connp;
+
+  pool_purge (gnupg_get_time ());
+
+  /* We start over after each check because the check as well as the
+   * release of a dead connection may let other threads run.  */
+  for (;;)
+    {
+      for (connp = &conn_pool; (conn = *connp); connp = &conn->next)
+        if (!strcmp (conn->key, key))
+          break;
+      if (!conn)
+        return NULL;
+      *connp = conn->next;
+      conn->next = NULL;
+
+      if (pool_conn_alive (conn))
+        {
+          if (opt_debug)
+            log_debug ("http.c:pool: reusing connection %p to %s\n",
+                       conn, conn->key);
+          return conn;
+        }
+      pool_conn_release (conn);
+    }
+}
+
+
+/* Put the connection using SOCK and the optional TLS SESSION into the
+ * pool under KEY.  The caller's references to SOCK and SESSION are
+ * taken over.  */
+static void
+pool_put (const char *key, my_socket_t sock, http_session_t session)
+{
+  pool_conn_t conn, *connp;
+  pool_conn_t victims = NULL;
+  time_t now = gnupg_get_time ();
+  int n, nkey, same;
+
+  conn = xtrymalloc (sizeof *conn + strlen (key));
+  if (!conn)
+    {
+      my_socket_unref (sock, NULL, NULL);
+      http_session_unref (session);
+      return;
+    }
+  strcpy (conn->key, key);
+  conn->sock = sock;
+  conn->session = session;
+  conn->since = now;
+  conn->next = conn_pool;
+  conn_pool = conn;
+  if (opt_debug)
+    log_debug ("http.c:pool: keeping connection %p to %s\n", conn, key);
+
+  /* Enforce the limits.  Because new connections are inserted at the
+   * front we drop the oldest ones.  */
+  n = nkey = 0;
+  for (connp = &conn_pool; (conn = *connp); )
+    {
+      same = !strcmp (conn->key, key);
+      if (n + 1 > HTTP_POOL_MAX
+          || (same && nkey + 1 > HTTP_POOL_MAX_PER_KEY)
+          || conn->since + HTTP_POOL_IDLE_TIME <= now)
+        {
+          *connp = conn->next;
+          conn->next = victims;
+          victims = conn;
+        }
+      else
+        {
+          n++;
+          if (same)
+            nkey++;
+          connp = &conn->next;
+        }
+    }
+
+  pool_release_list (victims);
+}
+
+
+/* Close all idle persistent connections.  */
+void
+http_pool_flush (void)
+{
+  pool_conn_t list = conn_pool;
+
+  conn_pool = NULL;
+  pool_release_list (list);
+}
+
+
 estream_t
 http_get_read_ptr (http_t hd)
 {
@@ -1743,6 +1995,33 @@ is_hostname_port (const char *string)
 }
 
 
+/* Return a malloced key identifying a connection to SERVER and PORT
+ * for use with the connection pool.  The Host header, the service
+ * tag, and the flags affecting the connection and the TLS
+ * verification are part of the key so that a connection is only
+ * reused under the same conditions it has been established.  Returns
+ * NULL and sets ERRNO on error.  */
+static char *
+make_pool_key (http_t hd, const char *server, unsigned short port,
+               const char *httphost, const char *srvtag)
+{
+  unsigned int flags;
+
+  flags = (hd->flags & (HTTP_FLAG_IGNORE_IPv4 | HTTP_FLAG_IGNORE_IPv6));
+  if (hd->uri->use_tls)
+    flags |= ((hd->flags | hd->session->flags)
+              & (HTTP_FLAG_TRUST_DEF | HTTP_FLAG_TRUST_SYS
+                 | HTTP_FLAG_TRUST_CFG | HTTP_FLAG_NO_CRL));
+
+  return xtryasprintf ("%s://%s:%hu %s %s %u",
+                       hd->uri->use_tls? "https" : "http",
+                       server, port,
+                       httphost? httphost : "-",
+                       srvtag? srvtag : "-",
+                       flags);
+}
+
+
 /*
  * Send a HTTP request to the server
  * Returns 0 if the request was successful
@@ -1761,6 +2040,8 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
   char *authstr = NULL;
   assuan_fd_t sock;
   int have_http_proxy = 0;
+  const char *s;
+  pool_conn_t conn;
 
   if (hd->uri->use_tls && !hd->session)
     {
@@ -1799,6 +2080,42 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
   server = *hd->uri->host ? hd->uri->host : "localhost";
   port = hd->uri->port ? hd->uri->port : 80;
 
+  /* Check whether we may use a persistent connection.  We do not do
+   * this for proxies, Tor, and requests which need a shutdown or
+   * ignore the content length.  NTBTLS is not yet supported.  */
+  if ((hd->flags & HTTP_FLAG_KEEP_ALIVE)
+      && !(hd->flags & (HTTP_FLAG_FORCE_TOR | HTTP_FLAG_SHUTDOWN
+                        | HTTP_FLAG_IGNORE_CL))
+      && !(proxy && *proxy)
+      && !((hd->flags & HTTP_FLAG_TRY_PROXY)
+           && (s = getenv (HTTP_PROXY_ENV)) && *s)
+#if HTTP_USE_NTBTLS
+      && !hd->uri->use_tls
+#endif
+      )
+    {
+      hd->pool_key = make_pool_key (hd, server, port, httphost, srvtag);
+      if (!hd->pool_key)
+        return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+      hd->keep_alive = 1;
+
+      conn = pool_get (hd->pool_key);
+      if (conn)
+        {
+          /* Take over the socket and, for TLS, the already
+           * established and verified session.  */
+          hd->sock = conn->sock;
+          if (conn->session)
+            {
+              http_session_unref (hd->session);
+              hd->session = conn->session;
+            }
+          xfree (conn);
+          hd->reused = 1;
+          goto send_it;
+        }
+    }
+
   /* Try to use SNI.  */
   if (hd->uri->use_tls)
     {
@@ -1909,6 +2226,21 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
       return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
     }
 
+#ifdef TCP_NODELAY
+  if (hd->keep_alive)
+    {
+      /* The request is written in several parts.  On a persistent
+       * connection the Nagle algorithm would then delay the next
+       * request until the delayed ACK for the previous response has
+       * been sent.  */
+      int one = 1;
+
+      if (setsockopt (FD2INT (hd->sock->fd), IPPROTO_TCP, TCP_NODELAY,
+                      (void *)&one, sizeof one))
+        log_info ("setsockopt(TCP_NODELAY) failed: %s\n", strerror (errno));
+    }
+#endif /*TCP_NODELAY*/
+
   if (have_http_proxy && hd->uri->use_tls)
     {
       int saved_flags;
@@ -2161,6 +2493,7 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
 
 #endif /*HTTP_USE_GNUTLS*/
 
+ send_it:
   if (auth || hd->uri->auth)
     {
       char *myauth;
@@ -2221,12 +2554,15 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
       else
         snprintf (portstr, sizeof portstr, ":%u", port);
 
+      /* Persistent connections require HTTP/1.1 which is also the
+       * only version with chunked transfer encoding.  */
       request = es_bsprintf
-        ("%s %s%s HTTP/1.0\r\nHost: %s%s\r\n%s",
+        ("%s %s%s HTTP/1.%d\r\nHost: %s%s\r\n%s",
          hd->req_type == HTTP_REQ_GET ? "GET" :
          hd->req_type == HTTP_REQ_HEAD ? "HEAD" :
          hd->req_type == HTTP_REQ_POST ? "POST" : "OOPS",
          *p == '/' ? "" : "/", p,
+         hd->keep_alive? 1 : 0,
          httphost? httphost : server,
          portstr,
          authstr? authstr:"");
@@ -2493,6 +2829,25 @@ http_get_header_names (http_t hd)
 }
 
 
+/* Return true if the comma separated list in header NAME contains
+ * TOKEN.  The comparison is case-insensitive.  */
+static int
+header_has_token (http_t hd, const char *name, const char *token)
+{
+  const char *s;
+  size_t n = strlen (token);
+
+  for (s = http_get_header (hd, name); s && *s; s = strchr (s, ','))
+    {
+      s += strspn (s, ", \t");
+      if (!ascii_strncasecmp (s, token, n)
+          && (!s[n] || strchr (",; \t", s[n])))
+        return 1;
+    }
+  return 0;
+}
+
+
 /*
  * Parse the response from a server.
  * Returns: Errorcode and sets some files in the handle
@@ -2504,6 +2859,7 @@ parse_response (http_t hd)
   size_t maxlen, len;
   cookie_t cookie = hd->read_cookie;
   const char *s;
+  int is_http_1_1;
 
   /* Delete old header lines.  */
   while (hd->headers)
@@ -2535,7 +2891,10 @@ parse_response (http_t hd)
   if ((p = strchr (line, '/')))
     *p++ = 0;
   if (!p || strcmp (line, "HTTP"))
-    return 0; /* Assume http 0.9. */
+    {
+      hd->keep_alive = 0;
+      return 0; /* Assume http 0.9. */
+    }
 
   if ((p2 = strpbrk (p, " \t")))
     {
@@ -2543,7 +2902,11 @@ parse_response (http_t hd)
       p2 += strspn (p2, " \t");
     }
   if (!p2)
-    return 0; /* Also assume http 0.9. */
+    {
+      hd->keep_alive = 0;
+      return 0; /* Also assume http 0.9. */
+    }
+  is_http_1_1 = !strcmp (p, "1.1");
   p = p2;
   /* TODO: Add HTTP version number check. */
   if ((p2 = strpbrk (p, " \t")))
@@ -2554,6 +2917,7 @@ parse_response (http_t hd)
       /* Malformed HTTP status code - assume http 0.9. */
       hd->is_http_0_9 = 1;
       hd->status_code = 200;
+      hd->keep_alive = 0;
       return 0;
     }
   hd->status_code = atoi (p);
@@ -2595,6 +2959,37 @@ parse_response (http_t hd)
         }
     }
 
+  /* A HTTP/1.1 request was sent if BUFFERED is set.  The server may
+   * then use chunked encoding or a response without a body.  */
+  if (cookie->buffered)
+    {
+      if (is_http_1_1 && header_has_token (hd, "Transfer-Encoding", "chunked"))
+        {
+          cookie->chunked = 1;
+          cookie->content_length_valid = 0;
+        }
+      else if (hd->status_code == 204 || hd->status_code == 304)
+        {
+          cookie->content_length_valid = 1;
+          cookie->content_length = 0;
+        }
+    }
+
+  /* HTTP/1.1 connections are persistent unless the server says
+   * otherwise; a HTTP/1.0 server needs to ask for it.  Without a
+   * known length the end of the body is signaled by closing the
+   * connection.  */
+  if (hd->keep_alive)
+    {
+      if (header_has_token (hd, "Connection", "close"))
+        hd->keep_alive = 0;
+      else if (!is_http_1_1
+               && !header_has_token (hd, "Connection", "keep-alive"))
+        hd->keep_alive = 0;
+      else if (!cookie->chunked && !cookie->content_length_valid)
+        hd->keep_alive = 0;
+    }
+
   return 0;
 }
 
@@ -2887,12 +3282,428 @@ connect_with_timeout (assuan_fd_t sock,
 }
 
 
+/* Return the current time in milliseconds.  Only the difference
+ * between two returned values is meaningful.  */
+static unsigned long
+get_msec_time (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  return GetTickCount ();
+#elif defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  return (unsigned long)time (NULL) * 1000;
+#else
+  struct timeval tv;
+
+  if (!gettimeofday (&tv, NULL))
+    return (unsigned long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  return (unsigned long)time (NULL) * 1000;
+#endif
+}
+
+
+/* Switch SOCK into non-blocking mode if NONBLOCK is true, or back
+ * into blocking mode if it is false.  */
+static gpg_error_t
+set_sock_nonblocking (assuan_fd_t sock, int nonblock)
+{
+#ifdef HAVE_W32_SYSTEM
+  unsigned long along = !!nonblock;
+
+  if (ioctlsocket (FD2INT (sock), FIONBIO, &along))
+    return my_wsagetlasterror ();
+#else
+  int oflags;
+
+  oflags = fcntl (sock, F_GETFL, 0);
+  if (oflags == -1
+      || fcntl (sock, F_SETFL, (nonblock? (oflags | O_NONBLOCK)
+                                /*    */ : (oflags & ~O_NONBLOCK))))
+    return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+#endif
+  return 0;
+}
+
+
+/* Store the usable addresses of AIBUF in the array CANDS starting at
+ * index *R_IDX and update *R_IDX.  The address families are
+ * interleaved as recommended by RFC-8305, starting with the family
+ * of the first usable address.  WANT_V4 and WANT_V6 tell whether
+ * IPv4 and IPv6 addresses may be used.  */
+static void
+add_connect_candidates (dns_addrinfo_t aibuf, int want_v4, int want_v6,
+                        dns_addrinfo_t *cands, int *r_idx)
+{
+  dns_addrinfo_t first, other;
+  int family;
+
+#define USABLE(a) (!((a)->family == AF_INET && !want_v4)     \
+                   && !((a)->family == AF_INET6 && !want_v6))
+
+  for (first = aibuf; first && !USABLE (first); first = first->next)
+    ;
+  if (!first)
+    return;
+  family = first->family;
+
+  other = aibuf;
+  for (;;)
+    {
+      for (; first && !(USABLE (first) && first->family == family);
+           first = first->next)
+        ;
+      for (; other && !(USABLE (other) && other->family != family);
+           other = other->next)
+        ;
+      if (!first && !other)
+        break;
+      if (first)
+        {
+          cands[(*r_idx)++] = first;
+          first = first->next;
+        }
+      if (other)
+        {
+          cands[(*r_idx)++] = other;
+          other = other->next;
+        }
+    }
+
+#undef USABLE
+}
+
+
+/* The addresses to be tried by connect_staggered.  These are the
+ * addresses of SRV targets with the same priority; a target is only
+ * resolved when the first of its addresses is due.  */
+struct connect_cands_s
+{
+  ctrl_t ctrl;
+  struct srventry *targets;  /* The SRV targets.  */
+  int ntargets;              /* The number of SRV targets.  */
+  int nresolved;             /* The number of targets already resolved.  */
+  unsigned short port;
+  int want_v4;
+  int want_v6;
+  dns_addrinfo_t *aibufs;    /* The resolver results for each target.  */
+  dns_addrinfo_t *addrs;     /* The usable addresses in connect order.  */
+  int naddrs;                /* The number of entries in ADDRS.  */
+  int hostfound;             /* At least one target could be resolved.  */
+  gpg_error_t last_err;      /* The last resolver error.  */
+};
+
+
+/* Initialize CC for the NTARGETS SRV targets at TARGETS.  */
+static gpg_error_t
+init_connect_cands (struct connect_cands_s *cc, ctrl_t ctrl,
+                    struct srventry *targets, int ntargets,
+                    unsigned short port, int want_v4, int want_v6)
+{
+  memset (cc, 0, sizeof *cc);
+  cc->ctrl = ctrl;
+  cc->targets = targets;
+  cc->ntargets = ntargets;
+  cc->port = port;
+  cc->want_v4 = want_v4;
+  cc->want_v6 = want_v6;
+  cc->aibufs = xtrycalloc (ntargets, sizeof *cc->aibufs);
+  if (!cc->aibufs)
+    return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+  return 0;
+}
+
+
+/* Release the resources of CC.  */
+static void
+release_connect_cands (struct connect_cands_s *cc)
+{
+  int i;
+
+  for (i=0; i < cc->nresolved; i++)
+    free_dns_addrinfo (cc->aibufs[i]);
+  xfree (cc->aibufs);
+  xfree (cc->addrs);
+  cc->aibufs = NULL;
+  cc->addrs = NULL;
+}
+
+
+/* Return true if CC may have an address with index IDX.  */
+static int
+more_connect_cands_p (struct connect_cands_s *cc, int idx)
+{
+  return idx < cc->naddrs || cc->nresolved < cc->ntargets;
+}
+
+
+/* Return the address with index IDX from CC or NULL if there is no
+ * such address.  Further targets are resolved as needed.  */
+static dns_addrinfo_t
+get_connect_cand (struct connect_cands_s *cc, int idx)
+{
+  gpg_error_t err;
+  struct srventry *target;
+  dns_addrinfo_t ai, *tmp;
+  int n;
+
+  while (idx >= cc->naddrs && cc->nresolved < cc->ntargets)
+    {
+      target = cc->targets + cc->nresolved;
+      if (opt_debug)
+        log_debug ("http.c:connect_server: trying name='%s' port=%hu\n",
+                   target->target, cc->port);
+      err = resolve_dns_name (cc->ctrl, target->target, cc->port,
+                              0, SOCK_STREAM,
+                              &cc->aibufs[cc->nresolved], NULL);
+      ai = cc->aibufs[cc->nresolved++];
+      if (err)
+        {
+          log_info ("resolving '%s' failed: %s\n",
+                    target->target, gpg_strerror (err));
+          cc->last_err = err;
+          continue; /* Not found - try next one. */
+        }
+      cc->hostfound = 1;
+
+      for (n=0; ai; ai = ai->next)
+        n++;
+      tmp = xtryrealloc (cc->addrs, (cc->naddrs + n) * sizeof *cc->addrs);
+      if (!tmp)
+        {
+          cc->last_err = gpg_err_make (default_errsource,
+                                       gpg_err_code_from_syserror ());
+          return NULL;
+        }
+      cc->addrs = tmp;
+      add_connect_candidates (cc->aibufs[cc->nresolved-1],
+                              cc->want_v4, cc->want_v6,
+                              cc->addrs, &cc->naddrs);
+    }
+
+  return idx < cc->naddrs? cc->addrs[idx] : NULL;
+}
+
+
+/* The state of a pending connection attempt.  */
+struct connect_attempt_s
+{
+  assuan_fd_t sock;
+  unsigned long started;  /* Start time of the attempt in ms.  */
+};
+
+
+/* Connect to one of the addresses in CC.  As recommended by RFC-8305
+ * ("Happy Eyeballs") the attempts are not done one after the other
+ * but staggered: A new attempt is started
+ * every CONNECT_ATTEMPT_DELAY milliseconds or as soon as the previous
+ * one failed; the attempts already started are kept running.  The
+ * first attempt which succeeds wins and all others are cancelled.
+ * Thus a black-holed address delays the connection only by the
+ * attempt delay and not by the full TIMEOUT, which is the timeout in
+ * milliseconds for each single attempt (0 for the system's default).
+ * On success 0 is returned and the connected socket is stored at
+ * R_SOCK.  R_ANYHOSTADDR is set to true if a socket was created for
+ * at least one address.  */
+static gpg_error_t
+connect_staggered (struct connect_cands_s *cc, unsigned int timeout,
+                   int *r_anyhostaddr, assuan_fd_t *r_sock)
+{
+  gpg_error_t err;
+  gpg_error_t last_err = 0;
+  struct connect_attempt_s attempts[MAX_CONNECT_ATTEMPTS];
+  int nattempts = 0;
+  int next = 0;
+  unsigned long now, next_start, wait, elapsed;
+  dns_addrinfo_t ai;
+  assuan_fd_t sock;
+  fd_set rset, wset, eset;
+  struct timeval tval;
+  int nfds, i, n;
+  int syserr;
+  socklen_t slen;
+
+  *r_sock = ASSUAN_INVALID_FD;
+
+  next_start = get_msec_time ();
+  for (;;)
+    {
+      now = get_msec_time ();
+
+      /* Start new attempts.  The first one is started right away and
+       * a further one when its start time has been reached.  */
+      while (nattempts < MAX_CONNECT_ATTEMPTS
+             && (!nattempts || (long)(now - next_start) >= 0)
+             && (ai = get_connect_cand (cc, next)))
+        {
+          next++;
+          now = get_msec_time ();  /* Resolving may have taken a while.  */
+          sock = my_sock_new_for_addr (ai->addr, ai->socktype, ai->protocol);
+          if (sock == ASSUAN_INVALID_FD)
+            {
+              err = gpg_err_make (default_errsource,
+                                  gpg_err_code_from_syserror ());
+              log_error ("error creating socket: %s\n", gpg_strerror (err));
+              goto leave;
+            }
+          *r_anyhostaddr = 1;
+
+          if (opt_debug)
+            log_debug ("http.c:connect_server: starting attempt %d\n", next);
+
+          err = set_sock_nonblocking (sock, 1);
+          if (!err)
+            {
+              if (!assuan_sock_connect (sock, (struct sockaddr *)ai->addr,
+                                        ai->addrlen))
+                {
+                  /* Immediate connect.  */
+                  err = set_sock_nonblocking (sock, 0);
+                  if (!err)
+                    {
+                      *r_sock = sock;
+                      goto leave;
+                    }
+                }
+              else
+                {
+                  err = gpg_err_make (default_errsource,
+                                      gpg_err_code_from_syserror ());
+                  if (gpg_err_code (err) == GPG_ERR_EINPROGRESS
+#ifdef HAVE_W32_SYSTEM
+                      || gpg_err_code (err) == GPG_ERR_EAGAIN
+#endif
+                      )
+                    {
+                      attempts[nattempts].sock = sock;
+                      attempts[nattempts].started = now;
+                      nattempts++;
+                      next_start = now + CONNECT_ATTEMPT_DELAY;
+                      continue;
+                    }
+                }
+            }
+
+          /* This attempt failed at once - try the next address
+           * without waiting.  */
+          last_err = err;
+          assuan_sock_close (sock);
+          next_start = now;
+        }
+
+      if (!nattempts)
+        {
+          /* All addresses failed.  */
+          err = last_err? last_err :
+                cc->last_err? cc->last_err : gpg_err_make (default_errsource,
+                                                           GPG_ERR_UNKNOWN_HOST);
+          goto leave;
+        }
+
+      /* Wait until one of the pending attempts finishes, one of them
+       * times out, or the next attempt is due.  */
+      wait = (unsigned long)(-1);
+      if (nattempts < MAX_CONNECT_ATTEMPTS && more_connect_cands_p (cc, next))
+        wait = (long)(next_start - now) > 0? (next_start - now) : 0;
+      FD_ZERO (&rset);
+      nfds = 0;
+      for (i=0; i < nattempts; i++)
+        {
+          if (timeout)
+            {
+              elapsed = now - attempts[i].started;
+              if (elapsed >= timeout)
+                wait = 0;
+              else if (timeout - elapsed < wait)
+                wait = timeout - elapsed;
+            }
+          FD_SET (FD2INT (attempts[i].sock), &rset);
+          if (FD2INT (attempts[i].sock) > nfds)
+            nfds = FD2INT (attempts[i].sock);
+        }
+      wset = rset;
+      eset = rset;  /* Windows reports a failed connect this way.  */
+      if (wait != (unsigned long)(-1))
+        {
+          tval.tv_sec = wait / 1000;
+          tval.tv_usec = (wait % 1000) * 1000;
+        }
+
+      n = my_select (nfds+1, &rset, &wset, &eset,
+                     wait != (unsigned long)(-1)? &tval : NULL);
+      if (n < 0)
+        {
+          err = gpg_err_make (default_errsource,
+                              gpg_err_code_from_syserror ());
+          if (gpg_err_code (err) == GPG_ERR_EINTR)
+            continue;
+          goto leave;
+        }
+
+      now = get_msec_time ();
+      for (i=0; i < nattempts; )
+        {
+          sock = attempts[i].sock;
+          if (n > 0 && (FD_ISSET (FD2INT (sock), &rset)
+                        || FD_ISSET (FD2INT (sock), &wset)
+                        || FD_ISSET (FD2INT (sock), &eset)))
+            {
+              slen = sizeof (syserr);
+              if (getsockopt (FD2INT(sock), SOL_SOCKET, SO_ERROR,
+                              (void*)&syserr, &slen) < 0)
+                err = gpg_err_make (default_errsource,
+                                    gpg_err_code_from_syserror ());
+              else if (syserr)
+                err = gpg_err_make (default_errsource,
+                                    gpg_err_code_from_errno (syserr));
+              else
+                err = set_sock_nonblocking (sock, 0);
+              if (!err)
+                {
+                  /* Connected.  */
+                  attempts[i] = attempts[--nattempts];
+                  *r_sock = sock;
+                  goto leave;
+                }
+            }
+          else if (timeout && now - attempts[i].started >= timeout)
+            err = gpg_err_make (default_errsource, GPG_ERR_ETIMEDOUT);
+          else
+            {
+              i++;
+              continue;  /* Still pending.  */
+            }
+
+          if (opt_debug)
+            log_debug ("http.c:connect_server: attempt failed: %s\n",
+                       gpg_strerror (err));
+          last_err = err;
+          assuan_sock_close (sock);
+          attempts[i] = attempts[--nattempts];
+          next_start = now;
+        }
+    }
+
+ leave:
+  /* Cancel all attempts still pending.  */
+  for (i=0; i < nattempts; i++)
+    assuan_sock_close (attempts[i].sock);
+  return err;
+}
+
+
 /* Actually connect to a server.  On success 0 is returned and the
  * file descriptor for the socket is stored at R_SOCK; on error an
  * error code is returned and ASSUAN_INVALID_FD is stored at R_SOCK.
  * TIMEOUT is the connect timeout in milliseconds.  Note that the
  * function tries to connect to all known addresses and the timeout is
- * for each one. */
+ * for each one.  As demanded by RFC-2782 the SRV targets are tried
+ * by priority; the targets of the next priority are only tried after
+ * all addresses of the current priority failed.  The addresses of
+ * the targets with the same priority are tried in a staggered
+ * parallel fashion; see connect_staggered.  */
 static gpg_error_t
 connect_server (ctrl_t ctrl, const char *server, unsigned short port,
                 unsigned int flags, const char *srvtag, unsigned int timeout,
@@ -2903,9 +3714,12 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
   unsigned int srvcount = 0;
   int hostfound = 0;
   int anyhostaddr = 0;
-  int srv, connected, v4_valid, v6_valid;
+  int srv, end, connected, v4_valid, v6_valid, want_v4, want_v6;
   gpg_error_t last_err = 0;
   struct srventry *serverlist = NULL;
+  struct connect_cands_s cc;
+  dns_addrinfo_t ai;
+  int idx, use_tor;
 
   *r_sock = ASSUAN_INVALID_FD;
 
@@ -2914,6 +3728,8 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
 #endif /*Windows*/
 
   check_inet_support (&v4_valid, &v6_valid);
+  want_v4 = v4_valid && !(flags & HTTP_FLAG_IGNORE_IPv4);
+  want_v6 = v6_valid && !(flags & HTTP_FLAG_IGNORE_IPv6);
 
   /* Onion addresses require special treatment.  */
   if (is_onion_address (server))
@@ -2971,65 +3787,74 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
       srvcount = 1;
     }
 
+  /* Non-blocking connects do not work with our Tor proxy.  Thus in
+   * Tor mode we try one address after the other.  */
+  if (assuan_sock_get_flag (ASSUAN_INVALID_FD, "tor-mode", &use_tor))
+    use_tor = 0;
+
+  /* The server list is sorted by priority.  */
   connected = 0;
-  for (srv=0; srv < srvcount && !connected; srv++)
+  for (srv=0; srv < srvcount && !connected; srv = end)
     {
-      dns_addrinfo_t aibuf, ai;
-
-      if (opt_debug)
-        log_debug ("http.c:connect_server: trying name='%s' port=%hu\n",
-                   serverlist[srv].target, port);
-      err = resolve_dns_name (ctrl,
-                              serverlist[srv].target, port, 0, SOCK_STREAM,
-                              &aibuf, NULL);
+      for (end=srv+1; (end < srvcount
+                       && serverlist[end].priority == serverlist[srv].priority);
+           end++)
+        ;
+      err = init_connect_cands (&cc, ctrl, serverlist + srv, end - srv,
+                                port, want_v4, want_v6);
       if (err)
-        {
-          log_info ("resolving '%s' failed: %s\n",
-                    serverlist[srv].target, gpg_strerror (err));
-          last_err = err;
-          continue; /* Not found - try next one. */
-        }
-      hostfound = 1;
+        goto leave;
 
-      for (ai = aibuf; ai && !connected; ai = ai->next)
+      if (!use_tor)
         {
-          if (ai->family == AF_INET
-              && ((flags & HTTP_FLAG_IGNORE_IPv4) || !v4_valid))
-            continue;
-          if (ai->family == AF_INET6
-              && ((flags & HTTP_FLAG_IGNORE_IPv6) || !v6_valid))
-            continue;
-
-          if (sock != ASSUAN_INVALID_FD)
-            assuan_sock_close (sock);
-          sock = my_sock_new_for_addr (ai->addr, ai->socktype, ai->protocol);
-          if (sock == ASSUAN_INVALID_FD)
-            {
-              err = gpg_err_make (default_errsource,
-                                  gpg_err_code_from_syserror ());
-              log_error ("error creating socket: %s\n", gpg_strerror (err));
-              free_dns_addrinfo (aibuf);
-              xfree (serverlist);
-              return err;
-            }
-
-          anyhostaddr = 1;
-          err = connect_with_timeout (sock, (struct sockaddr *)ai->addr,
-                                      ai->addrlen, timeout);
+          err = connect_staggered (&cc, timeout, &anyhostaddr, &sock);
           if (err)
-            {
-              last_err = err;
-            }
+            last_err = err;
           else
             {
               connected = 1;
               notify_netactivity ();
             }
         }
-      free_dns_addrinfo (aibuf);
-    }
+      else
+        {
+          for (idx=0; !connected && (ai = get_connect_cand (&cc, idx)); idx++)
+            {
+              if (sock != ASSUAN_INVALID_FD)
+                assuan_sock_close (sock);
+              sock = my_sock_new_for_addr (ai->addr, ai->socktype,
+                                           ai->protocol);
+              if (sock == ASSUAN_INVALID_FD)
+                {
+                  err = gpg_err_make (default_errsource,
+                                      gpg_err_code_from_syserror ());
+                  log_error ("error creating socket: %s\n",
+                             gpg_strerror (err));
+                  release_connect_cands (&cc);
+                  goto leave;
+                }
 
-  xfree (serverlist);
+              anyhostaddr = 1;
+              err = connect_with_timeout (sock, (struct sockaddr *)ai->addr,
+                                          ai->addrlen, timeout);
+              if (err)
+                {
+                  last_err = err;
+                }
+              else
+                {
+                  connected = 1;
+                  notify_netactivity ();
+                }
+            }
+          if (!connected && cc.last_err)
+            last_err = cc.last_err;
+        }
+
+      if (cc.hostfound)
+        hostfound = 1;
+      release_connect_cands (&cc);
+    }
 
   if (!connected)
     {
@@ -3051,13 +3876,18 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
         }
       err = last_err? last_err : gpg_err_make (default_errsource,
                                                GPG_ERR_UNKNOWN_HOST);
-      if (sock != ASSUAN_INVALID_FD)
-	assuan_sock_close (sock);
-      return err;
+      goto leave;
     }
 
   *r_sock = sock;
-  return 0;
+  sock = ASSUAN_INVALID_FD;
+  err = 0;
+
+ leave:
+  if (sock != ASSUAN_INVALID_FD)
+    assuan_sock_close (sock);
+  xfree (serverlist);
+  return err;
 }
 
 
@@ -3150,21 +3980,12 @@ write_server (assuan_fd_t sock, const char *data, size_t length)
 
 
 
-/* Read handler for estream.  */
+/* Read up to SIZE bytes from the connection of cookie C.  */
 static gpgrt_ssize_t
-cookie_read (void *cookie, void *buffer, size_t size)
+cookie_read_transport (cookie_t c, void *buffer, size_t size)
 {
-  cookie_t c = cookie;
   int nread;
 
-  if (c->content_length_valid)
-    {
-      if (!c->content_length)
-        return 0; /* EOF */
-      if (c->content_length < size)
-        size = c->content_length;
-    }
-
 #if HTTP_USE_NTBTLS
   if (c->use_tls && c->session && c->session->tls_session)
     {
@@ -3214,6 +4035,174 @@ cookie_read (void *cookie, void *buffer, size_t size)
       nread = read_server (c->sock->fd, buffer, size);
     }
 
+  return (gpgrt_ssize_t)nread;
+}
+
+
+/* Read from the connection of cookie C through its read buffer.
+ * While reading the response header only the bytes up to the empty
+ * line terminating the header are returned.  This makes sure that
+ * the estream buffer never holds any part of the body.  */
+static gpgrt_ssize_t
+buffered_read (cookie_t c, void *buffer, size_t size)
+{
+  gpgrt_ssize_t nread;
+  size_t n, i;
+  int ch;
+
+  if (c->rbuf_pos == c->rbuf_len)
+    {
+      /* Large reads of the body don't need to go through the buffer
+       * because SIZE has already been limited by the caller.  */
+      if (!c->in_header && size >= sizeof c->rbuf)
+        return cookie_read_transport (c, buffer, size);
+
+      nread = cookie_read_transport (c, c->rbuf, sizeof c->rbuf);
+      if (nread <= 0)
+        return nread;
+      c->rbuf_pos = 0;
+      c->rbuf_len = nread;
+    }
+
+  n = c->rbuf_len - c->rbuf_pos;
+  if (n > size)
+    n = size;
+  if (c->in_header)
+    {
+      for (i=0; i < n && c->header_nl < 2; i++)
+        {
+          ch = c->rbuf[c->rbuf_pos + i];
+          if (ch == '\n')
+            c->header_nl++;
+          else if (ch != '\r')
+            c->header_nl = 0;
+        }
+      n = i;
+    }
+  memcpy (buffer, c->rbuf + c->rbuf_pos, n);
+  c->rbuf_pos += n;
+  return (gpgrt_ssize_t)n;
+}
+
+
+/* Read a line of the chunked transfer encoding into BUF which has a
+ * size of BUFSIZE and strip the line ending.  Overlong lines are
+ * truncated.  Returns 0 on success or -1 on error or EOF.  */
+static int
+read_chunk_line (cookie_t c, char *buf, size_t bufsize)
+{
+  gpgrt_ssize_t nread;
+  size_t len = 0;
+  int ch;
+
+  for (;;)
+    {
+      if (c->rbuf_pos == c->rbuf_len)
+        {
+          nread = cookie_read_transport (c, c->rbuf, sizeof c->rbuf);
+          if (nread <= 0)
+            {
+              if (!nread)
+                gpg_err_set_errno (EIO);
+              return -1;
+            }
+          c->rbuf_pos = 0;
+          c->rbuf_len = nread;
+        }
+      ch = c->rbuf[c->rbuf_pos++];
+      if (ch == '\n')
+        break;
+      if (len + 1 < bufsize)
+        buf[len++] = ch;
+    }
+  if (len && buf[len-1] == '\r')
+    len--;
+  buf[len] = 0;
+  return 0;
+}
+
+
+/* Read from a body using the chunked transfer encoding.  */
+static gpgrt_ssize_t
+chunked_read (cookie_t c, void *buffer, size_t size)
+{
+  char line[256];
+  gpgrt_ssize_t nread;
+
+  if (c->chunk_eof)
+    return 0;
+
+  if (!c->chunk_left)
+    {
+      if (c->chunk_crlf)
+        {
+          /* Skip the CRLF after the data of the last chunk.  */
+          if (read_chunk_line (c, line, sizeof line))
+            return -1;
+          c->chunk_crlf = 0;
+        }
+      if (read_chunk_line (c, line, sizeof line))
+        return -1;
+      if (!hexdigitp (line))
+        {
+          log_info ("invalid chunk size in HTTP response\n");
+          gpg_err_set_errno (EIO);
+          return -1;
+        }
+      c->chunk_left = strtoull (line, NULL, 16);
+      if (!c->chunk_left)
+        {
+          /* That was the last chunk; skip the trailer.  */
+          do
+            {
+              if (read_chunk_line (c, line, sizeof line))
+                return -1;
+            }
+          while (*line);
+          c->chunk_eof = 1;
+          return 0;
+        }
+      c->chunk_crlf = 1;
+    }
+
+  if (size > c->chunk_left)
+    size = c->chunk_left;
+  nread = buffered_read (c, buffer, size);
+  if (!nread)
+    {
+      log_info ("premature EOF in chunked HTTP response\n");
+      gpg_err_set_errno (EIO);
+      return -1;
+    }
+  if (nread > 0)
+    c->chunk_left -= nread;
+  return nread;
+}
+
+
+/* Read handler for estream.  */
+static gpgrt_ssize_t
+cookie_read (void *cookie, void *buffer, size_t size)
+{
+  cookie_t c = cookie;
+  gpgrt_ssize_t nread;
+
+  if (c->chunked && !c->in_header)
+    return chunked_read (c, buffer, size);
+
+  if (c->content_length_valid)
+    {
+      if (!c->content_length)
+        return 0; /* EOF */
+      if (c->content_length < size)
+        size = c->content_length;
+    }
+
+  if (c->buffered)
+    nread = buffered_read (c, buffer, size);
+  else
+    nread = cookie_read_transport (c, buffer, size);
+
   if (c->content_length_valid && nread > 0)
     {
       if (nread < c->content_length)
@@ -3222,7 +4211,7 @@ cookie_read (void *cookie, void *buffer, size_t size)
         c->content_length = 0;
     }
 
-  return (gpgrt_ssize_t)nread;
+  return nread;
 }
 
 /* Write handler for estream.  */
@@ -3354,6 +4343,25 @@ cookie_close (void *cookie)
   if (!c)
     return 0;
 
+  /* Put the connection into the pool if the entire response has been
+   * read.  */
+  if (c->keep_alive && c->sock && c->pool_key
+      && (c->chunked? c->chunk_eof
+          : (c->content_length_valid && !c->content_length))
+      && c->rbuf_pos == c->rbuf_len
+      && (!c->use_tls || (c->session && c->session->tls_session)))
+    {
+      if (!c->use_tls)
+        {
+          http_session_unref (c->session);
+          c->session = NULL;
+        }
+      pool_put (c->pool_key, c->sock, c->session);
+      xfree (c->pool_key);
+      xfree (c);
+      return 0;
+    }
+
 #if HTTP_USE_NTBTLS
   if (c->use_tls && c->session && c->session->tls_session)
     {
@@ -3372,6 +4380,7 @@ cookie_close (void *cookie)
 
   if (c->session)
     http_session_unref (c->session);
+  xfree (c->pool_key);
   xfree (c);
   return 0;
 }
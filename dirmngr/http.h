@@ -94,7 +94,8 @@ enum
     HTTP_FLAG_TRUST_DEF   = 256, /* Use the CAs configured for HKP.  */
     HTTP_FLAG_TRUST_SYS   = 512, /* Also use the system defined CAs. */
     HTTP_FLAG_TRUST_CFG  = 1024, /* Also use configured CAs.         */
-    HTTP_FLAG_NO_CRL     = 2048  /* Do not consult CRLs for https.   */
+    HTTP_FLAG_NO_CRL     = 2048, /* Do not consult CRLs for https.   */
+    HTTP_FLAG_KEEP_ALIVE = 4096  /* Use a persistent connection.     */
   };
 
 
@@ -176,6 +177,8 @@ gpg_error_t http_wait_response (http_t hd);
 
 void http_close (http_t hd, int keep_read_stream);
 
+void http_pool_flush (void);
+
 gpg_error_t http_open_document (ctrl_t ctrl, http_t *r_hd,
                                 const char *document,
                                 const char *auth,
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <npth.h>
 
 #include "dirmngr.h"
 #include "misc.h"
@@ -207,8 +208,267 @@ ks_action_search (ctrl_t ctrl, uri_item_t keyservers,
 }
 
 
+/* The maximum number of keys fetched in parallel from one HKP
+ * keyserver by ks_action_get.  */
+#define KS_GET_MAX_PARALLEL 4
+
+/* One key to be fetched by ks_get_worker.  */
+struct ks_get_item_s
+{
+  struct ks_get_item_s *next; /* Next item in the queue of done items.  */
+  const char *pattern;        /* The pattern from the caller's list.  */
+  gpg_error_t err;            /* The error returned by the engine.  */
+  int read_failed;            /* ERR is a read error.  */
+  estream_t fp;               /* The fetched data or NULL.  */
+  char *source;               /* Malloced name of the answering host.  */
+};
+
+/* The state shared by ks_get_parallel and its workers.  */
+struct ks_get_parm_s
+{
+  npth_mutex_t lock;
+  npth_cond_t cond;
+  ctrl_t ctrl;                /* The caller's control object.  */
+  parsed_uri_t uri;           /* The keyserver.  */
+  struct ks_get_item_s *items;
+  int nitems;
+  int next;                   /* Index of the next item to fetch.  */
+  int running;                /* Number of running workers.  */
+  int stop;                   /* Do not start more fetches.  */
+  struct ks_get_item_s *done; /* Queue of fetched items.  */
+  struct ks_get_item_s **done_tail;
+};
+
+
+/* Thread to fetch items from a ks_get_parm_s object until all items
+ * are done.  The worker uses its own control object so that it does
+ * not write to the client's connection; all output is done by
+ * ks_get_parallel.  */
+static void *
+ks_get_worker (void *arg)
+{
+  struct ks_get_parm_s *parm = arg;
+  struct server_control_s ctrlbuf;
+  struct ks_get_item_s *item;
+  estream_t infp;
+
+  memset (&ctrlbuf, 0, sizeof ctrlbuf);
+  dirmngr_init_default_ctrl (&ctrlbuf);
+  xfree (ctrlbuf.http_proxy);
+  ctrlbuf.http_proxy = parm->ctrl->http_proxy;
+  ctrlbuf.http_no_crl = parm->ctrl->http_no_crl;
+  ctrlbuf.timeout = parm->ctrl->timeout;
+
+  npth_mutex_lock (&parm->lock);
+  while (!parm->stop && parm->next < parm->nitems)
+    {
+      item = parm->items + parm->next++;
+      npth_mutex_unlock (&parm->lock);
+
+      item->err = ks_hkp_get (&ctrlbuf, parm->uri, item->pattern, &infp,
+                              &item->source);
+      if (!item->err)
+        {
+          /* Read the data now so that the connection is free for the
+           * next request.  */
+          item->fp = es_fopenmem (0, "w+b");
+          if (!item->fp)
+            item->err = gpg_error_from_syserror ();
+          else
+            item->err = copy_stream (infp, item->fp);
+          if (!item->err)
+            es_rewind (item->fp);
+          else
+            {
+              item->read_failed = 1;
+              es_fclose (item->fp);
+              item->fp = NULL;
+            }
+          es_fclose (infp);
+        }
+
+      npth_mutex_lock (&parm->lock);
+      /* There is no point in trying more keys if all hosts are dead.  */
+      if (gpg_err_code (item->err) == GPG_ERR_NO_KEYSERVER)
+        parm->stop = 1;
+      *parm->done_tail = item;
+      parm->done_tail = &item->next;
+      npth_cond_signal (&parm->cond);
+    }
+  parm->running--;
+  npth_cond_signal (&parm->cond);
+  npth_mutex_unlock (&parm->lock);
+
+  ctrlbuf.http_proxy = NULL;
+  dirmngr_deinit_default_ctrl (&ctrlbuf);
+  return NULL;
+}
+
+
+/* Start up to N more workers for PARM.  Must be called with
+ * PARM->LOCK held.  Returns the number of started workers.  */
+static int
+ks_get_start_workers (struct ks_get_parm_s *parm, int n)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+  int i, rc;
+
+  if (npth_attr_init (&tattr))
+    return 0;
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  for (i=0; i < n; i++)
+    {
+      rc = npth_create (&thread, &tattr, ks_get_worker, parm);
+      if (rc)
+        {
+          log_error ("error spawning keyserver worker: %s\n", strerror (rc));
+          break;
+        }
+      parm->running++;
+    }
+  npth_attr_destroy (&tattr);
+  return i;
+}
+
+
+/* Get the keys matching PATTERNS from the HKP keyserver URI with up
+ * to KS_GET_MAX_PARALLEL requests in parallel.  The keys are written
+ * to OUTFP in the order they arrive.  The first error returned for a
+ * pattern is stored at R_FIRST_ERR and R_ANY_DATA is set if at least
+ * one key was received.  The return value is an error which does not
+ * allow to continue.  */
+static gpg_error_t
+ks_get_parallel (ctrl_t ctrl, parsed_uri_t uri, strlist_t patterns,
+                 estream_t outfp, gpg_error_t *r_first_err, int *r_any_data)
+{
+  gpg_error_t err = 0;
+  struct ks_get_parm_s parm;
+  struct ks_get_item_s *item;
+  struct timespec abstime;
+  strlist_t sl;
+  int i, ramped_up;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctrl = ctrl;
+  parm.uri = uri;
+  parm.done_tail = &parm.done;
+  parm.nitems = strlist_length (patterns);
+  parm.items = xtrycalloc (parm.nitems, sizeof *parm.items);
+  if (!parm.items)
+    return gpg_error_from_syserror ();
+  for (i=0, sl = patterns; sl; sl = sl->next)
+    parm.items[i++].pattern = sl->d;
+
+  err = gpg_error_from_errno (npth_mutex_init (&parm.lock, NULL));
+  if (err)
+    {
+      xfree (parm.items);
+      return err;
+    }
+  err = gpg_error_from_errno (npth_cond_init (&parm.cond, NULL));
+  if (err)
+    {
+      npth_mutex_destroy (&parm.lock);
+      xfree (parm.items);
+      return err;
+    }
+
+  /* We start with one worker so that the first request resolves the
+   * keyserver and sets up the host table.  The other workers are
+   * started after the first response.  If no thread can be created
+   * we do all the work ourself.  */
+  npth_mutex_lock (&parm.lock);
+  ramped_up = 0;
+  if (!ks_get_start_workers (&parm, 1))
+    {
+      parm.running++;
+      npth_mutex_unlock (&parm.lock);
+      ks_get_worker (&parm);
+      npth_mutex_lock (&parm.lock);
+      ramped_up = 1;
+    }
+
+  while (parm.running || parm.done)
+    {
+      if (!parm.done)
+        {
+          /* Wake up every second to keep the client informed.  */
+          npth_clock_gettime (&abstime);
+          abstime.tv_sec += 1;
+          npth_cond_timedwait (&parm.cond, &parm.lock, &abstime);
+          if (!parm.done && !err)
+            {
+              npth_mutex_unlock (&parm.lock);
+              err = dirmngr_tick (ctrl);
+              npth_mutex_lock (&parm.lock);
+              if (err)
+                parm.stop = 1;
+            }
+          continue;
+        }
+
+      item = parm.done;
+      parm.done = item->next;
+      if (!parm.done)
+        parm.done_tail = &parm.done;
+
+      if (!ramped_up)
+        {
+          ramped_up = 1;
+          i = parm.nitems - parm.next;
+          if (i > KS_GET_MAX_PARALLEL - 1)
+            i = KS_GET_MAX_PARALLEL - 1;
+          if (!parm.stop && i > 0)
+            ks_get_start_workers (&parm, i);
+        }
+      npth_mutex_unlock (&parm.lock);
+
+      if (err)
+        ; /* Just drain the queue.  */
+      else
+        {
+          if (item->source)
+            err = dirmngr_status (ctrl, "SOURCE", item->source, NULL);
+          if (err)
+            ;
+          else if (item->read_failed)
+            err = item->err;
+          else if (item->err)
+            {
+              /* As in the sequential case we only remember the error
+               * because a server may not carry all keys.  */
+              *r_first_err = item->err;
+            }
+          else
+            {
+              err = copy_stream (item->fp, outfp);
+              if (!err)
+                *r_any_data = 1;
+            }
+        }
+      es_fclose (item->fp);
+      item->fp = NULL;
+      xfree (item->source);
+      item->source = NULL;
+
+      npth_mutex_lock (&parm.lock);
+      if (err)
+        parm.stop = 1;
+    }
+  npth_mutex_unlock (&parm.lock);
+
+  npth_cond_destroy (&parm.cond);
+  npth_mutex_destroy (&parm.lock);
+  xfree (parm.items);
+  return err;
+}
+
+
 /* Get the requested keys (matching PATTERNS) using all configured
-   keyservers and write the result to the provided output stream.  */
+   keyservers and write the result to the provided output stream.
+   Keys from HKP keyservers are fetched in parallel and written in the
+   order they arrive.  */
 gpg_error_t
 ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
 	       strlist_t patterns, estream_t outfp)
@@ -244,7 +504,13 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
 		 || strcmp (uri->parsed_uri->scheme, "ldapi") == 0);
 #endif
 
-      if (is_hkp_s || is_http_s || is_ldap)
+      if (is_hkp_s && patterns->next)
+        {
+          any_server = 1;
+          err = ks_get_parallel (ctrl, uri->parsed_uri, patterns, outfp,
+                                 &first_err, &any_data);
+        }
+      else if (is_hkp_s || is_http_s || is_ldap)
         {
           any_server = 1;
           for (sl = patterns; !err && sl; sl = sl->next)
@@ -255,7 +521,7 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
 	      else
 #endif
               if (is_hkp_s)
-                err = ks_hkp_get (ctrl, uri->parsed_uri, sl->d, &infp);
+                err = ks_hkp_get (ctrl, uri->parsed_uri, sl->d, &infp, NULL);
               else if (is_http_s)
                 err = ks_http_fetch (ctrl, uri->parsed_uri->original,
                                      KS_HTTP_FETCH_NOCACHE,
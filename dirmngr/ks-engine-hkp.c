@@ -1238,6 +1238,7 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
                    httphost,
                    /* fixme: AUTH */ NULL,
                    (httpflags
+                    |HTTP_FLAG_KEEP_ALIVE
                     |(opt.honor_http_proxy? HTTP_FLAG_TRY_PROXY:0)
                     |(dirmngr_use_tor ()? HTTP_FLAG_FORCE_TOR:0)
                     |(opt.disable_ipv4? HTTP_FLAG_IGNORE_IPv4 : 0)
@@ -1600,9 +1601,12 @@ ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 /* Get the key described key the KEYSPEC string from the keyserver
    identified by URI.  On success R_FP has an open stream to read the
    data.  The data will be provided in a format GnuPG can import
-   (either a binary OpenPGP message or an armored one).  */
+   (either a binary OpenPGP message or an armored one).  If R_SOURCE
+   is not NULL the host which answered the request is stored there as
+   a malloced string instead of emitting a SOURCE status line.  */
 gpg_error_t
-ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
+ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp,
+            char **r_source)
 {
   gpg_error_t err;
   KEYDB_SEARCH_DESC desc;
@@ -1620,6 +1624,8 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
   unsigned int extra_tries = SEND_REQUEST_EXTRA_RETRIES;
 
   *r_fp = NULL;
+  if (r_source)
+    *r_source = NULL;
 
   /* Remove search type indicator and adjust PATTERN accordingly.
      Note that HKP keyservers like the 0x to be present when searching
@@ -1699,14 +1705,29 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
     }
   if (err)
     {
-      if (gpg_err_code (err) == GPG_ERR_NO_DATA)
+      if (gpg_err_code (err) != GPG_ERR_NO_DATA)
+        ;
+      else if (r_source)
+        {
+          *r_source = hostport;
+          hostport = NULL;
+        }
+      else
         dirmngr_status (ctrl, "SOURCE", hostport, NULL);
       goto leave;
     }
 
-  err = dirmngr_status (ctrl, "SOURCE", hostport, NULL);
-  if (err)
-    goto leave;
+  if (r_source)
+    {
+      *r_source = hostport;
+      hostport = NULL;
+    }
+  else
+    {
+      err = dirmngr_status (ctrl, "SOURCE", hostport, NULL);
+      if (err)
+        goto leave;
+    }
 
   /* Return the read stream and close the HTTP context.  */
   *r_fp = fp;
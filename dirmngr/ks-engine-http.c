@@ -111,7 +111,8 @@ ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
                    url,
                    /* httphost */ NULL,
                    /* fixme: AUTH */ NULL,
-                   ((opt.honor_http_proxy? HTTP_FLAG_TRY_PROXY:0)
+                   (HTTP_FLAG_KEEP_ALIVE
+                    | (opt.honor_http_proxy? HTTP_FLAG_TRY_PROXY:0)
                     | (DBG_LOOKUP? HTTP_FLAG_LOG_RESP:0)
                     | (dirmngr_use_tor ()? HTTP_FLAG_FORCE_TOR:0)
                     | (opt.disable_ipv4? HTTP_FLAG_IGNORE_IPv4 : 0)
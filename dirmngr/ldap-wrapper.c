@@ -39,7 +39,10 @@
  *    cancellation of a query at any point of time.
  *
  * 4. Given that we are going out to the network and usually get back
- *    a long response, the fork/exec overhead is acceptable.
+ *    a long response, the fork/exec overhead is acceptable.  To avoid
+ *    it anyway the wrapper is run in server mode and kept running
+ *    for further requests; it then also keeps its LDAP connections
+ *    open.  Idle wrappers are terminated after some time.
  *
  * Note that under WindowsCE the number of processes is strongly
  * limited (32 processes including the kernel processes) and thus we
@@ -61,13 +64,12 @@
 
 #include "dirmngr.h"
 #include "../common/exechelp.h"
+#include "../common/host2net.h"
 #include "misc.h"
 #include "ldap-wrapper.h"
 
 
-#ifdef HAVE_W32_SYSTEM
-#define setenv(a,b,c) SetEnvironmentVariable ((a),(b))
-#else
+#ifndef HAVE_W32_SYSTEM
 #define pth_close(fd) close(fd)
 #endif
 
@@ -80,6 +82,11 @@
 
 #define INACTIVITY_TIMEOUT (opt.ldaptimeout + 60*5)  /* seconds */
 
+/* The time after which an idle wrapper is terminated and the maximum
+ * number of idle wrappers.  */
+#define IDLE_TIMEOUT 120  /* seconds */
+#define MAX_IDLE_WRAPPERS 4
+
 #define TIMERTICK_INTERVAL 2
 
 /* To keep track of the LDAP wrapper state we use this structure.  */
@@ -90,13 +97,19 @@ struct wrapper_context_s
   pid_t pid;           /* The pid of the wrapper process. */
   int printable_pid;   /* Helper to print diagnostics after the process has
                         * been cleaned up. */
+  estream_t infp;      /* Connected with stdin of the ldap wrapper.  */
   estream_t fp;        /* Connected with stdout of the ldap wrapper.  */
   gpg_error_t fp_err;  /* Set to the gpg_error of the last read error
                         * if any.  */
   estream_t log_fp;    /* Connected with stderr of the ldap wrapper.  */
   ctrl_t ctrl;         /* Connection data. */
   int ready;           /* Internally used to mark to be removed contexts. */
-  ksba_reader_t reader;/* The ksba reader object or NULL. */
+  ksba_reader_t reader;/* The ksba reader object or NULL if the wrapper
+                        * is idle. */
+  int eor;             /* The end of the response has been read.  */
+  unsigned char hdr[5];/* The header of the next frame.  */
+  size_t hdrlen;       /* The number of octets read into HDR.  */
+  size_t frame_left;   /* The number of data octets left in the frame.  */
   char *line;          /* Used to print the log lines (malloced). */
   size_t linesize;     /* Allocated size of LINE.  */
   size_t linelen;      /* Use size of LINE.  */
@@ -176,6 +189,7 @@ destroy_wrapper (struct wrapper_context_s *ctx)
       gnupg_release_process (ctx->pid);
     }
   ksba_reader_release (ctx->reader);
+  SAFE_CLOSE (ctx->infp);
   SAFE_CLOSE (ctx->fp);
   SAFE_CLOSE (ctx->log_fp);
   xfree (ctx->line);
@@ -291,7 +305,7 @@ ldap_reaper_thread (void *dummy)
   int fparraysize = 0;
   int count, i;
   int ret;
-  time_t exptime;
+  time_t exptime, idle_exptime;
 
   (void)dummy;
 
@@ -413,9 +427,11 @@ ldap_reaper_thread (void *dummy)
         }
 
       /* All timestamps before exptime should be considered expired.  */
-      exptime = time (NULL);
+      exptime = idle_exptime = time (NULL);
       if (exptime > INACTIVITY_TIMEOUT)
         exptime -= INACTIVITY_TIMEOUT;
+      if (idle_exptime > IDLE_TIMEOUT)
+        idle_exptime -= IDLE_TIMEOUT;
 
       lock_reaper_list ();
       {
@@ -474,8 +490,21 @@ ldap_reaper_thread (void *dummy)
                   }
               }
 
+            /* Terminate idle wrappers after some time and at
+             * shutdown by closing their stdin.  */
+            if (ctx->pid != (pid_t)(-1) && !ctx->reader && ctx->infp
+                && (shutting_down || ctx->stamp < idle_exptime))
+              {
+                if (DBG_EXTPROG)
+                  log_debug ("ldap wrapper %d idle - terminating\n",
+                             (int)ctx->pid);
+                SAFE_CLOSE (ctx->infp);
+                SAFE_CLOSE (ctx->fp);
+                any_action = 1;
+              }
+
             /* Check whether we should terminate the process. */
-            if (ctx->pid != (pid_t)(-1)
+            if (ctx->pid != (pid_t)(-1) && (ctx->reader || !ctx->infp)
                 && ctx->stamp != (time_t)(-1) && ctx->stamp < exptime)
               {
                 gnupg_kill_process (ctx->pid);
@@ -587,11 +616,13 @@ ldap_wrapper_wait_connections ()
 
 
 /* This function is to be used to release a context associated with the
-   given reader object. */
+   given reader object.  If the entire response has been read the
+   wrapper is kept for the next request.  */
 void
 ldap_wrapper_release_context (ksba_reader_t reader)
 {
-  struct wrapper_context_s *ctx;
+  struct wrapper_context_s *ctx, *c;
+  int nidle;
 
   if (!reader )
     return;
@@ -603,13 +634,13 @@ ldap_wrapper_release_context (ksba_reader_t reader)
         {
           if (DBG_EXTPROG)
             log_debug ("releasing ldap worker c=%p pid=%d/%d rdr=%p"
-                       " ctrl=%p/%d\n", ctx,
+                       " ctrl=%p/%d eor=%d\n", ctx,
                        (int)ctx->pid, (int)ctx->printable_pid,
                        ctx->reader,
-                       ctx->ctrl, ctx->ctrl? ctx->ctrl->refcount:0);
+                       ctx->ctrl, ctx->ctrl? ctx->ctrl->refcount:0,
+                       ctx->eor);
 
           ctx->reader = NULL;
-          SAFE_CLOSE (ctx->fp);
           if (ctx->ctrl)
             {
               ctx->ctrl->refcount--;
@@ -618,6 +649,26 @@ ldap_wrapper_release_context (ksba_reader_t reader)
           if (ctx->fp_err)
             log_info ("%s: reading from ldap wrapper %d failed: %s\n",
                       __func__, ctx->printable_pid, gpg_strerror (ctx->fp_err));
+
+          for (nidle=0, c=reaper_list; c; c=c->next)
+            if (!c->reader && c->infp && c->pid != (pid_t)(-1))
+              nidle++;
+          if (ctx->eor && !ctx->fp_err && ctx->fp && ctx->infp
+              && ctx->pid != (pid_t)(-1)
+              && !shutting_down && nidle <= MAX_IDLE_WRAPPERS)
+            {
+              /* Keep it for the next request.  */
+              ctx->stamp = time (NULL);
+            }
+          else
+            {
+              /* Let the wrapper terminate.  If it has not yet sent
+               * the entire response we need to kill it.  */
+              SAFE_CLOSE (ctx->infp);
+              SAFE_CLOSE (ctx->fp);
+              if (!ctx->eor && ctx->pid != (pid_t)(-1))
+                gnupg_kill_process (ctx->pid);
+            }
           break;
         }
   }
@@ -651,8 +702,9 @@ ldap_wrapper_connection_cleanup (ctrl_t ctrl)
 
 
 /* This is the callback used by the ldap wrapper to feed the ksba
- * reader with the wrapper's stdout.  See the description of
- * ksba_reader_set_cb for details.  */
+ * reader with the wrapper's stdout.  The data frames of the response
+ * are unpacked and the end frame is returned as EOF.  See the
+ * description of ksba_reader_set_cb for details.  */
 static int
 reader_callback (void *cb_value, char *buffer, size_t count,  size_t *nread)
 {
@@ -678,7 +730,7 @@ reader_callback (void *cb_value, char *buffer, size_t count,  size_t *nread)
   /* If we ever encountered a read error, don't continue (we don't want to
      possibly overwrite the last error cause).  Bail out also if the
      file descriptor has been closed. */
-  if (ctx->fp_err || !ctx->fp)
+  if (ctx->fp_err || !ctx->fp || ctx->eor)
     {
       *nread = 0;
       return -1;
@@ -691,7 +743,7 @@ reader_callback (void *cb_value, char *buffer, size_t count,  size_t *nread)
   npth_clock_gettime (&abstime);
   abstime.tv_sec += TIMERTICK_INTERVAL;
 
-  while (nleft > 0)
+  while (nleft > 0 && !ctx->eor)
     {
       npth_clock_gettime (&curtime);
       if (!(npth_timercmp (&curtime, &abstime, <)))
@@ -748,9 +800,22 @@ reader_callback (void *cb_value, char *buffer, size_t count,  size_t *nread)
 
       if (fparray[0].got_read)
         {
+          char *dst;
           size_t n;
 
-          if (es_read (ctx->fp, buffer, nleft, &n))
+          /* Read either the header of the next frame or data.  */
+          if (!ctx->frame_left)
+            {
+              dst = (char *)ctx->hdr + ctx->hdrlen;
+              n = sizeof ctx->hdr - ctx->hdrlen;
+            }
+          else
+            {
+              dst = buffer;
+              n = nleft < ctx->frame_left? nleft : ctx->frame_left;
+            }
+
+          if (es_read (ctx->fp, dst, n, &n))
             {
               ctx->fp_err = gpg_error_from_syserror ();
               if (gpg_err_code (ctx->fp_err) == GPG_ERR_EAGAIN)
@@ -762,102 +827,90 @@ reader_callback (void *cb_value, char *buffer, size_t count,  size_t *nread)
                   SAFE_CLOSE (ctx->fp);
                   return -1;
                 }
+              n = 0;
             }
-          else if (!n) /* EOF */
+          else if (!n) /* EOF - the wrapper terminated.  */
             {
               if (nleft == count)
                 return -1; /* EOF. */
               break;
             }
-          nleft -= n;
-          buffer += n;
+          else if (!ctx->frame_left)
+            {
+              ctx->hdrlen += n;
+              if (ctx->hdrlen == sizeof ctx->hdr)
+                {
+                  ctx->hdrlen = 0;
+                  if (*ctx->hdr == 'D')
+                    ctx->frame_left = buf32_to_size_t (ctx->hdr + 1);
+                  else if (*ctx->hdr == 'E')
+                    {
+                      ctx->eor = 1;
+                      if (DBG_EXTPROG)
+                        log_debug ("%s: ldap wrapper %d finished (rc=%u)\n",
+                                   __func__, ctx->printable_pid,
+                                   buf32_to_uint (ctx->hdr + 1));
+                    }
+                  else
+                    {
+                      ctx->fp_err = gpg_error (GPG_ERR_INV_RESPONSE);
+                      log_error ("%s: invalid frame from ldap wrapper %d\n",
+                                 __func__, ctx->printable_pid);
+                      SAFE_CLOSE (ctx->fp);
+                      return -1;
+                    }
+                }
+            }
+          else
+            {
+              nleft -= n;
+              buffer += n;
+              ctx->frame_left -= n;
+            }
           if (n > 0 && ctx->stamp != (time_t)(-1))
             ctx->stamp = time (NULL);
         }
     }
+  if (nleft == count)
+    return -1; /* End of the response.  */
   *nread = count - nleft;
 
   return 0;
 }
 
 
-/* Fork and exec the LDAP wrapper and return a new libksba reader
-   object at READER.  ARGV is a NULL terminated list of arguments for
-   the wrapper.  The function returns 0 on success or an error code.
-
-   Special hack to avoid passing a password through the command line
-   which is globally visible: If the first element of ARGV is "--pass"
-   it will be removed and instead the environment variable
-   DIRMNGR_LDAP_PASS will be set to the next value of ARGV.  On modern
-   OSes the environment is not visible to other users.  For those old
-   systems where it can't be avoided, we don't want to go into the
-   hassle of passing the password via stdin; it's just too complicated
-   and an LDAP password used for public directory lookups should not
-   be that confidential.  */
-gpg_error_t
-ldap_wrapper (ctrl_t ctrl, ksba_reader_t *reader, const char *argv[])
+/* Fork and exec the LDAP wrapper in server mode and store a new
+ * context for it at R_CTX.  */
+static gpg_error_t
+start_wrapper (struct wrapper_context_s **r_ctx)
 {
   gpg_error_t err;
-  pid_t pid;
   struct wrapper_context_s *ctx;
-  int i;
-  int j;
-  const char **arg_list;
   const char *pgmname;
-  estream_t outfp, errfp;
-
-  /* It would be too simple to connect stderr just to our logging
-     stream.  The problem is that if we are running multi-threaded
-     everything gets intermixed.  Clearly we don't want this.  So the
-     only viable solutions are either to have another thread
-     responsible for logging the messages or to add an option to the
-     wrapper module to do the logging on its own.  Given that we anyway
-     need a way to reap the child process and this is best done using a
-     general reaping thread, that thread can do the logging too. */
-  ldap_reaper_launch_thread ();
+  const char *arg_list[2];
+  estream_t infp, outfp, errfp;
+  pid_t pid;
 
-  *reader = NULL;
+  *r_ctx = NULL;
 
-  /* Files: We need to prepare stdin and stdout.  We get stderr from
-     the function.  */
   if (!opt.ldap_wrapper_program || !*opt.ldap_wrapper_program)
     pgmname = gnupg_module_name (GNUPG_MODULE_NAME_DIRMNGR_LDAP);
   else
     pgmname = opt.ldap_wrapper_program;
 
-  /* Create command line argument array.  */
-  for (i = 0; argv[i]; i++)
-    ;
-  arg_list = xtrycalloc (i + 2, sizeof *arg_list);
-  if (!arg_list)
-    {
-      err = gpg_error_from_syserror ();
-      log_error (_("error allocating memory: %s\n"), strerror (errno));
-      return err;
-    }
-  for (i = j = 0; argv[i]; i++, j++)
-    if (!i && argv[i + 1] && !strcmp (*argv, "--pass"))
-      {
-	arg_list[j] = "--env-pass";
-	setenv ("DIRMNGR_LDAP_PASS", argv[1], 1);
-	i++;
-      }
-    else
-      arg_list[j] = (char*) argv[i];
-
   ctx = xtrycalloc (1, sizeof *ctx);
   if (!ctx)
     {
       err = gpg_error_from_syserror ();
       log_error (_("error allocating memory: %s\n"), strerror (errno));
-      xfree (arg_list);
       return err;
     }
 
+  arg_list[0] = "--server";
+  arg_list[1] = NULL;
   err = gnupg_spawn_process (pgmname, arg_list,
                              NULL, NULL, GNUPG_SPAWN_NONBLOCK,
-                             NULL, &outfp, &errfp, &pid);
-  xfree (arg_list);
+                             &infp, &outfp, &errfp, &pid);
   if (err)
     {
       xfree (ctx);
@@ -865,42 +918,174 @@ ldap_wrapper (ctrl_t ctrl, ksba_reader_t *reader, const char *argv[])
       return err;
     }
 
+  /* The requests are short and written only to an idle wrapper;
+   * thus blocking writes are fine.  Reading is done without a buffer
+   * so that es_poll sees all data not yet consumed.  */
+  es_set_nonblock (infp, 0);
+  es_setvbuf (outfp, NULL, _IONBF, 0);
+
   ctx->pid = pid;
   ctx->printable_pid = (int) pid;
+  ctx->infp = infp;
   ctx->fp = outfp;
   ctx->log_fp = errfp;
-  ctx->ctrl = ctrl;
-  ctrl->refcount++;
   ctx->stamp = time (NULL);
 
+  if (DBG_EXTPROG)
+    log_debug ("ldap wrapper %d started (%s)\n", (int)ctx->pid, pgmname);
+
+  *r_ctx = ctx;
+  return 0;
+}
+
+
+/* Return a malloced request line for the LDAP wrapper with the
+ * arguments ARGV.  See dirmngr_ldap.c for the format.  */
+static char *
+make_request_line (const char *argv[])
+{
+  membuf_t mb;
+  char *p;
+  int i;
+
+  init_membuf (&mb, 256);
+  for (i=0; argv[i]; i++)
+    {
+      p = percent_plus_escape (argv[i]);
+      if (!p)
+        {
+          xfree (get_membuf (&mb, NULL));
+          return NULL;
+        }
+      if (i)
+        put_membuf (&mb, " ", 1);
+      put_membuf_str (&mb, p);
+      xfree (p);
+    }
+  put_membuf (&mb, "\n", 2);  /* Including the terminating nul.  */
+  return get_membuf (&mb, NULL);
+}
+
+
+/* Run an LDAP query using a wrapper process and return a new libksba
+   reader object at READER.  ARGV is a NULL terminated list of
+   arguments for the wrapper.  The function returns 0 on success or
+   an error code.
+
+   An idle wrapper is used if available; otherwise a new one is
+   started.  The arguments are sent to the wrapper's stdin and not
+   passed on the command line; thus a password given with "--pass" is
+   not visible to other users.  */
+gpg_error_t
+ldap_wrapper (ctrl_t ctrl, ksba_reader_t *reader, const char *argv[])
+{
+  gpg_error_t err;
+  struct wrapper_context_s *ctx;
+  char *line;
+  int reused;
+
+  /* It would be too simple to connect stderr just to our logging
+     stream.  The problem is that if we are running multi-threaded
+     everything gets intermixed.  Clearly we don't want this.  So the
+     only viable solutions are either to have another thread
+     responsible for logging the messages or to add an option to the
+     wrapper module to do the logging on its own.  Given that we anyway
+     need a way to reap the child process and this is best done using a
+     general reaping thread, that thread can do the logging too. */
+  ldap_reaper_launch_thread ();
+
+  *reader = NULL;
+
+  line = make_request_line (argv);
+  if (!line)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error allocating memory: %s\n"), strerror (errno));
+      return err;
+    }
+
   err = ksba_reader_new (reader);
-  if (!err)
-    err = ksba_reader_set_cb (*reader, reader_callback, ctx);
   if (err)
     {
       log_error (_("error initializing reader object: %s\n"),
                  gpg_strerror (err));
-      destroy_wrapper (ctx);
-      ksba_reader_release (*reader);
-      *reader = NULL;
+      xfree (line);
       return err;
     }
 
-  /* Hook the context into our list of running wrappers.  */
+ again:
+  /* Take an idle wrapper.  */
   lock_reaper_list ();
   {
-    ctx->reader = *reader;
-    ctx->next = reaper_list;
-    reaper_list = ctx;
-    if (npth_cond_signal (&reaper_run_cond))
-      log_error ("ldap-wrapper: Ooops: signaling condition failed: %s (%d)\n",
-                 gpg_strerror (gpg_error_from_syserror ()), errno);
+    for (ctx=reaper_list; ctx; ctx=ctx->next)
+      if (!ctx->reader && ctx->infp && ctx->fp && !ctx->ready
+          && ctx->pid != (pid_t)(-1))
+        {
+          ctx->reader = *reader;
+          break;
+        }
   }
   unlock_reaper_list ();
+  reused = !!ctx;
+
+  if (!ctx)
+    {
+      err = start_wrapper (&ctx);
+      if (err)
+        goto leave;
+      ctx->reader = *reader;
+
+      /* Hook the context into our list of running wrappers.  */
+      lock_reaper_list ();
+      {
+        ctx->next = reaper_list;
+        reaper_list = ctx;
+        if (npth_cond_signal (&reaper_run_cond))
+          log_error ("ldap-wrapper: Ooops: signaling condition failed:"
+                     " %s (%d)\n",
+                     gpg_strerror (gpg_error_from_syserror ()), errno);
+      }
+      unlock_reaper_list ();
+    }
+
+  ctx->fp_err = 0;
+  ctx->eor = 0;
+  ctx->hdrlen = 0;
+  ctx->frame_left = 0;
+  ctx->ctrl = ctrl;
+  ctrl->refcount++;
+  ctx->stamp = time (NULL);
+
+  err = ksba_reader_set_cb (*reader, reader_callback, ctx);
+  if (err)
+    {
+      log_error (_("error initializing reader object: %s\n"),
+                 gpg_strerror (err));
+      ldap_wrapper_release_context (*reader);
+      goto leave;
+    }
 
   if (DBG_EXTPROG)
-    log_debug ("ldap wrapper %d started (%p, %s)\n",
-               (int)ctx->pid, ctx->reader, pgmname);
+    log_debug ("ldap wrapper %d: sending request (%p)\n",
+               (int)ctx->pid, ctx->reader);
+
+  if (es_fputs (line, ctx->infp) || es_fflush (ctx->infp))
+    {
+      err = gpg_error_from_syserror ();
+      ldap_wrapper_release_context (*reader);
+      if (reused)
+        {
+          /* The wrapper may have terminated meanwhile; try again
+           * with another one.  */
+          if (DBG_EXTPROG)
+            log_debug ("ldap wrapper %d: writing request failed: %s\n",
+                       ctx->printable_pid, gpg_strerror (err));
+          goto again;
+        }
+      log_error ("error writing to ldap wrapper %d: %s\n",
+                 ctx->printable_pid, gpg_strerror (err));
+      goto leave;
+    }
 
   /* Need to wait for the first byte so we are able to detect an empty
      output and not let the consumer see an EOF without further error
@@ -914,15 +1099,19 @@ ldap_wrapper (ctrl_t ctrl, ksba_reader_t *reader, const char *argv[])
     if (err)
       {
         ldap_wrapper_release_context (*reader);
-        ksba_reader_release (*reader);
-        *reader = NULL;
         if (gpg_err_code (err) == GPG_ERR_EOF)
-          return gpg_error (GPG_ERR_NO_DATA);
-        else
-          return err;
+          err = gpg_error (GPG_ERR_NO_DATA);
+        goto leave;
       }
     ksba_reader_unread (*reader, &c, 1);
   }
 
-  return 0;
+ leave:
+  if (err)
+    {
+      ksba_reader_release (*reader);
+      *reader = NULL;
+    }
+  xfree (line);
+  return err;
 }
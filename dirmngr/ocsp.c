@@ -34,6 +34,18 @@
 /* The maximum size we allow as a response from an OCSP reponder. */
 #define MAX_RESPONSE_SIZE 65536
 
+/* The name of the file used to store the OCSP cache.  */
+#define OCSP_CACHE_FILE "ocsp-cache.txt"
+
+/* The maximum number of cached OCSP responses.  */
+#define OCSP_CACHE_MAX_ITEMS 10000
+
+/* Certificates with a longer serial number are not cached.  */
+#define OCSP_CACHE_MAX_SERIAL 64
+
+/* The number of hash buckets of the OCSP cache.  */
+#define OCSP_CACHE_TABLE_SIZE 1024
+
 
 static const char oidstr_ocsp[] = "1.3.6.1.5.5.7.48.1";
 
@@ -182,7 +194,8 @@ do_ocsp_request (ctrl_t ctrl, ksba_ocsp_t ocsp,
 
  once_more:
   err = http_open (ctrl, &http, HTTP_REQ_POST, url, NULL, NULL,
-                   ((opt.honor_http_proxy? HTTP_FLAG_TRY_PROXY:0)
+                   (HTTP_FLAG_KEEP_ALIVE
+                    | (opt.honor_http_proxy? HTTP_FLAG_TRY_PROXY:0)
                     | (dirmngr_use_tor ()? HTTP_FLAG_FORCE_TOR:0)
                     | (opt.disable_ipv4? HTTP_FLAG_IGNORE_IPv4 : 0)
                     | (opt.disable_ipv6? HTTP_FLAG_IGNORE_IPv6 : 0)),
@@ -586,6 +599,469 @@ check_signature (ctrl_t ctrl,
 }
 
 
+/* The OCSP response cache.  We cache the verified status of a
+   certificate until the nextUpdate time given by the responder.  The
+   key is made up of a hash over the issuer's public key and the
+   serial number of the certificate.  The cache is also stored in the
+   file OCSP_CACHE_FILE so that it survives a restart.  The table is
+   only accessed from code which does not run other threads and thus
+   no extra locking is required.  */
+
+/* Cached status of one certificate.  */
+struct ocsp_cache_item_s
+{
+  struct ocsp_cache_item_s *next;
+  int revoked;                     /* The certificate has been revoked. */
+  ksba_crl_reason_t reason;        /* The revocation reason.  */
+  ksba_isotime_t revocation_time;
+  ksba_isotime_t this_update;
+  ksba_isotime_t next_update;
+  char key[1];                     /* The key as built by make_cache_key.  */
+};
+typedef struct ocsp_cache_item_s *ocsp_cache_item_t;
+
+/* The table of cached items indexed by a hash of the key.  */
+static ocsp_cache_item_t ocsp_cache[OCSP_CACHE_TABLE_SIZE];
+
+/* Flags telling whether the cache file has been read and whether the
+   cache has been changed since.  */
+static int ocsp_cache_loaded;
+static int ocsp_cache_dirty;
+
+/* Set while the cache file is being written.  */
+static int ocsp_cache_saving;
+
+/* The counters shown by GETINFO.  */
+static struct ocsp_cache_stats_s ocsp_cache_stats;
+
+
+/* Build the cache key for the certificate with SERIAL issued by
+   ISSUER_CERT.  Returns a malloced string or NULL on error or if the
+   serial number is too long.  */
+static char *
+make_cache_key (ksba_cert_t issuer_cert, ksba_const_sexp_t serial)
+{
+  ksba_sexp_t pubkey;
+  unsigned char keyhash[20];
+  const unsigned char *s;
+  char *endp, *result;
+  size_t pubkeylen;
+  unsigned long n;
+
+  if (!serial || *serial != '(')
+    return NULL;
+  n = strtoul ((const char *)serial+1, &endp, 10);
+  if (*endp != ':' || !n || n > OCSP_CACHE_MAX_SERIAL)
+    return NULL;
+  s = (const unsigned char *)endp+1;
+
+  pubkey = ksba_cert_get_public_key (issuer_cert);
+  pubkeylen = gcry_sexp_canon_len (pubkey, 0, NULL, NULL);
+  if (!pubkeylen)
+    {
+      ksba_free (pubkey);
+      return NULL;
+    }
+  gcry_md_hash_buffer (GCRY_MD_SHA1, keyhash, pubkey, pubkeylen);
+  ksba_free (pubkey);
+
+  result = xtrymalloc (2*20 + 1 + 2*n + 1);
+  if (!result)
+    return NULL;
+  bin2hex (keyhash, 20, result);
+  result[40] = '.';
+  bin2hex (s, n, result + 41);
+  return result;
+}
+
+
+/* Return the bucket for KEY.  The entire key is hashed because its
+   first part is the same for all certificates of an issuer.  We use
+   the FNV-1a hash.  */
+static ocsp_cache_item_t *
+cache_bucket (const char *key)
+{
+  const unsigned char *s;
+  u32 hash = 2166136261;
+
+  for (s = (const unsigned char *)key; *s; s++)
+    {
+      hash ^= *s;
+      hash *= 16777619;
+    }
+  return ocsp_cache + (hash % OCSP_CACHE_TABLE_SIZE);
+}
+
+
+/* Remove the item with KEY from the cache.  */
+static void
+cache_remove (const char *key)
+{
+  ocsp_cache_item_t item, *itemp;
+
+  for (itemp = cache_bucket (key); (item = *itemp); itemp = &item->next)
+    if (!strcmp (item->key, key))
+      {
+        *itemp = item->next;
+        xfree (item);
+        ocsp_cache_stats.entries--;
+        ocsp_cache_dirty = 1;
+        return;
+      }
+}
+
+
+/* Return true if the cached ITEM may not be used at the time NOW.  */
+static int
+cache_item_expired (ocsp_cache_item_t item, const ksba_isotime_t now)
+{
+  ksba_isotime_t tmp_time;
+
+  if (strcmp (item->next_update, now) <= 0)
+    return 1;
+
+  /* The same check as done for a fresh response.  */
+  gnupg_copy_time (tmp_time, item->this_update);
+  add_seconds_to_isotime (tmp_time,
+                          opt.ocsp_max_period+opt.ocsp_max_clock_skew);
+  return (!*tmp_time || strcmp (tmp_time, now) < 0);
+}
+
+
+/* Make room for a new item in the full cache.  This removes all
+   expired items and, if that did not help, the item which expires
+   first.  This walks the entire table but it is only done for a full
+   cache and only after an OCSP transaction, which takes far longer.  */
+static void
+cache_make_room (const ksba_isotime_t now)
+{
+  ocsp_cache_item_t item, *itemp, *oldest;
+  int i;
+
+  oldest = NULL;
+  for (i=0; i < DIM (ocsp_cache); i++)
+    for (itemp = ocsp_cache + i; (item = *itemp); )
+      {
+        if (cache_item_expired (item, now))
+          {
+            *itemp = item->next;
+            xfree (item);
+            ocsp_cache_stats.entries--;
+            ocsp_cache_dirty = 1;
+            continue;
+          }
+        /* Note that removing a later item does not change the link
+           to the oldest item.  */
+        if (!oldest || strcmp (item->next_update, (*oldest)->next_update) < 0)
+          oldest = itemp;
+        itemp = &item->next;
+      }
+
+  if (ocsp_cache_stats.entries >= OCSP_CACHE_MAX_ITEMS && oldest)
+    {
+      item = *oldest;
+      *oldest = item->next;
+      xfree (item);
+      ocsp_cache_stats.entries--;
+      ocsp_cache_dirty = 1;
+    }
+}
+
+
+/* Insert a copy of ITEM into the cache using KEY.  An item with the
+   same key is replaced.  */
+static void
+cache_insert (const char *key, ocsp_cache_item_t item)
+{
+  ocsp_cache_item_t newitem, *itemp;
+  ksba_isotime_t now;
+
+  cache_remove (key);
+
+  gnupg_get_isotime (now);
+  if (cache_item_expired (item, now))
+    return;
+
+  if (ocsp_cache_stats.entries >= OCSP_CACHE_MAX_ITEMS)
+    cache_make_room (now);
+
+  newitem = xtrymalloc (sizeof *newitem + strlen (key));
+  if (!newitem)
+    return;
+  *newitem = *item;
+  strcpy (newitem->key, key);
+  itemp = cache_bucket (newitem->key);
+  newitem->next = *itemp;
+  *itemp = newitem;
+  ocsp_cache_stats.entries++;
+  ocsp_cache_stats.stored++;
+  ocsp_cache_dirty = 1;
+}
+
+
+/* Parse a line of the cache file into a new item.  Returns NULL if
+   the line is not valid.  */
+static ocsp_cache_item_t
+parse_cache_line (char *line)
+{
+  char *field[7];
+  ocsp_cache_item_t item;
+  size_t n;
+  int i;
+
+  trim_trailing_spaces (line);
+  if (*line != 'c' || line[1] != ':')
+    return NULL;
+  line += 2;
+  for (i=0; i < DIM (field); i++)
+    {
+      field[i] = line;
+      line = strchr (line, ':');
+      if (!line)
+        break;
+      *line++ = 0;
+    }
+  if (i != DIM (field) - 1)
+    return NULL;
+  /* field[0] is the key, field[1] the status, field[2] to field[4]
+     the times, field[5] the reason and field[6] is reserved.  */
+  n = strlen (field[0]);
+  if (n < 43 || n > 41 + 2*OCSP_CACHE_MAX_SERIAL
+      || !hexdigitp (field[0]) || field[0][40] != '.'
+      || (*field[1] != 'g' && *field[1] != 'r')
+      || strlen (field[2]) != 15 || check_isotime (field[2])
+      || strlen (field[3]) != 15 || check_isotime (field[3])
+      || (*field[4]
+          && (strlen (field[4]) != 15 || check_isotime (field[4]))))
+    return NULL;
+
+  item = xtrycalloc (1, sizeof *item + n);
+  if (!item)
+    return NULL;
+  strcpy (item->key, field[0]);
+  item->revoked = (*field[1] == 'r');
+  strcpy (item->this_update, field[2]);
+  strcpy (item->next_update, field[3]);
+  strcpy (item->revocation_time, field[4]);
+  item->reason = strtoul (field[5], NULL, 10);
+  return item;
+}
+
+
+/* Read the cache file if this has not yet been done.  */
+static void
+ocsp_cache_load (void)
+{
+  char *fname;
+  estream_t fp;
+  char *line = NULL;
+  size_t linelen = 0;
+  size_t maxlen;
+  ssize_t n;
+  ocsp_cache_item_t item;
+  ksba_isotime_t now;
+  unsigned int count = 0;
+
+  if (ocsp_cache_loaded)
+    return;
+  ocsp_cache_loaded = 1;
+
+  fname = make_filename (opt.homedir_cache, OCSP_CACHE_FILE, NULL);
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        log_info (_("error opening '%s': %s\n"), fname, strerror (errno));
+      xfree (fname);
+      return;
+    }
+
+  gnupg_get_isotime (now);
+  maxlen = 1024;
+  while ((n = es_read_line (fp, &line, &linelen, &maxlen)) > 0)
+    {
+      if (!maxlen)
+        break;  /* Line too long - the file is corrupt.  */
+      maxlen = 1024;
+      if (*line == '#' || *line == 'v')
+        continue;
+      item = parse_cache_line (line);
+      if (!item)
+        continue;
+      if (!cache_item_expired (item, now))
+        {
+          cache_insert (item->key, item);
+          count++;
+        }
+      xfree (item);
+    }
+  if (n < 0 || es_ferror (fp))
+    log_error (_("error reading '%s': %s\n"), fname,
+               gpg_strerror (gpg_error_from_syserror ()));
+  es_free (line);
+  es_fclose (fp);
+  ocsp_cache_stats.stored -= count;
+  ocsp_cache_dirty = 0;
+  if (opt.verbose)
+    log_info ("loaded %u OCSP cache items from '%s'\n", count, fname);
+  xfree (fname);
+}
+
+
+/* Write the cache file if the cache has been changed.  */
+void
+ocsp_cache_save (void)
+{
+  char *fname = NULL;
+  char *tmpfname = NULL;
+  membuf_t mb;
+  ocsp_cache_item_t item;
+  ksba_isotime_t now;
+  estream_t fp = NULL;
+  char *data;
+  size_t datalen;
+  int failed = 0;
+  int i;
+
+  if (!ocsp_cache_loaded || !ocsp_cache_dirty || ocsp_cache_saving)
+    return;
+
+  /* Take a snapshot first because writing the file lets other threads
+     run.  */
+  gnupg_get_isotime (now);
+  init_membuf (&mb, 4096);
+  put_membuf_str (&mb, "# Dirmngr OCSP cache - do not edit.\nv:1:\n");
+  for (i=0; i < DIM (ocsp_cache); i++)
+    for (item = ocsp_cache[i]; item; item = item->next)
+      if (!cache_item_expired (item, now))
+        put_membuf_printf (&mb, "c:%s:%c:%s:%s:%s:%u:\n",
+                           item->key, item->revoked? 'r':'g',
+                           item->this_update, item->next_update,
+                           item->revocation_time, (unsigned int)item->reason);
+  data = get_membuf (&mb, &datalen);
+  if (!data)
+    {
+      log_error ("error building the OCSP cache file: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      return;
+    }
+  ocsp_cache_dirty = 0;
+  ocsp_cache_saving = 1;
+
+  fname = make_filename (opt.homedir_cache, OCSP_CACHE_FILE, NULL);
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    {
+      ocsp_cache_dirty = 1;
+      goto leave;
+    }
+  fp = es_fopen (tmpfname, "w");
+  if (!fp)
+    {
+      log_error (_("error creating '%s': %s\n"), tmpfname,
+                 gpg_strerror (gpg_error_from_syserror ()));
+      ocsp_cache_dirty = 1;
+      goto leave;
+    }
+  if (es_write (fp, data, datalen, NULL))
+    {
+      log_error (_("error writing '%s': %s\n"), tmpfname,
+                 gpg_strerror (gpg_error_from_syserror ()));
+      es_fclose (fp);
+      failed = 1;
+    }
+  else if (es_fclose (fp))
+    {
+      log_error (_("error closing '%s': %s\n"), tmpfname,
+                 gpg_strerror (gpg_error_from_syserror ()));
+      failed = 1;
+    }
+  if (failed)
+    {
+      gnupg_remove (tmpfname);
+      ocsp_cache_dirty = 1;
+      goto leave;
+    }
+  if (gnupg_rename_file (tmpfname, fname, NULL))
+    {
+      log_error (_("error renaming '%s' to '%s': %s\n"), tmpfname, fname,
+                 gpg_strerror (gpg_error_from_syserror ()));
+      gnupg_remove (tmpfname);
+      ocsp_cache_dirty = 1;
+    }
+
+ leave:
+  ocsp_cache_saving = 0;
+  xfree (data);
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Save the cache and release all items.  The cache is read again
+   from the file on the next use.  */
+void
+ocsp_cache_deinit (void)
+{
+  ocsp_cache_item_t item;
+  int i;
+
+  ocsp_cache_save ();
+  for (i=0; i < DIM (ocsp_cache); i++)
+    while ((item = ocsp_cache[i]))
+      {
+        ocsp_cache[i] = item->next;
+        xfree (item);
+      }
+  ocsp_cache_stats.entries = 0;
+  ocsp_cache_loaded = 0;
+  ocsp_cache_dirty = 0;
+}
+
+
+/* Store the statistics of the OCSP cache at R_STATS.  */
+void
+ocsp_cache_get_stats (struct ocsp_cache_stats_s *r_stats)
+{
+  ocsp_cache_load ();
+  *r_stats = ocsp_cache_stats;
+}
+
+
+/* Lookup the cache for KEY and on success copy the item to R_ITEM
+   and return true.  */
+static int
+ocsp_cache_get (const char *key, ocsp_cache_item_t r_item)
+{
+  ocsp_cache_item_t item;
+  ksba_isotime_t now;
+
+  ocsp_cache_load ();
+  for (item = *cache_bucket (key); item; item = item->next)
+    if (!strcmp (item->key, key))
+      break;
+  if (!item)
+    {
+      ocsp_cache_stats.misses++;
+      return 0;
+    }
+
+  gnupg_get_isotime (now);
+  if (cache_item_expired (item, now))
+    {
+      ocsp_cache_stats.expired++;
+      cache_remove (key);
+      return 0;
+    }
+
+  ocsp_cache_stats.hits++;
+  *r_item = *item;
+  r_item->next = NULL;
+  return 1;
+}
+
+
+
 /* Check whether the certificate either given by fingerprint CERT_FPR
    or directly through the CERT object is valid by running an OCSP
    transaction.  With FORCE_DEFAULT_RESPONDER set only the configured
@@ -611,6 +1087,9 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   char *oid;
   ksba_name_t name;
   fingerprint_list_t default_signer = NULL;
+  ksba_sexp_t serial = NULL;
+  char *cache_key = NULL;
+  struct ocsp_cache_item_s cached;
 
   /* Get the certificate.  */
   if (cert)
@@ -643,6 +1122,28 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
         }
     }
 
+  /* Check whether we have a still valid status in our cache.  */
+  serial = ksba_cert_get_serial (cert);
+  cache_key = make_cache_key (issuer_cert, serial);
+  if (cache_key && ocsp_cache_get (cache_key, &cached))
+    {
+      if (opt.verbose)
+        log_info ("using cached OCSP status: %s  (this=%s  next=%s)\n",
+                  cached.revoked? _("revoked"):_("good"),
+                  cached.this_update, cached.next_update);
+      if (cached.revoked)
+        {
+          time_t validated_at = 0;
+
+          ksba_cert_set_user_data (cert, "validated_at",
+                                   &validated_at, sizeof (validated_at));
+          err = gpg_error (GPG_ERR_CERT_REVOKED);
+        }
+      else
+        err = 0;
+      goto leave;
+    }
+
   /* Create an OCSP instance.  */
   err = ksba_ocsp_new (&ocsp);
   if (err)
@@ -863,8 +1364,24 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
         }
     }
 
+  /* Cache a definite answer until NEXT_UPDATE.  Responses without a
+     NEXT_UPDATE may change at any time and are thus not cached.  */
+  if (cache_key && *next_update
+      && (!err || gpg_err_code (err) == GPG_ERR_CERT_REVOKED))
+    {
+      memset (&cached, 0, sizeof cached);
+      cached.revoked = (status == KSBA_STATUS_REVOKED);
+      cached.reason = cached.revoked? reason : 0;
+      gnupg_copy_time (cached.this_update, this_update);
+      gnupg_copy_time (cached.next_update, next_update);
+      if (cached.revoked)
+        gnupg_copy_time (cached.revocation_time, revocation_time);
+      cache_insert (cache_key, &cached);
+    }
 
  leave:
+  xfree (cache_key);
+  ksba_free (serial);
   gcry_md_close (md);
   gcry_sexp_release (s_sig);
   xfree (sigval);
@@ -28,4 +28,18 @@ gpg_error_t ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
 /* Release the list of OCSP certificates hold in the CTRL object. */
 void release_ctrl_ocsp_certs (ctrl_t ctrl);
 
+/* Statistics of the OCSP cache.  */
+struct ocsp_cache_stats_s
+{
+  unsigned int entries;       /* Number of cached items.  */
+  unsigned long hits;         /* Number of lookups answered by the cache. */
+  unsigned long misses;       /* Number of lookups not in the cache.  */
+  unsigned long expired;      /* Number of items found to be outdated.  */
+  unsigned long stored;       /* Number of items put into the cache.  */
+};
+
+void ocsp_cache_get_stats (struct ocsp_cache_stats_s *r_stats);
+void ocsp_cache_save (void);
+void ocsp_cache_deinit (void);
+
 #endif /*OCSP_H*/
@@ -1196,7 +1196,102 @@ static const char hlp_isvalid[] =
   "\n"
   "If the option --force-default-responder is given, only the default\n"
   "OCSP responder will be used and any other methods of obtaining an\n"
-  "OCSP responder URL won't be used.";
+  "OCSP responder URL won't be used.\n"
+  "\n"
+  "  ISVALID --bulk <issuer_hash> <serialno> [<serialno> ...]\n"
+  "\n"
+  "This form checks several serial numbers of certificates issued by\n"
+  "the same CA using only the CRL.  For each serial number a status\n"
+  "line\n"
+  "\n"
+  "  S CRLSTATUS <serialno> <errorcode>\n"
+  "\n"
+  "is emitted, where ERRORCODE is 0 for a valid certificate.  The\n"
+  "command itself fails only if the CRL can't be used at all.";
+
+/* Helper for cmd_isvalid to implement the --bulk option.  */
+static gpg_error_t
+isvalid_bulk (assuan_context_t ctx, const char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  char *linecopy;
+  char **fields = NULL;
+  crl_cache_result_t *results = NULL;
+  int nfields, i;
+  int did_inquire = 0;
+
+  /* We need to work on a copy of the line because that same Assuan
+   * context may be used for an inquiry.  */
+  linecopy = xtrystrdup (line);
+  if (!linecopy)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  nfields = strlen (linecopy) / 2 + 1;
+  fields = xtrycalloc (nfields, sizeof *fields);
+  results = xtrycalloc (nfields, sizeof *results);
+  if (!fields || !results)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  nfields = split_fields (linecopy, fields, nfields);
+  if (nfields < 2)
+    {
+      err = PARM_ERROR (_("serialno missing in cert ID"));
+      goto leave;
+    }
+  if (strlen (fields[0]) != 40 || !hexdigitp (fields[0]))
+    {
+      err = PARM_ERROR ("invalid issuer hash");
+      goto leave;
+    }
+  for (i=1; i < nfields; i++)
+    if (!*fields[i] || strspn (fields[i], "0123456789abcdefABCDEF")
+        != strlen (fields[i]))
+      {
+        err = PARM_ERROR ("invalid serial number");
+        goto leave;
+      }
+
+ again:
+  crl_cache_isvalid_many (ctrl, fields[0], (const char **)fields + 1,
+                          nfields - 1, results, ctrl->force_crl_refresh);
+  /* All results are the same if the CRL was not usable.  */
+  switch (results[0])
+    {
+    case CRL_CACHE_DONTKNOW:
+      if (did_inquire)
+        err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+      else if (!(err = inquire_cert_and_load_crl (ctx)))
+        {
+          did_inquire = 1;
+          goto again;
+        }
+      goto leave;
+    case CRL_CACHE_CANTUSE:
+      err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+      goto leave;
+    default:
+      break;
+    }
+
+  err = 0;
+  for (i=1; i < nfields && !err; i++)
+    err = dirmngr_status_printf
+      (ctrl, "CRLSTATUS", "%s %u", fields[i],
+       results[i-1] == CRL_CACHE_VALID? 0 : gpg_error (GPG_ERR_CERT_REVOKED));
+
+ leave:
+  xfree (results);
+  xfree (fields);
+  xfree (linecopy);
+  return err;
+}
+
+
 static gpg_error_t
 cmd_isvalid (assuan_context_t ctx, char *line)
 {
@@ -1208,6 +1303,9 @@ cmd_isvalid (assuan_context_t ctx, char *line)
   int only_ocsp;
   int force_default_responder;
 
+  if (has_option (line, "--bulk"))
+    return leave_cmd (ctx, isvalid_bulk (ctx, skip_options (line)));
+
   only_ocsp = has_option (line, "--only-ocsp");
   force_default_responder = has_option (line, "--force-default-responder");
   line = skip_options (line);
@@ -2407,7 +2505,8 @@ static const char hlp_ks_get[] =
   "\n"
   "Get the keys matching PATTERN from the configured OpenPGP keyservers\n"
   "(see command KEYSERVER).  Each pattern should be a keyid, a fingerprint,\n"
-  "or an exact name indicated by the '=' prefix.";
+  "or an exact name indicated by the '=' prefix.  Several keys are fetched\n"
+  "in parallel from HKP keyservers and returned in the order they arrive.";
 static gpg_error_t
 cmd_ks_get (assuan_context_t ctx, char *line)
 {
@@ -2611,6 +2710,8 @@ static const char hlp_getinfo[] =
   "socket_name - Return the name of the socket.\n"
   "session_id  - Return the current session_id.\n"
   "workqueue   - Inspect the work queue\n"
+  "dns_cache   - Return statistics of the DNS cache\n"
+  "ocsp_cache  - Return statistics of the OCSP cache\n"
   "getenv NAME - Return value of envvar NAME\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
@@ -2679,6 +2780,31 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       workqueue_dump_queue (ctrl);
       err = 0;
     }
+  else if (!strcmp (line, "dns_cache"))
+    {
+      struct dns_cache_stats_s stats;
+      char buf[200];
+
+      dns_cache_get_stats (&stats);
+      snprintf (buf, sizeof buf,
+                "entries=%u hits=%lu neg_hits=%lu misses=%lu"
+                " expired=%lu flushes=%lu",
+                stats.entries, stats.hits, stats.neg_hits, stats.misses,
+                stats.expired, stats.flushes);
+      err = assuan_send_data (ctx, buf, strlen (buf));
+    }
+  else if (!strcmp (line, "ocsp_cache"))
+    {
+      struct ocsp_cache_stats_s stats;
+      char buf[200];
+
+      ocsp_cache_get_stats (&stats);
+      snprintf (buf, sizeof buf,
+                "entries=%u hits=%lu misses=%lu expired=%lu stored=%lu",
+                stats.entries, stats.hits, stats.misses,
+                stats.expired, stats.stored);
+      err = assuan_send_data (ctx, buf, strlen (buf));
+    }
   else if (!strncmp (line, "getenv", 6)
            && (line[6] == ' ' || line[6] == '\t' || !line[6]))
     {
@@ -0,0 +1,386 @@
+/* t-certcache.c - Regression tests and benchmark for certcache.c
+ * Copyright (C) 2021 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <npth.h>
+
+#define INCLUDED_BY_MAIN_MODULE 1
+#include "dirmngr.h"
+#include "crlfetch.h"
+#include "certcache.h"
+#include "t-support.h"
+
+#define PGM "t-certcache"
+
+/* The certificates used by the tests.  */
+static const char *default_files[] =
+  { "tls-ca.pem", "sks-keyservers.netCA.pem", NULL };
+
+
+/* Stubs for testing.  The certificates are only taken from the
+ * cache; see crlfetch.c, server.c, http.c and dirmngr.c for the real
+ * implementations.  */
+gpg_error_t
+ca_cert_fetch (ctrl_t ctrl, cert_fetch_context_t *context, const char *dn)
+{
+  (void)ctrl;
+  (void)dn;
+
+  *context = NULL;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+gpg_error_t
+fetch_next_ksba_cert (cert_fetch_context_t context, ksba_cert_t *r_cert)
+{
+  (void)context;
+
+  *r_cert = NULL;
+  return gpg_error (GPG_ERR_EOF);
+}
+
+void
+end_cert_fetch (cert_fetch_context_t context)
+{
+  (void)context;
+}
+
+ksba_cert_t
+get_cert_local (ctrl_t ctrl, const char *issuer)
+{
+  (void)ctrl;
+  (void)issuer;
+
+  return NULL;
+}
+
+ksba_cert_t
+get_cert_local_ski (ctrl_t ctrl, const char *name, ksba_sexp_t keyid)
+{
+  (void)ctrl;
+  (void)name;
+  (void)keyid;
+
+  return NULL;
+}
+
+void
+http_register_cfg_ca (const char *fname)
+{
+  (void)fname;
+}
+
+int
+dirmngr_enter_unlocked (void)
+{
+  return 0;
+}
+
+void
+dirmngr_leave_unlocked (void)
+{
+}
+
+
+/* Prepend FNAME with the srcdir environment variable's value and
+ * return an allocated filename.  */
+static char *
+prepend_srcdir (const char *fname)
+{
+  static const char *srcdir;
+
+  if (!srcdir && !(srcdir = getenv ("srcdir")))
+    srcdir = ".";
+  return xstrconcat (srcdir, "/", fname, NULL);
+}
+
+
+/* Read all certificates from the files FILES into a list.  */
+static certlist_t
+read_files (strlist_t files)
+{
+  certlist_t result = NULL;
+  certlist_t cl, *cltail;
+  estream_t fp;
+
+  cltail = &result;
+  for (; files; files = files->next)
+    {
+      fp = es_fopen (files->d, "rb");
+      if (!fp)
+        {
+          fprintf (stderr, PGM ": can't open '%s': %s\n",
+                   files->d, strerror (errno));
+          exit (1);
+        }
+      if (read_certlist_from_stream (&cl, fp))
+        fail (0);
+      es_fclose (fp);
+      *cltail = cl;
+      for (; cl; cl = cl->next)
+        cltail = &cl->next;
+    }
+  if (!result)
+    fail (0);
+  return result;
+}
+
+
+/* Callback for get_certs_bypattern to count the returned certificates
+ * with the fingerprint FPR.  */
+struct match_parm_s
+{
+  unsigned char fpr[20];
+  unsigned int count;
+};
+
+static gpg_error_t
+match_cb (void *opaque, ksba_cert_t cert)
+{
+  struct match_parm_s *parm = opaque;
+  unsigned char fpr[20];
+
+  if (!memcmp (cert_compute_fpr (cert, fpr), parm->fpr, 20))
+    parm->count++;
+  return 0;
+}
+
+
+/* Return the number of matches of PATTERN with the fingerprint FPR.
+ * Returns -1 for no match at all.  */
+static int
+lookup (const char *pattern, const unsigned char *fpr)
+{
+  struct match_parm_s parm;
+  gpg_error_t err;
+
+  memcpy (parm.fpr, fpr, 20);
+  parm.count = 0;
+  err = get_certs_bypattern (pattern, match_cb, &parm);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    return -1;
+  if (err)
+    fail (0);
+  return parm.count;
+}
+
+
+/* Check the lookups for all certificates in CERTS.  */
+static void
+test_lookups (ctrl_t ctrl, certlist_t certs)
+{
+  certlist_t cl;
+  ksba_cert_t issuer;
+  char *dn, *pattern;
+  char hexkid[17];
+
+  for (cl = certs; cl; cl = cl->next)
+    {
+      dn = ksba_cert_get_subject (cl->cert, 0);
+      if (!dn)
+        fail (1);
+      pattern = xstrconcat ("/", dn, NULL);
+      if (lookup (pattern, cl->fpr) != 1)
+        fail (1);
+      xfree (pattern);
+      ksba_free (dn);
+
+      dn = ksba_cert_get_issuer (cl->cert, 0);
+      if (!dn)
+        fail (2);
+      pattern = xstrconcat ("#/", dn, NULL);
+      if (lookup (pattern, cl->fpr) != 1)
+        fail (2);
+      xfree (pattern);
+      ksba_free (dn);
+
+      /* The key ids are the trailing bytes of the fingerprint.  */
+      bin2hex (cl->fpr + 12, 8, hexkid);
+      if (lookup (hexkid, cl->fpr) != 1)
+        fail (3);
+      pattern = xstrconcat ("0x", hexkid + 8, NULL);
+      if (lookup (pattern, cl->fpr) != 1)
+        fail (3);
+      xfree (pattern);
+      hexkid[0] = hexkid[0] == '0'? '1' : '0';
+      if (lookup (hexkid, cl->fpr) != -1)
+        fail (3);
+
+      /* The test certificates are self-signed.  */
+      if (find_issuing_cert (ctrl, cl->cert, &issuer))
+        fail (4);
+      ksba_cert_release (issuer);
+    }
+
+  if (lookup ("/CN=No such subject", certs->fpr) != -1)
+    fail (5);
+}
+
+
+/* Return the current time in seconds.  */
+static double
+get_time (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/* Run the lookups done for the validation of CERTS COUNT times and
+ * print the timings.  */
+static void
+run_benchmark (ctrl_t ctrl, certlist_t certs, unsigned long count)
+{
+  certlist_t cl;
+  ksba_cert_t issuer;
+  unsigned long n, ncerts, nissuers;
+  char **subjects, **hexkids;
+  double t0, t1, t2, t3;
+  size_t idx;
+
+  for (ncerts = 0, cl = certs; cl; cl = cl->next)
+    ncerts++;
+  subjects = xcalloc (ncerts, sizeof *subjects);
+  hexkids = xcalloc (ncerts, sizeof *hexkids);
+  for (idx = 0, cl = certs; cl; cl = cl->next, idx++)
+    {
+      char *dn = ksba_cert_get_subject (cl->cert, 0);
+
+      subjects[idx] = xstrconcat ("/", dn? dn : "", NULL);
+      ksba_free (dn);
+      hexkids[idx] = xmalloc (17);
+      bin2hex (cl->fpr + 12, 8, hexkids[idx]);
+    }
+
+  t0 = get_time ();
+  for (n = nissuers = 0; n < count; n++)
+    for (cl = certs; cl; cl = cl->next)
+      if (!find_issuing_cert (ctrl, cl->cert, &issuer))
+        {
+          nissuers++;
+          ksba_cert_release (issuer);
+        }
+
+  t1 = get_time ();
+  for (n = 0; n < count; n++)
+    for (idx = 0, cl = certs; cl; cl = cl->next, idx++)
+      if (lookup (subjects[idx], cl->fpr) < 1)
+        fail (10);
+
+  t2 = get_time ();
+  for (n = 0; n < count; n++)
+    for (idx = 0, cl = certs; cl; cl = cl->next, idx++)
+      if (lookup (hexkids[idx], cl->fpr) < 1)
+        fail (10);
+  t3 = get_time ();
+
+  printf ("%lu certificates, %lu rounds, %lu issuers found:"
+          " issuer %.3fs, subject %.3fs, keyid %.3fs"
+          " (%.0f issuer lookups/s)\n",
+          ncerts, count, nissuers, t1 - t0, t2 - t1, t3 - t2,
+          t1 > t0? ncerts * count / (t1 - t0) : 0.0);
+
+  for (idx = 0; idx < ncerts; idx++)
+    {
+      xfree (subjects[idx]);
+      xfree (hexkids[idx]);
+    }
+  xfree (subjects);
+  xfree (hexkids);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  unsigned long bench = 0;
+  strlist_t files = NULL;
+  certlist_t certs;
+  ctrl_t ctrl;
+  char *fname;
+  int i;
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM " [options] [FILES]\n"
+                 "Options:\n"
+                 "  --bench N    run the lookups N times for the"
+                 " certificates in FILES\n"
+                 "  --verbose    print diagnostics\n",
+                 stdout);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          opt.verbose++;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--bench") && argc > 1)
+        {
+          bench = strtoul (argv[1], NULL, 10);
+          argc -= 2; argv += 2;
+        }
+    }
+
+  npth_init ();
+  if (argc)
+    {
+      for (; argc; argc--, argv++)
+        append_to_strlist (&files, *argv);
+    }
+  else
+    {
+      for (i = 0; default_files[i]; i++)
+        {
+          fname = prepend_srcdir (default_files[i]);
+          append_to_strlist (&files, fname);
+          xfree (fname);
+        }
+    }
+
+  /* The files are loaded like those given with --hkp-cacert; the
+   * certificates of the system are also loaded.  */
+  cert_cache_init (files);
+  certs = read_files (files);
+  ctrl = xcalloc (1, sizeof *ctrl);
+
+  if (bench)
+    run_benchmark (ctrl, certs, bench);
+  else
+    test_lookups (ctrl, certs);
+
+  xfree (ctrl);
+  release_certlist (certs);
+  cert_cache_deinit (1);
+  free_strlist (files);
+  return 0;
+}
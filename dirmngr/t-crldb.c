@@ -0,0 +1,473 @@
+/* t-crldb.c - Regression tests for crldb.c
+ * Copyright (C) 2021 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/resource.h>
+#endif
+
+#include "../common/util.h"
+#include "../common/sysutils.h"
+#include "t-support.h"
+#include "crldb.h"
+
+#define PGM "t-crldb"
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+static const char rdate[] = "20210401T120000";
+
+/* The memory limit used for creating the databases.  */
+static size_t make_limit;
+
+
+/* Create the database file FNAME from the N serial numbers starting
+ * at FIRST (big endian, one or two bytes).  If REMOVE_EVERY is not 0,
+ * every REMOVE_EVERY'th serial number is removed instead.  BASE is
+ * the optional base database.  */
+static void
+make_db (const char *fname, crldb_t base, unsigned int first,
+         unsigned int n, unsigned int remove_every)
+{
+  gpg_error_t err;
+  crldb_make_t mk;
+  unsigned char sn[4];
+  unsigned char id[CRLDB_ID_LEN];
+  unsigned int i, v;
+  int fd;
+
+  err = crldb_make_new (&mk);
+  if (err)
+    fail (0);
+  crldb_make_set_limit (mk, make_limit);
+  if (base)
+    crldb_make_set_base (mk, base);
+
+  /* Add in descending order to check the sorting.  */
+  for (i = first + n - 1; i >= first; i--)
+    {
+      v = i;
+      sn[0] = v >> 24;
+      sn[1] = v >> 16;
+      sn[2] = v >> 8;
+      sn[3] = v;
+      if (remove_every && !(i % remove_every))
+        err = crldb_make_remove (mk, sn + (v < 256? 3 : 2),
+                                 v < 256? 1 : 2);
+      else
+        err = crldb_make_add (mk, sn + (v < 256? 3 : 2), v < 256? 1 : 2,
+                              (int)(i & 0x7f), rdate);
+      if (err)
+        fail (0);
+      if (!i)
+        break;
+    }
+
+  fd = open (fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  if (fd == -1)
+    fail (0);
+  err = crldb_make_finish (mk, fd, id);
+  if (err)
+    fail (0);
+  if (close (fd))
+    fail (0);
+  crldb_make_release (mk);
+}
+
+
+static int
+lookup (crldb_t db, unsigned int v, struct crldb_item_s *item)
+{
+  unsigned char sn[2];
+
+  sn[0] = v >> 8;
+  sn[1] = v;
+  if (v < 256)
+    return crldb_find (db, sn + 1, 1, item);
+  return crldb_find (db, sn, 2, item);
+}
+
+
+static void
+test_full_and_delta (void)
+{
+  const char fname1[] = PGM "-1.db";
+  const char fname2[] = PGM "-2.db";
+  gpg_error_t err;
+  crldb_t db, db2;
+  struct crldb_item_s item;
+  unsigned int v;
+  size_t idx;
+
+  /* A full CRL with the serial numbers 1..1000.  */
+  make_db (fname1, NULL, 1, 1000, 0);
+  err = crldb_open (fname1, &db);
+  if (err)
+    fail (1);
+  if (crldb_count (db) != 1000)
+    fail (1);
+  for (v = 1; v <= 1000; v++)
+    {
+      if (!lookup (db, v, &item))
+        fail (1);
+      if (item.reason != (v & 0x7f) || memcmp (item.rdate, rdate, 15))
+        fail (1);
+    }
+  if (lookup (db, 1001, NULL) || lookup (db, 0, NULL))
+    fail (1);
+
+  /* The records must be sorted.  */
+  for (idx = 0; idx + 1 < crldb_count (db); idx++)
+    {
+      struct crldb_item_s next;
+
+      crldb_get (db, idx, &item);
+      crldb_get (db, idx+1, &next);
+      if (item.snlen > next.snlen
+          || (item.snlen == next.snlen
+              && memcmp (item.sn, next.sn, item.snlen) >= 0))
+        fail (1);
+    }
+
+  /* A delta CRL adding 1001..1500 and removing every tenth serial
+   * number in the range 901..1500.  */
+  make_db (fname2, db, 901, 600, 10);
+  crldb_close (db);
+  err = crldb_open (fname2, &db2);
+  if (err)
+    fail (2);
+  for (v = 1; v <= 1500; v++)
+    {
+      if (v > 900 && !(v % 10))
+        {
+          if (lookup (db2, v, NULL))
+            fail (2);
+        }
+      else if (!lookup (db2, v, NULL))
+        fail (2);
+    }
+  if (crldb_count (db2) != 1500 - 60)
+    fail (2);
+  crldb_close (db2);
+
+  gnupg_remove (fname1);
+  gnupg_remove (fname2);
+}
+
+
+static void
+test_corrupt (void)
+{
+  const char fname[] = PGM "-3.db";
+  gpg_error_t err;
+  crldb_t db;
+  FILE *fp;
+
+  make_db (fname, NULL, 1, 10, 0);
+
+  /* Append a byte so that the length does not match.  */
+  fp = fopen (fname, "ab");
+  if (!fp)
+    fail (3);
+  putc (0, fp);
+  fclose (fp);
+  err = crldb_open (fname, &db);
+  if (gpg_err_code (err) != GPG_ERR_INV_OBJ)
+    fail (3);
+
+  gnupg_remove (fname);
+}
+
+
+/* Check that for the same serial number the last item wins even if
+ * the items are spread over several runs.  */
+static void
+test_duplicates (void)
+{
+  const char fname[] = PGM "-4.db";
+  gpg_error_t err;
+  crldb_make_t mk;
+  crldb_t db;
+  struct crldb_item_s item;
+  unsigned char sn[1], id[CRLDB_ID_LEN];
+  unsigned int v;
+  int fd;
+
+  err = crldb_make_new (&mk);
+  if (err)
+    fail (4);
+  crldb_make_set_limit (mk, 256);
+  for (v = 1; v <= 200; v++)
+    {
+      sn[0] = v;
+      if (crldb_make_add (mk, sn, 1, 1, rdate))
+        fail (4);
+    }
+  for (v = 1; v <= 100; v++)
+    {
+      sn[0] = v;
+      if (crldb_make_remove (mk, sn, 1))
+        fail (4);
+    }
+  sn[0] = 50;
+  if (crldb_make_add (mk, sn, 1, 7, rdate))
+    fail (4);
+
+  fd = open (fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  if (fd == -1)
+    fail (4);
+  if (crldb_make_finish (mk, fd, id))
+    fail (4);
+  if (close (fd))
+    fail (4);
+  crldb_make_release (mk);
+
+  err = crldb_open (fname, &db);
+  if (err)
+    fail (4);
+  if (crldb_count (db) != 101)
+    fail (4);
+  for (v = 1; v <= 200; v++)
+    {
+      if (v == 50)
+        {
+          if (!lookup (db, v, &item) || item.reason != 7)
+            fail (4);
+        }
+      else if ((v > 100) != lookup (db, v, NULL))
+        fail (4);
+    }
+  crldb_close (db);
+
+  gnupg_remove (fname);
+}
+
+
+/* Check the helpers deciding whether a delta CRL may be merged with
+ * a cached complete CRL.  */
+static void
+test_delta_numbers (void)
+{
+  static const unsigned char der1[] = { 0x02, 0x01, 0x2a };
+  static const unsigned char der2[] = { 0x02, 0x02, 0x01, 0x00 };
+  static const unsigned char bad1[] = { 0x04, 0x01, 0x2a };
+  static const unsigned char bad2[] = { 0x02, 0x03, 0x01, 0x00 };
+  static const unsigned char bad3[] = { 0x02, 0x81, 0x01, 0x01 };
+  gpg_error_t err;
+  char *number;
+
+  err = crldb_parse_base_number (der1, sizeof der1, &number);
+  if (err || strcmp (number, "2A"))
+    fail (5);
+  xfree (number);
+  err = crldb_parse_base_number (der2, sizeof der2, &number);
+  if (err || strcmp (number, "0100"))
+    fail (5);
+  xfree (number);
+  if (gpg_err_code (crldb_parse_base_number (bad1, sizeof bad1, &number))
+      != GPG_ERR_INV_CRL || number)
+    fail (5);
+  if (gpg_err_code (crldb_parse_base_number (bad2, sizeof bad2, &number))
+      != GPG_ERR_INV_CRL || number)
+    fail (5);
+  if (gpg_err_code (crldb_parse_base_number (bad3, sizeof bad3, &number))
+      != GPG_ERR_INV_CRL || number)
+    fail (5);
+
+  /* Leading zeroes and case do not matter.  */
+  if (crldb_compare_numbers ("0100", "FF") <= 0
+      || crldb_compare_numbers ("ff", "00FF")
+      || crldb_compare_numbers ("2a", "2B") >= 0
+      || crldb_compare_numbers ("0", "") )
+    fail (6);
+
+  /* No complete CRL cached.  */
+  if (gpg_err_code (crldb_check_delta (NULL, "05", "07"))
+      != GPG_ERR_NO_CRL_KNOWN)
+    fail (7);
+  /* The cached CRL is older than the base of the delta CRL.  */
+  if (gpg_err_code (crldb_check_delta ("04", "05", "07"))
+      != GPG_ERR_NO_CRL_KNOWN)
+    fail (7);
+  /* The delta CRL is not newer than the cached CRL.  */
+  if (gpg_err_code (crldb_check_delta ("07", "05", "07")) != GPG_ERR_TOO_OLD
+      || gpg_err_code (crldb_check_delta ("07", "05", NULL))
+      != GPG_ERR_TOO_OLD)
+    fail (7);
+  /* Usable; the cached CRL may be newer than the base.  */
+  if (crldb_check_delta ("05", "05", "07")
+      || crldb_check_delta ("06", "05", "0107"))
+    fail (7);
+}
+
+
+/* Return the current time in seconds.  */
+static double
+get_time (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/* Create a database with COUNT random serial numbers of 16 bytes
+ * each, look up all of them and print the timings.  This mimics a
+ * very large CRL without the ASN.1 parsing.  */
+static void
+run_benchmark (unsigned long count)
+{
+  const char fname[] = PGM "-bench.db";
+  gpg_error_t err;
+  crldb_make_t mk;
+  crldb_t db;
+  unsigned char sn[16], id[CRLDB_ID_LEN];
+  unsigned long n, nfound;
+  unsigned long long rnd = 0x2545f4914f6cdd1dULL;
+  double t0, t1, t2, t3;
+  int i, fd;
+
+  t0 = get_time ();
+  err = crldb_make_new (&mk);
+  if (err)
+    fail (10);
+  crldb_make_set_limit (mk, make_limit);
+  for (n = 0; n < count; n++)
+    {
+      /* A simple xorshift generator is sufficient here.  */
+      rnd ^= rnd << 13;
+      rnd ^= rnd >> 7;
+      rnd ^= rnd << 17;
+      for (i = 0; i < 8; i++)
+        sn[i] = rnd >> (i * 8);
+      sn[0] |= 0x01;
+      memset (sn + 8, 0, 4);
+      sn[12] = n >> 24;
+      sn[13] = n >> 16;
+      sn[14] = n >> 8;
+      sn[15] = n;
+      if (crldb_make_add (mk, sn, 16, 1, rdate))
+        fail (10);
+    }
+
+  t1 = get_time ();
+  fd = open (fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  if (fd == -1)
+    fail (10);
+  if (crldb_make_finish (mk, fd, id))
+    fail (10);
+  if (close (fd))
+    fail (10);
+  crldb_make_release (mk);
+
+  t2 = get_time ();
+#ifndef HAVE_W32_SYSTEM
+  {
+    struct rusage ru;
+
+    /* The lookups below touch the entire mapped file; thus report
+     * the memory usage now.  */
+    if (!getrusage (RUSAGE_SELF, &ru))
+      printf ("maximum resident set size: %ld KiB\n", (long)ru.ru_maxrss);
+  }
+#endif
+  err = crldb_open (fname, &db);
+  if (err)
+    fail (10);
+  for (n = nfound = 0; n < crldb_count (db); n++)
+    {
+      struct crldb_item_s item;
+
+      crldb_get (db, n, &item);
+      memcpy (sn, item.sn, item.snlen);
+      if (crldb_find (db, sn, item.snlen, NULL))
+        nfound++;
+    }
+  t3 = get_time ();
+  if (nfound != count)
+    fail (10);
+  crldb_close (db);
+  gnupg_remove (fname);
+
+  printf ("%lu items: add %.3fs, finish %.3fs, lookup %.3fs"
+          " (%.0f lookups/s)\n",
+          count, t1 - t0, t2 - t1, t3 - t2,
+          t3 > t2? count / (t3 - t2) : 0.0);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  unsigned long bench = 0;
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM " [options]\n"
+                 "Options:\n"
+                 "  --bench N    run a benchmark with N items\n"
+                 "  --limit N    use a memory limit of N bytes\n",
+                 stdout);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--bench") && argc > 1)
+        {
+          bench = strtoul (argv[1], NULL, 10);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--limit") && argc > 1)
+        {
+          make_limit = strtoul (argv[1], NULL, 10);
+          argc -= 2; argv += 2;
+        }
+    }
+
+  if (bench)
+    {
+      run_benchmark (bench);
+      return 0;
+    }
+
+  test_full_and_delta ();
+  test_corrupt ();
+  test_duplicates ();
+  test_delta_numbers ();
+
+  /* Again with many runs.  */
+  make_limit = 512;
+  test_full_and_delta ();
+
+  return 0;
+}
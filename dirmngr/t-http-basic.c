@@ -20,10 +20,20 @@
 
 #include <config.h>
 #include <stdlib.h>
+#include <time.h>
+#ifndef HAVE_W32_SYSTEM
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+#endif
+#include <assuan.h>
 
 #include "../common/util.h"
 #include "t-support.h"
 #include "http.h"
+#include "dns-stuff.h"
 
 #define PGM "t-http-basic"
 
@@ -187,13 +197,206 @@ test_http_prepare_redirect (void)
 }
 
 
+#ifndef HAVE_W32_SYSTEM
+/* Create a listening socket for the loopback address of FAMILY and
+ * PORT.  If PORT is 0 an ephemeral port is used and stored at
+ * R_PORT.  Returns -1 on error.  */
+static int
+make_listener (int family, unsigned short port, int backlog,
+               unsigned short *r_port)
+{
+  struct sockaddr_storage ss;
+  socklen_t sslen;
+  int fd, one = 1;
+
+  memset (&ss, 0, sizeof ss);
+  if (family == AF_INET6)
+    {
+      struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+
+      sin6->sin6_family = AF_INET6;
+      sin6->sin6_addr = in6addr_loopback;
+      sin6->sin6_port = htons (port);
+      sslen = sizeof *sin6;
+    }
+  else
+    {
+      struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+
+      sin->sin_family = AF_INET;
+      sin->sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+      sin->sin_port = htons (port);
+      sslen = sizeof *sin;
+    }
+
+  fd = socket (family, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+#ifdef IPV6_V6ONLY
+  if (family == AF_INET6)
+    setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof one);
+#endif
+  if (bind (fd, (struct sockaddr *)&ss, sslen) || listen (fd, backlog))
+    {
+      close (fd);
+      return -1;
+    }
+  if (r_port)
+    {
+      if (getsockname (fd, (struct sockaddr *)&ss, &sslen))
+        {
+          close (fd);
+          return -1;
+        }
+      *r_port = ntohs (((struct sockaddr_in *)&ss)->sin_port);
+    }
+  return fd;
+}
+
+
+/* Make the listener FD unresponsive by filling up its backlog; new
+ * SYNs are then silently dropped and a connect hangs until it times
+ * out.  This simulates a black-holed address.  */
+static void
+stall_listener (int family, int fd, int *clients, int nclients)
+{
+  struct sockaddr_storage ss;
+  socklen_t sslen = sizeof ss;
+  int i;
+
+  if (getsockname (fd, (struct sockaddr *)&ss, &sslen))
+    return;
+  for (i=0; i < nclients; i++)
+    {
+      clients[i] = socket (family, SOCK_STREAM, 0);
+      if (clients[i] == -1)
+        continue;
+      fcntl (clients[i], F_SETFL, O_NONBLOCK);
+      connect (clients[i], (struct sockaddr *)&ss, sslen);
+    }
+}
+
+
+/* Store the address family of the first address of "localhost" at
+ * R_FIRST and that of a following address of another family at
+ * R_SECOND.  Returns false if localhost does not resolve to
+ * addresses of two families.  */
+static int
+localhost_families (int *r_first, int *r_second)
+{
+  dns_addrinfo_t aibuf, ai;
+  int found = 0;
+
+  if (resolve_dns_name (NULL, "localhost", 0, 0, SOCK_STREAM, &aibuf, NULL))
+    return 0;
+  if (aibuf)
+    {
+      *r_first = aibuf->family;
+      for (ai = aibuf->next; ai && !found; ai = ai->next)
+        if (ai->family != *r_first
+            && (ai->family == AF_INET || ai->family == AF_INET6))
+          {
+            *r_second = ai->family;
+            found = 1;
+          }
+    }
+  free_dns_addrinfo (aibuf);
+  return found;
+}
+
+
+/* Check that connecting to a host with several addresses does not
+ * wait for a dead or stalled address before trying the next one.
+ * The host is localhost; the first address tried is made to fail and
+ * only the address of the other family accepts the connection.  */
+static void
+test_http_connect_fallback (void)
+{
+  gpg_error_t err;
+  http_t hd;
+  int fd_good, fd_bad;
+  int first, second;
+  int clients[4];
+  unsigned short port;
+  time_t started;
+  int i;
+
+  if (!localhost_families (&first, &second))
+    {
+      fprintf (stderr, PGM ": skipping connect tests: localhost does not"
+               " have an IPv4 and an IPv6 address\n");
+      return;
+    }
+
+  fd_good = make_listener (second, 0, 5, &port);
+  if (fd_good == -1)
+    {
+      fprintf (stderr, PGM ": skipping connect tests: %s\n",
+               strerror (errno));
+      return;
+    }
+  /* Make sure that the first address is usable at all.  */
+  fd_bad = make_listener (first, port, 0, NULL);
+  if (fd_bad == -1)
+    {
+      fprintf (stderr, PGM ": skipping connect tests: %s\n",
+               strerror (errno));
+      close (fd_good);
+      return;
+    }
+  close (fd_bad);
+
+  /* Nothing listens on the first address - that one is refused at
+   * once.  */
+  err = http_raw_connect (NULL, &hd, "localhost", port, 0, NULL, 10000);
+  if (err)
+    fail (1);
+  http_close (hd, 0);
+
+  /* The first address silently drops our SYN - we must not wait for
+   * the timeout before trying the second one.  */
+  fd_bad = make_listener (first, port, 0, NULL);
+  if (fd_bad == -1)
+    fail (2);
+  for (i=0; i < DIM (clients); i++)
+    clients[i] = -1;
+  stall_listener (first, fd_bad, clients, DIM (clients));
+  started = time (NULL);
+  err = http_raw_connect (NULL, &hd, "localhost", port, 0, NULL, 10000);
+  if (err)
+    fail (2);
+  if (time (NULL) - started > 5)
+    fail (2);
+  http_close (hd, 0);
+  for (i=0; i < DIM (clients); i++)
+    if (clients[i] != -1)
+      close (clients[i]);
+  close (fd_bad);
+
+  /* No address is listening at all.  */
+  close (fd_good);
+  err = http_raw_connect (NULL, &hd, "localhost", port, 0, NULL, 10000);
+  if (!err)
+    {
+      http_close (hd, 0);
+      fail (3);
+    }
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 int
 main (int argc, char **argv)
 {
   (void)argc;
   (void)argv;
 
+  assuan_sock_init ();
+
   test_http_prepare_redirect ();
+#ifndef HAVE_W32_SYSTEM
+  test_http_connect_fallback ();
+#endif
 
   return 0;
 }
@@ -36,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <sys/time.h>
 #include <assuan.h>
 
 #include "../common/util.h"
@@ -189,6 +190,80 @@ prepend_srcdir (const char *fname)
 }
 
 
+/* Create a new session object for one request.  */
+static http_session_t
+new_session (int no_crl, unsigned int timeout)
+{
+  gpg_error_t err = 0;
+  http_session_t session = NULL;
+
+#if HTTP_USE_NTBTLS
+  err = http_session_new (&session, NULL,
+                          ((no_crl? HTTP_FLAG_NO_CRL : 0)
+                           | HTTP_FLAG_TRUST_DEF),
+                          my_http_tls_verify_cb, NULL);
+#elif HTTP_USE_GNUTLS
+  err = http_session_new (&session, NULL,
+                          ((no_crl? HTTP_FLAG_NO_CRL : 0)
+                           | HTTP_FLAG_TRUST_DEF),
+                          NULL, NULL);
+#else
+  (void)no_crl;
+#endif
+  if (err)
+    log_error ("http_session_new failed: %s\n", gpg_strerror (err));
+  if (session)
+    http_session_set_timeout (session, timeout);
+  return session;
+}
+
+
+/* Fetch URL COUNT times and print the number of requests per second.
+ * This is useful to compare persistent connections (--keep-alive)
+ * with a new connection per request against a local server.  */
+static void
+run_benchmark (const char *url, unsigned int flags, unsigned int count,
+               int no_crl, unsigned int timeout)
+{
+  gpg_error_t err;
+  http_session_t session;
+  http_t hd;
+  struct timeval start, stop;
+  unsigned int n, nfail = 0;
+  unsigned long total = 0;
+  double elapsed;
+  estream_t fp;
+
+  gettimeofday (&start, NULL);
+  for (n = 0; n < count; n++)
+    {
+      session = new_session (no_crl, timeout);
+      err = http_open_document (NULL, &hd, url, NULL, flags,
+                                NULL, session, NULL, NULL);
+      if (err)
+        {
+          log_error ("request %u failed: %s\n", n, gpg_strerror (err));
+          nfail++;
+        }
+      else
+        {
+          fp = http_get_read_ptr (hd);
+          while (es_getc (fp) != EOF)
+            total++;
+          http_close (hd, 0);
+        }
+      http_session_release (session);
+    }
+  gettimeofday (&stop, NULL);
+
+  elapsed = ((stop.tv_sec - start.tv_sec)
+             + (stop.tv_usec - start.tv_usec) / 1000000.0);
+  log_info ("%u requests (%u failed, %lu bytes) in %.3fs: %.1f requests/s\n",
+            count, nfail, total, elapsed,
+            elapsed > 0? count / elapsed : 0.0);
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -205,6 +280,7 @@ main (int argc, char **argv)
   const char *cafile = NULL;
   http_session_t session = NULL;
   unsigned int timeout = 0;
+  unsigned int repeat = 0;
 
   gpgrt_init ();
   log_set_prefix (PGM, GPGRT_LOG_WITH_PREFIX | GPGRT_LOG_WITH_PID);
@@ -231,7 +307,9 @@ main (int argc, char **argv)
                  "  --force-tls       use HTTP_FLAG_FORCE_TLS\n"
                  "  --force-tor       use HTTP_FLAG_FORCE_TOR\n"
                  "  --no-out          do not print the content\n"
-                 "  --no-crl          do not consuilt a CRL\n",
+                 "  --no-crl          do not consuilt a CRL\n"
+                 "  --keep-alive      use HTTP_FLAG_KEEP_ALIVE\n"
+                 "  --repeat N        fetch N more times and print a rate\n",
                  stdout);
           exit (0);
         }
@@ -298,6 +376,20 @@ main (int argc, char **argv)
           no_crl = 1;
           argc--; argv++;
         }
+      else if (!strcmp (*argv, "--keep-alive"))
+        {
+          my_http_flags |= HTTP_FLAG_KEEP_ALIVE;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--repeat"))
+        {
+          argc--; argv++;
+          if (argc)
+            {
+              repeat = strtoul (*argv, NULL, 10);
+              argc--; argv++;
+            }
+        }
       else if (!strncmp (*argv, "--", 2))
         {
           fprintf (stderr, PGM ": unknown option '%s'\n", *argv);
@@ -489,7 +581,12 @@ main (int argc, char **argv)
     }
   http_close (hd, 0);
 
+  if (repeat)
+    run_benchmark (*argv, (my_http_flags & ~HTTP_FLAG_LOG_RESP),
+                   repeat, no_crl, timeout);
+
   http_session_release (session);
+  http_pool_flush ();
 #ifdef HTTP_USE_GNUTLS
   gnutls_global_deinit ();
 #endif /*HTTP_USE_GNUTLS*/
@@ -734,6 +734,42 @@ keydb_get_keyblock (KEYDB_HANDLE hd, kbnode_t *ret_kb)
 }
 
 
+/* Return the raw OpenPGP image of the keyblock last found by
+ * keydb_search() at R_IMAGE and its length at R_IMAGELEN.  The image
+ * is owned by HD and valid only until the next search or a call to
+ * keydb_get_keyblock.  If the keyblock is not available as an image
+ * (e.g. the keyring backend is used or the keyboxd passed the
+ * keyblock via the datastream) GPG_ERR_NOT_SUPPORTED is returned and
+ * the caller should use keydb_get_keyblock instead.  */
+gpg_error_t
+keydb_get_keyblock_image (KEYDB_HANDLE hd,
+                          const void **r_image, size_t *r_imagelen)
+{
+  gpg_error_t err;
+
+  *r_image = NULL;
+  *r_imagelen = 0;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  if (!hd->use_keyboxd)
+    err = internal_keydb_get_keyblock_image (hd, r_image, r_imagelen);
+  else if (hd->kbl->search_result)
+    {
+      *r_image = iobuf_get_temp_buffer (hd->kbl->search_result);
+      *r_imagelen = iobuf_get_temp_length (hd->kbl->search_result);
+      err = 0;
+    }
+  else if (hd->kbl->datastream.found_keyblock)
+    err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+  else
+    err = gpg_error (GPG_ERR_VALUE_NOT_FOUND);
+
+  return err;
+}
+
+
 
 /* Communication object for STORE commands.  */
 struct store_parm_s
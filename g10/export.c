@@ -1897,6 +1897,355 @@ do_export_one_keyblock (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid,
 }
 
 
+/* Parse the OpenPGP packet header at the start of the BUFLEN bytes
+ * at BUF.  On success the packet type is stored at R_PKTTYPE, the
+ * length of the header at R_HDRLEN and the length of the body at
+ * R_BODYLEN.  Partial and indeterminate lengths are not supported by
+ * this parser and return GPG_ERR_NOT_SUPPORTED.  */
+static gpg_error_t
+parse_image_header (const byte *buf, size_t buflen,
+                    int *r_pkttype, size_t *r_hdrlen, size_t *r_bodylen)
+{
+  int ctb;
+  size_t hdrlen, bodylen;
+
+  if (!buflen || !(buf[0] & 0x80))
+    return gpg_error (GPG_ERR_INV_PACKET);
+  ctb = buf[0];
+
+  if ((ctb & 0x40))  /* New style CTB.  */
+    {
+      *r_pkttype = (ctb & 0x3f);
+      if (buflen < 2)
+        return gpg_error (GPG_ERR_INV_PACKET);
+      if (buf[1] < 192)
+        {
+          bodylen = buf[1];
+          hdrlen = 2;
+        }
+      else if (buf[1] < 224)
+        {
+          if (buflen < 3)
+            return gpg_error (GPG_ERR_INV_PACKET);
+          bodylen = ((buf[1] - 192) << 8) + buf[2] + 192;
+          hdrlen = 3;
+        }
+      else if (buf[1] == 255)
+        {
+          if (buflen < 6)
+            return gpg_error (GPG_ERR_INV_PACKET);
+          bodylen = buf32_to_size_t (buf+2);
+          hdrlen = 6;
+        }
+      else
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);  /* Partial length.  */
+    }
+  else  /* Old style CTB.  */
+    {
+      *r_pkttype = ((ctb >> 2) & 0xf);
+      switch ((ctb & 3))
+        {
+        case 0:
+          if (buflen < 2)
+            return gpg_error (GPG_ERR_INV_PACKET);
+          bodylen = buf[1];
+          hdrlen = 2;
+          break;
+        case 1:
+          if (buflen < 3)
+            return gpg_error (GPG_ERR_INV_PACKET);
+          bodylen = buf16_to_uint (buf+1);
+          hdrlen = 3;
+          break;
+        case 2:
+          if (buflen < 5)
+            return gpg_error (GPG_ERR_INV_PACKET);
+          bodylen = buf32_to_size_t (buf+1);
+          hdrlen = 5;
+          break;
+        default:
+          return gpg_error (GPG_ERR_NOT_SUPPORTED);  /* Indeterminate.  */
+        }
+    }
+
+  if (bodylen > buflen - hdrlen)
+    return gpg_error (GPG_ERR_INV_PACKET);
+
+  *r_hdrlen = hdrlen;
+  *r_bodylen = bodylen;
+  return 0;
+}
+
+
+/* Find the next signature subpacket of type REQTYPE in the subpacket
+ * AREA of AREALEN bytes.  *R_OFF is the offset where the scan starts
+ * and is updated to continue a scan.  Returns 1 and stores the
+ * subpacket data at R_DATA and its length at R_DATALEN if found, 0 if
+ * not found and -1 if the area is malformed.  */
+static int
+find_image_subpkt (const byte *area, size_t arealen, int reqtype,
+                   size_t *r_off, const byte **r_data, size_t *r_datalen)
+{
+  size_t off = *r_off;
+  size_t n;
+
+  while (off < arealen)
+    {
+      n = area[off++];
+      if (n == 255)
+        {
+          if (arealen - off < 4)
+            return -1;
+          n = buf32_to_size_t (area+off);
+          off += 4;
+        }
+      else if (n >= 192)
+        {
+          if (arealen - off < 1)
+            return -1;
+          n = ((n - 192) << 8) + area[off] + 192;
+          off++;
+        }
+      if (!n || n > arealen - off)
+        return -1;
+      if ((area[off] & 0x7f) == reqtype)
+        {
+          *r_data = area + off + 1;
+          *r_datalen = n - 1;
+          *r_off = off + n;
+          return 1;
+        }
+      off += n;
+    }
+
+  *r_off = off;
+  return 0;
+}
+
+
+/* Decide whether the signature packet body SIG of SIGLEN bytes taken
+ * from a keyblock image shall be exported.  This mirrors the checks
+ * done by do_export_one_keyblock.  Returns 1 to export the signature,
+ * 0 to skip it, and -1 if the signature can't be handled here and
+ * the keyblock needs to be parsed.  */
+static int
+image_sig_exportable_p (const byte *sig, size_t siglen, unsigned int options)
+{
+  const byte *hashed, *unhashed, *data;
+  size_t hashedlen, unhashedlen, datalen, off;
+  int sigclass, rc;
+
+  if (siglen < 1)
+    return -1;
+  if (sig[0] == 2 || sig[0] == 3)
+    return 1;  /* No subpackets - always exportable.  */
+  if (sig[0] != 4 && sig[0] != 5)
+    return -1;
+
+  if (siglen < 6)
+    return -1;
+  sigclass = sig[1];
+  hashedlen = buf16_to_uint (sig+4);
+  if (siglen - 6 < hashedlen + 2)
+    return -1;
+  hashed = sig + 6;
+  unhashedlen = buf16_to_uint (hashed + hashedlen);
+  if (siglen - 6 - hashedlen - 2 < unhashedlen)
+    return -1;
+  unhashed = hashed + hashedlen + 2;
+
+  if (!(options & EXPORT_LOCAL_SIGS))
+    {
+      /* The exportable flag is taken from the first such subpacket
+       * in the hashed area or, if there is none, from the unhashed
+       * area.  */
+      off = 0;
+      rc = find_image_subpkt (hashed, hashedlen, SIGSUBPKT_EXPORTABLE,
+                              &off, &data, &datalen);
+      if (!rc)
+        {
+          off = 0;
+          rc = find_image_subpkt (unhashed, unhashedlen, SIGSUBPKT_EXPORTABLE,
+                                  &off, &data, &datalen);
+        }
+      if (rc < 0 || (rc && !datalen))
+        return -1;
+      if (rc && !*data)
+        return 0;  /* Not exportable.  */
+    }
+
+  if (!(options & EXPORT_SENSITIVE_REVKEYS) && sigclass == 0x1F)
+    {
+      off = 0;
+      while ((rc = find_image_subpkt (hashed, hashedlen, SIGSUBPKT_REV_KEY,
+                                      &off, &data, &datalen)) > 0)
+        {
+          if (datalen < 22)
+            return -1;
+          if ((datalen == 22 || datalen == 34)
+              && (data[0] & 0x80) && (data[0] & 0x40))
+            return 0;  /* Sensitive revocation key.  */
+        }
+      if (rc < 0)
+        return -1;
+    }
+
+  return 1;
+}
+
+
+/* Print an "EXPORTED" status line for the primary key packet body PK
+ * of PKLEN bytes as found in a keyblock image.  */
+static void
+print_status_exported_image (const byte *pk, size_t pklen)
+{
+  gcry_md_hd_t md;
+  byte hdr[5];
+  char hexfpr[2*MAX_FINGERPRINT_LEN+1];
+  int algo;
+
+  if (!is_status_enabled ())
+    return;
+
+  if (pk[0] == 5)
+    {
+      algo = GCRY_MD_SHA256;
+      hdr[0] = 0x9a;
+      hdr[1] = pklen >> 24;
+      hdr[2] = pklen >> 16;
+      hdr[3] = pklen >> 8;
+      hdr[4] = pklen;
+    }
+  else
+    {
+      algo = GCRY_MD_SHA1;
+      hdr[0] = 0x99;
+      hdr[1] = pklen >> 8;
+      hdr[2] = pklen;
+    }
+
+  if (gcry_md_open (&md, algo, 0))
+    BUG ();
+  gcry_md_write (md, hdr, algo == GCRY_MD_SHA256? 5 : 3);
+  gcry_md_write (md, pk, pklen);
+  gcry_md_final (md);
+  bin2hex (gcry_md_read (md, algo), gcry_md_get_algo_dlen (algo), hexfpr);
+  gcry_md_close (md);
+  write_status_text (STATUS_EXPORTED, hexfpr);
+}
+
+
+/* Export the keyblock IMAGE of IMAGELEN bytes as stored in the
+ * keybox to OUT without parsing it into a kbnode tree.  Only the
+ * filtering which can be decided from the packet headers and the
+ * signature subpackets is done here; thus the caller must make sure
+ * that OPTIONS do not require a full parse.  If the image contains
+ * anything this function does not handle, GPG_ERR_NOT_SUPPORTED is
+ * returned and nothing has been written to OUT; the caller should
+ * then fall back to the regular code path.  */
+static gpg_error_t
+export_keyblock_image (const byte *image, size_t imagelen, iobuf_t out,
+                       unsigned int options, export_stats_t stats, int *any)
+{
+  gpg_error_t err;
+  int pass, pkttype, keep, skip_sigs, rc;
+  size_t off, hdrlen, bodylen;
+  const byte *primary = NULL;
+  size_t primarylen = 0;
+
+  /* In the first pass we only check that we can handle all packets;
+   * the second pass writes them.  */
+  for (pass = 0; pass < 2; pass++)
+    {
+      skip_sigs = 0;
+      for (off = 0; off < imagelen; off += hdrlen + bodylen)
+        {
+          err = parse_image_header (image + off, imagelen - off,
+                                    &pkttype, &hdrlen, &bodylen);
+          if (err)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+          if (!off && pkttype != PKT_PUBLIC_KEY)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+          switch (pkttype)
+            {
+            case PKT_PUBLIC_KEY:
+              if (off)
+                return gpg_error (GPG_ERR_NOT_SUPPORTED);
+              /* v3 keys use a different fingerprint algorithm; let
+               * the regular code handle them.  */
+              if (!bodylen || (image[off+hdrlen] != 4
+                               && image[off+hdrlen] != 5)
+                  || (image[off+hdrlen] == 4 && bodylen > 0xffff))
+                return gpg_error (GPG_ERR_NOT_SUPPORTED);
+              primary = image + off + hdrlen;
+              primarylen = bodylen;
+              keep = 1;
+              skip_sigs = 0;
+              break;
+
+            case PKT_PUBLIC_SUBKEY:
+              keep = 1;
+              skip_sigs = 0;
+              break;
+
+            case PKT_USER_ID:
+              keep = !(options & EXPORT_DROP_UIDS);
+              skip_sigs = !keep;
+              break;
+
+            case PKT_ATTRIBUTE:
+              keep = (!(options & EXPORT_DROP_UIDS)
+                      && (options & EXPORT_ATTRIBUTES));
+              skip_sigs = !keep;
+              break;
+
+            case PKT_SIGNATURE:
+              if (skip_sigs)
+                keep = 0;
+              else
+                {
+                  rc = image_sig_exportable_p (image + off + hdrlen,
+                                               bodylen, options);
+                  if (rc < 0)
+                    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+                  keep = rc;
+                }
+              break;
+
+            case PKT_RING_TRUST:
+            case PKT_COMMENT:
+              keep = 0;
+              break;
+
+            default:
+              return gpg_error (GPG_ERR_NOT_SUPPORTED);
+            }
+
+          if (pass && keep)
+            {
+              err = iobuf_write (out, image + off, hdrlen + bodylen);
+              if (err)
+                {
+                  log_error ("error writing keyblock: %s\n",
+                             gpg_strerror (err));
+                  return err;
+                }
+            }
+        }
+      if (!primary)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  stats->count++;
+  stats->exported++;
+  print_status_exported_image (primary, primarylen);
+  *any = 1;
+  return 0;
+}
+
+
 /* Export the keys identified by the list of strings in USERS to the
    stream OUT.  If SECRET is false public keys will be exported.  With
    secret true secret keys will be exported; in this case 1 means the
@@ -1922,6 +2271,7 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
   gcry_cipher_hd_t cipherhd = NULL;
   struct export_stats_s dummystats;
   iobuf_t out_help = NULL;
+  int use_image;
 
   if (!stats)
     stats = &dummystats;
@@ -2008,6 +2358,14 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
       kek = NULL;
     }
 
+  /* If no option requires a parsed keyblock we can copy the packets
+   * straight from the stored keyblock image.  This avoids building
+   * and serializing a kbnode tree for each key and speeds up the
+   * export of large keyrings considerably.  */
+  use_image = (!secret && !keyblock_out && !out_help
+               && !(options & (EXPORT_CLEAN | EXPORT_MINIMAL | EXPORT_BACKUP))
+               && !export_keep_uid && !export_drop_subkey);
+
   for (;;)
     {
       u32 keyid[2];
@@ -2019,6 +2377,22 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
       if (err)
         break;
 
+      if (use_image && !desc[descindex].exact)
+        {
+          const void *image;
+          size_t imagelen;
+
+          err = keydb_get_keyblock_image (kdbhd, &image, &imagelen);
+          if (!err)
+            err = export_keyblock_image (image, imagelen, out,
+                                         options, stats, any);
+          if (!err)
+            continue;
+          if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+            goto leave;
+          err = 0;  /* Fall back to the parsed keyblock.  */
+        }
+
       /* Read the keyblock. */
       release_kbnode (keyblock);
       keyblock = NULL;
@@ -326,6 +326,7 @@ enum cmd_and_opt_values
     oExportOptions,
     oExportFilter,
     oListOptions,
+    oColonFields,
     oVerifyOptions,
     oTempDir,
     oExecPath,
@@ -784,6 +785,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_header ("Keylist", N_("Options controlling key listings")),
 
   ARGPARSE_s_s (oListOptions,   "list-options", "@"),
+  ARGPARSE_s_s (oColonFields,   "colon-fields", "@"),
   ARGPARSE_s_n (oFullTimestrings, "full-timestrings", "@"),
   ARGPARSE_s_n (oShowPhotos,   "show-photos", "@"),
   ARGPARSE_s_n (oNoShowPhotos, "no-show-photos", "@"),
@@ -2070,6 +2072,32 @@ parse_list_options(char *str)
 }
 
 
+/* Parse the argument of --colon-fields.  STR lists the optional
+ * fields of the colon key listing which shall be computed or, when
+ * prefixed with "no-", be left empty.  Fields not listed keep their
+ * current setting.  Returns true on success.  */
+static int
+parse_colon_fields (char *str)
+{
+  struct parse_options cfopts[]=
+    {
+      {"all", COLON_FIELD_ALL, NULL,
+       N_("compute all optional fields")},
+      {"validity", COLON_FIELD_VALIDITY, NULL,
+       N_("compute the validity of keys and user IDs")},
+      {"ownertrust", COLON_FIELD_OWNERTRUST, NULL,
+       N_("show the owner trust of keys")},
+      {"usage", COLON_FIELD_USAGE, NULL,
+       N_("show the key capabilities")},
+      {"compliance", COLON_FIELD_COMPLIANCE, NULL,
+       N_("show the compliance flags of keys")},
+      {NULL,0,NULL,NULL}
+    };
+
+  return parse_options (str, &opt.colon_fields, cfopts, 1);
+}
+
+
 /* Collapses argc/argv into a single string that must be freed */
 static char *
 collapse_args(int argc,char *argv[])
@@ -2401,6 +2429,7 @@ main (int argc, char **argv)
                           | VERIFY_SHOW_KEYSERVER_URLS);
     opt.list_options   = (LIST_SHOW_UID_VALIDITY
                           | LIST_SHOW_USAGE);
+    opt.colon_fields   = COLON_FIELD_ALL;
 #ifdef NO_TRUST_MODELS
     opt.trust_model = TM_ALWAYS;
 #else
@@ -3295,6 +3324,16 @@ main (int argc, char **argv)
 		  log_error(_("invalid list options\n"));
 	      }
 	    break;
+	  case oColonFields:
+	    if (!parse_colon_fields (pargs.r.ret_str))
+	      {
+		if (configname)
+		  log_error (_("%s:%d: invalid colon fields\n"),
+                             configname, pargs.lineno);
+		else
+		  log_error (_("invalid colon fields\n"));
+	      }
+	    break;
 	  case oVerifyOptions:
 	    {
 	      struct parse_options vopts[]=
@@ -5221,6 +5260,7 @@ g10_exit( int rc )
   if ( (opt.debug & DBG_MEMSTAT_VALUE) )
     {
       keydb_dump_stats ();
+      kbnode_dump_stats ();
       sig_check_dump_stats ();
       objcache_dump_stats ();
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
@@ -931,8 +931,7 @@ read_block( IOBUF a, unsigned int options,
   else
     in_cert = 0;
 
-  pkt = xmalloc (sizeof *pkt);
-  init_packet (pkt);
+  pkt = alloc_kbnode_packet ();
   init_parse_packet (&parsectx, a);
   if (!(options & IMPORT_RESTORE))
     parsectx.skip_meta = 1;
@@ -1094,11 +1093,13 @@ read_block( IOBUF a, unsigned int options,
                   lastnode->next = new_kbnode (pkt);
                   lastnode = lastnode->next;
                 }
-              pkt = xmalloc (sizeof *pkt);
+              pkt = alloc_kbnode_packet ();
             }
           else
-            free_packet (pkt, &parsectx);
-          init_packet(pkt);
+            {
+              free_packet (pkt, &parsectx);
+              init_packet (pkt);
+            }
           break;
         }
     }
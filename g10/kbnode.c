@@ -31,40 +31,92 @@
 
 #define USE_UNUSED_NODES 1
 
+/* Number of nodes allocated at once.  */
+#define NODE_BLOCK_SIZE 64
+
+/* Maximum number of packet structures kept for reuse.  */
+#define MAX_UNUSED_PACKETS 256
+
+/* Nodes are allocated in blocks of NODE_BLOCK_SIZE which are only
+ * released at process termination.  */
+struct node_block_s
+{
+  struct node_block_s *next;
+  struct kbnode_struct nodes[NODE_BLOCK_SIZE];
+};
+
 static int cleanup_registered;
 static KBNODE unused_nodes;
+static struct node_block_s *node_blocks;
+static PACKET *unused_packets[MAX_UNUSED_PACKETS];
+static int n_unused_packets;
+
+/* Some statistics.  */
+static struct
+{
+  unsigned int node_blocks;     /* Number of allocated node blocks.  */
+  unsigned int nodes;           /* Number of alloc_node calls.       */
+  unsigned int packets;         /* Number of allocated packets.      */
+  unsigned int packets_reused;  /* Number of reused packets.         */
+} kbnode_stats;
+
 
 static void
 release_unused_nodes (void)
 {
 #if USE_UNUSED_NODES
-  while (unused_nodes)
+  while (node_blocks)
     {
-      kbnode_t next = unused_nodes->next;
-      xfree (unused_nodes);
-      unused_nodes = next;
+      struct node_block_s *next = node_blocks->next;
+      xfree (node_blocks);
+      node_blocks = next;
     }
+  unused_nodes = NULL;
+  while (n_unused_packets)
+    xfree (unused_packets[--n_unused_packets]);
 #endif /*USE_UNUSED_NODES*/
 }
 
 
+static void
+register_cleanup (void)
+{
+  if (!cleanup_registered)
+    {
+      cleanup_registered = 1;
+      register_mem_cleanup_func (release_unused_nodes);
+    }
+}
+
+
 static kbnode_t
 alloc_node (void)
 {
   kbnode_t n;
 
-  n = unused_nodes;
-  if (n)
-    unused_nodes = n->next;
-  else
+#if USE_UNUSED_NODES
+  if (!unused_nodes)
     {
-      if (!cleanup_registered)
+      struct node_block_s *blk;
+      int i;
+
+      register_cleanup ();
+      blk = xmalloc (sizeof *blk);
+      blk->next = node_blocks;
+      node_blocks = blk;
+      for (i = NODE_BLOCK_SIZE - 1; i >= 0; i--)
         {
-          cleanup_registered = 1;
-          register_mem_cleanup_func (release_unused_nodes);
+          blk->nodes[i].next = unused_nodes;
+          unused_nodes = blk->nodes + i;
         }
-      n = xmalloc (sizeof *n);
+      kbnode_stats.node_blocks++;
     }
+  n = unused_nodes;
+  unused_nodes = n->next;
+#else
+  n = xmalloc (sizeof *n);
+#endif
+  kbnode_stats.nodes++;
   n->next = NULL;
   n->pkt = NULL;
   n->flag = 0;
@@ -88,6 +140,78 @@ free_node( KBNODE n )
 }
 
 
+/* Release the packet PKT of a node and its content.  */
+static void
+free_node_packet (PACKET *pkt)
+{
+  if (!pkt)
+    return;
+  free_packet (pkt, NULL);
+#if USE_UNUSED_NODES
+  if (n_unused_packets < MAX_UNUSED_PACKETS)
+    {
+      register_cleanup ();
+      unused_packets[n_unused_packets++] = pkt;
+      return;
+    }
+#endif
+  xfree (pkt);
+}
+
+
+/* Return a new and initialized packet to be used with new_kbnode.
+ * The packet is taken from a pool of packets released by
+ * release_kbnode so that reading many keyblocks does not need to
+ * allocate a packet structure for each node.  The packet may also be
+ * released using free_packet and xfree.  Returns NULL and sets ERRNO
+ * if the memory is exhausted.  */
+PACKET *
+alloc_kbnode_packet_try (void)
+{
+  PACKET *pkt;
+
+  if (n_unused_packets)
+    {
+      pkt = unused_packets[--n_unused_packets];
+      kbnode_stats.packets_reused++;
+    }
+  else
+    {
+      pkt = xtrymalloc (sizeof *pkt);
+      if (!pkt)
+        return NULL;
+      kbnode_stats.packets++;
+    }
+  init_packet (pkt);
+  return pkt;
+}
+
+
+/* Same as alloc_kbnode_packet_try but terminates the process if the
+ * memory is exhausted.  */
+PACKET *
+alloc_kbnode_packet (void)
+{
+  PACKET *pkt;
+
+  pkt = alloc_kbnode_packet_try ();
+  if (!pkt)
+    xoutofcore ();
+  return pkt;
+}
+
+
+void
+kbnode_dump_stats (void)
+{
+  log_info ("kbnode: nodes=%u blocks=%u packets=%u reused=%u\n",
+            kbnode_stats.nodes,
+            kbnode_stats.node_blocks,
+            kbnode_stats.packets,
+            kbnode_stats.packets_reused);
+}
+
+
 
 KBNODE
 new_kbnode( PACKET *pkt )
@@ -116,10 +240,8 @@ release_kbnode( KBNODE n )
 
     while( n ) {
 	n2 = n->next;
-	if( !is_cloned_kbnode(n) ) {
-            free_packet (n->pkt, NULL);
-            xfree( n->pkt );
-	}
+	if( !is_cloned_kbnode(n) )
+            free_node_packet (n->pkt);
 	free_node( n );
 	n = n2;
     }
@@ -287,10 +409,8 @@ commit_kbnode( KBNODE *root )
 		*root = nl = n->next;
 	    else
 		nl->next = n->next;
-	    if( !is_cloned_kbnode(n) ) {
-                free_packet (n->pkt, NULL);
-		xfree( n->pkt );
-	    }
+	    if( !is_cloned_kbnode(n) )
+                free_node_packet (n->pkt);
 	    free_node( n );
 	    changed = 1;
 	}
@@ -311,10 +431,8 @@ remove_kbnode( KBNODE *root, KBNODE node )
 		*root = nl = n->next;
 	    else
 		nl->next = n->next;
-	    if( !is_cloned_kbnode(n) ) {
-                free_packet (n->pkt, NULL);
-		xfree( n->pkt );
-	    }
+	    if( !is_cloned_kbnode(n) )
+                free_node_packet (n->pkt);
 	    free_node( n );
 	}
 	else
@@ -148,6 +148,10 @@ struct keydb_handle_s
   /* Copy of ALL_RESOURCES when keydb_new is called.  */
   struct resource_item active[MAX_KEYDB_RESOURCES];
 
+  /* The generation of the key id filter for which this handle has
+     last checked that the resources did not change.  */
+  unsigned int kid_filter_generation;
+
   /* END !USE_KEYBOXD */
 };
 
@@ -162,6 +166,9 @@ void internal_keydb_deinit (KEYDB_HANDLE hd);
 gpg_error_t internal_keydb_lock (KEYDB_HANDLE hd);
 
 gpg_error_t internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb);
+gpg_error_t internal_keydb_get_keyblock_image (KEYDB_HANDLE hd,
+                                               const void **r_image,
+                                               size_t *r_imagelen);
 gpg_error_t internal_keydb_update_keyblock (ctrl_t ctrl,
                                             KEYDB_HANDLE hd, kbnode_t kb);
 gpg_error_t internal_keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb);
@@ -36,6 +36,7 @@
 #include "../kbx/keybox.h"
 #include "keydb.h"
 #include "../common/i18n.h"
+#include "../common/host2net.h"
 
 #include "keydb-private.h"  /* For struct keydb_handle_s */
 
@@ -89,6 +90,7 @@ struct
   unsigned int locks;   /* Number of locks taken.  */
   unsigned int parse_keyblocks; /* Number of parse_keyblock_image calls.  */
   unsigned int get_keyblocks;   /* Number of keydb_get_keyblock calls.    */
+  unsigned int get_keyblock_images; /* Number of raw image requests.      */
   unsigned int build_keyblocks; /* Number of build_keyblock_image calls.  */
   unsigned int update_keyblocks;/* Number of update_keyblock calls.       */
   unsigned int insert_keyblocks;/* Number of update_keyblock calls.       */
@@ -189,6 +191,628 @@ kid_not_found_flush (void)
 }
 
 
+/* To also answer "key not found" across invocations of gpg without a
+   scan of the key database, a Bloom filter over the key ids of all
+   primary keys and subkeys is stored in the file RESNAME.kidf, where
+   RESNAME is the first registered resource.  If several resources
+   are registered, a hash over their names is appended to RESNAME so
+   that each set of resources has its own filter.  A key id which is
+   not in the filter is definitely not in the database.
+
+   The filter is bound to a stamp, which is a hash over the names,
+   inodes, sizes and modification times of all resources.  It is only
+   used while that stamp matches; if the resources have been modified
+   by other means the filter is rebuilt on its first use in a process.
+   To avoid computing the stamp for each lookup, a keydb handle checks
+   it only once per generation of the filter.  Thus, like the
+   KID_NOT_FOUND_CACHE, a handle does not notice modifications by
+   other processes made after its first lookup.
+   We update the filter and its stamp when we insert or update a
+   keyblock.  Key ids of deleted keys are not removed from the filter;
+   that merely increases the false positive rate.  The in-memory
+   filter is written back to disk by an atexit handler.  */
+
+#define KID_FILTER_MAGIC "GPGkidf1"
+#define KID_FILTER_HDRLEN (8 + 20 + 4 + 4)
+#define KID_FILTER_NHASHES 7
+#define KID_FILTER_BITS_PER_KEY 16
+#define KID_FILTER_MIN_BITS (1 << 16)
+#define KID_FILTER_MAX_BITS (1 << 30)
+
+static struct
+{
+  int disabled;        /* The filter shall not be used.  */
+  int state;           /* 0 = not yet loaded, 1 = valid, -1 = unusable.  */
+  int dirty;           /* The filter needs to be written back.  */
+  char *fname;         /* NULL or the name of the filter file.  */
+  unsigned char stamp[20]; /* The stamp of the resources.  */
+  u32 nbits;           /* The size of the bit array (a power of 2).  */
+  u32 nkids;           /* The number of added key ids.  */
+  unsigned char *bits; /* The bit array.  */
+  unsigned int generation; /* Bumped whenever the stamp is (re)set.  */
+  char *resnames[MAX_KEYDB_RESOURCES]; /* Names of ALL_RESOURCES.  */
+} kid_filter;
+
+struct
+{
+  unsigned int notfound;  /* Number of lookups answered by the filter.  */
+  unsigned int maybe;     /* Number of lookups passed on to the DB.  */
+  unsigned int rebuilds;  /* Number of rebuilds.  */
+} kid_filter_stats;
+
+
+/* Compute the stamp of all registered resources and store it at
+   STAMP, which must provide space for 20 bytes.  */
+static gpg_error_t
+kid_filter_compute_stamp (unsigned char *stamp)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  struct stat sb;
+  char buf[100];
+  int i;
+
+  err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (err)
+    return err;
+  for (i=0; i < used_resources; i++)
+    {
+      if (!kid_filter.resnames[i] || stat (kid_filter.resnames[i], &sb))
+        {
+          err = gpg_error_from_syserror ();
+          gcry_md_close (md);
+          return err;
+        }
+      gcry_md_write (md, kid_filter.resnames[i],
+                     strlen (kid_filter.resnames[i]) + 1);
+      snprintf (buf, sizeof buf, "%lu:%llu:%llu.%09lu:",
+                (unsigned long)sb.st_ino,
+                (unsigned long long)sb.st_size,
+                (unsigned long long)sb.st_mtime,
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+                (unsigned long)sb.st_mtim.tv_nsec
+#else
+                0UL
+#endif
+                );
+      gcry_md_write (md, buf, strlen (buf));
+    }
+  memcpy (stamp, gcry_md_read (md, 0), 20);
+  gcry_md_close (md);
+  return 0;
+}
+
+
+/* Return true if STAMP matches the current state of the resources.  */
+static int
+kid_filter_stamp_matches_p (const unsigned char *stamp)
+{
+  unsigned char curstamp[20];
+
+  return (!kid_filter_compute_stamp (curstamp)
+          && !memcmp (curstamp, stamp, 20));
+}
+
+
+/* Return true if the filter is valid and its stamp matches the
+   current state of the resources.  */
+static int
+kid_filter_current_p (void)
+{
+  return kid_filter.state == 1 && kid_filter_stamp_matches_p (kid_filter.stamp);
+}
+
+
+/* Mark the in-memory filter as unusable for the rest of the process
+   lifetime.  */
+static void
+kid_filter_invalidate (void)
+{
+  if (kid_filter.state == 1 && DBG_CACHE)
+    log_debug ("keydb: kid_filter invalidated\n");
+  kid_filter.state = -1;
+  kid_filter.dirty = 0;
+  kid_filter.generation++;
+  xfree (kid_filter.bits);
+  kid_filter.bits = NULL;
+}
+
+
+static void
+kid_filter_add (u32 *kid)
+{
+  u32 h1 = kid[1];
+  u32 h2 = kid[0] | 1;
+  int i;
+
+  for (i=0; i < KID_FILTER_NHASHES; i++, h1 += h2)
+    kid_filter.bits[(h1 & (kid_filter.nbits - 1)) / 8]
+      |= 1 << (h1 & 7);
+  kid_filter.nkids++;
+}
+
+
+/* Return true if KID may be in the filter.  */
+static int
+kid_filter_test (u32 *kid)
+{
+  u32 h1 = kid[1];
+  u32 h2 = kid[0] | 1;
+  int i;
+
+  for (i=0; i < KID_FILTER_NHASHES; i++, h1 += h2)
+    if (!(kid_filter.bits[(h1 & (kid_filter.nbits - 1)) / 8]
+          & (1 << (h1 & 7))))
+      return 0;
+  return 1;
+}
+
+
+/* Write the filter to its file.  */
+static void
+kid_filter_save (void)
+{
+  gpg_error_t err;
+  char *tmpfname;
+  estream_t fp;
+  unsigned char hdr[KID_FILTER_HDRLEN];
+  int block = 0;
+
+  if (kid_filter.state != 1 || !kid_filter.dirty)
+    return;
+  kid_filter.dirty = 0;
+
+  memcpy (hdr, KID_FILTER_MAGIC, 8);
+  memcpy (hdr+8, kid_filter.stamp, 20);
+  ulongtobuf (hdr+28, kid_filter.nbits);
+  ulongtobuf (hdr+32, kid_filter.nkids);
+
+  tmpfname = xstrconcat (kid_filter.fname, EXTSEP_S "tmp", NULL);
+  fp = es_fopen (tmpfname, "wb,mode=-rw");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_fwrite (hdr, sizeof hdr, 1, fp) != 1
+      || es_fwrite (kid_filter.bits, kid_filter.nbits / 8, 1, fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  err = gnupg_rename_file (tmpfname, kid_filter.fname, &block);
+  if (block)
+    gnupg_unblock_all_signals ();
+  if (err)
+    gnupg_remove (tmpfname);
+
+ leave:
+  if (err && opt.verbose)
+    log_info ("error writing '%s': %s\n", kid_filter.fname, gpg_strerror (err));
+  xfree (tmpfname);
+}
+
+
+/* The atexit handler.  */
+static void
+kid_filter_cleanup (void)
+{
+  kid_filter_save ();
+}
+
+
+/* Try to load the filter from its file.  Returns true on success.  */
+static int
+kid_filter_load (void)
+{
+  estream_t fp;
+  unsigned char hdr[KID_FILTER_HDRLEN];
+  u32 nbits;
+
+  fp = es_fopen (kid_filter.fname, "rb");
+  if (!fp)
+    return 0;
+  if (es_fread (hdr, sizeof hdr, 1, fp) != 1
+      || memcmp (hdr, KID_FILTER_MAGIC, 8))
+    goto leave;
+  nbits = buf32_to_u32 (hdr+28);
+  if (nbits < KID_FILTER_MIN_BITS || nbits > KID_FILTER_MAX_BITS
+      || (nbits & (nbits - 1)))
+    goto leave;
+  if (!kid_filter_stamp_matches_p (hdr+8))
+    goto leave;
+
+  kid_filter.bits = xtrymalloc (nbits / 8);
+  if (!kid_filter.bits)
+    goto leave;
+  if (es_fread (kid_filter.bits, nbits / 8, 1, fp) != 1)
+    {
+      xfree (kid_filter.bits);
+      kid_filter.bits = NULL;
+      goto leave;
+    }
+  memcpy (kid_filter.stamp, hdr+8, 20);
+  kid_filter.nbits = nbits;
+  kid_filter.nkids = buf32_to_u32 (hdr+32);
+  kid_filter.generation++;
+
+ leave:
+  es_fclose (fp);
+  return !!kid_filter.bits;
+}
+
+
+
+
+/* Append the key ids of the current keyblock of the keyring handle
+   KR to the array at (R_KIDS,R_NKIDS,R_SIZE).  */
+static gpg_error_t
+kid_filter_collect_keyring (KEYRING_HANDLE kr,
+                            u32 **r_kids, size_t *r_nkids, size_t *r_size)
+{
+  gpg_error_t err;
+  kbnode_t keyblock, node;
+
+  err = keyring_get_keyblock (kr, &keyblock);
+  if (err)
+    return err;
+  for (node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+      if (*r_nkids == *r_size)
+        {
+          u32 *tmp;
+
+          *r_size += 4096;
+          tmp = xtryrealloc (*r_kids, *r_size * 2 * sizeof **r_kids);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+          *r_kids = tmp;
+        }
+      keyid_from_pk (node->pkt->pkt.public_key, *r_kids + 2 * *r_nkids);
+      (*r_nkids)++;
+    }
+  release_kbnode (keyblock);
+  return err;
+}
+
+
+/* Same as kid_filter_collect_keyring but for the keybox handle KB.  */
+static gpg_error_t
+kid_filter_collect_keybox (KEYBOX_HANDLE kb,
+                           u32 **r_kids, size_t *r_nkids, size_t *r_size)
+{
+  gpg_error_t err;
+  u32 *kids;
+  size_t nkids;
+
+  err = keybox_get_keyids (kb, &kids, &nkids);
+  if (err)
+    return err;
+  if (*r_nkids + nkids > *r_size)
+    {
+      u32 *tmp;
+
+      *r_size += nkids + 4096;
+      tmp = xtryrealloc (*r_kids, *r_size * 2 * sizeof **r_kids);
+      if (!tmp)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (kids);
+          return err;
+        }
+      *r_kids = tmp;
+    }
+  memcpy (*r_kids + 2 * *r_nkids, kids, nkids * 2 * sizeof *kids);
+  *r_nkids += nkids;
+  xfree (kids);
+  return 0;
+}
+
+
+/* Rebuild the filter by walking over all resources.  */
+static gpg_error_t
+kid_filter_rebuild (void)
+{
+  gpg_error_t err = 0;
+  unsigned char stamp[20];
+  KEYDB_SEARCH_DESC desc;
+  unsigned long skipped = 0;
+  u32 *kids = NULL;
+  size_t nkids = 0;
+  size_t size = 0;
+  size_t n;
+  u32 nbits;
+  int i;
+
+  if (DBG_CACHE)
+    log_debug ("keydb: kid_filter_rebuild\n");
+
+  err = kid_filter_compute_stamp (stamp);
+  if (err)
+    return err;
+
+  memset (&desc, 0, sizeof desc);
+  for (i=0; !err && i < used_resources; i++)
+    {
+      desc.mode = KEYDB_SEARCH_MODE_FIRST;
+      switch (all_resources[i].type)
+        {
+        case KEYDB_RESOURCE_TYPE_NONE:
+          break;
+
+        case KEYDB_RESOURCE_TYPE_KEYRING:
+          {
+            KEYRING_HANDLE kr = keyring_new (all_resources[i].token);
+
+            if (!kr)
+              {
+                err = gpg_error_from_syserror ();
+                break;
+              }
+            while (!(err = keyring_search (kr, &desc, 1, NULL, 1)))
+              {
+                desc.mode = KEYDB_SEARCH_MODE_NEXT;
+                err = kid_filter_collect_keyring (kr, &kids, &nkids, &size);
+                if (err)
+                  break;
+              }
+            keyring_release (kr);
+          }
+          break;
+
+        case KEYDB_RESOURCE_TYPE_KEYBOX:
+          {
+            KEYBOX_HANDLE kb = keybox_new_openpgp (all_resources[i].token, 0);
+
+            if (!kb)
+              {
+                err = gpg_error_from_syserror ();
+                break;
+              }
+            while (!(err = keybox_search (kb, &desc, 1, KEYBOX_BLOBTYPE_PGP,
+                                          NULL, &skipped))
+                   || err == GPG_ERR_LEGACY_KEY)
+              {
+                desc.mode = KEYDB_SEARCH_MODE_NEXT;
+                if (err)
+                  continue;
+                err = kid_filter_collect_keybox (kb, &kids, &nkids, &size);
+                if (err)
+                  break;
+              }
+            keybox_release (kb);
+          }
+          break;
+        }
+      if (err == -1 || gpg_err_code (err) == GPG_ERR_EOF)
+        err = 0;
+    }
+  if (err)
+    goto leave;
+
+  /* If the resources changed while we were reading them we can't
+     trust our result.  */
+  if (!kid_filter_stamp_matches_p (stamp))
+    {
+      err = gpg_error (GPG_ERR_TRY_LATER);
+      goto leave;
+    }
+
+  for (nbits = KID_FILTER_MIN_BITS;
+       nbits < KID_FILTER_MAX_BITS && nbits < nkids * KID_FILTER_BITS_PER_KEY;
+       nbits <<= 1)
+    ;
+  xfree (kid_filter.bits);
+  kid_filter.bits = xtrycalloc (1, nbits / 8);
+  if (!kid_filter.bits)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  kid_filter.nbits = nbits;
+  kid_filter.nkids = 0;
+  for (n=0; n < nkids; n++)
+    kid_filter_add (kids + 2*n);
+  memcpy (kid_filter.stamp, stamp, 20);
+  kid_filter.dirty = 1;
+  kid_filter.generation++;
+  kid_filter_stats.rebuilds++;
+
+ leave:
+  xfree (kids);
+  return err;
+}
+
+
+/* Return the name of the filter file for the registered resources
+   or NULL on error.  */
+static const char *
+kid_filter_get_fname (void)
+{
+  gcry_md_hd_t md;
+  char hexhash[2*8+1];
+  int i;
+
+  if (kid_filter.fname || !used_resources)
+    return kid_filter.fname;
+
+  if (used_resources == 1)
+    {
+      kid_filter.fname = xstrconcat (kid_filter.resnames[0],
+                                     EXTSEP_S "kidf", NULL);
+      return kid_filter.fname;
+    }
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    return NULL;
+  for (i=0; i < used_resources; i++)
+    gcry_md_write (md, kid_filter.resnames[i],
+                   strlen (kid_filter.resnames[i]) + 1);
+  bin2hex (gcry_md_read (md, 0), 8, hexhash);
+  gcry_md_close (md);
+  kid_filter.fname = xstrconcat (kid_filter.resnames[0], "-", hexhash,
+                                 EXTSEP_S "kidf", NULL);
+  return kid_filter.fname;
+}
+
+
+/* Load or build the filter on first use.  */
+static void
+kid_filter_init (void)
+{
+  static int initialized;
+
+  if (kid_filter.state)
+    return;
+  kid_filter.state = -1;
+  if (kid_filter.disabled || !kid_filter_get_fname ())
+    return;
+
+  if (!initialized)
+    {
+      atexit (kid_filter_cleanup);
+      initialized = 1;
+    }
+
+  /* A rebuild is only worthwhile if we can store the result; we
+     assume that the filter can be written if the first resource is
+     writable.  */
+  if (kid_filter_load ())
+    kid_filter.state = 1;
+  else if (!access (kid_filter.resnames[0], W_OK) && !kid_filter_rebuild ())
+    kid_filter.state = 1;
+  else
+    kid_filter_invalidate ();
+}
+
+
+/* Record the name of the resource which is about to be registered as
+   ALL_RESOURCES[USED_RESOURCES].  */
+static void
+kid_filter_register_resource (const char *filename, int read_only)
+{
+  /* We won't be able to keep the filter up-to-date if we may not
+     write to all resources.  Further, a filter which has already been
+     used does not cover the new resource.  */
+  if (read_only || kid_filter.state)
+    {
+      kid_filter.disabled = 1;
+      kid_filter_invalidate ();
+    }
+
+  kid_filter.resnames[used_resources] = xstrdup (filename);
+
+  /* The name of the filter file depends on all resources.  */
+  xfree (kid_filter.fname);
+  kid_filter.fname = NULL;
+}
+
+
+/* Check whether the keyid KID is definitely not in the database
+   according to the filter.  Returns 1 in this case and 0 if the
+   answer is indeterminate.  HD is the handle used for the search.  */
+static int
+kid_filter_not_found_p (KEYDB_HANDLE hd, u32 *kid)
+{
+  kid_filter_init ();
+  if (kid_filter.state != 1)
+    return 0;
+
+  /* Check that nobody changed the resources behind our back.  */
+  if (hd->kid_filter_generation != kid_filter.generation)
+    {
+      if (!kid_filter_current_p ())
+        {
+          kid_filter_invalidate ();
+          return 0;
+        }
+      hd->kid_filter_generation = kid_filter.generation;
+    }
+
+  if (kid_filter_test (kid))
+    {
+      kid_filter_stats.maybe++;
+      return 0;
+    }
+
+  if (DBG_CACHE)
+    log_debug ("keydb: kid_filter_not_found_p (%08lx%08lx) => not in DB\n",
+               (ulong)kid[0], (ulong)kid[1]);
+  kid_filter_stats.notfound++;
+  return 1;
+}
+
+
+/* Prepare the filter for a modification of the resources.  Returns
+   true if the filter shall be updated after the modification.  This
+   must be called with the resources locked.  */
+static int
+kid_filter_begin_update (void)
+{
+  if (kid_filter.disabled)
+    return 0;
+  if (!kid_filter.state && kid_filter_get_fname () && kid_filter_load ())
+    kid_filter.state = 1;
+
+  if (kid_filter_current_p ())
+    return 1;
+
+  if (kid_filter.state == 1)
+    kid_filter_invalidate ();
+  return 0;
+}
+
+
+/* Finish the modification started with kid_filter_begin_update which
+   returned true.  KEYBLOCK is the new keyblock or NULL for a
+   deletion; ERR is the result of the modification.  This must be
+   called with the resources still locked.  */
+static void
+kid_filter_end_update (kbnode_t keyblock, gpg_error_t err)
+{
+  kbnode_t node;
+  u32 kid[2];
+
+  if (err || kid_filter_compute_stamp (kid_filter.stamp))
+    {
+      kid_filter_invalidate ();
+      return;
+    }
+
+  for (node = keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_PUBLIC_KEY
+        || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+      {
+        keyid_from_pk (node->pkt->pkt.public_key, kid);
+        kid_filter_add (kid);
+      }
+  kid_filter.dirty = 1;
+  kid_filter.generation++;
+
+  /* Force a rebuild by the next process if the filter gets too
+     crowded.  */
+  if (kid_filter.nkids > kid_filter.nbits / (KID_FILTER_BITS_PER_KEY / 2))
+    {
+      kid_filter_invalidate ();
+      gnupg_remove (kid_filter.fname);
+    }
+}
+
+
 static void
 keyblock_cache_clear (struct keydb_handle_s *hd)
 {
@@ -704,6 +1328,7 @@ keydb_add_resource (const char *url, unsigned int flags)
               all_resources[used_resources].type = rt;
               all_resources[used_resources].u.kr = NULL; /* Not used here */
               all_resources[used_resources].token = token;
+              kid_filter_register_resource (filename, read_only);
               used_resources++;
             }
         }
@@ -752,6 +1377,7 @@ keydb_add_resource (const char *url, unsigned int flags)
                     keybox_release (kbxhd);
                   }
 
+                kid_filter_register_resource (filename, read_only);
                 used_resources++;
               }
           }
@@ -790,11 +1416,12 @@ keydb_add_resource (const char *url, unsigned int flags)
 void
 keydb_dump_stats (void)
 {
-  log_info ("keydb: handles=%u locks=%u parse=%u get=%u\n",
+  log_info ("keydb: handles=%u locks=%u parse=%u get=%u image=%u\n",
             keydb_stats.handles,
             keydb_stats.locks,
             keydb_stats.parse_keyblocks,
-            keydb_stats.get_keyblocks);
+            keydb_stats.get_keyblocks,
+            keydb_stats.get_keyblock_images);
   log_info ("       build=%u update=%u insert=%u delete=%u\n",
             keydb_stats.build_keyblocks,
             keydb_stats.update_keyblocks,
@@ -810,6 +1437,14 @@ keydb_dump_stats (void)
             kid_not_found_stats.count,
             kid_not_found_stats.peak,
             kid_not_found_stats.flushes);
+  log_info ("kid_filter: state=%d keys=%u bits=%u not=%u maybe=%u"
+            " rebuilds=%u\n",
+            kid_filter.state,
+            kid_filter.nkids,
+            kid_filter.nbits,
+            kid_filter_stats.notfound,
+            kid_filter_stats.maybe,
+            kid_filter_stats.rebuilds);
 }
 
 
@@ -1150,10 +1785,9 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
 
   *r_keyblock = NULL;
 
-  pkt = xtrymalloc (sizeof *pkt);
+  pkt = alloc_kbnode_packet_try ();
   if (!pkt)
     return gpg_error_from_syserror ();
-  init_packet (pkt);
   init_parse_packet (&parsectx, iobuf);
   save_mode = set_packet_list_mode (0);
   in_cert = 0;
@@ -1246,13 +1880,12 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
       else
         *tail = node;
       tail = &node->next;
-      pkt = xtrymalloc (sizeof *pkt);
+      pkt = alloc_kbnode_packet_try ();
       if (!pkt)
         {
           err = gpg_error_from_syserror ();
           break;
         }
-      init_packet (pkt);
     }
   set_packet_list_mode (save_mode);
 
@@ -1359,6 +1992,43 @@ internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
 }
 
 
+/* Return the raw image of the keyblock last found by keydb_search()
+ * at R_IMAGE and its length at R_IMAGELEN.  The image is not copied
+ * and thus only valid until the next operation on HD.  Returns
+ * GPG_ERR_NOT_SUPPORTED if the resource does not store keyblocks as
+ * images; the caller should then use keydb_get_keyblock.  */
+gpg_error_t
+internal_keydb_get_keyblock_image (KEYDB_HANDLE hd,
+                                   const void **r_image, size_t *r_imagelen)
+{
+  gpg_error_t err;
+
+  log_assert (!hd->use_keyboxd);
+
+  *r_image = NULL;
+  *r_imagelen = 0;
+
+  if (hd->found < 0 || hd->found >= hd->used)
+    return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
+
+  switch (hd->active[hd->found].type)
+    {
+    case KEYDB_RESOURCE_TYPE_KEYBOX:
+      err = keybox_get_keyblock_image (hd->active[hd->found].u.kb,
+                                       r_image, r_imagelen);
+      break;
+    default:
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      break;
+    }
+
+  if (!err)
+    keydb_stats.get_keyblock_images++;
+
+  return err;
+}
+
+
 /* Update the keyblock KB (i.e., extract the fingerprint and find the
  * corresponding keyblock in the keyring).
  * keydb_update_keyblock diverts to here in the non-keyboxd mode.
@@ -1382,6 +2052,7 @@ internal_keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   PKT_public_key *pk;
   KEYDB_SEARCH_DESC desc;
   size_t len;
+  int update_filter;
 
   log_assert (!hd->use_keyboxd);
   pk = kb->pkt->pkt.public_key;
@@ -1395,6 +2066,7 @@ internal_keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   err = lock_all (hd);
   if (err)
     return err;
+  update_filter = kid_filter_begin_update ();
 
 #ifdef USE_TOFU
   tofu_notice_key_changed (ctrl, kb);
@@ -1413,7 +2085,11 @@ internal_keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   keydb_search_reset (hd);
   err = keydb_search (hd, &desc, 1, NULL);
   if (err)
-    return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
+    {
+      if (update_filter)
+        kid_filter_end_update (NULL, 0);
+      return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
+    }
   log_assert (hd->found >= 0 && hd->found < hd->used);
 
   switch (hd->active[hd->found].type)
@@ -1441,6 +2117,8 @@ internal_keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
       break;
     }
 
+  if (update_filter)
+    kid_filter_end_update (kb, err);
   unlock_all (hd);
   if (!err)
     keydb_stats.update_keyblocks++;
@@ -1464,6 +2142,7 @@ internal_keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
 {
   gpg_error_t err;
   int idx;
+  int update_filter;
 
   log_assert (!hd->use_keyboxd);
 
@@ -1483,6 +2162,7 @@ internal_keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   err = lock_all (hd);
   if (err)
     return err;
+  update_filter = kid_filter_begin_update ();
 
   switch (hd->active[idx].type)
     {
@@ -1512,6 +2192,8 @@ internal_keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
       break;
     }
 
+  if (update_filter)
+    kid_filter_end_update (kb, err);
   unlock_all (hd);
   if (!err)
     keydb_stats.insert_keyblocks++;
@@ -1528,6 +2210,7 @@ gpg_error_t
 internal_keydb_delete_keyblock (KEYDB_HANDLE hd)
 {
   gpg_error_t rc;
+  int update_filter;
 
   log_assert (!hd->use_keyboxd);
 
@@ -1543,6 +2226,7 @@ internal_keydb_delete_keyblock (KEYDB_HANDLE hd)
   rc = lock_all (hd);
   if (rc)
     return rc;
+  update_filter = kid_filter_begin_update ();
 
   switch (hd->active[hd->found].type)
     {
@@ -1557,6 +2241,8 @@ internal_keydb_delete_keyblock (KEYDB_HANDLE hd)
       break;
     }
 
+  if (update_filter)
+    kid_filter_end_update (NULL, rc);
   unlock_all (hd);
   if (!rc)
     keydb_stats.delete_keyblocks++;
@@ -1759,6 +2445,39 @@ internal_keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       return gpg_error (GPG_ERR_NOT_FOUND);
     }
 
+  /* Ask the persistent filter; for a fingerprint we use the key id
+     part of it.  */
+  if (ndesc == 1
+      && (desc[0].mode == KEYDB_SEARCH_MODE_LONG_KID
+          || (desc[0].mode == KEYDB_SEARCH_MODE_FPR
+              && (desc[0].fprlen == 20 || desc[0].fprlen == 32))))
+    {
+      u32 kid[2];
+
+      if (desc[0].mode == KEYDB_SEARCH_MODE_LONG_KID)
+        {
+          kid[0] = desc[0].u.kid[0];
+          kid[1] = desc[0].u.kid[1];
+        }
+      else if (desc[0].fprlen == 20)
+        {
+          kid[0] = buf32_to_u32 (desc[0].u.fpr + 12);
+          kid[1] = buf32_to_u32 (desc[0].u.fpr + 16);
+        }
+      else
+        {
+          kid[0] = buf32_to_u32 (desc[0].u.fpr);
+          kid[1] = buf32_to_u32 (desc[0].u.fpr + 4);
+        }
+      if (kid_filter_not_found_p (hd, kid))
+        {
+          if (DBG_CLOCK)
+            log_clock ("%s leave (not found, filter)", __func__);
+          keydb_stats.notfound_cached++;
+          return gpg_error (GPG_ERR_NOT_FOUND);
+        }
+    }
+
   /* NB: If one of the exact search modes below is used in a loop to
      walk over all keys (with the same fingerprint) the caching must
      have been disabled for the handle.  */
@@ -187,6 +187,11 @@ gpg_error_t keydb_lock (KEYDB_HANDLE hd);
 /* Return the keyblock last found by keydb_search.  */
 gpg_error_t keydb_get_keyblock (KEYDB_HANDLE hd, kbnode_t *ret_kb);
 
+/* Return the raw image of the keyblock last found by keydb_search.  */
+gpg_error_t keydb_get_keyblock_image (KEYDB_HANDLE hd,
+                                      const void **r_image,
+                                      size_t *r_imagelen);
+
 /* Update the keyblock KB.  */
 gpg_error_t keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb);
 
@@ -561,6 +566,9 @@ gpg_error_t hexkeygrip_from_pk (PKT_public_key *pk, char **r_grip);
 
 /*-- kbnode.c --*/
 KBNODE new_kbnode( PACKET *pkt );
+PACKET *alloc_kbnode_packet (void);
+PACKET *alloc_kbnode_packet_try (void);
+void kbnode_dump_stats (void);
 KBNODE clone_kbnode( KBNODE node );
 void release_kbnode( KBNODE n );
 void delete_kbnode( KBNODE node );
@@ -133,8 +133,11 @@ public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode, int no_local)
      update the keyring while we already have the keyring open.  This
      is very bad for W32 because of a sharing violation. For real OSes
      it might lead to false results if we are later listing a keyring
-     which is associated with the inode of a deleted file.  */
-  check_trustdb_stale (ctrl);
+     which is associated with the inode of a deleted file.  The check
+     is not needed if no trust related colon field has been requested. */
+  if (!opt.with_colons
+      || (opt.colon_fields & (COLON_FIELD_VALIDITY|COLON_FIELD_OWNERTRUST)))
+    check_trustdb_stale (ctrl);
 
 #ifdef USE_TOFU
   tofu_begin_batch_update (ctrl);
@@ -158,7 +161,9 @@ secret_key_list (ctrl_t ctrl, strlist_t list)
 {
   (void)ctrl;
 
-  check_trustdb_stale (ctrl);
+  if (!opt.with_colons
+      || (opt.colon_fields & (COLON_FIELD_VALIDITY|COLON_FIELD_OWNERTRUST)))
+    check_trustdb_stale (ctrl);
 
   if (!list)
     list_all (ctrl, 1, 0);
@@ -1460,7 +1465,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
     trustletter_print = 'r';
   else if (pk->has_expired)
     trustletter_print = 'e';
-  else if (opt.fast_list_mode || opt.no_expensive_trust_checks)
+  else if (opt.fast_list_mode || opt.no_expensive_trust_checks
+           || !(opt.colon_fields & COLON_FIELD_VALIDITY))
     trustletter_print = 0;
   else
     {
@@ -1470,7 +1476,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
       trustletter_print = trustletter;
     }
 
-  if (!opt.fast_list_mode && !opt.no_expensive_trust_checks)
+  if (!opt.fast_list_mode && !opt.no_expensive_trust_checks
+      && (opt.colon_fields & COLON_FIELD_OWNERTRUST))
     ownertrust_print = get_ownertrust_info (ctrl, pk, 0);
   else
     ownertrust_print = 0;
@@ -1492,7 +1499,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 
   es_putc (':', es_stdout);
   es_putc (':', es_stdout);
-  print_capabilities (ctrl, pk, keyblock);
+  if ((opt.colon_fields & COLON_FIELD_USAGE))
+    print_capabilities (ctrl, pk, keyblock);
   es_putc (':', es_stdout);		/* End of field 13. */
   es_putc (':', es_stdout);		/* End of field 14. */
   if (secret || has_secret)
@@ -1517,7 +1525,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
       es_fputs (curvename, es_stdout);
     }
   es_putc (':', es_stdout);		/* End of field 17. */
-  print_compliance_flags (pk, keylength, curvename);
+  if ((opt.colon_fields & COLON_FIELD_COMPLIANCE))
+    print_compliance_flags (pk, keylength, curvename);
   es_putc (':', es_stdout);		/* End of field 18 (compliance). */
   if (pk->keyupdate)
     es_fputs (colon_strtime (pk->keyupdate), es_stdout);
@@ -1550,7 +1559,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	    uid_validity = 'r';
 	  else if (uid->flags.expired)
 	    uid_validity = 'e';
-	  else if (opt.no_expensive_trust_checks)
+	  else if (opt.no_expensive_trust_checks
+                   || !(opt.colon_fields & COLON_FIELD_VALIDITY))
 	    uid_validity = 0;
 	  else if (ulti_hack)
             uid_validity = 'u';
@@ -1642,7 +1652,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
                       (ulong) keyid2[0], (ulong) keyid2[1],
                       colon_datestr_from_pk (pk2),
                       colon_strtime (pk2->expiredate));
-	  print_capabilities (ctrl, pk2, NULL);
+          if ((opt.colon_fields & COLON_FIELD_USAGE))
+            print_capabilities (ctrl, pk2, NULL);
           es_putc (':', es_stdout);	/* End of field 13. */
           es_putc (':', es_stdout);	/* End of field 14. */
           if (secret || has_secret)
@@ -1668,7 +1679,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
               es_fputs (curvename, es_stdout);
             }
           es_putc (':', es_stdout);	/* End of field 17. */
-          print_compliance_flags (pk2, keylength, curvename);
+          if ((opt.colon_fields & COLON_FIELD_COMPLIANCE))
+            print_compliance_flags (pk2, keylength, curvename);
           es_putc (':', es_stdout);	/* End of field 18. */
 	  es_putc ('\n', es_stdout);
           print_fingerprint (ctrl, NULL, pk2, 0);
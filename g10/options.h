@@ -171,6 +171,7 @@ struct
   unsigned int import_options;
   unsigned int export_options;
   unsigned int list_options;
+  unsigned int colon_fields;  /* COLON_FIELD_* for --with-colons.  */
   unsigned int verify_options;
   const char *def_preference_list;
   const char *def_keyserver_url;
@@ -396,6 +397,15 @@ EXTERN_UNLESS_MAIN_MODULE int memory_stat_debug_mode;
 #define LIST_SHOW_USAGE                  (1<<11)
 #define LIST_SHOW_ONLY_FPR_MBOX          (1<<12)
 
+#define COLON_FIELD_VALIDITY             (1<<0)
+#define COLON_FIELD_OWNERTRUST           (1<<1)
+#define COLON_FIELD_USAGE                (1<<2)
+#define COLON_FIELD_COMPLIANCE           (1<<3)
+#define COLON_FIELD_ALL                  (COLON_FIELD_VALIDITY   \
+                                          | COLON_FIELD_OWNERTRUST \
+                                          | COLON_FIELD_USAGE      \
+                                          | COLON_FIELD_COMPLIANCE)
+
 #define VERIFY_SHOW_PHOTOS               (1<<0)
 #define VERIFY_SHOW_POLICY_URLS          (1<<1)
 #define VERIFY_SHOW_STD_NOTATIONS        (1<<2)
@@ -0,0 +1,332 @@
+/* t-keydb-filter.c - Tests for the key id filter of the key database.
+ * Copyright (C) 2021 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The filter is loaded once per process and written back at exit.
+ * Thus each step of the test is run in a new process: this program
+ * calls itself with "--phase NAME" and checks the exit code.  */
+
+#include "test.c"
+
+#include <unistd.h>
+
+#include "../common/exechelp.h"
+#include "options.h"
+#include "keydb.h"
+
+#define PGM "t-keydb-filter"
+
+/* The directory with the keybox and its filter.  */
+static const char testdir[] = PGM ".d";
+
+/* The fingerprints of two keys in t-keydb-keyring.kbx.  */
+static const char *fingerprints[] =
+  {
+    "2689 5E25 E844 6D44 A26D  8FAF 2F79 98F3 DBFC 6AD9",
+    "8061 5870 F5BA D690 3336  86D0 F2AD 85AC 1E42 B367",
+    NULL
+  };
+
+
+/* Read the file FNAME into a malloced buffer and store its length
+ * at R_LEN.  */
+static char *
+read_file (const char *fname, size_t *r_len)
+{
+  estream_t fp;
+  char *buf = NULL;
+  size_t size = 0;
+  size_t n;
+
+  *r_len = 0;
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    return NULL;
+  do
+    {
+      size += 4096;
+      buf = xrealloc (buf, size);
+      n = es_fread (buf + *r_len, 1, size - *r_len, fp);
+      *r_len += n;
+    }
+  while (n);
+  es_fclose (fp);
+  return buf;
+}
+
+
+/* Atomically replace the file FNAME by LEN bytes from BUF.  */
+static void
+write_file (const char *fname, const void *buf, size_t len)
+{
+  char *tmpfname;
+  estream_t fp;
+  int block = 0;
+
+  tmpfname = xstrconcat (fname, EXTSEP_S "tmp", NULL);
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp || (len && es_fwrite (buf, len, 1, fp) != 1) || es_fclose (fp))
+    ABORT ("writing a test file failed");
+  if (gnupg_rename_file (tmpfname, fname, &block))
+    ABORT ("renaming a test file failed");
+  if (block)
+    gnupg_unblock_all_signals ();
+  xfree (tmpfname);
+}
+
+
+/* Search for DESC using HD and return the error code.  */
+static gpg_err_code_t
+search_one (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc)
+{
+  keydb_search_reset (hd);
+  return gpg_err_code (keydb_search (hd, desc, 1, NULL));
+}
+
+
+/* Phase "empty": The keybox does not contain any keys.  This creates
+ * a filter without any key ids.  */
+static void
+phase_empty (ctrl_t ctrl)
+{
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  int i;
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    ABORT ("");
+  for (i = 0; fingerprints[i]; i++)
+    {
+      if (classify_user_id (fingerprints[i], &desc, 0))
+        ABORT ("Failed to convert fingerprint");
+      TEST ("key not in empty keybox", search_one (hd, &desc),
+            GPG_ERR_NOT_FOUND);
+    }
+  keydb_release (hd);
+}
+
+
+/* Phase "full": All keys of the keybox must be found by key id and
+ * by fingerprint.  */
+static void
+phase_full (ctrl_t ctrl)
+{
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t keyblock, node;
+  u32 *kids = NULL;
+  size_t nkids = 0;
+  size_t i;
+  gpg_err_code_t ec;
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    ABORT ("");
+
+  /* Collect the key ids of all keys and subkeys.  A full scan does
+   * not use the filter.  */
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  while (!(ec = gpg_err_code (keydb_search (hd, &desc, 1, NULL))))
+    {
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+      if (keydb_get_keyblock (hd, &keyblock))
+        ABORT ("Failed to get keyblock");
+      for (node = keyblock; node; node = node->next)
+        if (node->pkt->pkttype == PKT_PUBLIC_KEY
+            || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+          {
+            kids = xrealloc (kids, (nkids + 1) * 2 * sizeof *kids);
+            keyid_from_pk (node->pkt->pkt.public_key, kids + 2 * nkids);
+            nkids++;
+          }
+      release_kbnode (keyblock);
+    }
+  TEST ("enumeration ends", ec, GPG_ERR_NOT_FOUND);
+  TEST_P ("keys enumerated", nkids >= 2);
+  keydb_release (hd);
+
+  /* No false negatives.  */
+  hd = keydb_new (ctrl);
+  if (!hd)
+    ABORT ("");
+  for (i = 0; fingerprints[i]; i++)
+    {
+      if (classify_user_id (fingerprints[i], &desc, 0))
+        ABORT ("Failed to convert fingerprint");
+      TEST ("key found by fingerprint", search_one (hd, &desc), 0);
+    }
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_LONG_KID;
+  for (i = 0; i < nkids; i++)
+    {
+      desc.u.kid[0] = kids[2*i];
+      desc.u.kid[1] = kids[2*i+1];
+      TEST ("key found by key id", search_one (hd, &desc), 0);
+    }
+
+  /* Unknown key ids are still not found.  */
+  for (i = 0; i < nkids; i++)
+    {
+      desc.u.kid[0] = kids[2*i] ^ 0x5a5a5a5a;
+      desc.u.kid[1] = kids[2*i+1] ^ 0xa5a5a5a5;
+      TEST ("unknown key id not found", search_one (hd, &desc),
+            GPG_ERR_NOT_FOUND);
+    }
+
+  keydb_release (hd);
+  xfree (kids);
+}
+
+
+/* Run this program with the phase PHASE and check its exit code.  */
+static void
+run_phase (const char *pgmname, const char *phase)
+{
+  const char *argv[3];
+  pid_t pid;
+  int exitcode;
+
+  argv[0] = "--phase";
+  argv[1] = phase;
+  argv[2] = NULL;
+  if (gnupg_spawn_process_fd (pgmname, argv, -1, -1, -1, &pid))
+    ABORT ("Failed to run a phase");
+  if (gnupg_wait_process (pgmname, pid, 1, &exitcode))
+    exitcode = -1;
+  gnupg_release_process (pid);
+  if (verbose)
+    printf ("phase %s: exit code %d\n", phase, exitcode);
+  TEST (phase, exitcode, 0);
+}
+
+
+/* Remove the test files.  If REMOVE_DIR is set remove the test
+ * directory instead of creating it.  */
+static void
+reset_testdir (int remove_dir)
+{
+  static const char *names[] = { "pubring.kbx", "pubring.kbx.kidf",
+                                 "pubring.kbx.lock", NULL };
+  char *fname;
+  int i;
+
+  for (i = 0; names[i]; i++)
+    {
+      fname = make_filename (testdir, names[i], NULL);
+      gnupg_remove (fname);
+      xfree (fname);
+    }
+  if (remove_dir)
+    rmdir (testdir);
+  else
+    gnupg_mkdir (testdir, "-rwx");
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  const char *pgmname = argv[0];
+  const char *phase = NULL;
+  ctrl_t ctrl;
+  char *fname, *kbxname, *filtername;
+  char *kbx, *empty_filter, *filter;
+  size_t kbxlen, empty_filterlen, filterlen;
+
+  if (argc > 2 && !strcmp (argv[1], "--phase"))
+    phase = argv[2];
+
+  kbxname = make_filename (testdir, "pubring.kbx", NULL);
+  filtername = make_filename (testdir, "pubring.kbx.kidf", NULL);
+
+  if (phase)
+    {
+      ctrl = xcalloc (1, sizeof *ctrl);
+      if (keydb_add_resource (kbxname, 0))
+        ABORT ("Failed to open keybox.");
+      if (!strcmp (phase, "empty"))
+        phase_empty (ctrl);
+      else
+        phase_full (ctrl);
+      xfree (ctrl);
+      xfree (kbxname);
+      xfree (filtername);
+      return;
+    }
+
+  fname = prepend_srcdir ("t-keydb-keyring.kbx");
+  kbx = read_file (fname, &kbxlen);
+  test_free (fname);
+  if (!kbx || kbxlen < 32)
+    ABORT ("Failed to read keybox");
+
+  /* A keybox with only the header blob creates an empty filter.  */
+  reset_testdir (0);
+  write_file (kbxname, kbx, 32);
+  run_phase (pgmname, "empty");
+  empty_filter = read_file (filtername, &empty_filterlen);
+  TEST_P ("empty filter written", empty_filter && empty_filterlen > 36);
+
+  /* Replacing the keybox by other means makes the filter stale; it
+   * must be rebuilt.  */
+  write_file (kbxname, kbx, kbxlen);
+  run_phase (pgmname, "full");
+  filter = read_file (filtername, &filterlen);
+  TEST_P ("filter rebuilt", filter && filterlen > 36
+          && (filterlen != empty_filterlen
+              || memcmp (filter, empty_filter, filterlen)));
+
+  /* A current filter loaded from disk.  */
+  run_phase (pgmname, "full");
+
+  /* A corrupt filter must be ignored.  */
+  if (filter && filterlen > 36)
+    {
+      write_file (filtername, "GPGkidfX", 8);
+      run_phase (pgmname, "full");
+
+      memcpy (filter, "XPGkidf1", 8);
+      write_file (filtername, filter, filterlen);
+      run_phase (pgmname, "full");
+
+      memcpy (filter, "GPGkidf1", 8);
+      write_file (filtername, filter, 36);
+      run_phase (pgmname, "full");
+
+      filter[28] = filter[29] = filter[30] = 0;
+      filter[31] = 3;
+      write_file (filtername, filter, filterlen);
+      run_phase (pgmname, "full");
+    }
+
+  /* A filter for another keybox must be ignored.  */
+  if (empty_filter)
+    {
+      write_file (filtername, empty_filter, empty_filterlen);
+      run_phase (pgmname, "full");
+    }
+
+  reset_testdir (1);
+  xfree (kbx);
+  xfree (empty_filter);
+  xfree (filter);
+  xfree (kbxname);
+  xfree (filtername);
+}
@@ -0,0 +1,277 @@
+/* t-tofu.c - Tests and a benchmark for the TOFU database updates.
+ * Copyright (C) 2021 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Besides the regression tests this program can be used to measure
+ * the cost of the TOFU database updates done for each verified
+ * signature:
+ *
+ *   $ ./t-tofu --bench 1000
+ *
+ * registers 1000 signatures three times: with a commit per signature
+ * (as done before automatic group commits), with the automatic group
+ * commit, and within one explicit batch update.  */
+
+#include "test.c"
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <sqlite3.h>
+
+#include "options.h"
+#include "keydb.h"
+#include "tofu.h"
+
+#define PGM "t-tofu"
+
+/* The directory used as GnuPG home directory.  */
+static const char homedir[] = PGM ".d";
+
+/* A counter to create unique signature digests.  */
+static unsigned long sig_counter;
+
+
+static double
+get_time (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/* Remove the database files and create an empty home directory.  If
+ * REMOVE_DIR is set remove the home directory instead.  */
+static void
+reset_homedir (int remove_dir)
+{
+  static const char *names[] = { "tofu.db", "tofu.db-journal",
+                                 "tofu.db-want-lock", NULL };
+  char *fname;
+  int i;
+
+  for (i = 0; names[i]; i++)
+    {
+      fname = make_filename (homedir, names[i], NULL);
+      gnupg_remove (fname);
+      xfree (fname);
+    }
+  if (remove_dir)
+    rmdir (homedir);
+  else
+    {
+      gnupg_mkdir (homedir, "-rwx");
+      gnupg_set_homedir (homedir);
+    }
+}
+
+
+/* Return the number of signatures committed to the TOFU database.
+ * A second connection is used so that only committed records are
+ * seen.  Returns -1 on error.  */
+static int
+count_committed (void)
+{
+  char *fname;
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
+  int count = -1;
+
+  fname = make_filename (homedir, "tofu.db", NULL);
+  if (sqlite3_open (fname, &db))
+    ABORT ("opening the database failed");
+  xfree (fname);
+  sqlite3_busy_timeout (db, 5 * 1000);
+  if (!sqlite3_prepare_v2 (db, "select count (*) from signatures;",
+                           -1, &stmt, NULL))
+    {
+      if (sqlite3_step (stmt) == SQLITE_ROW)
+        count = sqlite3_column_int (stmt, 0);
+      sqlite3_finalize (stmt);
+    }
+  sqlite3_close (db);
+  return count;
+}
+
+
+/* Register a new signature of PK for the user ids USER_IDS.  */
+static gpg_error_t
+register_one (ctrl_t ctrl, PKT_public_key *pk, strlist_t user_ids)
+{
+  byte digest[20];
+  int i;
+
+  memset (digest, 0, sizeof digest);
+  sig_counter++;
+  for (i = 0; i < sizeof sig_counter; i++)
+    digest[i] = sig_counter >> (8 * i);
+
+  return tofu_register_signature (ctrl, pk, user_ids, digest, sizeof digest,
+                                  gnupg_get_time () - 3600, PGM);
+}
+
+
+/* Check that grouped commits reach the database.  */
+static void
+test_group_commit (ctrl_t ctrl, PKT_public_key *pk, strlist_t user_ids)
+{
+  int n, i;
+
+  TEST_GROUP ("group commit");
+
+  /* All signatures must be committed when the database is closed.  */
+  for (i = 0; i < 10; i++)
+    TEST_P ("register signature", !register_one (ctrl, pk, user_ids));
+  tofu_closedbs (ctrl);
+  TEST ("commit on close", count_committed (), 10);
+
+  /* A pending group must be committed once its time bound passed.
+   * The bound is well below the 500ms we wait here.  */
+  TEST_P ("register signature", !register_one (ctrl, pk, user_ids));
+  gnupg_usleep (500000);
+  TEST_P ("register signature", !register_one (ctrl, pk, user_ids));
+  n = count_committed ();
+  TEST_P ("commit after time bound", n == 11 || n == 12);
+
+  /* Ending a batch update commits everything.  */
+  tofu_begin_batch_update (ctrl);
+  for (i = 0; i < 10; i++)
+    TEST_P ("register signature", !register_one (ctrl, pk, user_ids));
+  tofu_end_batch_update (ctrl);
+  TEST ("commit at end of batch", count_committed (), 22);
+
+  tofu_closedbs (ctrl);
+}
+
+
+/* Register COUNT signatures in each of the three modes and print
+ * the timings.  */
+static void
+run_benchmark (ctrl_t ctrl, PKT_public_key *pk, strlist_t user_ids,
+               unsigned long count)
+{
+  double t0, t1, t2, t3;
+  unsigned long n;
+
+  /* One commit per signature.  */
+  t0 = get_time ();
+  for (n = 0; n < count; n++)
+    {
+      tofu_begin_batch_update (ctrl);
+      if (register_one (ctrl, pk, user_ids))
+        ABORT ("registering a signature failed");
+      tofu_end_batch_update (ctrl);
+    }
+
+  /* Automatic group commit.  */
+  t1 = get_time ();
+  for (n = 0; n < count; n++)
+    if (register_one (ctrl, pk, user_ids))
+      ABORT ("registering a signature failed");
+  tofu_closedbs (ctrl);
+
+  /* Explicit batch update.  */
+  t2 = get_time ();
+  tofu_begin_batch_update (ctrl);
+  for (n = 0; n < count; n++)
+    if (register_one (ctrl, pk, user_ids))
+      ABORT ("registering a signature failed");
+  tofu_end_batch_update (ctrl);
+  t3 = get_time ();
+  tofu_closedbs (ctrl);
+
+  if (count_committed () != 3 * count)
+    ABORT ("not all signatures have been committed");
+
+  printf ("%lu signatures per mode\n", count);
+  printf ("  single commits: %8.3fs (%8.0f/s)\n",
+          t1 - t0, t1 > t0? count / (t1 - t0) : 0.0);
+  printf ("  group commits:  %8.3fs (%8.0f/s)\n",
+          t2 - t1, t2 > t1? count / (t2 - t1) : 0.0);
+  printf ("  batch update:   %8.3fs (%8.0f/s)\n",
+          t3 - t2, t3 > t2? count / (t3 - t2) : 0.0);
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  int rc;
+  ctrl_t ctrl;
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t kb, node;
+  strlist_t user_ids = NULL;
+  char *fname;
+  int last_argc = -1;
+  unsigned long bench = 0;
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--bench") && argc > 1)
+        {
+          bench = strtoul (argv[1], NULL, 10);
+          argc -= 2; argv += 2;
+        }
+    }
+
+  opt.tofu_default_policy = TOFU_POLICY_AUTO;
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+  fname = prepend_srcdir ("t-keydb-keyring.kbx");
+  rc = keydb_add_resource (fname, 0);
+  test_free (fname);
+  if (rc)
+    ABORT ("Failed to open keyring.");
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    ABORT ("");
+  rc = classify_user_id ("2689 5E25 E844 6D44 A26D  8FAF 2F79 98F3 DBFC 6AD9",
+                         &desc, 0);
+  if (rc)
+    ABORT ("Failed to convert fingerprint for DBFC6AD9");
+  rc = keydb_search (hd, &desc, 1, NULL);
+  if (rc)
+    ABORT ("Failed to lookup key associated with DBFC6AD9");
+  rc = keydb_get_keyblock (hd, &kb);
+  if (rc)
+    ABORT ("Failed to get keyblock for DBFC6AD9");
+  keydb_release (hd);
+
+  for (node = kb; node; node = node->next)
+    if (node->pkt->pkttype == PKT_USER_ID)
+      add_to_strlist (&user_ids, node->pkt->pkt.user_id->name);
+  if (!user_ids)
+    ABORT ("DBFC6AD9 has no user id packet");
+
+  reset_homedir (0);
+  if (bench)
+    run_benchmark (ctrl, kb->pkt->pkt.public_key, user_ids, bench);
+  else
+    test_group_commit (ctrl, kb->pkt->pkt.public_key, user_ids);
+  reset_homedir (1);
+
+  free_strlist (user_ids);
+  release_kbnode (kb);
+  xfree (ctrl);
+}
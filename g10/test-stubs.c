@@ -501,6 +501,23 @@ export_pubkey_buffer (ctrl_t ctrl, const char *keyspec, unsigned int options,
   return gpg_error (GPG_ERR_NOT_IMPLEMENTED);
 }
 
+#ifdef TEST_WITH_TOFU
+/* The test links tofu.c; provide what it needs from trustdb.c.  */
+int
+tdb_keyid_is_utk (u32 *kid)
+{
+  (void)kid;
+  return 0;
+}
+
+struct key_item *
+tdb_utks (void)
+{
+  return NULL;
+}
+
+#else /*!TEST_WITH_TOFU*/
+
 gpg_error_t
 tofu_write_tfs_record (ctrl_t ctrl, estream_t fp,
                        PKT_public_key *pk, const char *user_id)
@@ -552,6 +569,8 @@ tofu_notice_key_changed (ctrl_t ctrl, kbnode_t kb)
   return 0;
 }
 
+#endif /*!TEST_WITH_TOFU*/
+
 int
 get_revocation_reason (PKT_signature *sig, char **r_reason,
                        char **r_comment, size_t *r_commentlen)
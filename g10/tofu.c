@@ -55,6 +55,12 @@
  * indicate that a lot of history is available.  */
 #define FULL_TRUST_THRESHOLD  21
 
+/* The maximum number of transactions and the maximum time in
+ * milliseconds for which the commit of transactions is deferred to
+ * group them into one SQLite transaction.  */
+#define GROUP_COMMIT_MAX      64
+#define GROUP_COMMIT_TIMEOUT 250
+
 
 /* A struct with data pertaining to the tofu DB.  There is one such
    struct per session and it is cached in session's ctrl structure.
@@ -71,6 +77,8 @@ struct tofu_dbs_s
   {
     sqlite3_stmt *savepoint_batch;
     sqlite3_stmt *savepoint_batch_commit;
+    sqlite3_stmt *savepoint_inner;
+    sqlite3_stmt *savepoint_inner_commit;
 
     sqlite3_stmt *record_binding_get_old_policy;
     sqlite3_stmt *record_binding_update;
@@ -87,6 +95,12 @@ struct tofu_dbs_s
   int in_batch_transaction;
   int in_transaction;
   time_t batch_update_started;
+
+  /* The number of transactions folded into the open batch transaction
+   * while not in batch mode and the time in milliseconds the batch
+   * transaction was started; see group_commit_deferrable.  */
+  unsigned int group_commit_count;
+  unsigned long group_commit_started;
 };
 
 
@@ -163,6 +177,53 @@ tofu_policy_to_trust_level (enum tofu_policy policy)
 
 
 
+/* Return the current time in milliseconds.  Only the difference
+ * between two returned values is meaningful.  */
+static unsigned long
+get_msec_time (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  return GetTickCount ();
+#elif defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  return (unsigned long)time (NULL) * 1000;
+#else
+  struct timeval tv;
+
+  if (!gettimeofday (&tv, NULL))
+    return (unsigned long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  return (unsigned long)time (NULL) * 1000;
+#endif
+}
+
+
+/* Return true if the commit of the open batch transaction may be
+ * deferred although batch mode has not been requested.  This folds
+ * several independent updates (e.g. one per verified signature) into
+ * one SQLite transaction and thus saves an fsync per update.  The
+ * group is bounded by GROUP_COMMIT_MAX transactions and by
+ * GROUP_COMMIT_TIMEOUT milliseconds.  If another process wants the
+ * lock we commit right away.  */
+static int
+group_commit_deferrable (tofu_dbs_t dbs)
+{
+  struct stat statbuf;
+
+  if (dbs->group_commit_count >= GROUP_COMMIT_MAX)
+    return 0;
+  if (get_msec_time () - dbs->group_commit_started >= GROUP_COMMIT_TIMEOUT)
+    return 0;
+  if (stat (dbs->want_lock_file, &statbuf) == 0
+      && statbuf.st_ctime != dbs->want_lock_file_ctime)
+    return 0;
+
+  return 1;
+}
+
+
 /* Start a transaction on DB.  If ONLY_BATCH is set, then this will
    start a batch transaction if we haven't started a batch transaction
    and one has been requested.  */
@@ -175,6 +236,14 @@ begin_transaction (ctrl_t ctrl, int only_batch)
 
   log_assert (dbs);
 
+  /* If a group commit is pending (see end_transaction) and one of its
+   * bounds has been reached, commit it first.  */
+  if (dbs->in_transaction == 0
+      && dbs->in_batch_transaction
+      && !ctrl->tofu.batch_updated_wanted
+      && !group_commit_deferrable (dbs))
+    end_transaction (ctrl, 2);
+
   /* If we've been in batch update mode for a while (on average, more
    * than 500 ms), to prevent starving other gpg processes, we drop
    * and retake the batch lock.
@@ -185,15 +254,13 @@ begin_transaction (ctrl_t ctrl, int only_batch)
       dbs->in_transaction == 0
       /* There is an open batch transaction.  */
       && dbs->in_batch_transaction
+      /* Which is not a pending group commit.  */
+      && ctrl->tofu.batch_updated_wanted
       /* And some time has gone by since it was started.  */
       && dbs->batch_update_started != gnupg_get_time ())
     {
       struct stat statbuf;
 
-      /* If we are in a batch update, then batch updates better have
-         been enabled.  */
-      log_assert (ctrl->tofu.batch_updated_wanted);
-
       /* Check if another process wants to run.  (We just ignore any
        * stat failure.  A waiter might have to wait a bit longer, but
        * otherwise there should be no impact.)  */
@@ -236,6 +303,8 @@ begin_transaction (ctrl_t ctrl, int only_batch)
 
       dbs->in_batch_transaction = 1;
       dbs->batch_update_started = gnupg_get_time ();
+      dbs->group_commit_started = get_msec_time ();
+      dbs->group_commit_count = 0;
 
       if (stat (dbs->want_lock_file, &statbuf) == 0)
         dbs->want_lock_file_ctime = statbuf.st_ctime;
@@ -247,9 +316,16 @@ begin_transaction (ctrl_t ctrl, int only_batch)
   log_assert (dbs->in_transaction >= 0);
   dbs->in_transaction ++;
 
-  rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
-                           "savepoint inner%d;",
-                           dbs->in_transaction);
+  /* The outermost save point is by far the most common one; use a
+   * prepared statement for it.  */
+  if (dbs->in_transaction == 1)
+    rc = gpgsql_stepx (dbs->db, &dbs->s.savepoint_inner,
+                       NULL, NULL, &err,
+                       "savepoint inner1;", GPGSQL_ARG_END);
+  else
+    rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
+                             "savepoint inner%d;",
+                             dbs->in_transaction);
   if (rc)
     {
       log_error (_("error beginning transaction on TOFU database: %s\n"),
@@ -265,13 +341,19 @@ begin_transaction (ctrl_t ctrl, int only_batch)
 /* Commit a transaction.  If ONLY_BATCH is 1, then this only ends the
  * batch transaction if we have left batch mode.  If ONLY_BATCH is 2,
  * this commits any open batch transaction even if we are still in
- * batch mode.  */
+ * batch mode.  If ONLY_BATCH is 0 and we are not in batch mode, the
+ * commit of the outer transaction is deferred to group it with the
+ * following transactions until one of the bounds checked by
+ * group_commit_deferrable is reached.  A pending group is also
+ * committed before prompting the user (tofu_suspend_batch_transaction),
+ * when a batch update ends and by tofu_closedbs.  */
 static gpg_error_t
 end_transaction (ctrl_t ctrl, int only_batch)
 {
   tofu_dbs_t dbs = ctrl->tofu.dbs;
   int rc;
   char *err = NULL;
+  int defer = 0;
 
   if (only_batch || (! only_batch && dbs->in_transaction == 1))
     {
@@ -283,15 +365,28 @@ end_transaction (ctrl_t ctrl, int only_batch)
       if (only_batch)
         log_assert (dbs->in_transaction == 0);
 
+      if (!only_batch
+          && !ctrl->tofu.batch_updated_wanted
+          && dbs->in_batch_transaction)
+        {
+          /* Not in batch mode: try to group this transaction with the
+           * following ones.  */
+          dbs->group_commit_count++;
+          defer = group_commit_deferrable (dbs);
+        }
+
       if (/* Batch mode disabled?  */
           (!ctrl->tofu.batch_updated_wanted || only_batch == 2)
           /* But, we still have an open batch transaction?  */
-          && dbs->in_batch_transaction)
+          && dbs->in_batch_transaction
+          /* And we can't group it with the next transactions?  */
+          && !defer)
         {
           /* The batch transaction is still in open, but we've left
            * batch mode.  */
           dbs->in_batch_transaction = 0;
           dbs->in_transaction = 0;
+          dbs->group_commit_count = 0;
 
           rc = gpgsql_stepx (dbs->db, &dbs->s.savepoint_batch_commit,
                              NULL, NULL, &err,
@@ -314,8 +409,13 @@ end_transaction (ctrl_t ctrl, int only_batch)
   log_assert (dbs);
   log_assert (dbs->in_transaction > 0);
 
-  rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
-                           "release inner%d;", dbs->in_transaction);
+  if (dbs->in_transaction == 1)
+    rc = gpgsql_stepx (dbs->db, &dbs->s.savepoint_inner_commit,
+                       NULL, NULL, &err,
+                       "release inner1;", GPGSQL_ARG_END);
+  else
+    rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
+                             "release inner%d;", dbs->in_transaction);
 
   dbs->in_transaction --;
 
@@ -1223,6 +1223,65 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
  * a successful search operation.
  */
 
+/* Return the key ids of all keys of the last found OpenPGP blob.  On
+ * success a newly allocated array with two u32 words per key id is
+ * stored at R_KIDS and the number of key ids at R_NKIDS.  */
+gpg_error_t
+keybox_get_keyids (KEYBOX_HANDLE hd, u32 **r_kids, size_t *r_nkids)
+{
+  const unsigned char *buffer;
+  size_t length, nkeys, keyinfolen, off;
+  size_t idx;
+  int fpr32;
+  u32 *kids;
+
+  *r_kids = NULL;
+  *r_nkids = 0;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (!hd->found.blob)
+    return gpg_error (GPG_ERR_NOTHING_FOUND);
+  if (blob_get_type (hd->found.blob) != KEYBOX_BLOBTYPE_PGP)
+    return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  if (length < 40)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+  fpr32 = buffer[5] == 2;
+
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18);
+  if (!nkeys || keyinfolen < (fpr32?56:28)
+      || 20 + (uint64_t)keyinfolen*nkeys > (uint64_t)length)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+
+  kids = xtrycalloc (nkeys, 2 * sizeof *kids);
+  if (!kids)
+    return gpg_error_from_syserror ();
+
+  for (idx=0; idx < nkeys; idx++)
+    {
+      off = 20 + idx*keyinfolen;
+      if (fpr32 && (get16 (buffer + off + 32) & 0x80))
+        {
+          /* 32 byte fingerprint.  */
+          kids[2*idx]   = get32 (buffer + off);
+          kids[2*idx+1] = get32 (buffer + off + 4);
+        }
+      else /* 20 byte fingerprint.  */
+        {
+          kids[2*idx]   = get32 (buffer + off + 12);
+          kids[2*idx+1] = get32 (buffer + off + 16);
+        }
+    }
+
+  *r_kids = kids;
+  *r_nkids = nkeys;
+  return 0;
+}
+
+
 /* Return the raw data from the last found blob.  Caller must release
  * the value stored at R_BUFFER.  If called with NULL for R_BUFFER
  * only the needed length for the buffer and the public key type is
@@ -1342,6 +1401,43 @@ keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
 }
 
 
+/* Return a pointer to the OpenPGP keyblock image of the last found
+ * blob at R_IMAGE and its length at R_IMAGELEN.  In contrast to
+ * keybox_get_keyblock no copy is made; the returned pointer is only
+ * valid until the next search or any other operation on HD.  */
+gpg_error_t
+keybox_get_keyblock_image (KEYBOX_HANDLE hd,
+                           const void **r_image, size_t *r_imagelen)
+{
+  const unsigned char *buffer;
+  size_t length;
+  size_t image_off, image_len;
+
+  *r_image = NULL;
+  *r_imagelen = 0;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (!hd->found.blob)
+    return gpg_error (GPG_ERR_NOTHING_FOUND);
+
+  if (blob_get_type (hd->found.blob) != KEYBOX_BLOBTYPE_PGP)
+    return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  if (length < 40)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+  image_off = get32 (buffer+8);
+  image_len = get32 (buffer+12);
+  if ((uint64_t)image_off+(uint64_t)image_len > (uint64_t)length)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+
+  *r_image = buffer + image_off;
+  *r_imagelen = image_len;
+  return 0;
+}
+
+
 #ifdef KEYBOX_WITH_X509
 /*
   Return the last found cert.  Caller must free it.
@@ -91,6 +91,10 @@ gpg_error_t keybox_get_data (KEYBOX_HANDLE hd,
                              unsigned char *r_ubid);
 gpg_error_t keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
                                  int *r_pk_no, int *r_uid_no);
+gpg_error_t keybox_get_keyblock_image (KEYBOX_HANDLE hd,
+                                       const void **r_image,
+                                       size_t *r_imagelen);
+gpg_error_t keybox_get_keyids (KEYBOX_HANDLE hd, u32 **r_kids, size_t *r_nkids);
 #ifdef KEYBOX_WITH_X509
 int keybox_get_cert (KEYBOX_HANDLE hd, ksba_cert_t *ret_cert);
 #endif /*KEYBOX_WITH_X509*/
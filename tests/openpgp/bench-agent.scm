@@ -0,0 +1,119 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2021 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+;; Load benchmark for the private key operations of gpg-agent.  A
+;; number of gpg-connect-agent clients run PKSIGN in parallel, once
+;; with --crypto-threads 0, which computes the signatures with the
+;; nPth lock held, and once with the default.  See bench-common.scm
+;; for how to run it.  The number of clients and of signatures per
+;; client may be set with the envvars BENCH_CLIENTS and BENCH_OPS.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(load (in-srcdir "tests" "openpgp" "bench-common.scm"))
+(setup-environment)
+
+(define (getenv-number name default)
+  (let ((n (string->number (getenv name))))
+    (if n n default)))
+(define clients (getenv-number "BENCH_CLIENTS" 8))
+(define ops (getenv-number "BENCH_OPS" 200))
+
+(define agent-conf (path-join GNUPGHOME "gpg-agent.conf"))
+(define agent-conf-orig (call-with-input-file agent-conf read-all))
+
+;; Set --crypto-threads to N or to the default if N is #f.
+(define (set-crypto-threads n)
+  (call-with-output-file agent-conf
+    (lambda (port)
+      (display agent-conf-orig port)
+      (if n
+	  (display (string-append "crypto-threads " (number->string n) "\n")
+		   port))))
+  (call-check `(,(tool 'gpg-connect-agent) reloadagent /bye)))
+
+(info "Creating a key...")
+(call-check `(,@GPG --quick-generate-key "bench-agent@example.org"
+		    rsa3072 sign never))
+(define keygrip
+  (let ((grp (assoc "grp" (gpg-with-colons '(--with-keygrip
+					      --list-secret-keys
+					      "bench-agent@example.org")))))
+    (unless grp (fail "keygrip not found"))
+    (list-ref grp 9)))
+
+(define (write-script name count)
+  (call-with-output-file name
+    (lambda (port)
+      (do ((i 0 (+ 1 i))) ((= i count) #t)
+	(display (string-append
+		  "SIGKEY " keygrip "\n"
+		  "SETHASH --hash=sha256 "
+		  "E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855"
+		  "\n"
+		  "PKSIGN\n")
+		 port))
+      (display "/bye\n" port))))
+
+;; Run CLIENTS clients with OPS signatures each and return the time in
+;; seconds.
+(define (run-clients)
+  (let* ((names (let loop ((i 0) (acc '()))
+		  (if (= i clients)
+		      acc
+		      (loop (+ 1 i)
+			    (cons (string-append "out-" (number->string i))
+				  acc)))))
+	 (start (get-time))
+	 (pids (map (lambda (name)
+		      (letfd ((in (open "script" (logior O_RDONLY O_BINARY)))
+			      (out (open name (logior O_WRONLY O_CREAT O_BINARY)
+					 #o600)))
+			(spawn-process-fd `(,(tool 'gpg-connect-agent))
+					  in out out)))
+		    names)))
+    (wait-processes (map (lambda (name) "gpg-connect-agent") names) pids #t)
+    (let ((seconds (- (get-time) start)))
+      (for-each
+       (lambda (name)
+	 (if (string-contains? (call-with-input-file name read-all) "ERR ")
+	     (fail "signing failed:" (call-with-input-file name read-all)))
+	 (unlink name))
+       names)
+      seconds)))
+
+(with-temporary-working-directory
+ ;; Unlock the key.
+ (write-script "script" 1)
+ (pipe:do
+  (pipe:open "script" (logior O_RDONLY O_BINARY))
+  (pipe:spawn `(,(tool 'gpg-connect-agent))))
+
+ (write-script "script" ops)
+ (for-each
+  (lambda (n)
+    (set-crypto-threads n)
+    (let ((seconds (run-clients)))
+      (info clients "clients with" ops "signatures each and crypto-threads"
+	    (if n n "default") "..." seconds "s"
+	    (if (> seconds 0)
+		(string-append "(" (number->string (/ (* clients ops) seconds))
+			       " signatures/s)")
+		""))))
+  '(0 #f))
+ (set-crypto-threads #f))
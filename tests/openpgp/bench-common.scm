@@ -0,0 +1,71 @@
+;; Common definitions for the benchmarks.
+;;
+;; Copyright (C) 2021 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+;; The benchmarks are not part of the test suite; run them using for
+;; example
+;;
+;;   make -C tests/openpgp check TESTS=bench-keylist.scm
+;;
+;; The number of keys may be set with the envvar BENCH_KEYS; the
+;; default is 100000.
+
+(define nkeys (let ((n (string->number (getenv "BENCH_KEYS"))))
+		(if n n 100000)))
+(define rounds 3)
+
+;; Return the command to run gpg on the key database RESOURCE (e.g.
+;; "gnupg-ring:/tmp/foo.gpg") with the trustdb TRUSTDB.  We do not
+;; use GPG because it may include --always-trust.
+(define (bench-gpg resource trustdb . args)
+  `(,(tool 'gpg) --no-permission-warning --batch --no-default-keyring
+    --keyring ,resource --trustdb-name ,trustdb --trust-model pgp ,@args))
+
+;; Generate NKEYS keys in the keyring KEYRING.  The keys are generated
+;; in one gpg process and stored in a keyring because an insert into
+;; a keybox copies the whole file.  The keys are ultimately trusted
+;; in TRUSTDB.
+(define (bench-generate-keys keyring trustdb)
+  (call-with-output-file "params"
+    (lambda (port)
+      (display "%no-protection\n" port)
+      (do ((i 0 (+ 1 i))) ((= i nkeys) #t)
+	(display (string-append
+		  "Key-Type: eddsa\n"
+		  "Key-Curve: ed25519\n"
+		  "Key-Usage: sign\n"
+		  "Name-Email: bench-" (number->string i) "@example.org\n"
+		  "Expire-Date: 0\n"
+		  "%commit\n")
+		 port))))
+  (info "Generating" nkeys "keys...")
+  (let ((start (get-time)))
+    (call-check (bench-gpg (string-append "gnupg-ring:" keyring) trustdb
+			   '--gen-key "params"))
+    (info "  done in" (- (get-time) start) "s")))
+
+;; Run COMMAND ROUNDS times with its output written to the file
+;; OUTPUT and return the mean time in seconds.
+(define (bench-time command output)
+  (let ((start (get-time)))
+    (do ((i 0 (+ 1 i))) ((= i rounds) #t)
+      (catch '() (unlink output))
+      (letfd ((fd (open output (logior O_WRONLY O_CREAT O_BINARY) #o600)))
+	(unless (= 0 (call-with-fds command CLOSED_FD fd CLOSED_FD))
+		(fail "command failed:" command))))
+    (/ (- (get-time) start) rounds)))
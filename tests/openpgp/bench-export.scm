@@ -0,0 +1,66 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2021 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+;; Benchmark for the export of all keys.  The same keys are exported
+;; from a keyring, which requires parsing each keyblock, and from a
+;; keybox, which allows to copy the stored keyblock images.  See
+;; bench-common.scm for how to run it.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(load (in-srcdir "tests" "openpgp" "bench-common.scm"))
+(setup-environment)
+
+(define kbxutil
+  (qualify (path-join (getenv "objdir") "kbx" "kbxutil")))
+(unless (file-exists? kbxutil)
+	(skip "kbxutil not found"))
+
+(define (report what seconds)
+  (info "Exporting" nkeys "keys from" what "..." seconds "s"
+	(if (> seconds 0)
+	    (string-append "(" (number->string (/ nkeys seconds)) " keys/s)")
+	    "")))
+
+(with-temporary-working-directory
+ (let* ((keyring (path-join (getcwd) "bench.gpg"))
+	(keybox (path-join (getcwd) "bench.kbx"))
+	(trustdb (path-join (getcwd) "trustdb.gpg"))
+	(from-keyring (string-append "gnupg-ring:" keyring))
+	(from-keybox (string-append "gnupg-kbx:" keybox)))
+
+   (bench-generate-keys keyring trustdb)
+
+   ;; Let gpg create an empty keybox and append the keys.  We can't
+   ;; import them because each insert copies the whole keybox.
+   (call-check (bench-gpg from-keybox trustdb '--list-keys))
+   (letfd ((fd (open keybox (logior O_WRONLY O_APPEND O_BINARY))))
+     (unless (= 0 (call-with-fds `(,kbxutil --import-openpgp ,keyring)
+				 CLOSED_FD fd CLOSED_FD))
+	     (fail "appending the keys to the keybox failed")))
+
+   (report "a keyring"
+	   (bench-time (bench-gpg from-keyring trustdb '--export)
+		       "export-keyring"))
+   (report "a keybox"
+	   (bench-time (bench-gpg from-keybox trustdb '--export)
+		       "export-keybox"))
+
+   ;; Both ways must yield the same result.
+   (unless (file=? "export-keyring" "export-keybox")
+	   (fail "exports differ"))))
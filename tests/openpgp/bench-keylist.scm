@@ -0,0 +1,62 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2021 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+;; Benchmark for the colon key listing of a large keyring with and
+;; without the expensive fields.  See bench-common.scm for how to run
+;; it.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(load (in-srcdir "tests" "openpgp" "bench-common.scm"))
+(setup-environment)
+
+(with-temporary-working-directory
+ (let ((keyring (string-append "gnupg-ring:" (path-join (getcwd) "bench.gpg")))
+       (trustdb (path-join (getcwd) "trustdb.gpg")))
+
+   (bench-generate-keys (path-join (getcwd) "bench.gpg")
+			(path-join (getcwd) "gen-trustdb.gpg"))
+
+   ;; The generated keys are ultimately trusted in their trustdb; list
+   ;; them using a fresh trustdb so that the validity is computed.
+   (call-check (bench-gpg keyring trustdb '--check-trustdb))
+
+   ;; Fields which are not deselected must still be computed.
+   (let ((pub (assoc "pub" (map (lambda (line) (string-split line #\:))
+				(string-split-newlines
+				 (call-check (bench-gpg keyring trustdb
+							'--with-colons
+							'--colon-fields
+							"no-validity,no-ownertrust"
+							'--list-keys
+							"bench-0@example.org")))))))
+     (unless (and pub (string=? (list-ref pub 1) "")
+		  (not (string=? (list-ref pub 11) "")))
+	     (fail "unexpected colon fields:" pub)))
+
+   (for-each
+    (lambda (args)
+      (info "Listing" nkeys "keys with" (if (null? args) "all fields" args)
+	    "..."
+	    (bench-time (apply bench-gpg keyring trustdb
+			       `(--with-colons ,@args --list-keys))
+			"listing")
+	    "s"))
+    '(()
+      (--colon-fields "no-all,usage")
+      (--colon-fields "no-all")))))
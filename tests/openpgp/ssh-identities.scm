@@ -0,0 +1,96 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2021 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-environment)
+
+(setenv "SSH_AUTH_SOCK"
+        (call-check `(,(tool 'gpgconf) --null --list-dirs agent-ssh-socket))
+        #t)
+
+(define path (string-split (getenv "PATH") *pathsep*))
+(define ssh-add #f)
+(catch (skip "ssh-add not found")
+       (set! ssh-add (path-expand "ssh-add" path)))
+
+(define key (path-join (in-srcdir "tests" "openpgp" "samplekeys")
+		       "ssh-rsa.key"))
+(define hash "c9:85:b5:55:00:84:a9:82:5a:df:d6:62:1b:5a:28:22")
+(define sshcontrol (path-join GNUPGHOME "sshcontrol"))
+
+(info "Importing ssh key...")
+(pipe:do
+ (pipe:open key (logior O_RDONLY O_BINARY))
+ (pipe:spawn `(,ssh-add -)))
+(unless (string-contains? (call-popen `(,ssh-add -l "-E" md5) "") hash)
+	(fail "key not added"))
+
+;; The control file with the key enabled and with the key disabled.
+(define control-enabled (call-with-input-file sshcontrol read-all))
+(define control-disabled
+  (apply string-append
+	 (map (lambda (line)
+		(string-append
+		 (if (or (string=? line "") (string-prefix? line "#"))
+		     line
+		     (string-append "!" line))
+		 "\n"))
+	      (string-split-newlines control-enabled))))
+
+(define (write-control content)
+  (call-with-output-file sshcontrol
+    (lambda (port) (display content port))))
+
+(define clients 4)
+(define rounds 20)
+
+;; Start CLIENTS concurrent "ssh-add -l" while the cached answer is
+;; invalidated by toggling the key in sshcontrol.  Each client must
+;; get a consistent answer: either the key or no key at all.
+(info "Checking concurrent request_identities...")
+(with-temporary-working-directory
+ (do ((round 0 (+ 1 round))) ((= round rounds) #t)
+   (let* ((names (let loop ((i 0) (acc '()))
+		   (if (= i clients)
+		       acc
+		       (loop (+ 1 i)
+			     (cons (string-append "out-"
+						  (number->string round)
+						  "-" (number->string i))
+				   acc)))))
+	  (pids (map (lambda (name)
+		       (letfd ((fd (open name
+					 (logior O_WRONLY O_CREAT O_BINARY)
+					 #o600)))
+			 (spawn-process-fd `(,ssh-add -l "-E" md5)
+					   CLOSED_FD fd fd)))
+		     names)))
+     (write-control (if (even? round) control-disabled control-enabled))
+     (wait-processes (map (lambda (name) "ssh-add") names) pids #t)
+     (for-each
+      (lambda (name)
+	(let ((answer (call-with-input-file name read-all)))
+	  (unless (or (string-contains? answer hash)
+		      (string-contains? answer "no identities"))
+		  (fail "unexpected answer:" answer))))
+      names))))
+
+(write-control control-enabled)
+(unless (string-contains? (call-popen `(,ssh-add -l "-E" md5) "") hash)
+	(fail "key not listed after concurrent requests"))
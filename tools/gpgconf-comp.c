@@ -358,6 +358,7 @@ static known_option_t known_options_gpg_agent[] =
    { "max-passphrase-days", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "enable-passphrase-history", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "pinentry-timeout", GC_OPT_FLAG_RUNTIME, GC_LEVEL_ADVANCED },
+   { "crypto-threads", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
 
    { NULL }
  };